@@ -37,6 +37,8 @@
 #include <memory>
 #include <stdexcept>
 #include <array>
+#include <functional>
+#include <mutex>
 
 #ifdef DEBUG_PRINT
 #	define dout std::cerr
@@ -121,30 +123,53 @@ enum class LogEntities {
 	Controller, Driver, Logger, UDPReceiver, UDPSender, Generic
 };
 
-inline std::string DebugMsg(const LogEntities entity, const std::string inputMsg, const std::string generic = ""){
-	std::stringstream strstr;
+/// Color and label of the DebugMsg() prefix (the label of Generic is supplied by the caller)
+inline const char* LogEntityColor(const LogEntities entity){
 	switch (entity) {
 	case LogEntities::Controller:
-		strstr << tc::cyanL << "[controller] ";
-		break;
+		return tc::cyanL;
 	case LogEntities::Driver:
-		strstr << tc::magL << "[driver] ";
-		break;
+		return tc::magL;
 	case LogEntities::Logger:
-		strstr << tc::grnL << "[logger] ";
-		break;
+		return tc::grnL;
 	case LogEntities::UDPReceiver:
-		strstr << tc::bluL << "[udpReceiver] ";
-		break;
 	case LogEntities::UDPSender:
-		strstr << tc::bluL << "[udpSender] ";
+		return tc::bluL;
+	case LogEntities::Generic:
 		break;
+	}
+	return tc::white;
+}
+
+inline const char* LogEntityName(const LogEntities entity){
+	switch (entity) {
+	case LogEntities::Controller:
+		return "controller";
+	case LogEntities::Driver:
+		return "driver";
+	case LogEntities::Logger:
+		return "logger";
+	case LogEntities::UDPReceiver:
+		return "udpReceiver";
+	case LogEntities::UDPSender:
+		return "udpSender";
 	case LogEntities::Generic:
-		strstr << tc::white << "[" << generic << "] ";
 		break;
 	}
-	strstr << tc::none  << inputMsg;
-	return strstr.str();
+	return "";
+}
+
+inline std::string DebugMsg(const LogEntities entity, const std::string &inputMsg, const std::string &generic = std::string()){
+	std::string msg;
+	msg.reserve(inputMsg.size() + generic.size() + 32);
+	msg.append(LogEntityColor(entity)).append("[");
+	if (entity == LogEntities::Generic) {
+		msg.append(generic);
+	} else {
+		msg.append(LogEntityName(entity));
+	}
+	msg.append("] ").append(tc::none).append(inputMsg);
+	return msg;
 }
 
 namespace FUTILS
@@ -381,9 +406,10 @@ std::string ArrayToString(T arr, const int size, const char delimiter, const int
 {
 	std::string arrayText;
 	for (int i = 0; i < size; ++i) {
-		arrayText = arrayText + toStringPointDecimal(arr[i]);
+		arrayText += toStringPointDecimal(arr[i]);
 		if (i < (size - 1)) {
-			arrayText = arrayText + delimiter + " ";
+			arrayText += delimiter;
+			arrayText += ' ';
 		}
 	}
 	return arrayText;
@@ -394,9 +420,10 @@ std::string CMATArrayToString(T arr, const int size, const char delimiter)
 {
 	std::string arrayText;
 	for (int i = 1; i <= size; ++i) {
-		arrayText = arrayText + toStringPointDecimal(arr(i));
+		arrayText += toStringPointDecimal(arr(i));
 		if (i < size) {
-			arrayText = arrayText + delimiter + " ";
+			arrayText += delimiter;
+			arrayText += ' ';
 		}
 	}
 	return arrayText;
@@ -420,9 +447,10 @@ std::string STLVectorToString(T vecObj, const char delimiter, const std::string
 	std::string vectorText;
 	vectorText = preText + " ";
 	for (typename T::iterator itr = vecObj.begin(); itr != vecObj.end(); ++itr) {
-		vectorText = vectorText + toStringPointDecimal(*itr);
+		vectorText += toStringPointDecimal(*itr);
 		if (itr != (vecObj.end() - 1)) {
-			vectorText = vectorText + delimiter + " ";
+			vectorText += delimiter;
+			vectorText += ' ';
 		}
 	}
 	return vectorText;
@@ -493,11 +521,8 @@ inline std::string get_selfpath()
 	char buff[2048];
 	ssize_t len = ::readlink("/proc/self/exe", buff, sizeof(buff) - 1);
 	if (len != -1) {
-		buff[len] = '\0';
-		std::string path(buff);   ///Here the executable name is still in
-		std::string::size_type t = path.find_last_of("/");   // Here we find the last "/"
-		path = path.substr(0, t);                             // and remove the rest (exe name)
-		return path;
+		const char *slash = static_cast<const char*>(memrchr(buff, '/', static_cast<size_t>(len)));   // Here we find the last "/"
+		return std::string(buff, slash ? static_cast<size_t>(slash - buff) : static_cast<size_t>(len)); // and drop the exe name
 	} else {
 		printf("Cannot determine executable path! [Exiting]\n");
 		exit(-1);
@@ -535,16 +560,20 @@ inline std::string exec(const char* cmd) {
 	return result;
 }
 
-inline void ParseIPString(const std::string input_Str, unsigned char ip[4]){
-	std::string ipString = input_Str, ip_chunk;
-	std::string::size_type t1;
-	for (int i = 0; i < 3; ++i) {
-		t1 = ipString.find_first_of(".");
-		ip_chunk = ipString.substr(0, t1);
-		ip[i] = static_cast<unsigned char>(stod(ip_chunk, &t1));
-		ipString = ipString.substr(t1 + 1, ipString.size());
+/**
+ * Parses a dotted-quad string into its four octets, without allocating.
+ * See ParseIPv4() in futils_string.h for a validating version.
+ */
+inline void ParseIPString(const std::string &input_Str, unsigned char ip[4]){
+	const char *p = input_Str.c_str();
+	char *end;
+	for (int i = 0; i < 4; ++i) {
+		ip[i] = static_cast<unsigned char>(strtoul(p, &end, 10));
+		if (end == p) {
+			throw std::invalid_argument("ParseIPString: " + input_Str);
+		}
+		p = (*end == '.') ? end + 1 : end;
 	}
-	ip[3] = static_cast<unsigned char>(stod(ipString, &t1));
 }
 
 inline void paddr(unsigned char *a)
@@ -552,9 +581,62 @@ inline void paddr(unsigned char *a)
 	printf("%d.%d.%d.%d\n", a[0], a[1], a[2], a[3]);
 }
 
+namespace detail
+{
+struct DieHookRegistry
+{
+	std::mutex mtx;
+	std::vector<std::pair<int, std::function<void(const std::string&)> > > hooks;
+	int nextId = 1;
+};
+
+inline DieHookRegistry& DieHooks()
+{
+	static DieHookRegistry registry;
+	return registry;
+}
+}
+
+/**
+ * Registers a function that die() calls before exiting, e.g. to flush buffered logs.
+ * Hooks run in registration order, on the thread that called die(). Thread safe.
+ *
+ * @return id to pass to RemoveDieHook() when the objects used by the hook go away
+ */
+inline int AddDieHook(std::function<void(const std::string&)> hook)
+{
+	detail::DieHookRegistry &registry = detail::DieHooks();
+	std::lock_guard<std::mutex> lock(registry.mtx);
+	int id = registry.nextId++;
+	registry.hooks.emplace_back(id, std::move(hook));
+	return id;
+}
+
+/// Unregisters a hook added by AddDieHook(); unknown ids are ignored
+inline void RemoveDieHook(int id)
+{
+	detail::DieHookRegistry &registry = detail::DieHooks();
+	std::lock_guard<std::mutex> lock(registry.mtx);
+	for (size_t i = 0; i < registry.hooks.size(); ++i) {
+		if (registry.hooks[i].first == id) {
+			registry.hooks.erase(registry.hooks.begin() + static_cast<long>(i));
+			return;
+		}
+	}
+}
+
 inline void die(std::string s)
 {
 	perror(s.c_str());
+	std::vector<std::pair<int, std::function<void(const std::string&)> > > hooks;
+	{
+		detail::DieHookRegistry &registry = detail::DieHooks();
+		std::lock_guard<std::mutex> lock(registry.mtx);
+		hooks.swap(registry.hooks);	// a hook calling die() must not run the hooks again
+	}
+	for (size_t i = 0; i < hooks.size(); ++i) {
+		hooks[i].second(s);
+	}
 	exit(1);
 }
 
@@ -0,0 +1,1248 @@
+/**
+ * @brief Authenticated encryption of UDP payloads (AES-GCM, ChaCha20-Poly1305), in place.
+ *
+ * @details The utilities implemented include, with runtime CPU dispatch on x86:
+ * 			- AeadCipher: AES-128-GCM and AES-256-GCM (AES-NI counter mode interleaved 8 blocks
+ * 			  deep, GHASH with PCLMULQDQ and one reduction per 8 blocks) and ChaCha20-Poly1305
+ * 			  (RFC 8439, 8 or 2 ChaCha20 blocks per AVX2 pass), with portable fallbacks
+ * 			- AeadSendStream: seals datagrams in place, one nonce per datagram made of the stream
+ * 			  id and a 64 bit counter, which travels after the ciphertext with the tag
+ * 			- AeadReceiveStream: opens them in place and drops forgeries and replays (sliding
+ * 			  window over the counters)
+ * 			- Batch variants over PacketBatch for the recvmmsg()/sendmmsg() paths
+ *
+ * 			Wire format: [header][ciphertext][counter, 8 bytes big endian][tag, 16 bytes]. The
+ * 			optional header stays in clear and is authenticated, the stream id is not sent: both
+ * 			ends configure it, and every sender sharing a key needs its own id. Counters start at
+ * 			the wall clock in nanoseconds, so a restarted sender continues above the counters it
+ * 			used before (and its receivers accept it) as long as the clock does not step back.
+ *
+ * 			The key schedule and the GHASH powers are computed once by Init(); sealing a small
+ * 			datagram then costs a few tens of nanoseconds with AES-NI. The portable AES uses table
+ * 			lookups (not constant time): it is there for interoperability with hosts lacking
+ * 			AES-NI, which should prefer ChaCha20-Poly1305 (see PreferredAeadAlgorithm()).
+ *
+ * 			Example:
+ * 			@code
+ * 			FUTILS::AeadCipher cipher;
+ * 			cipher.Init(FUTILS::AeadAlgorithm::Aes256Gcm, key, 32);
+ * 			FUTILS::AeadSendStream tx(cipher, 1);
+ * 			tx.Seal(batch);                         // before UdpBatchSender::Send()
+ *
+ * 			FUTILS::AeadReceiveStream rx(cipher, 1);
+ * 			rx.Open(batch, keep);                   // after UdpBatchReceiver::Receive()
+ * 			@endcode
+ */
+
+#ifndef FUTILS_AEAD_H_
+#define FUTILS_AEAD_H_
+
+#include "futils.h"
+#include "futils_checksum.h"
+#include "futils_udpbatch.h"
+
+#if defined(__linux__) || defined(linux)
+
+#if defined(__x86_64__)
+#	include <immintrin.h>
+#	define FUTILS_AEAD_X86 1
+#endif
+
+namespace FUTILS
+{
+
+enum class AeadAlgorithm
+{
+	Aes128Gcm,
+	Aes256Gcm,
+	ChaCha20Poly1305,
+};
+
+const size_t kAeadNonceSize = 12;
+const size_t kAeadTagSize = 16;
+/// Bytes added to a datagram by AeadSendStream: counter and tag
+const size_t kAeadOverhead = 8 + kAeadTagSize;
+
+namespace detail
+{
+
+/// Expanded keys of an AeadCipher
+struct AeadKeys
+{
+	alignas(16) uint8_t roundKeys[15 * 16];
+	unsigned rounds;
+	alignas(16) uint8_t hashKey[16];            ///< GHASH key H = AES(K, 0), big endian
+	alignas(16) uint8_t hashPowers[8][16];      ///< H^1..H^8 byte reversed, for PCLMULQDQ
+	uint8_t chachaKey[32];
+};
+
+/// Seals (expected == nullptr: writes tag) or opens (checks expected, zeroes data on mismatch) in place
+typedef bool (*AeadKernel)(const AeadKeys&, const uint8_t *nonce, const uint8_t *aad, size_t aadLen,
+		uint8_t *data, size_t len, uint8_t *tag, const uint8_t *expected);
+
+/// Clears key material; the empty asm keeps the compiler from dropping the dead stores
+inline void AeadWipe(void *p, size_t len)
+{
+	memset(p, 0, len);
+	__asm__ __volatile__("" : : "r"(p) : "memory");
+}
+
+/// Constant time comparison of two tags
+inline bool AeadTagEqual(const uint8_t *a, const uint8_t *b)
+{
+	uint8_t diff = 0;
+	for (size_t i = 0; i < kAeadTagSize; ++i) {
+		diff |= static_cast<uint8_t>(a[i] ^ b[i]);
+	}
+	return diff == 0;
+}
+
+inline uint64_t AeadLoad64BE(const uint8_t *p)
+{
+	return __builtin_bswap64(Load64LE(p));
+}
+
+inline void AeadStore64BE(uint8_t *p, uint64_t v)
+{
+	v = __builtin_bswap64(v);
+	memcpy(p, &v, sizeof(v));
+}
+
+inline void AeadStore64LE(uint8_t *p, uint64_t v)
+{
+	memcpy(p, &v, sizeof(v));
+}
+
+inline uint8_t AesXtime(uint8_t v)
+{
+	return static_cast<uint8_t>((v << 1) ^ ((v >> 7) * 0x1b));
+}
+
+/// AES S-box, generated from the multiplicative inverse in GF(2^8) and the affine transform
+struct AesTables
+{
+	AesTables()
+	{
+		uint8_t p = 1, q = 1;
+		do {
+			p = static_cast<uint8_t>(p ^ (p << 1) ^ (p & 0x80 ? 0x1b : 0));
+			q ^= static_cast<uint8_t>(q << 1);
+			q ^= static_cast<uint8_t>(q << 2);
+			q ^= static_cast<uint8_t>(q << 4);
+			if (q & 0x80) {
+				q ^= 0x09;
+			}
+			uint8_t x = static_cast<uint8_t>(q ^ Rotl8(q, 1) ^ Rotl8(q, 2) ^ Rotl8(q, 3) ^ Rotl8(q, 4));
+			sbox[p] = static_cast<uint8_t>(x ^ 0x63);
+		} while (p != 1);
+		sbox[0] = 0x63;
+	}
+
+	static uint8_t Rotl8(uint8_t x, int r)
+	{
+		return static_cast<uint8_t>((x << r) | (x >> (8 - r)));
+	}
+
+	uint8_t sbox[256];
+};
+
+inline const AesTables& Aes()
+{
+	static const AesTables tables;
+	return tables;
+}
+
+/// FIPS-197 key expansion; the byte layout is the one AESENC expects. @return number of rounds
+inline unsigned AesExpandKey(const uint8_t *key, size_t keyLen, uint8_t *rk)
+{
+	const uint8_t *sbox = Aes().sbox;
+	unsigned nk = static_cast<unsigned>(keyLen / 4);
+	unsigned rounds = nk + 6;
+	memcpy(rk, key, keyLen);
+	uint8_t rcon = 1;
+	for (unsigned i = nk; i < 4 * (rounds + 1); ++i) {
+		uint8_t t[4];
+		memcpy(t, rk + 4 * (i - 1), 4);
+		if (i % nk == 0) {
+			uint8_t t0 = t[0];
+			t[0] = static_cast<uint8_t>(sbox[t[1]] ^ rcon);
+			t[1] = sbox[t[2]];
+			t[2] = sbox[t[3]];
+			t[3] = sbox[t0];
+			rcon = AesXtime(rcon);
+		} else if (nk > 6 && i % nk == 4) {
+			for (int j = 0; j < 4; ++j) {
+				t[j] = sbox[t[j]];
+			}
+		}
+		for (int j = 0; j < 4; ++j) {
+			rk[4 * i + j] = static_cast<uint8_t>(rk[4 * (i - nk) + j] ^ t[j]);
+		}
+	}
+	return rounds;
+}
+
+inline void AesEncryptPortable(const uint8_t *rk, unsigned rounds, const uint8_t *in, uint8_t *out)
+{
+	const uint8_t *sbox = Aes().sbox;
+	uint8_t s[16], t[16];
+	for (int i = 0; i < 16; ++i) {
+		s[i] = static_cast<uint8_t>(in[i] ^ rk[i]);
+	}
+	for (unsigned r = 1; r <= rounds; ++r) {
+		// SubBytes and ShiftRows (state in column order: byte row + 4 * column)
+		for (int c = 0; c < 4; ++c) {
+			for (int row = 0; row < 4; ++row) {
+				t[row + 4 * c] = sbox[s[row + 4 * ((c + row) & 3)]];
+			}
+		}
+		if (r < rounds) {
+			for (int c = 0; c < 4; ++c) {
+				uint8_t a0 = t[4 * c], a1 = t[4 * c + 1], a2 = t[4 * c + 2], a3 = t[4 * c + 3];
+				uint8_t x = static_cast<uint8_t>(a0 ^ a1 ^ a2 ^ a3);
+				s[4 * c] = static_cast<uint8_t>(a0 ^ x ^ AesXtime(static_cast<uint8_t>(a0 ^ a1)));
+				s[4 * c + 1] = static_cast<uint8_t>(a1 ^ x ^ AesXtime(static_cast<uint8_t>(a1 ^ a2)));
+				s[4 * c + 2] = static_cast<uint8_t>(a2 ^ x ^ AesXtime(static_cast<uint8_t>(a2 ^ a3)));
+				s[4 * c + 3] = static_cast<uint8_t>(a3 ^ x ^ AesXtime(static_cast<uint8_t>(a3 ^ a0)));
+			}
+		} else {
+			memcpy(s, t, 16);
+		}
+		for (int i = 0; i < 16; ++i) {
+			s[i] ^= rk[16 * r + i];
+		}
+	}
+	memcpy(out, s, 16);
+}
+
+/// X = X * H in GF(2^128) with the GCM bit order, bit by bit with masks (constant time, slow)
+inline void GhashMulPortable(uint64_t &xh, uint64_t &xl, uint64_t hh, uint64_t hl)
+{
+	uint64_t zh = 0, zl = 0, vh = hh, vl = hl;
+	for (int i = 0; i < 128; ++i) {
+		uint64_t bit = i < 64 ? (xh >> (63 - i)) & 1 : (xl >> (127 - i)) & 1;
+		uint64_t take = 0 - bit;
+		zh ^= vh & take;
+		zl ^= vl & take;
+		uint64_t carry = 0 - (vl & 1);
+		vl = (vl >> 1) | (vh << 63);
+		vh = (vh >> 1) ^ (0xe100000000000000ULL & carry);
+	}
+	xh = zh;
+	xl = zl;
+}
+
+/// GHASH of data zero padded to whole blocks
+inline void GhashPortable(uint64_t &yh, uint64_t &yl, uint64_t hh, uint64_t hl, const uint8_t *p, size_t len)
+{
+	while (len) {
+		uint8_t block[16] = { 0 };
+		size_t n = std::min<size_t>(len, 16);
+		memcpy(block, p, n);
+		yh ^= AeadLoad64BE(block);
+		yl ^= AeadLoad64BE(block + 8);
+		GhashMulPortable(yh, yl, hh, hl);
+		p += n;
+		len -= n;
+	}
+}
+
+inline bool GcmPortable(const AeadKeys &k, const uint8_t *nonce, const uint8_t *aad, size_t aadLen,
+		uint8_t *data, size_t len, uint8_t *tag, const uint8_t *expected)
+{
+	uint64_t hh = AeadLoad64BE(k.hashKey), hl = AeadLoad64BE(k.hashKey + 8);
+	uint64_t yh = 0, yl = 0;
+	uint8_t counter[16], stream[16];
+	memcpy(counter, nonce, kAeadNonceSize);
+
+	GhashPortable(yh, yl, hh, hl, aad, aadLen);
+	if (expected) {
+		GhashPortable(yh, yl, hh, hl, data, len);
+	}
+	uint32_t ctr = 2;
+	for (size_t off = 0; off < len; off += 16, ++ctr) {
+		uint32_t be = __builtin_bswap32(ctr);
+		memcpy(counter + 12, &be, 4);
+		AesEncryptPortable(k.roundKeys, k.rounds, counter, stream);
+		size_t n = std::min<size_t>(len - off, 16);
+		for (size_t i = 0; i < n; ++i) {
+			data[off + i] ^= stream[i];
+		}
+	}
+	if (!expected) {
+		GhashPortable(yh, yl, hh, hl, data, len);
+	}
+	yh ^= static_cast<uint64_t>(aadLen) * 8;
+	yl ^= static_cast<uint64_t>(len) * 8;
+	GhashMulPortable(yh, yl, hh, hl);
+
+	uint8_t computed[16];
+	counter[12] = counter[13] = counter[14] = 0;
+	counter[15] = 1;
+	AesEncryptPortable(k.roundKeys, k.rounds, counter, stream);
+	AeadStore64BE(computed, yh);
+	AeadStore64BE(computed + 8, yl);
+	for (int i = 0; i < 16; ++i) {
+		computed[i] ^= stream[i];
+	}
+	if (!expected) {
+		memcpy(tag, computed, kAeadTagSize);
+		return true;
+	}
+	if (!AeadTagEqual(computed, expected)) {
+		memset(data, 0, len);
+		return false;
+	}
+	return true;
+}
+
+#ifdef FUTILS_AEAD_X86
+
+/// Unreduced carry-less product a * b, accumulated into lo/hi (byte reversed GHASH operands)
+__attribute__((target("pclmul,sse4.1,ssse3")))
+inline void GhashClmul(__m128i a, __m128i b, __m128i &lo, __m128i &hi)
+{
+	__m128i t0 = _mm_clmulepi64_si128(a, b, 0x00);
+	__m128i t1 = _mm_clmulepi64_si128(a, b, 0x10);
+	__m128i t2 = _mm_clmulepi64_si128(a, b, 0x01);
+	__m128i t3 = _mm_clmulepi64_si128(a, b, 0x11);
+	t1 = _mm_xor_si128(t1, t2);
+	lo = _mm_xor_si128(lo, _mm_xor_si128(t0, _mm_slli_si128(t1, 8)));
+	hi = _mm_xor_si128(hi, _mm_xor_si128(t3, _mm_srli_si128(t1, 8)));
+}
+
+/**
+ * Reduction of a 256 bit product modulo x^128 + x^7 + x^2 + x + 1, after the one bit shift that
+ * the reflected representation needs (Intel white paper "Carry-Less Multiplication and Its Usage
+ * for Computing the GCM Mode", algorithm 5). Linear, so one reduction serves a sum of products.
+ */
+__attribute__((target("pclmul,sse4.1,ssse3")))
+inline __m128i GhashReduce(__m128i lo, __m128i hi)
+{
+	__m128i t7 = _mm_srli_epi32(lo, 31);
+	__m128i t8 = _mm_srli_epi32(hi, 31);
+	lo = _mm_slli_epi32(lo, 1);
+	hi = _mm_slli_epi32(hi, 1);
+	__m128i t9 = _mm_srli_si128(t7, 12);
+	t8 = _mm_slli_si128(t8, 4);
+	t7 = _mm_slli_si128(t7, 4);
+	lo = _mm_or_si128(lo, t7);
+	hi = _mm_or_si128(_mm_or_si128(hi, t8), t9);
+
+	t7 = _mm_slli_epi32(lo, 31);
+	t8 = _mm_slli_epi32(lo, 30);
+	t9 = _mm_slli_epi32(lo, 25);
+	t7 = _mm_xor_si128(_mm_xor_si128(t7, t8), t9);
+	t8 = _mm_srli_si128(t7, 4);
+	t7 = _mm_slli_si128(t7, 12);
+	lo = _mm_xor_si128(lo, t7);
+	__m128i t2 = _mm_srli_epi32(lo, 1);
+	__m128i t4 = _mm_srli_epi32(lo, 2);
+	__m128i t5 = _mm_srli_epi32(lo, 7);
+	t2 = _mm_xor_si128(_mm_xor_si128(t2, t4), _mm_xor_si128(t5, t8));
+	lo = _mm_xor_si128(lo, t2);
+	return _mm_xor_si128(hi, lo);
+}
+
+__attribute__((target("pclmul,sse4.1,ssse3")))
+inline __m128i GhashMulClmul(__m128i a, __m128i b)
+{
+	__m128i lo = _mm_setzero_si128(), hi = _mm_setzero_si128();
+	GhashClmul(a, b, lo, hi);
+	return GhashReduce(lo, hi);
+}
+
+/// Byte reversed powers of H, computed once per key
+__attribute__((target("pclmul,sse4.1,ssse3")))
+inline void GcmPrepareClmul(AeadKeys &k)
+{
+	const __m128i bswap = _mm_setr_epi8(15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0);
+	__m128i h = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(k.hashKey)), bswap);
+	__m128i power = h;
+	for (int i = 0; i < 8; ++i) {
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(k.hashPowers[i]), power);
+		power = GhashMulClmul(power, h);
+	}
+}
+
+__attribute__((target("aes,pclmul,sse4.1,ssse3")))
+inline __m128i GhashBlocksClmul(__m128i y, __m128i h, const uint8_t *p, size_t len)
+{
+	const __m128i bswap = _mm_setr_epi8(15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0);
+	while (len) {
+		__m128i block;
+		if (len >= 16) {
+			block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+		} else {
+			alignas(16) uint8_t pad[16] = { 0 };
+			memcpy(pad, p, len);
+			block = _mm_load_si128(reinterpret_cast<const __m128i*>(pad));
+		}
+		y = GhashMulClmul(_mm_xor_si128(y, _mm_shuffle_epi8(block, bswap)), h);
+		size_t n = std::min<size_t>(len, 16);
+		p += n;
+		len -= n;
+	}
+	return y;
+}
+
+/// N counter blocks from ctr encrypted side by side: AESENC latency is hidden by the other blocks
+template<int N>
+__attribute__((target("aes,pclmul,sse4.1,ssse3")))
+inline void AesCtrBlocks(const __m128i *rk, unsigned rounds, __m128i j0, uint32_t ctr, __m128i *x)
+{
+#pragma GCC unroll 8
+	for (int i = 0; i < N; ++i) {
+		x[i] = _mm_xor_si128(_mm_insert_epi32(j0, static_cast<int>(__builtin_bswap32(ctr + i)), 3), rk[0]);
+	}
+	for (unsigned r = 1; r < rounds; ++r) {
+#pragma GCC unroll 8
+		for (int i = 0; i < N; ++i) {
+			x[i] = _mm_aesenc_si128(x[i], rk[r]);
+		}
+	}
+#pragma GCC unroll 8
+	for (int i = 0; i < N; ++i) {
+		x[i] = _mm_aesenclast_si128(x[i], rk[rounds]);
+	}
+}
+
+/// Encrypts or decrypts N whole blocks and folds their ciphertext into y (powers H^N..H^1, one reduction)
+template<int N>
+__attribute__((target("aes,pclmul,sse4.1,ssse3")))
+inline __m128i GcmBlocks(const __m128i *rk, unsigned rounds, const __m128i *h, __m128i j0, uint32_t ctr,
+		__m128i y, uint8_t *p, bool decrypt)
+{
+	const __m128i bswap = _mm_setr_epi8(15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0);
+	__m128i x[N];
+	AesCtrBlocks<N>(rk, rounds, j0, ctr, x);
+	__m128i lo = _mm_setzero_si128(), hi = _mm_setzero_si128();
+#pragma GCC unroll 8
+	for (int i = 0; i < N; ++i) {
+		__m128i *q = reinterpret_cast<__m128i*>(p + 16 * i);
+		__m128i d = _mm_loadu_si128(q);
+		__m128i o = _mm_xor_si128(x[i], d);
+		_mm_storeu_si128(q, o);
+		// the hash covers the ciphertext: the input when decrypting, the output when encrypting
+		__m128i c = _mm_shuffle_epi8(decrypt ? d : o, bswap);
+		GhashClmul(i == 0 ? _mm_xor_si128(y, c) : c, h[N - 1 - i], lo, hi);
+	}
+	return GhashReduce(lo, hi);
+}
+
+/// GCM with AES-NI and PCLMULQDQ: 8 counter blocks in flight, their GHASH reduced once
+__attribute__((target("aes,pclmul,sse4.1,ssse3")))
+inline bool GcmAesni(const AeadKeys &k, const uint8_t *nonce, const uint8_t *aad, size_t aadLen,
+		uint8_t *data, size_t len, uint8_t *tag, const uint8_t *expected)
+{
+	const __m128i bswap = _mm_setr_epi8(15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0);
+	const unsigned rounds = k.rounds;
+	__m128i rk[15], h[8];
+	for (unsigned r = 0; r <= rounds; ++r) {
+		rk[r] = _mm_load_si128(reinterpret_cast<const __m128i*>(k.roundKeys + 16 * r));
+	}
+	for (int i = 0; i < 8; ++i) {
+		h[i] = _mm_load_si128(reinterpret_cast<const __m128i*>(k.hashPowers[i]));
+	}
+	alignas(16) uint8_t j0bytes[16];
+	memcpy(j0bytes, nonce, kAeadNonceSize);
+	j0bytes[12] = j0bytes[13] = j0bytes[14] = 0;
+	j0bytes[15] = 1;
+	const __m128i j0 = _mm_load_si128(reinterpret_cast<const __m128i*>(j0bytes));
+	const bool decrypt = expected != nullptr;
+
+	__m128i y = GhashBlocksClmul(_mm_setzero_si128(), h[0], aad, aadLen);
+	uint32_t ctr = 2;
+	uint8_t *p = data;
+	size_t left = len;
+	for (; left >= 128; p += 128, left -= 128, ctr += 8) {
+		y = GcmBlocks<8>(rk, rounds, h, j0, ctr, y, p, decrypt);
+	}
+	if (left >= 64) {
+		y = GcmBlocks<4>(rk, rounds, h, j0, ctr, y, p, decrypt);
+		p += 64;
+		left -= 64;
+		ctr += 4;
+	}
+	if (left) {
+		// the last 1 to 63 bytes, with their counter blocks still encrypted side by side
+		__m128i x[4];
+		AesCtrBlocks<4>(rk, rounds, j0, ctr, x);
+		for (int i = 0; left; ++i) {
+			size_t n = std::min<size_t>(left, 16);
+			alignas(16) uint8_t block[16] = { 0 };
+			memcpy(block, p, n);
+			__m128i d = _mm_load_si128(reinterpret_cast<const __m128i*>(block));
+			_mm_store_si128(reinterpret_cast<__m128i*>(block), _mm_xor_si128(d, x[i]));
+			memcpy(p, block, n);
+			if (!decrypt) {
+				memset(block + n, 0, 16 - n);
+				d = _mm_load_si128(reinterpret_cast<const __m128i*>(block));
+			}
+			y = GhashMulClmul(_mm_xor_si128(y, _mm_shuffle_epi8(d, bswap)), h[0]);
+			p += n;
+			left -= n;
+		}
+	}
+	__m128i lengths = _mm_set_epi64x(static_cast<long long>(aadLen * 8), static_cast<long long>(len * 8));
+	y = GhashMulClmul(_mm_xor_si128(y, lengths), h[0]);
+
+	__m128i s = _mm_xor_si128(j0, rk[0]);
+	for (unsigned r = 1; r < rounds; ++r) {
+		s = _mm_aesenc_si128(s, rk[r]);
+	}
+	s = _mm_xor_si128(_mm_aesenclast_si128(s, rk[rounds]), _mm_shuffle_epi8(y, bswap));
+	alignas(16) uint8_t computed[16];
+	_mm_store_si128(reinterpret_cast<__m128i*>(computed), s);
+	if (!decrypt) {
+		memcpy(tag, computed, kAeadTagSize);
+		return true;
+	}
+	if (!AeadTagEqual(computed, expected)) {
+		memset(data, 0, len);
+		return false;
+	}
+	return true;
+}
+
+#endif /* FUTILS_AEAD_X86 */
+
+#define FUTILS_CHACHA_QR(a, b, c, d) \
+	a += b; d ^= a; d = (d << 16) | (d >> 16); \
+	c += d; b ^= c; b = (b << 12) | (b >> 20); \
+	a += b; d ^= a; d = (d << 8) | (d >> 24); \
+	c += d; b ^= c; b = (b << 7) | (b >> 25)
+
+/// One ChaCha20 block (RFC 8439) of key, counter and nonce words
+inline void ChaChaBlock(const uint32_t *key, uint32_t counter, const uint32_t *nonce, uint8_t *out)
+{
+	uint32_t s[16] = { 0x61707865, 0x3320646e, 0x79622d32, 0x6b206574,
+			key[0], key[1], key[2], key[3], key[4], key[5], key[6], key[7],
+			counter, nonce[0], nonce[1], nonce[2] };
+	uint32_t x[16];
+	memcpy(x, s, sizeof(x));
+	for (int i = 0; i < 10; ++i) {
+		FUTILS_CHACHA_QR(x[0], x[4], x[8], x[12]);
+		FUTILS_CHACHA_QR(x[1], x[5], x[9], x[13]);
+		FUTILS_CHACHA_QR(x[2], x[6], x[10], x[14]);
+		FUTILS_CHACHA_QR(x[3], x[7], x[11], x[15]);
+		FUTILS_CHACHA_QR(x[0], x[5], x[10], x[15]);
+		FUTILS_CHACHA_QR(x[1], x[6], x[11], x[12]);
+		FUTILS_CHACHA_QR(x[2], x[7], x[8], x[13]);
+		FUTILS_CHACHA_QR(x[3], x[4], x[9], x[14]);
+	}
+	for (int i = 0; i < 16; ++i) {
+		uint32_t v = x[i] + s[i];
+		memcpy(out + 4 * i, &v, 4);
+	}
+}
+
+#undef FUTILS_CHACHA_QR
+
+inline void ChaCha20XorPortable(const uint32_t *key, const uint32_t *nonce, uint32_t counter, uint8_t *data, size_t len)
+{
+	uint8_t stream[64];
+	while (len) {
+		ChaChaBlock(key, counter++, nonce, stream);
+		size_t n = std::min<size_t>(len, 64);
+		for (size_t i = 0; i < n; ++i) {
+			data[i] ^= stream[i];
+		}
+		data += n;
+		len -= n;
+	}
+}
+
+#ifdef FUTILS_AEAD_X86
+
+/// Blocks counter and counter + 1, one per 128 bit lane; the rows are rotated for the diagonal rounds
+__attribute__((target("avx2")))
+inline void ChaCha2BlocksAvx2(const uint32_t *key, uint32_t counter, const uint32_t *nonce, uint8_t *out)
+{
+	const __m256i rot16 = _mm256_setr_epi8(2, 3, 0, 1, 6, 7, 4, 5, 10, 11, 8, 9, 14, 15, 12, 13,
+			2, 3, 0, 1, 6, 7, 4, 5, 10, 11, 8, 9, 14, 15, 12, 13);
+	const __m256i rot8 = _mm256_setr_epi8(3, 0, 1, 2, 7, 4, 5, 6, 11, 8, 9, 10, 15, 12, 13, 14,
+			3, 0, 1, 2, 7, 4, 5, 6, 11, 8, 9, 10, 15, 12, 13, 14);
+	const __m256i a0 = _mm256_setr_epi32(0x61707865, 0x3320646e, 0x79622d32, 0x6b206574,
+			0x61707865, 0x3320646e, 0x79622d32, 0x6b206574);
+	const __m256i b0 = _mm256_broadcastsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i*>(key)));
+	const __m256i c0 = _mm256_broadcastsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i*>(key + 4)));
+	const __m256i d0 = _mm256_setr_epi32(static_cast<int>(counter), static_cast<int>(nonce[0]), static_cast<int>(nonce[1]),
+			static_cast<int>(nonce[2]), static_cast<int>(counter + 1), static_cast<int>(nonce[0]), static_cast<int>(nonce[1]),
+			static_cast<int>(nonce[2]));
+	__m256i a = a0, b = b0, c = c0, d = d0;
+#define FUTILS_CHACHA_ROWS(a, b, c, d) \
+	a = _mm256_add_epi32(a, b); d = _mm256_shuffle_epi8(_mm256_xor_si256(d, a), rot16); \
+	c = _mm256_add_epi32(c, d); b = _mm256_xor_si256(b, c); \
+	b = _mm256_or_si256(_mm256_slli_epi32(b, 12), _mm256_srli_epi32(b, 20)); \
+	a = _mm256_add_epi32(a, b); d = _mm256_shuffle_epi8(_mm256_xor_si256(d, a), rot8); \
+	c = _mm256_add_epi32(c, d); b = _mm256_xor_si256(b, c); \
+	b = _mm256_or_si256(_mm256_slli_epi32(b, 7), _mm256_srli_epi32(b, 25))
+	for (int i = 0; i < 10; ++i) {
+		FUTILS_CHACHA_ROWS(a, b, c, d);
+		b = _mm256_shuffle_epi32(b, 0x39);
+		c = _mm256_shuffle_epi32(c, 0x4e);
+		d = _mm256_shuffle_epi32(d, 0x93);
+		FUTILS_CHACHA_ROWS(a, b, c, d);
+		b = _mm256_shuffle_epi32(b, 0x93);
+		c = _mm256_shuffle_epi32(c, 0x4e);
+		d = _mm256_shuffle_epi32(d, 0x39);
+	}
+#undef FUTILS_CHACHA_ROWS
+	a = _mm256_add_epi32(a, a0);
+	b = _mm256_add_epi32(b, b0);
+	c = _mm256_add_epi32(c, c0);
+	d = _mm256_add_epi32(d, d0);
+	_mm256_storeu_si256(reinterpret_cast<__m256i*>(out), _mm256_permute2x128_si256(a, b, 0x20));
+	_mm256_storeu_si256(reinterpret_cast<__m256i*>(out + 32), _mm256_permute2x128_si256(c, d, 0x20));
+	_mm256_storeu_si256(reinterpret_cast<__m256i*>(out + 64), _mm256_permute2x128_si256(a, b, 0x31));
+	_mm256_storeu_si256(reinterpret_cast<__m256i*>(out + 96), _mm256_permute2x128_si256(c, d, 0x31));
+}
+
+/// Eight ChaCha20 blocks per pass, one block per 32 bit lane, transposed back to block order
+__attribute__((target("avx2")))
+inline void ChaCha20XorAvx2(const uint32_t *key, const uint32_t *nonce, uint32_t counter, uint8_t *data, size_t len)
+{
+	const __m256i rot16 = _mm256_setr_epi8(2, 3, 0, 1, 6, 7, 4, 5, 10, 11, 8, 9, 14, 15, 12, 13,
+			2, 3, 0, 1, 6, 7, 4, 5, 10, 11, 8, 9, 14, 15, 12, 13);
+	const __m256i rot8 = _mm256_setr_epi8(3, 0, 1, 2, 7, 4, 5, 6, 11, 8, 9, 10, 15, 12, 13, 14,
+			3, 0, 1, 2, 7, 4, 5, 6, 11, 8, 9, 10, 15, 12, 13, 14);
+	// eight blocks at a time while most of them are used, then two at a time
+	while (len > 384) {
+		__m256i s[16], x[16];
+		s[0] = _mm256_set1_epi32(0x61707865);
+		s[1] = _mm256_set1_epi32(0x3320646e);
+		s[2] = _mm256_set1_epi32(0x79622d32);
+		s[3] = _mm256_set1_epi32(0x6b206574);
+		for (int i = 0; i < 8; ++i) {
+			s[4 + i] = _mm256_set1_epi32(static_cast<int>(key[i]));
+		}
+		s[12] = _mm256_add_epi32(_mm256_set1_epi32(static_cast<int>(counter)), _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+		for (int i = 0; i < 3; ++i) {
+			s[13 + i] = _mm256_set1_epi32(static_cast<int>(nonce[i]));
+		}
+		for (int i = 0; i < 16; ++i) {
+			x[i] = s[i];
+		}
+#define FUTILS_CHACHA_QR8(a, b, c, d) \
+		x[a] = _mm256_add_epi32(x[a], x[b]); x[d] = _mm256_shuffle_epi8(_mm256_xor_si256(x[d], x[a]), rot16); \
+		x[c] = _mm256_add_epi32(x[c], x[d]); x[b] = _mm256_xor_si256(x[b], x[c]); \
+		x[b] = _mm256_or_si256(_mm256_slli_epi32(x[b], 12), _mm256_srli_epi32(x[b], 20)); \
+		x[a] = _mm256_add_epi32(x[a], x[b]); x[d] = _mm256_shuffle_epi8(_mm256_xor_si256(x[d], x[a]), rot8); \
+		x[c] = _mm256_add_epi32(x[c], x[d]); x[b] = _mm256_xor_si256(x[b], x[c]); \
+		x[b] = _mm256_or_si256(_mm256_slli_epi32(x[b], 7), _mm256_srli_epi32(x[b], 25))
+		for (int i = 0; i < 10; ++i) {
+			FUTILS_CHACHA_QR8(0, 4, 8, 12);
+			FUTILS_CHACHA_QR8(1, 5, 9, 13);
+			FUTILS_CHACHA_QR8(2, 6, 10, 14);
+			FUTILS_CHACHA_QR8(3, 7, 11, 15);
+			FUTILS_CHACHA_QR8(0, 5, 10, 15);
+			FUTILS_CHACHA_QR8(1, 6, 11, 12);
+			FUTILS_CHACHA_QR8(2, 7, 8, 13);
+			FUTILS_CHACHA_QR8(3, 4, 9, 14);
+		}
+#undef FUTILS_CHACHA_QR8
+		for (int i = 0; i < 16; ++i) {
+			x[i] = _mm256_add_epi32(x[i], s[i]);
+		}
+
+		// 8x8 transposes: words 0-7 then 8-15 of each block
+		__m256i out[16];
+		for (int half = 0; half < 2; ++half) {
+			const __m256i *a = x + 8 * half;
+			__m256i t0 = _mm256_unpacklo_epi32(a[0], a[1]), t1 = _mm256_unpackhi_epi32(a[0], a[1]);
+			__m256i t2 = _mm256_unpacklo_epi32(a[2], a[3]), t3 = _mm256_unpackhi_epi32(a[2], a[3]);
+			__m256i t4 = _mm256_unpacklo_epi32(a[4], a[5]), t5 = _mm256_unpackhi_epi32(a[4], a[5]);
+			__m256i t6 = _mm256_unpacklo_epi32(a[6], a[7]), t7 = _mm256_unpackhi_epi32(a[6], a[7]);
+			__m256i u0 = _mm256_unpacklo_epi64(t0, t2), u1 = _mm256_unpackhi_epi64(t0, t2);
+			__m256i u2 = _mm256_unpacklo_epi64(t1, t3), u3 = _mm256_unpackhi_epi64(t1, t3);
+			__m256i u4 = _mm256_unpacklo_epi64(t4, t6), u5 = _mm256_unpackhi_epi64(t4, t6);
+			__m256i u6 = _mm256_unpacklo_epi64(t5, t7), u7 = _mm256_unpackhi_epi64(t5, t7);
+			out[0 + half] = _mm256_permute2x128_si256(u0, u4, 0x20);
+			out[2 + half] = _mm256_permute2x128_si256(u1, u5, 0x20);
+			out[4 + half] = _mm256_permute2x128_si256(u2, u6, 0x20);
+			out[6 + half] = _mm256_permute2x128_si256(u3, u7, 0x20);
+			out[8 + half] = _mm256_permute2x128_si256(u0, u4, 0x31);
+			out[10 + half] = _mm256_permute2x128_si256(u1, u5, 0x31);
+			out[12 + half] = _mm256_permute2x128_si256(u2, u6, 0x31);
+			out[14 + half] = _mm256_permute2x128_si256(u3, u7, 0x31);
+		}
+		if (len >= 512) {
+			for (int i = 0; i < 16; ++i) {
+				__m256i *q = reinterpret_cast<__m256i*>(data + 32 * i);
+				_mm256_storeu_si256(q, _mm256_xor_si256(_mm256_loadu_si256(q), out[i]));
+			}
+			data += 512;
+			len -= 512;
+		} else {
+			alignas(32) uint8_t stream[512];
+			for (int i = 0; i < 16; ++i) {
+				_mm256_store_si256(reinterpret_cast<__m256i*>(stream + 32 * i), out[i]);
+			}
+			for (size_t i = 0; i < len; ++i) {
+				data[i] ^= stream[i];
+			}
+			len = 0;
+		}
+		counter += 8;
+	}
+	alignas(32) uint8_t stream[128];
+	while (len) {
+		ChaCha2BlocksAvx2(key, counter, nonce, stream);
+		size_t n = std::min<size_t>(len, 128);
+		for (size_t i = 0; i < n; ++i) {
+			data[i] ^= stream[i];
+		}
+		data += n;
+		len -= n;
+		counter += 2;
+	}
+}
+
+#endif /* FUTILS_AEAD_X86 */
+
+/// Poly1305 with 44/44/42 bit limbs (poly1305-donna-64), whole zero padded blocks as RFC 8439 feeds it
+class Poly1305
+{
+public:
+	explicit Poly1305(const uint8_t *key) :
+		h0(0), h1(0), h2(0)
+	{
+		uint64_t t0 = Load64LE(key), t1 = Load64LE(key + 8);
+		r0 = t0 & 0xffc0fffffffULL;
+		r1 = ((t0 >> 44) | (t1 << 20)) & 0xfffffc0ffffULL;
+		r2 = (t1 >> 24) & 0x00ffffffc0fULL;
+		s1 = r1 * (5 << 2);
+		s2 = r2 * (5 << 2);
+		pad0 = Load64LE(key + 16);
+		pad1 = Load64LE(key + 24);
+	}
+
+	~Poly1305()
+	{
+		AeadWipe(this, sizeof(*this));
+	}
+
+	void UpdatePadded(const uint8_t *m, size_t len)
+	{
+		size_t whole = len & ~static_cast<size_t>(15);
+		Blocks(m, whole);
+		if (len > whole) {
+			uint8_t block[16] = { 0 };
+			memcpy(block, m + whole, len - whole);
+			Blocks(block, 16);
+		}
+	}
+
+	void Blocks(const uint8_t *m, size_t len)
+	{
+		__extension__ typedef unsigned __int128 u128;
+		const uint64_t mask44 = 0xfffffffffffULL, mask42 = 0x3ffffffffffULL;
+		for (; len >= 16; m += 16, len -= 16) {
+			uint64_t t0 = Load64LE(m), t1 = Load64LE(m + 8);
+			h0 += t0 & mask44;
+			h1 += ((t0 >> 44) | (t1 << 20)) & mask44;
+			h2 += ((t1 >> 24) & mask42) | (1ULL << 40);
+			u128 d0 = static_cast<u128>(h0) * r0 + static_cast<u128>(h1) * s2 + static_cast<u128>(h2) * s1;
+			u128 d1 = static_cast<u128>(h0) * r1 + static_cast<u128>(h1) * r0 + static_cast<u128>(h2) * s2;
+			u128 d2 = static_cast<u128>(h0) * r2 + static_cast<u128>(h1) * r1 + static_cast<u128>(h2) * r0;
+			uint64_t c = static_cast<uint64_t>(d0 >> 44);
+			h0 = static_cast<uint64_t>(d0) & mask44;
+			d1 += c;
+			c = static_cast<uint64_t>(d1 >> 44);
+			h1 = static_cast<uint64_t>(d1) & mask44;
+			d2 += c;
+			c = static_cast<uint64_t>(d2 >> 42);
+			h2 = static_cast<uint64_t>(d2) & mask42;
+			h0 += c * 5;
+			c = h0 >> 44;
+			h0 &= mask44;
+			h1 += c;
+		}
+	}
+
+	void Finish(uint8_t *mac)
+	{
+		const uint64_t mask44 = 0xfffffffffffULL, mask42 = 0x3ffffffffffULL;
+		uint64_t c = h1 >> 44;
+		h1 &= mask44;
+		h2 += c; c = h2 >> 42; h2 &= mask42;
+		h0 += c * 5; c = h0 >> 44; h0 &= mask44;
+		h1 += c; c = h1 >> 44; h1 &= mask44;
+		h2 += c; c = h2 >> 42; h2 &= mask42;
+		h0 += c * 5; c = h0 >> 44; h0 &= mask44;
+		h1 += c;
+
+		// h - p, kept if it did not underflow
+		uint64_t g0 = h0 + 5; c = g0 >> 44; g0 &= mask44;
+		uint64_t g1 = h1 + c; c = g1 >> 44; g1 &= mask44;
+		uint64_t g2 = h2 + c - (1ULL << 42);
+		c = (g2 >> 63) - 1;
+		h0 = (h0 & ~c) | (g0 & c);
+		h1 = (h1 & ~c) | (g1 & c);
+		h2 = (h2 & ~c) | (g2 & c);
+
+		h0 += pad0 & mask44; c = h0 >> 44; h0 &= mask44;
+		h1 += (((pad0 >> 44) | (pad1 << 20)) & mask44) + c; c = h1 >> 44; h1 &= mask44;
+		h2 += ((pad1 >> 24) & mask42) + c; h2 &= mask42;
+		AeadStore64LE(mac, h0 | (h1 << 44));
+		AeadStore64LE(mac + 8, (h1 >> 20) | (h2 << 24));
+	}
+
+private:
+	uint64_t r0, r1, r2, s1, s2;
+	uint64_t h0, h1, h2;
+	uint64_t pad0, pad1;
+};
+
+/// ChaCha20 one block at a time
+struct ChaChaPortable
+{
+	/// Blocks 0 (Poly1305 key) and 1 (keystream of the first 64 bytes)
+	static void FirstBlocks(const uint32_t *key, const uint32_t *nonce, uint8_t *out)
+	{
+		ChaChaBlock(key, 0, nonce, out);
+		ChaChaBlock(key, 1, nonce, out + 64);
+	}
+
+	static void Xor(const uint32_t *key, const uint32_t *nonce, uint32_t counter, uint8_t *data, size_t len)
+	{
+		ChaCha20XorPortable(key, nonce, counter, data, len);
+	}
+};
+
+#ifdef FUTILS_AEAD_X86
+struct ChaChaAvx2
+{
+	static void FirstBlocks(const uint32_t *key, const uint32_t *nonce, uint8_t *out)
+	{
+		ChaCha2BlocksAvx2(key, 0, nonce, out);
+	}
+
+	static void Xor(const uint32_t *key, const uint32_t *nonce, uint32_t counter, uint8_t *data, size_t len)
+	{
+		ChaCha20XorAvx2(key, nonce, counter, data, len);
+	}
+};
+#endif
+
+/// RFC 8439 AEAD; opening checks the tag before decrypting
+template<typename ChaCha>
+inline bool ChaChaPoly(const AeadKeys &k, const uint8_t *nonce, const uint8_t *aad, size_t aadLen,
+		uint8_t *data, size_t len, uint8_t *tag, const uint8_t *expected)
+{
+	uint32_t key[8], n[3];
+	for (int i = 0; i < 8; ++i) {
+		key[i] = Load32LE(k.chachaKey + 4 * i);
+	}
+	for (int i = 0; i < 3; ++i) {
+		n[i] = Load32LE(nonce + 4 * i);
+	}
+	// the Poly1305 key and the first 64 bytes of keystream come out of the same pass
+	alignas(32) uint8_t first[128];
+	ChaCha::FirstBlocks(key, n, first);
+	size_t head = std::min<size_t>(len, 64);
+	Poly1305 mac(first);
+
+	mac.UpdatePadded(aad, aadLen);
+	if (!expected) {
+		for (size_t i = 0; i < head; ++i) {
+			data[i] ^= first[64 + i];
+		}
+		if (len > head) {
+			ChaCha::Xor(key, n, 2, data + head, len - head);
+		}
+	}
+	mac.UpdatePadded(data, len);
+	uint8_t lengths[16];
+	AeadStore64LE(lengths, aadLen);
+	AeadStore64LE(lengths + 8, len);
+	mac.Blocks(lengths, 16);
+	uint8_t computed[16];
+	mac.Finish(computed);
+	bool ok = true;
+	if (!expected) {
+		memcpy(tag, computed, kAeadTagSize);
+	} else if (!AeadTagEqual(computed, expected)) {
+		memset(data, 0, len);
+		ok = false;
+	} else {
+		for (size_t i = 0; i < head; ++i) {
+			data[i] ^= first[64 + i];
+		}
+		if (len > head) {
+			ChaCha::Xor(key, n, 2, data + head, len - head);
+		}
+	}
+	AeadWipe(first, sizeof(first));
+	AeadWipe(key, sizeof(key));
+	return ok;
+}
+
+inline bool AesGcmAccelerated()
+{
+#ifdef FUTILS_AEAD_X86
+	return __builtin_cpu_supports("aes") && __builtin_cpu_supports("pclmul")
+			&& __builtin_cpu_supports("sse4.1") && __builtin_cpu_supports("ssse3");
+#else
+	return false;
+#endif
+}
+
+} /* namespace detail */
+
+/// AES-GCM when this CPU has AES-NI and PCLMULQDQ, ChaCha20-Poly1305 otherwise
+inline AeadAlgorithm PreferredAeadAlgorithm()
+{
+	return detail::AesGcmAccelerated() ? AeadAlgorithm::Aes256Gcm : AeadAlgorithm::ChaCha20Poly1305;
+}
+
+/**
+ * A key and the implementation chosen for this CPU. Seal() and Open() are const and may be called
+ * from several threads at once.
+ */
+class AeadCipher
+{
+public:
+	AeadCipher() :
+		algorithm(AeadAlgorithm::Aes256Gcm), kernel(nullptr), implementation("none")
+	{
+		memset(&keys, 0, sizeof(keys));
+	}
+
+	~AeadCipher()
+	{
+		detail::AeadWipe(&keys, sizeof(keys));
+	}
+
+	AeadCipher(const AeadCipher&) = delete;
+	AeadCipher& operator=(const AeadCipher&) = delete;
+
+	/// Key length of an algorithm in bytes
+	static size_t KeySize(AeadAlgorithm algorithm)
+	{
+		return algorithm == AeadAlgorithm::Aes128Gcm ? 16 : 32;
+	}
+
+	/**
+	 * @brief Expands the key and picks the fastest implementation for this CPU.
+	 *
+	 * @return false if keyLen does not match the algorithm
+	 */
+	bool Init(AeadAlgorithm alg, const void *key, size_t keyLen)
+	{
+		if (keyLen != KeySize(alg)) {
+			std::cerr << tc::redL << "AeadCipher: key of " << keyLen << " bytes, " << KeySize(alg) << " expected" << tc::none << std::endl;
+			return false;
+		}
+		detail::AeadWipe(&keys, sizeof(keys));
+		algorithm = alg;
+		const uint8_t *k = static_cast<const uint8_t*>(key);
+		if (alg == AeadAlgorithm::ChaCha20Poly1305) {
+			memcpy(keys.chachaKey, k, 32);
+			kernel = &detail::ChaChaPoly<detail::ChaChaPortable>;
+			implementation = "portable";
+#ifdef FUTILS_AEAD_X86
+			if (__builtin_cpu_supports("avx2")) {
+				kernel = &detail::ChaChaPoly<detail::ChaChaAvx2>;
+				implementation = "avx2";
+			}
+#endif
+			return true;
+		}
+		keys.rounds = detail::AesExpandKey(k, keyLen, keys.roundKeys);
+		uint8_t zero[16] = { 0 };
+		detail::AesEncryptPortable(keys.roundKeys, keys.rounds, zero, keys.hashKey);
+		kernel = &detail::GcmPortable;
+		implementation = "portable";
+#ifdef FUTILS_AEAD_X86
+		if (detail::AesGcmAccelerated()) {
+			detail::GcmPrepareClmul(keys);
+			kernel = &detail::GcmAesni;
+			implementation = "aes-ni+pclmul";
+		}
+#endif
+		return true;
+	}
+
+	bool Ready() const
+	{
+		return kernel != nullptr;
+	}
+
+	/**
+	 * @brief Encrypts data in place and writes the kAeadTagSize bytes tag; aad is authenticated only.
+	 *
+	 * @return false, with data untouched, if no key is set (see Ready())
+	 */
+	bool Seal(const uint8_t *nonce, const uint8_t *aad, size_t aadLen, uint8_t *data, size_t len, uint8_t *tag) const
+	{
+		if (!kernel) {
+			return false;
+		}
+		kernel(keys, nonce, aad, aadLen, data, len, tag, nullptr);
+		return true;
+	}
+
+	/**
+	 * @brief Checks the tag and decrypts data in place.
+	 *
+	 * @return false on a forgery or if no key is set (data is then zeroed)
+	 */
+	bool Open(const uint8_t *nonce, const uint8_t *aad, size_t aadLen, uint8_t *data, size_t len, const uint8_t *tag) const
+	{
+		if (!kernel) {
+			memset(data, 0, len);
+			return false;
+		}
+		return kernel(keys, nonce, aad, aadLen, data, len, nullptr, tag);
+	}
+
+	AeadAlgorithm Algorithm() const
+	{
+		return algorithm;
+	}
+
+	/// "aes-ni+pclmul", "avx2" or "portable", for the startup log
+	const char* Implementation() const
+	{
+		return implementation;
+	}
+
+private:
+	AeadAlgorithm algorithm;
+	detail::AeadKeys keys;
+	detail::AeadKernel kernel;
+	const char *implementation;
+};
+
+/**
+ * Sealing side of a stream: nonce = stream id (4 bytes) + counter (8 bytes), both big endian.
+ * One sender thread per stream.
+ */
+class AeadSendStream
+{
+public:
+	/// @param firstCounter 0 to start at the wall clock in nanoseconds (see the file description)
+	AeadSendStream(const AeadCipher &cipher, uint32_t streamId, uint64_t firstCounter = 0) :
+		cipher(cipher), streamId(streamId), counter(firstCounter)
+	{
+		if (!counter) {
+			struct timespec ts;
+			clock_gettime(CLOCK_REALTIME, &ts);
+			counter = static_cast<uint64_t>(ts.tv_sec) * 1000000000ULL + static_cast<uint64_t>(ts.tv_nsec);
+		}
+	}
+
+	AeadSendStream(const AeadSendStream&) = delete;
+	AeadSendStream& operator=(const AeadSendStream&) = delete;
+
+	/**
+	 * @brief Seals buf[0, len) in place: the first headerLen bytes stay in clear, the rest is
+	 * encrypted, and the counter and tag are appended.
+	 *
+	 * @return the sealed length (len + kAeadOverhead), 0 if it exceeds capacity, the counters
+	 * are exhausted or the cipher has no key
+	 */
+	size_t Seal(uint8_t *buf, size_t len, size_t capacity, size_t headerLen = 0)
+	{
+		if (len < headerLen || len + kAeadOverhead > capacity || counter == ~0ULL || !cipher.Ready()) {
+			return 0;
+		}
+		uint8_t nonce[kAeadNonceSize];
+		uint32_t id = htonl(streamId);
+		memcpy(nonce, &id, 4);
+		detail::AeadStore64BE(nonce + 4, counter++);
+		cipher.Seal(nonce, buf, headerLen, buf + headerLen, len - headerLen, buf + len + 8);
+		memcpy(buf + len, nonce + 4, 8);
+		return len + kAeadOverhead;
+	}
+
+	/**
+	 * @brief Seals datagrams first..Size() of a batch to send.
+	 *
+	 * @return false, with nothing sealed, if one of them has no room for kAeadOverhead more bytes
+	 * or the cipher has no key
+	 */
+	bool Seal(PacketBatch &batch, size_t first = 0, size_t headerLen = 0)
+	{
+		if (!cipher.Ready()) {
+			return false;
+		}
+		for (size_t i = first; i < batch.Size(); ++i) {
+			if (batch.Length(i) + kAeadOverhead > batch.MaxPayload() || batch.Length(i) < headerLen) {
+				return false;
+			}
+		}
+		for (size_t i = first; i < batch.Size(); ++i) {
+			size_t sealed = Seal(batch.Payload(i), batch.Length(i), batch.MaxPayload(), headerLen);
+			if (!sealed) {
+				return false;
+			}
+			batch.SetLength(i, sealed);
+		}
+		return true;
+	}
+
+	/// Counter of the next datagram
+	uint64_t Counter() const
+	{
+		return counter;
+	}
+
+private:
+	const AeadCipher &cipher;
+	uint32_t streamId;
+	uint64_t counter;
+};
+
+struct AeadStats
+{
+	uint64_t opened;
+	uint64_t forged;        ///< tag mismatch: wrong key or stream id, corruption or tampering
+	uint64_t replayed;      ///< counter already seen, or older than the window
+	uint64_t malformed;     ///< too short to hold the counter and tag
+
+	/// Calls f(name, value) for each counter, for a metrics exporter
+	template<typename F>
+	void ForEach(F &&f) const
+	{
+		f("opened", opened);
+		f("forged", forged);
+		f("replayed", replayed);
+		f("malformed", malformed);
+	}
+};
+
+/**
+ * Opening side of a stream, with anti-replay over the last window counters. Unlike
+ * SequenceTracker it never resynchronises on old counters: an attacker controls those.
+ */
+class AeadReceiveStream
+{
+public:
+	/// @param window counters of history, rounded up to a power of two (at least 64)
+	AeadReceiveStream(const AeadCipher &cipher, uint32_t streamId, uint32_t window = 1024) :
+		cipher(cipher), streamId(streamId), highest(0), started(false)
+	{
+		uint32_t w = 64;
+		while (w < window) {
+			w <<= 1;
+		}
+		windowSize = w;
+		// twice the window, so the bits cleared ahead never belong to counters still inside it
+		bits.assign(2 * w / 64, 0);
+		memset(&stats, 0, sizeof(stats));
+	}
+
+	AeadReceiveStream(const AeadReceiveStream&) = delete;
+	AeadReceiveStream& operator=(const AeadReceiveStream&) = delete;
+
+	/**
+	 * @brief Authenticates and decrypts buf[0, len) in place.
+	 *
+	 * @return the plaintext length (header included), -1 if the datagram is forged, replayed or
+	 * malformed
+	 */
+	ssize_t Open(uint8_t *buf, size_t len, size_t headerLen = 0)
+	{
+		if (len < headerLen + kAeadOverhead) {
+			++stats.malformed;
+			return -1;
+		}
+		size_t body = len - kAeadOverhead;
+		uint64_t ctr = detail::AeadLoad64BE(buf + body);
+		if (!Fresh(ctr)) {
+			++stats.replayed;
+			return -1;
+		}
+		uint8_t nonce[kAeadNonceSize];
+		uint32_t id = htonl(streamId);
+		memcpy(nonce, &id, 4);
+		memcpy(nonce + 4, buf + body, 8);
+		if (!cipher.Open(nonce, buf, headerLen, buf + headerLen, body - headerLen, buf + body + 8)) {
+			++stats.forged;
+			return -1;
+		}
+		// only authenticated counters move the window
+		Mark(ctr);
+		++stats.opened;
+		return static_cast<ssize_t>(body);
+	}
+
+	/**
+	 * @brief Opens every datagram of a received batch; keep[i] tells which ones to use.
+	 *
+	 * @return number of datagrams kept
+	 */
+	size_t Open(PacketBatch &batch, bool *keep, size_t headerLen = 0)
+	{
+		size_t kept = 0;
+		for (size_t i = 0; i < batch.Size(); ++i) {
+			ssize_t n = Open(batch.Payload(i), batch.Length(i), headerLen);
+			keep[i] = n >= 0;
+			if (keep[i]) {
+				batch.SetLength(i, static_cast<size_t>(n));
+				++kept;
+			}
+		}
+		return kept;
+	}
+
+	/// Highest counter authenticated so far
+	uint64_t Highest() const
+	{
+		return highest;
+	}
+
+	const AeadStats& Stats() const
+	{
+		return stats;
+	}
+
+private:
+	bool Fresh(uint64_t ctr) const
+	{
+		if (!started || ctr > highest) {
+			return true;
+		}
+		if (highest - ctr >= windowSize) {
+			return false;
+		}
+		size_t bit = static_cast<size_t>(ctr & (2 * windowSize - 1));
+		return !(bits[bit / 64] >> (bit % 64) & 1);
+	}
+
+	void Mark(uint64_t ctr)
+	{
+		const uint64_t span = 2 * windowSize;
+		if (!started || ctr > highest) {
+			if (!started || ctr - highest >= span) {
+				std::fill(bits.begin(), bits.end(), 0);
+			} else {
+				for (uint64_t c = highest + 1; c < ctr; ++c) {
+					size_t bit = static_cast<size_t>(c & (span - 1));
+					bits[bit / 64] &= ~(1ULL << (bit % 64));
+				}
+			}
+			highest = ctr;
+			started = true;
+		}
+		size_t bit = static_cast<size_t>(ctr & (span - 1));
+		bits[bit / 64] |= 1ULL << (bit % 64);
+	}
+
+	const AeadCipher &cipher;
+	uint32_t streamId;
+	uint64_t highest;
+	bool started;
+	uint32_t windowSize;
+	std::vector<uint64_t> bits;
+	AeadStats stats;
+};
+
+} /* namespace FUTILS */
+
+#endif /* Linux functions*/
+
+#endif /* FUTILS_AEAD_H_ */
@@ -0,0 +1,715 @@
+/**
+ * @brief Capture of received UDP datagrams to file and timed replay.
+ *
+ * @details The utilities implemented include:
+ * 			- CaptureWriter: appends datagrams with their kernel receive timestamp to a pcap file
+ * 			  (nanosecond, raw IPv4, opens in Wireshark/tcpdump) or to a compact binary file,
+ * 			  through a growing shared mapping instead of write() calls
+ * 			- CaptureReader: maps a capture read-only and iterates its UDP datagrams; reads both
+ * 			  formats, including microsecond pcap and Ethernet captures taken with tcpdump
+ * 			- CaptureLoop(): receive-and-record loop over a UdpBatchReceiver
+ * 			- ReplayEngine: sends a capture to one destination (ConfigureSenderSocket()) at the
+ * 			  original timing, scaled, or as fast as possible, in batches released by a
+ * 			  PeriodicScheduler
+ *
+ * 			Example:
+ * 			@code
+ * 			FUTILS::CaptureReader reader;
+ * 			FUTILS::ReplayEngine replay;
+ * 			if (reader.Open("rx.pcap") && replay.Open("127.0.0.1", 5000)) {
+ * 				FUTILS::ReplayOptions options;
+ * 				options.speed = 2.0;   // twice as fast; 0 for line rate
+ * 				FUTILS::ReplayStats stats = replay.Run(reader, options);
+ * 			}
+ * 			@endcode
+ */
+
+#ifndef FUTILS_CAPTURE_H_
+#define FUTILS_CAPTURE_H_
+
+#include "futils.h"
+#include "futils_time.h"
+#include "futils_udpbatch.h"
+
+#if defined(__linux__) || defined(linux)
+
+#include <atomic>
+#include <cerrno>
+#include <poll.h>
+#include <sys/mman.h>
+
+namespace FUTILS
+{
+
+enum class CaptureFormat
+{
+	Pcap,       ///< pcap, nanosecond timestamps, LINKTYPE_RAW with synthesized IPv4/UDP headers
+	Compact     ///< 16 byte record header (time, source, length) + payload, 8 byte aligned
+};
+
+/// One datagram of a capture; payload points into the mapping of the reader
+struct CaptureRecord
+{
+	uint64_t timestampNs;
+	uint32_t addr;          ///< source address, host byte order
+	uint16_t port;          ///< source port, host byte order
+	uint32_t length;
+	const uint8_t *payload;
+};
+
+namespace detail
+{
+
+static const uint32_t kPcapMagicNs = 0xa1b23c4d;
+static const uint32_t kPcapMagicUs = 0xa1b2c3d4;
+static const uint32_t kLinkEthernet = 1;
+static const uint32_t kLinkRaw = 101;
+static const uint32_t kLinkIpv4 = 228;
+static const char kCompactMagic[8] = {'F', 'U', 'C', 'A', 'P', 0, 1, 0};
+
+struct PcapFileHeader
+{
+	uint32_t magic;
+	uint16_t versionMajor;
+	uint16_t versionMinor;
+	int32_t thisZone;
+	uint32_t sigFigs;
+	uint32_t snapLen;
+	uint32_t linkType;
+};
+
+struct PcapRecordHeader
+{
+	uint32_t sec;
+	uint32_t frac;          ///< ns or us depending on the magic
+	uint32_t capturedLen;
+	uint32_t originalLen;
+};
+
+struct CompactRecordHeader
+{
+	uint64_t timestampNs;
+	uint32_t addr;
+	uint16_t port;
+	uint16_t length;
+};
+
+inline uint16_t Ipv4HeaderChecksum(const uint8_t *header)
+{
+	uint32_t sum = 0;
+	for (int i = 0; i < 20; i += 2) {
+		sum += static_cast<uint32_t>(header[i] << 8 | header[i + 1]);
+	}
+	while (sum >> 16) {
+		sum = (sum & 0xffff) + (sum >> 16);
+	}
+	return static_cast<uint16_t>(~sum);
+}
+
+/**
+ * Append-only file written through a shared mapping, extended window by window. Close() trims the
+ * file to the bytes written.
+ */
+class MappedFileWriter
+{
+public:
+	MappedFileWriter() :
+		fd(-1), base(nullptr), windowOffset(0), windowSize(0), used(0), chunk(0)
+	{
+	}
+
+	~MappedFileWriter()
+	{
+		Close();
+	}
+
+	MappedFileWriter(const MappedFileWriter&) = delete;
+	MappedFileWriter& operator=(const MappedFileWriter&) = delete;
+
+	bool Open(const std::string &path, size_t chunkBytes)
+	{
+		Close();
+		fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+		if (fd < 0) {
+			perror(("open " + path).c_str());
+			return false;
+		}
+		long page = sysconf(_SC_PAGESIZE);
+		chunk = (chunkBytes + static_cast<size_t>(page) - 1) & ~(static_cast<size_t>(page) - 1);
+		used = 0;
+		return true;
+	}
+
+	/// Pointer to len bytes at the end of the file, nullptr on error
+	uint8_t* Append(size_t len)
+	{
+		if (used + len > windowOffset + windowSize && !Remap(len)) {
+			return nullptr;
+		}
+		uint8_t *p = base + (used - windowOffset);
+		used += len;
+		return p;
+	}
+
+	size_t Size() const
+	{
+		return used;
+	}
+
+	bool IsOpen() const
+	{
+		return fd >= 0;
+	}
+
+	void Close()
+	{
+		if (base) {
+			munmap(base, windowSize);
+			base = nullptr;
+		}
+		if (fd >= 0) {
+			if (ftruncate(fd, static_cast<off_t>(used)) != 0) {
+				perror("ftruncate");
+			}
+			::close(fd);
+			fd = -1;
+		}
+		windowOffset = windowSize = 0;
+	}
+
+private:
+	bool Remap(size_t len)
+	{
+		if (base) {
+			// written pages are flushed by the kernel in the background
+			munmap(base, windowSize);
+			base = nullptr;
+		}
+		long page = sysconf(_SC_PAGESIZE);
+		windowOffset = used & ~(static_cast<size_t>(page) - 1);
+		windowSize = std::max(chunk, (used - windowOffset + len + static_cast<size_t>(page) - 1) & ~(static_cast<size_t>(page) - 1));
+		if (ftruncate(fd, static_cast<off_t>(windowOffset + windowSize)) != 0) {
+			perror("ftruncate");
+			return false;
+		}
+		void *p = mmap(nullptr, windowSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, static_cast<off_t>(windowOffset));
+		if (p == MAP_FAILED) {
+			perror("mmap");
+			windowSize = 0;
+			return false;
+		}
+		base = static_cast<uint8_t*>(p);
+		return true;
+	}
+
+	int fd;
+	uint8_t *base;
+	size_t windowOffset;
+	size_t windowSize;
+	size_t used;
+	size_t chunk;
+};
+
+} /* namespace detail */
+
+/**
+ * Records datagrams to a capture file.
+ */
+class CaptureWriter
+{
+public:
+	CaptureWriter() :
+		format(CaptureFormat::Pcap), localAddr(0), localPort(0), records(0)
+	{
+	}
+
+	/**
+	 * @param chunkBytes size of the mapping windows (the file grows by this much at a time)
+	 */
+	bool Open(const std::string &path, CaptureFormat captureFormat = CaptureFormat::Pcap, size_t chunkBytes = 64 << 20)
+	{
+		format = captureFormat;
+		records = 0;
+		if (!file.Open(path, chunkBytes)) {
+			return false;
+		}
+		if (format == CaptureFormat::Pcap) {
+			detail::PcapFileHeader header;
+			header.magic = detail::kPcapMagicNs;
+			header.versionMajor = 2;
+			header.versionMinor = 4;
+			header.thisZone = 0;
+			header.sigFigs = 0;
+			header.snapLen = 65535;
+			header.linkType = detail::kLinkRaw;
+			return Put(&header, sizeof(header));
+		}
+		uint64_t header[2] = {0, 0};
+		memcpy(header, detail::kCompactMagic, sizeof(detail::kCompactMagic));
+		return Put(header, sizeof(header));
+	}
+
+	/// Destination written in the synthesized pcap IPv4/UDP headers (host byte order)
+	void SetLocalAddress(uint32_t addr, uint16_t port)
+	{
+		localAddr = addr;
+		localPort = port;
+	}
+
+	/// Records one datagram (addr and port of the source in host byte order)
+	bool Write(uint64_t timestampNs, uint32_t addr, uint16_t port, const void *payload, size_t len)
+	{
+		if (len > 65507) {
+			return false;
+		}
+		if (format == CaptureFormat::Compact) {
+			size_t total = (sizeof(detail::CompactRecordHeader) + len + 7) & ~static_cast<size_t>(7);
+			uint8_t *p = file.Append(total);
+			if (!p) {
+				return false;
+			}
+			detail::CompactRecordHeader header;
+			header.timestampNs = timestampNs;
+			header.addr = addr;
+			header.port = port;
+			header.length = static_cast<uint16_t>(len);
+			memcpy(p, &header, sizeof(header));
+			memcpy(p + sizeof(header), payload, len);
+			memset(p + sizeof(header) + len, 0, total - sizeof(header) - len);
+		} else {
+			const size_t ipLen = 28 + len;
+			uint8_t *p = file.Append(sizeof(detail::PcapRecordHeader) + ipLen);
+			if (!p) {
+				return false;
+			}
+			detail::PcapRecordHeader header;
+			header.sec = static_cast<uint32_t>(timestampNs / 1000000000ULL);
+			header.frac = static_cast<uint32_t>(timestampNs % 1000000000ULL);
+			header.capturedLen = header.originalLen = static_cast<uint32_t>(ipLen);
+			memcpy(p, &header, sizeof(header));
+			uint8_t *ip = p + sizeof(header);
+			memset(ip, 0, 28);
+			ip[0] = 0x45;
+			ip[2] = static_cast<uint8_t>(ipLen >> 8);
+			ip[3] = static_cast<uint8_t>(ipLen);
+			ip[6] = 0x40;               // don't fragment
+			ip[8] = 64;                 // ttl
+			ip[9] = IPPROTO_UDP;
+			uint32_t src = htonl(addr);
+			uint32_t dst = htonl(localAddr);
+			memcpy(ip + 12, &src, 4);
+			memcpy(ip + 16, &dst, 4);
+			uint16_t checksum = htons(detail::Ipv4HeaderChecksum(ip));
+			memcpy(ip + 10, &checksum, 2);
+			uint16_t udp[4] = {htons(port), htons(localPort), htons(static_cast<uint16_t>(len + 8)), 0};
+			memcpy(ip + 20, udp, 8);
+			memcpy(ip + 28, payload, len);
+		}
+		++records;
+		return true;
+	}
+
+	/// Records every datagram of a received batch (timestamps from PacketBatch::Timestamp())
+	size_t Write(const PacketBatch &batch)
+	{
+		size_t written = 0;
+		for (size_t i = 0; i < batch.Size(); ++i) {
+			uint64_t ts = batch.Timestamp(i) ? batch.Timestamp(i) : RealtimeNs();
+			written += Write(ts, batch.SrcAddr(i), batch.SrcPort(i), batch.Payload(i), batch.Length(i));
+		}
+		return written;
+	}
+
+	uint64_t Records() const
+	{
+		return records;
+	}
+
+	size_t Bytes() const
+	{
+		return file.Size();
+	}
+
+	/// Trims and closes the file
+	void Close()
+	{
+		file.Close();
+	}
+
+private:
+	static uint64_t RealtimeNs()
+	{
+		struct timespec ts;
+		clock_gettime(CLOCK_REALTIME, &ts);
+		return static_cast<uint64_t>(ts.tv_sec) * 1000000000ULL + static_cast<uint64_t>(ts.tv_nsec);
+	}
+
+	bool Put(const void *data, size_t len)
+	{
+		uint8_t *p = file.Append(len);
+		if (!p) {
+			return false;
+		}
+		memcpy(p, data, len);
+		return true;
+	}
+
+	detail::MappedFileWriter file;
+	CaptureFormat format;
+	uint32_t localAddr;
+	uint16_t localPort;
+	uint64_t records;
+};
+
+/**
+ * Iterates the UDP datagrams of a capture file mapped read-only.
+ */
+class CaptureReader
+{
+public:
+	CaptureReader() :
+		data(nullptr), size(0), offset(0), start(0), compact(false), nanoseconds(true), linkType(0)
+	{
+	}
+
+	~CaptureReader()
+	{
+		Close();
+	}
+
+	CaptureReader(const CaptureReader&) = delete;
+	CaptureReader& operator=(const CaptureReader&) = delete;
+
+	bool Open(const std::string &path)
+	{
+		Close();
+		int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+		if (fd < 0) {
+			perror(("open " + path).c_str());
+			return false;
+		}
+		struct stat st;
+		if (fstat(fd, &st) != 0 || st.st_size < 16) {
+			std::cerr << tc::redL << "CaptureReader: " << path << " is not a capture" << tc::none << std::endl;
+			::close(fd);
+			return false;
+		}
+		size = static_cast<size_t>(st.st_size);
+		void *p = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+		::close(fd);
+		if (p == MAP_FAILED) {
+			perror("mmap");
+			size = 0;
+			return false;
+		}
+		madvise(p, size, MADV_SEQUENTIAL);
+		data = static_cast<const uint8_t*>(p);
+		if (memcmp(data, detail::kCompactMagic, sizeof(detail::kCompactMagic)) == 0) {
+			compact = true;
+			start = 16;
+		} else {
+			detail::PcapFileHeader header;
+			memcpy(&header, data, std::min(size, sizeof(header)));
+			bool supported = size >= sizeof(header) && (header.linkType == detail::kLinkRaw ||
+					header.linkType == detail::kLinkIpv4 || header.linkType == detail::kLinkEthernet);
+			if (!supported || (header.magic != detail::kPcapMagicNs && header.magic != detail::kPcapMagicUs)) {
+				std::cerr << tc::redL << "CaptureReader: " << path << ": unsupported format (native byte order pcap, raw IPv4 or Ethernet)" << tc::none << std::endl;
+				Close();
+				return false;
+			}
+			compact = false;
+			nanoseconds = header.magic == detail::kPcapMagicNs;
+			linkType = header.linkType;
+			start = sizeof(header);
+		}
+		offset = start;
+		return true;
+	}
+
+	/**
+	 * @brief Reads the next UDP datagram (non-UDP pcap records are skipped).
+	 *
+	 * @return false at the end of the file
+	 */
+	bool Next(CaptureRecord &record)
+	{
+		while (offset < size) {
+			if (compact) {
+				detail::CompactRecordHeader header;
+				if (size - offset < sizeof(header)) {
+					break;
+				}
+				memcpy(&header, data + offset, sizeof(header));
+				size_t total = (sizeof(header) + header.length + 7) & ~static_cast<size_t>(7);
+				// zeros: end of a file whose writer did not get to Close()
+				if (header.timestampNs == 0 || size - offset < sizeof(header) + header.length) {
+					break;
+				}
+				record.timestampNs = header.timestampNs;
+				record.addr = header.addr;
+				record.port = header.port;
+				record.length = header.length;
+				record.payload = data + offset + sizeof(header);
+				offset += std::min(total, size - offset);
+				return true;
+			}
+			detail::PcapRecordHeader header;
+			if (size - offset < sizeof(header)) {
+				break;
+			}
+			memcpy(&header, data + offset, sizeof(header));
+			if (size - offset - sizeof(header) < header.capturedLen) {
+				break;
+			}
+			const uint8_t *frame = data + offset + sizeof(header);
+			offset += sizeof(header) + header.capturedLen;
+			record.timestampNs = static_cast<uint64_t>(header.sec) * 1000000000ULL +
+					static_cast<uint64_t>(header.frac) * (nanoseconds ? 1 : 1000);
+			if (ParseUdp(frame, header.capturedLen, record)) {
+				return true;
+			}
+		}
+		return false;
+	}
+
+	/// Restarts from the first record
+	void Rewind()
+	{
+		offset = start;
+	}
+
+	bool IsOpen() const
+	{
+		return data != nullptr;
+	}
+
+	void Close()
+	{
+		if (data) {
+			munmap(const_cast<uint8_t*>(data), size);
+			data = nullptr;
+		}
+		size = offset = 0;
+	}
+
+private:
+	bool ParseUdp(const uint8_t *frame, size_t len, CaptureRecord &record) const
+	{
+		if (linkType == detail::kLinkEthernet) {
+			if (len < 14 || frame[12] != 0x08 || frame[13] != 0x00) {
+				return false;
+			}
+			frame += 14;
+			len -= 14;
+		}
+		if (len < 20 || (frame[0] >> 4) != 4 || frame[9] != IPPROTO_UDP) {
+			return false;
+		}
+		size_t ihl = (frame[0] & 0x0f) * 4u;
+		if (len < ihl + 8) {
+			return false;
+		}
+		const uint8_t *udp = frame + ihl;
+		size_t udpLen = static_cast<size_t>(udp[4] << 8 | udp[5]);
+		if (udpLen < 8 || udpLen > len - ihl) {
+			return false;
+		}
+		uint32_t src;
+		memcpy(&src, frame + 12, 4);
+		record.addr = ntohl(src);
+		record.port = static_cast<uint16_t>(udp[0] << 8 | udp[1]);
+		record.length = static_cast<uint32_t>(udpLen - 8);
+		record.payload = udp + 8;
+		return true;
+	}
+
+	const uint8_t *data;
+	size_t size;
+	size_t offset;
+	size_t start;
+	bool compact;
+	bool nanoseconds;
+	uint32_t linkType;
+};
+
+/**
+ * @brief Records what a receiver gets until stop is set or maxPackets datagrams are written.
+ *
+ * Enables kernel timestamps on the receiver, and polls so that stop is checked at least every
+ * 100 ms.
+ *
+ * @return number of datagrams recorded
+ */
+inline uint64_t CaptureLoop(UdpBatchReceiver &receiver, CaptureWriter &writer, const std::atomic<bool> &stop, uint64_t maxPackets = 0, size_t batchSize = 64)
+{
+	PacketBatch batch(batchSize, 65536);
+	batch.SetReceiveTimestamps(receiver.EnableTimestamps());
+	uint64_t recorded = 0;
+	struct pollfd pfd;
+	pfd.fd = receiver.Fd();
+	pfd.events = POLLIN;
+	while (!stop.load(std::memory_order_relaxed) && (maxPackets == 0 || recorded < maxPackets)) {
+		int ready = poll(&pfd, 1, 100);
+		if (ready < 0 && errno != EINTR) {
+			perror("poll");
+			break;
+		}
+		if (ready <= 0) {
+			continue;
+		}
+		if (receiver.Receive(batch) < 0) {
+			break;
+		}
+		recorded += writer.Write(batch);
+	}
+	return recorded;
+}
+
+struct ReplayOptions
+{
+	double speed;               ///< 1 for the original timing, 2 twice as fast..., 0 as fast as possible
+	uint64_t granularityNs;     ///< scheduler period: datagrams due within one period leave in one batch
+	size_t batchSize;           ///< datagrams per sendmmsg()
+	unsigned loops;             ///< times the capture is played (0 = forever)
+
+	ReplayOptions() :
+		speed(1.0), granularityNs(50000), batchSize(64), loops(1)
+	{
+	}
+};
+
+struct ReplayStats
+{
+	uint64_t packets;
+	uint64_t bytes;
+	uint64_t elapsedNs;
+	uint64_t maxLatenessNs;     ///< largest delay of a datagram past its scheduled time
+	uint64_t overruns;          ///< scheduler periods missed because sending took longer
+
+	ReplayStats() :
+		packets(0), bytes(0), elapsedNs(0), maxLatenessNs(0), overruns(0)
+	{
+	}
+};
+
+/**
+ * Replays a capture to one destination.
+ */
+class ReplayEngine
+{
+public:
+	ReplayEngine()
+	{
+		memset(&destination, 0, sizeof(destination));
+	}
+
+	/// Creates the socket and sets the destination (ConfigureSenderSocket())
+	bool Open(const std::string &ip, uint16_t port)
+	{
+		std::vector<char> address(ip.begin(), ip.end());
+		address.push_back('\0');
+		ConfigureSenderSocket(destination, address.data(), port);
+		return sender.Open();
+	}
+
+	/// Sends from an already configured socket (not closed by this object)
+	void Attach(int fd, const struct sockaddr_in &dest)
+	{
+		sender.Attach(fd);
+		destination = dest;
+	}
+
+	/**
+	 * @brief Plays the capture from its first record.
+	 *
+	 * At each scheduler deadline the datagrams that have become due leave together: they are late
+	 * by less than granularityNs (never early), and every sendmmsg() carries as many datagrams as
+	 * the traffic allows.
+	 */
+	ReplayStats Run(CaptureReader &reader, const ReplayOptions &options = ReplayOptions())
+	{
+		ReplayStats stats;
+		PacketBatch batch(options.batchSize, 65536);
+		const uint64_t begin = MonotonicNs();
+		for (unsigned loop = 0; options.loops == 0 || loop < options.loops; ++loop) {
+			reader.Rewind();
+			if (options.speed > 0) {
+				PlayTimed(reader, options, batch, stats);
+			} else {
+				PlayUnthrottled(reader, batch, stats);
+			}
+			if (stats.packets == 0) {
+				break;
+			}
+		}
+		stats.elapsedNs = MonotonicNs() - begin;
+		return stats;
+	}
+
+private:
+	void PlayUnthrottled(CaptureReader &reader, PacketBatch &batch, ReplayStats &stats)
+	{
+		CaptureRecord record;
+		batch.Clear();
+		while (reader.Next(record)) {
+			if (batch.Size() == batch.Capacity()) {
+				Flush(batch, stats);
+			}
+			batch.Add(destination, record.payload, record.length);
+		}
+		Flush(batch, stats);
+	}
+
+	void PlayTimed(CaptureReader &reader, const ReplayOptions &options, PacketBatch &batch, ReplayStats &stats)
+	{
+		CaptureRecord record;
+		if (!reader.Next(record)) {
+			return;
+		}
+		const uint64_t first = record.timestampNs;
+		const uint64_t start = MonotonicNs() + options.granularityNs;
+		PeriodicScheduler scheduler(options.granularityNs, start);
+		uint64_t due = start;
+		bool more = true;
+		batch.Clear();
+		while (more) {
+			// jump over idle gaps instead of waking up every period
+			scheduler.SkipTo(due);
+			scheduler.Wait();
+			const uint64_t now = MonotonicNs();
+			while (more && due <= now) {
+				if (batch.Size() == batch.Capacity()) {
+					Flush(batch, stats);
+				}
+				batch.Add(destination, record.payload, record.length);
+				stats.maxLatenessNs = std::max(stats.maxLatenessNs, now - due);
+				more = reader.Next(record);
+				if (more) {
+					uint64_t offset = record.timestampNs > first ? record.timestampNs - first : 0;
+					due = start + static_cast<uint64_t>(static_cast<double>(offset) / options.speed);
+				}
+			}
+			Flush(batch, stats);
+		}
+		stats.overruns += scheduler.Overruns();
+	}
+
+	void Flush(PacketBatch &batch, ReplayStats &stats)
+	{
+		size_t sent = sender.Send(batch);
+		for (size_t i = 0; i < sent; ++i) {
+			stats.bytes += batch.Length(i);
+		}
+		stats.packets += sent;
+		batch.Clear();
+	}
+
+	UdpBatchSender sender;
+	struct sockaddr_in destination;
+};
+
+} /* namespace FUTILS */
+
+#endif /* Linux functions*/
+
+#endif /* FUTILS_CAPTURE_H_ */
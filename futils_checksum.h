@@ -0,0 +1,703 @@
+/**
+ * @brief Checksums and non-cryptographic hashes for packet integrity.
+ *
+ * @details The functions implemented, with runtime CPU dispatch on x86, include:
+ * 			- CRC32C (Castagnoli), SSE4.2 crc32 instruction with 3-way interleaving
+ * 			- CRC32 (IEEE 802.3, zlib compatible), PCLMULQDQ folding
+ * 			- XXH64 and wyhash, one-shot and streaming
+ * 			- Append/verify helpers for UDP payloads
+ *
+ * 			All CRC functions follow the zlib convention: the value returned by a call can be
+ * 			passed back as the crc argument of the next call to checksum a stream in pieces.
+ * 			A portable slicing-by-8 implementation is used when the CPU lacks the instructions.
+ */
+
+#ifndef FUTILS_CHECKSUM_H_
+#define FUTILS_CHECKSUM_H_
+
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+
+#if defined(__x86_64__)
+#	include <immintrin.h>
+#	define FUTILS_CHECKSUM_X86 1
+#endif
+
+namespace FUTILS
+{
+
+namespace detail
+{
+
+inline uint64_t Load64LE(const unsigned char *p)
+{
+	uint64_t v;
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+inline uint32_t Load32LE(const unsigned char *p)
+{
+	uint32_t v;
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+/// Slicing-by-8 tables for a reflected 32 bit polynomial
+struct CrcTables
+{
+	explicit CrcTables(uint32_t poly)
+	{
+		for (uint32_t n = 0; n < 256; ++n) {
+			uint32_t crc = n;
+			for (int k = 0; k < 8; ++k) {
+				crc = (crc & 1) ? (crc >> 1) ^ poly : crc >> 1;
+			}
+			table[0][n] = crc;
+		}
+		for (uint32_t n = 0; n < 256; ++n) {
+			uint32_t crc = table[0][n];
+			for (int k = 1; k < 8; ++k) {
+				crc = table[0][crc & 0xff] ^ (crc >> 8);
+				table[k][n] = crc;
+			}
+		}
+	}
+
+	/// Updates the raw (pre-inverted) crc register
+	uint32_t Update(uint32_t crc, const unsigned char *p, size_t len) const
+	{
+		while (len && (reinterpret_cast<uintptr_t>(p) & 7)) {
+			crc = table[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+			--len;
+		}
+		while (len >= 8) {
+			uint64_t w = Load64LE(p) ^ crc;
+			crc = table[7][w & 0xff] ^ table[6][(w >> 8) & 0xff] ^
+				table[5][(w >> 16) & 0xff] ^ table[4][(w >> 24) & 0xff] ^
+				table[3][(w >> 32) & 0xff] ^ table[2][(w >> 40) & 0xff] ^
+				table[1][(w >> 48) & 0xff] ^ table[0][w >> 56];
+			p += 8;
+			len -= 8;
+		}
+		while (len--) {
+			crc = table[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+		}
+		return crc;
+	}
+
+	uint32_t table[8][256];
+};
+
+const uint32_t kCrc32cPoly = 0x82f63b78;
+const uint32_t kCrc32Poly = 0xedb88320;
+
+inline const CrcTables& Crc32cTables()
+{
+	static const CrcTables tables(kCrc32cPoly);
+	return tables;
+}
+
+inline const CrcTables& Crc32Tables()
+{
+	static const CrcTables tables(kCrc32Poly);
+	return tables;
+}
+
+#ifdef FUTILS_CHECKSUM_X86
+
+/**
+ * Tables that advance a CRC32C register over a run of zero bytes, used to merge the three
+ * interleaved streams of the hardware implementation (see Mark Adler's crc32c.c).
+ */
+struct Crc32cShiftTables
+{
+	static const size_t kLong = 8192;
+	static const size_t kShort = 256;
+
+	Crc32cShiftTables()
+	{
+		Build(longShift, kLong);
+		Build(shortShift, kShort);
+	}
+
+	static uint32_t Shift(const uint32_t zeros[4][256], uint32_t crc)
+	{
+		return zeros[0][crc & 0xff] ^ zeros[1][(crc >> 8) & 0xff] ^
+			zeros[2][(crc >> 16) & 0xff] ^ zeros[3][crc >> 24];
+	}
+
+	uint32_t longShift[4][256];
+	uint32_t shortShift[4][256];
+
+private:
+	static uint32_t MatrixTimes(const uint32_t *mat, uint32_t vec)
+	{
+		uint32_t sum = 0;
+		while (vec) {
+			if (vec & 1) {
+				sum ^= *mat;
+			}
+			vec >>= 1;
+			mat++;
+		}
+		return sum;
+	}
+
+	static void MatrixSquare(uint32_t *square, const uint32_t *mat)
+	{
+		for (int n = 0; n < 32; ++n) {
+			square[n] = MatrixTimes(mat, mat[n]);
+		}
+	}
+
+	/// Builds the operator that applies len zero bytes to a crc register
+	static void ZerosOperator(uint32_t *even, size_t len)
+	{
+		uint32_t odd[32];
+		odd[0] = kCrc32cPoly;
+		uint32_t row = 1;
+		for (int n = 1; n < 32; ++n) {
+			odd[n] = row;
+			row <<= 1;
+		}
+		MatrixSquare(even, odd);
+		MatrixSquare(odd, even);
+		do {
+			MatrixSquare(even, odd);
+			len >>= 1;
+			if (len == 0) {
+				return;
+			}
+			MatrixSquare(odd, even);
+			len >>= 1;
+		} while (len);
+		memcpy(even, odd, sizeof(odd));
+	}
+
+	static void Build(uint32_t zeros[4][256], size_t len)
+	{
+		uint32_t op[32];
+		ZerosOperator(op, len);
+		for (uint32_t n = 0; n < 256; ++n) {
+			zeros[0][n] = MatrixTimes(op, n);
+			zeros[1][n] = MatrixTimes(op, n << 8);
+			zeros[2][n] = MatrixTimes(op, n << 16);
+			zeros[3][n] = MatrixTimes(op, n << 24);
+		}
+	}
+};
+
+inline const Crc32cShiftTables& Crc32cShifts()
+{
+	static const Crc32cShiftTables tables;
+	return tables;
+}
+
+__attribute__((target("sse4.2")))
+inline uint32_t Crc32cSse42(uint32_t crc, const unsigned char *next, size_t len)
+{
+	const size_t kLong = Crc32cShiftTables::kLong;
+	const size_t kShort = Crc32cShiftTables::kShort;
+	const Crc32cShiftTables &shifts = Crc32cShifts();
+	uint64_t crc0 = crc;
+
+	while (len && (reinterpret_cast<uintptr_t>(next) & 7)) {
+		crc0 = _mm_crc32_u8(static_cast<uint32_t>(crc0), *next++);
+		--len;
+	}
+	// Three independent streams hide the 3 cycle latency of the crc32 instruction
+	while (len >= kLong * 3) {
+		uint64_t crc1 = 0, crc2 = 0;
+		const unsigned char *end = next + kLong;
+		do {
+			crc0 = _mm_crc32_u64(crc0, Load64LE(next));
+			crc1 = _mm_crc32_u64(crc1, Load64LE(next + kLong));
+			crc2 = _mm_crc32_u64(crc2, Load64LE(next + kLong * 2));
+			next += 8;
+		} while (next < end);
+		crc0 = Crc32cShiftTables::Shift(shifts.longShift, static_cast<uint32_t>(crc0)) ^ crc1;
+		crc0 = Crc32cShiftTables::Shift(shifts.longShift, static_cast<uint32_t>(crc0)) ^ crc2;
+		next += kLong * 2;
+		len -= kLong * 3;
+	}
+	while (len >= kShort * 3) {
+		uint64_t crc1 = 0, crc2 = 0;
+		const unsigned char *end = next + kShort;
+		do {
+			crc0 = _mm_crc32_u64(crc0, Load64LE(next));
+			crc1 = _mm_crc32_u64(crc1, Load64LE(next + kShort));
+			crc2 = _mm_crc32_u64(crc2, Load64LE(next + kShort * 2));
+			next += 8;
+		} while (next < end);
+		crc0 = Crc32cShiftTables::Shift(shifts.shortShift, static_cast<uint32_t>(crc0)) ^ crc1;
+		crc0 = Crc32cShiftTables::Shift(shifts.shortShift, static_cast<uint32_t>(crc0)) ^ crc2;
+		next += kShort * 2;
+		len -= kShort * 3;
+	}
+	while (len >= 8) {
+		crc0 = _mm_crc32_u64(crc0, Load64LE(next));
+		next += 8;
+		len -= 8;
+	}
+	while (len) {
+		crc0 = _mm_crc32_u8(static_cast<uint32_t>(crc0), *next++);
+		--len;
+	}
+	return static_cast<uint32_t>(crc0);
+}
+
+/**
+ * CRC32 (reflected 0xedb88320) by folding 64 bytes per iteration with carry-less multiplies,
+ * followed by a Barrett reduction (Intel white paper "Fast CRC Computation Using PCLMULQDQ").
+ * Requires len >= 64 and len multiple of 16; works on the raw crc register.
+ */
+__attribute__((target("pclmul,sse4.1")))
+inline uint32_t Crc32Pclmul(uint32_t crc, const unsigned char *buf, size_t len)
+{
+	alignas(16) static const uint64_t k1k2[] = { 0x0154442bd4, 0x01c6e41596 };
+	alignas(16) static const uint64_t k3k4[] = { 0x01751997d0, 0x00ccaa009e };
+	alignas(16) static const uint64_t k5k0[] = { 0x0163cd6124, 0x0000000000 };
+	alignas(16) static const uint64_t poly[] = { 0x01db710641, 0x01f7011641 };
+
+	__m128i x0, x1, x2, x3, x4, x5, x6, x7, x8, y5, y6, y7, y8;
+
+	x1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(buf + 0x00));
+	x2 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(buf + 0x10));
+	x3 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(buf + 0x20));
+	x4 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(buf + 0x30));
+	x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128(static_cast<int>(crc)));
+	x0 = _mm_load_si128(reinterpret_cast<const __m128i*>(k1k2));
+	buf += 64;
+	len -= 64;
+
+	while (len >= 64) {
+		x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+		x6 = _mm_clmulepi64_si128(x2, x0, 0x00);
+		x7 = _mm_clmulepi64_si128(x3, x0, 0x00);
+		x8 = _mm_clmulepi64_si128(x4, x0, 0x00);
+		x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+		x2 = _mm_clmulepi64_si128(x2, x0, 0x11);
+		x3 = _mm_clmulepi64_si128(x3, x0, 0x11);
+		x4 = _mm_clmulepi64_si128(x4, x0, 0x11);
+		y5 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(buf + 0x00));
+		y6 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(buf + 0x10));
+		y7 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(buf + 0x20));
+		y8 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(buf + 0x30));
+		x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), y5);
+		x2 = _mm_xor_si128(_mm_xor_si128(x2, x6), y6);
+		x3 = _mm_xor_si128(_mm_xor_si128(x3, x7), y7);
+		x4 = _mm_xor_si128(_mm_xor_si128(x4, x8), y8);
+		buf += 64;
+		len -= 64;
+	}
+
+	// Fold the four accumulators into one
+	x0 = _mm_load_si128(reinterpret_cast<const __m128i*>(k3k4));
+	x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+	x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+	x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+	x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1, x3), x5);
+	x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+	x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1, x4), x5);
+
+	while (len >= 16) {
+		x2 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(buf));
+		x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+		x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+		x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+		buf += 16;
+		len -= 16;
+	}
+
+	// 128 -> 64 bits
+	x2 = _mm_clmulepi64_si128(x1, x0, 0x10);
+	x3 = _mm_setr_epi32(~0, 0, ~0, 0);
+	x1 = _mm_srli_si128(x1, 8);
+	x1 = _mm_xor_si128(x1, x2);
+	x0 = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(k5k0));
+	x2 = _mm_srli_si128(x1, 4);
+	x1 = _mm_and_si128(x1, x3);
+	x1 = _mm_clmulepi64_si128(x1, x0, 0x00);
+	x1 = _mm_xor_si128(x1, x2);
+
+	// Barrett reduction to 32 bits
+	x0 = _mm_load_si128(reinterpret_cast<const __m128i*>(poly));
+	x2 = _mm_and_si128(x1, x3);
+	x2 = _mm_clmulepi64_si128(x2, x0, 0x10);
+	x2 = _mm_and_si128(x2, x3);
+	x2 = _mm_clmulepi64_si128(x2, x0, 0x00);
+	x1 = _mm_xor_si128(x1, x2);
+
+	return static_cast<uint32_t>(_mm_extract_epi32(x1, 1));
+}
+
+#endif /* FUTILS_CHECKSUM_X86 */
+
+inline uint32_t Crc32cPortable(uint32_t crc, const unsigned char *p, size_t len)
+{
+	return Crc32cTables().Update(crc, p, len);
+}
+
+inline uint32_t Crc32Portable(uint32_t crc, const unsigned char *p, size_t len)
+{
+	return Crc32Tables().Update(crc, p, len);
+}
+
+#ifdef FUTILS_CHECKSUM_X86
+inline uint32_t Crc32Accelerated(uint32_t crc, const unsigned char *p, size_t len)
+{
+	if (len >= 64) {
+		size_t chunk = len & ~static_cast<size_t>(15);
+		crc = Crc32Pclmul(crc, p, chunk);
+		p += chunk;
+		len -= chunk;
+	}
+	return Crc32Portable(crc, p, len);
+}
+#endif
+
+typedef uint32_t (*CrcKernel)(uint32_t, const unsigned char*, size_t);
+
+/// Picks the CRC32C kernel once, based on the running CPU
+inline CrcKernel SelectCrc32c()
+{
+#ifdef FUTILS_CHECKSUM_X86
+	if (__builtin_cpu_supports("sse4.2")) {
+		return Crc32cSse42;
+	}
+#endif
+	return Crc32cPortable;
+}
+
+/// Picks the CRC32 kernel once, based on the running CPU
+inline CrcKernel SelectCrc32()
+{
+#ifdef FUTILS_CHECKSUM_X86
+	if (__builtin_cpu_supports("pclmul") && __builtin_cpu_supports("sse4.1")) {
+		return Crc32Accelerated;
+	}
+#endif
+	return Crc32Portable;
+}
+
+} /* namespace detail */
+
+/**
+ * @brief CRC32C (Castagnoli) of a buffer, as used by iSCSI, SCTP and ext4.
+ *
+ * @param data buffer to checksum
+ * @param len number of bytes
+ * @param crc value returned by a previous call, to continue a stream (0 to start)
+ * @return the checksum
+ */
+inline uint32_t Crc32c(const void *data, size_t len, uint32_t crc = 0)
+{
+	static const detail::CrcKernel kernel = detail::SelectCrc32c();
+	return ~kernel(~crc, static_cast<const unsigned char*>(data), len);
+}
+
+/**
+ * @brief CRC32 (IEEE 802.3), same result as zlib crc32().
+ *
+ * @param data buffer to checksum
+ * @param len number of bytes
+ * @param crc value returned by a previous call, to continue a stream (0 to start)
+ * @return the checksum
+ */
+inline uint32_t Crc32(const void *data, size_t len, uint32_t crc = 0)
+{
+	static const detail::CrcKernel kernel = detail::SelectCrc32();
+	return ~kernel(~crc, static_cast<const unsigned char*>(data), len);
+}
+
+namespace detail
+{
+
+const uint64_t kXxhPrime1 = 0x9E3779B185EBCA87ULL;
+const uint64_t kXxhPrime2 = 0xC2B2AE3D27D4EB4FULL;
+const uint64_t kXxhPrime3 = 0x165667B19E3779F9ULL;
+const uint64_t kXxhPrime4 = 0x85EBCA77C2B2AE63ULL;
+const uint64_t kXxhPrime5 = 0x27D4EB2F165667C5ULL;
+
+inline uint64_t Rotl64(uint64_t x, int r)
+{
+	return (x << r) | (x >> (64 - r));
+}
+
+inline uint64_t XxhRound(uint64_t acc, uint64_t input)
+{
+	acc += input * kXxhPrime2;
+	acc = Rotl64(acc, 31);
+	return acc * kXxhPrime1;
+}
+
+inline uint64_t XxhMergeRound(uint64_t acc, uint64_t val)
+{
+	acc ^= XxhRound(0, val);
+	return acc * kXxhPrime1 + kXxhPrime4;
+}
+
+/// Consumes the tail (< 32 bytes) and applies the final avalanche
+inline uint64_t XxhFinalize(uint64_t h, const unsigned char *p, size_t len)
+{
+	while (len >= 8) {
+		h ^= XxhRound(0, Load64LE(p));
+		h = Rotl64(h, 27) * kXxhPrime1 + kXxhPrime4;
+		p += 8;
+		len -= 8;
+	}
+	if (len >= 4) {
+		h ^= static_cast<uint64_t>(Load32LE(p)) * kXxhPrime1;
+		h = Rotl64(h, 23) * kXxhPrime2 + kXxhPrime3;
+		p += 4;
+		len -= 4;
+	}
+	while (len--) {
+		h ^= (*p++) * kXxhPrime5;
+		h = Rotl64(h, 11) * kXxhPrime1;
+	}
+	h ^= h >> 33;
+	h *= kXxhPrime2;
+	h ^= h >> 29;
+	h *= kXxhPrime3;
+	h ^= h >> 32;
+	return h;
+}
+
+inline void WyMum(uint64_t *a, uint64_t *b)
+{
+	__uint128_t r = static_cast<__uint128_t>(*a) * *b;
+	*a = static_cast<uint64_t>(r);
+	*b = static_cast<uint64_t>(r >> 64);
+}
+
+inline uint64_t WyMix(uint64_t a, uint64_t b)
+{
+	WyMum(&a, &b);
+	return a ^ b;
+}
+
+} /* namespace detail */
+
+/**
+ * @brief XXH64 one-shot hash (compatible with the reference xxHash implementation).
+ */
+inline uint64_t XXH64(const void *data, size_t len, uint64_t seed = 0)
+{
+	using namespace detail;
+	const unsigned char *p = static_cast<const unsigned char*>(data);
+	const size_t totalLen = len;
+	uint64_t h;
+
+	if (len >= 32) {
+		uint64_t v1 = seed + kXxhPrime1 + kXxhPrime2;
+		uint64_t v2 = seed + kXxhPrime2;
+		uint64_t v3 = seed;
+		uint64_t v4 = seed - kXxhPrime1;
+		do {
+			v1 = XxhRound(v1, Load64LE(p));
+			v2 = XxhRound(v2, Load64LE(p + 8));
+			v3 = XxhRound(v3, Load64LE(p + 16));
+			v4 = XxhRound(v4, Load64LE(p + 24));
+			p += 32;
+			len -= 32;
+		} while (len >= 32);
+		h = Rotl64(v1, 1) + Rotl64(v2, 7) + Rotl64(v3, 12) + Rotl64(v4, 18);
+		h = XxhMergeRound(h, v1);
+		h = XxhMergeRound(h, v2);
+		h = XxhMergeRound(h, v3);
+		h = XxhMergeRound(h, v4);
+	} else {
+		h = seed + kXxhPrime5;
+	}
+	h += totalLen;
+	return XxhFinalize(h, p, len);
+}
+
+/**
+ * Streaming XXH64: feed data in pieces with Update(), read the hash with Digest().
+ * Digest() does not modify the state, so it can be called at any point of the stream.
+ */
+struct Xxh64Stream
+{
+	explicit Xxh64Stream(uint64_t seed = 0)
+	{
+		Reset(seed);
+	}
+
+	void Reset(uint64_t seed = 0)
+	{
+		this->seed = seed;
+		v[0] = seed + detail::kXxhPrime1 + detail::kXxhPrime2;
+		v[1] = seed + detail::kXxhPrime2;
+		v[2] = seed;
+		v[3] = seed - detail::kXxhPrime1;
+		totalLen = 0;
+		bufferedLen = 0;
+	}
+
+	void Update(const void *data, size_t len)
+	{
+		using namespace detail;
+		const unsigned char *p = static_cast<const unsigned char*>(data);
+		totalLen += len;
+
+		if (bufferedLen + len < 32) {
+			memcpy(buffer + bufferedLen, p, len);
+			bufferedLen += len;
+			return;
+		}
+		if (bufferedLen) {
+			size_t fill = 32 - bufferedLen;
+			memcpy(buffer + bufferedLen, p, fill);
+			Consume(buffer);
+			p += fill;
+			len -= fill;
+			bufferedLen = 0;
+		}
+		while (len >= 32) {
+			Consume(p);
+			p += 32;
+			len -= 32;
+		}
+		memcpy(buffer, p, len);
+		bufferedLen = len;
+	}
+
+	uint64_t Digest() const
+	{
+		using namespace detail;
+		uint64_t h;
+		if (totalLen >= 32) {
+			h = Rotl64(v[0], 1) + Rotl64(v[1], 7) + Rotl64(v[2], 12) + Rotl64(v[3], 18);
+			for (int i = 0; i < 4; ++i) {
+				h = XxhMergeRound(h, v[i]);
+			}
+		} else {
+			h = seed + kXxhPrime5;
+		}
+		h += totalLen;
+		return XxhFinalize(h, buffer, bufferedLen);
+	}
+
+private:
+	void Consume(const unsigned char *p)
+	{
+		for (int i = 0; i < 4; ++i) {
+			v[i] = detail::XxhRound(v[i], detail::Load64LE(p + 8 * i));
+		}
+	}
+
+	uint64_t seed;
+	uint64_t v[4];
+	uint64_t totalLen;
+	unsigned char buffer[32];
+	size_t bufferedLen;
+};
+
+/**
+ * @brief wyhash (final4 variant with the default secret), the fastest option for short keys.
+ */
+inline uint64_t WyHash(const void *data, size_t len, uint64_t seed = 0)
+{
+	using namespace detail;
+	static const uint64_t secret[4] = {
+		0x2d358dccaa6c78a5ULL, 0x8bb84b93962eacc9ULL, 0x4b33a62ed433d4a3ULL, 0x4d5a2da51de1aa47ULL
+	};
+	const unsigned char *p = static_cast<const unsigned char*>(data);
+	seed ^= WyMix(seed ^ secret[0], secret[1]);
+	uint64_t a, b;
+
+	if (len <= 16) {
+		if (len >= 4) {
+			a = (static_cast<uint64_t>(Load32LE(p)) << 32) | Load32LE(p + ((len >> 3) << 2));
+			b = (static_cast<uint64_t>(Load32LE(p + len - 4)) << 32) | Load32LE(p + len - 4 - ((len >> 3) << 2));
+		} else if (len > 0) {
+			a = (static_cast<uint64_t>(p[0]) << 16) | (static_cast<uint64_t>(p[len >> 1]) << 8) | p[len - 1];
+			b = 0;
+		} else {
+			a = b = 0;
+		}
+	} else {
+		size_t i = len;
+		if (i > 48) {
+			uint64_t see1 = seed, see2 = seed;
+			do {
+				seed = WyMix(Load64LE(p) ^ secret[1], Load64LE(p + 8) ^ seed);
+				see1 = WyMix(Load64LE(p + 16) ^ secret[2], Load64LE(p + 24) ^ see1);
+				see2 = WyMix(Load64LE(p + 32) ^ secret[3], Load64LE(p + 40) ^ see2);
+				p += 48;
+				i -= 48;
+			} while (i > 48);
+			seed ^= see1 ^ see2;
+		}
+		while (i > 16) {
+			seed = WyMix(Load64LE(p) ^ secret[1], Load64LE(p + 8) ^ seed);
+			i -= 16;
+			p += 16;
+		}
+		a = Load64LE(p + i - 16);
+		b = Load64LE(p + i - 8);
+	}
+	a ^= secret[1];
+	b ^= seed;
+	WyMum(&a, &b);
+	return WyMix(a ^ secret[0] ^ len, b ^ secret[1]);
+}
+
+/// Size of the trailer added by AppendChecksum()
+const size_t kChecksumSize = sizeof(uint32_t);
+
+/**
+ * @brief Appends the CRC32C of a payload (little endian) right after it, ready for sendto().
+ *
+ * @param buf payload buffer, must have room for kChecksumSize more bytes
+ * @param len payload length
+ * @param capacity total size of buf
+ * @return new datagram length, or 0 if the buffer is too small
+ */
+inline size_t AppendChecksum(void *buf, size_t len, size_t capacity)
+{
+	if (capacity < len + kChecksumSize) {
+		return 0;
+	}
+	uint32_t crc = Crc32c(buf, len);
+	unsigned char *tail = static_cast<unsigned char*>(buf) + len;
+	tail[0] = static_cast<unsigned char>(crc);
+	tail[1] = static_cast<unsigned char>(crc >> 8);
+	tail[2] = static_cast<unsigned char>(crc >> 16);
+	tail[3] = static_cast<unsigned char>(crc >> 24);
+	return len + kChecksumSize;
+}
+
+/**
+ * @brief Verifies a datagram produced by AppendChecksum().
+ *
+ * @param buf received datagram
+ * @param len received length (payload + trailer)
+ * @param payloadLen set to the payload length when the checksum matches
+ * @return true if the trailer matches the payload
+ */
+inline bool VerifyChecksum(const void *buf, size_t len, size_t &payloadLen)
+{
+	if (len < kChecksumSize) {
+		return false;
+	}
+	const unsigned char *tail = static_cast<const unsigned char*>(buf) + len - kChecksumSize;
+	uint32_t expected = static_cast<uint32_t>(tail[0]) | (static_cast<uint32_t>(tail[1]) << 8) |
+		(static_cast<uint32_t>(tail[2]) << 16) | (static_cast<uint32_t>(tail[3]) << 24);
+	if (Crc32c(buf, len - kChecksumSize) != expected) {
+		return false;
+	}
+	payloadLen = len - kChecksumSize;
+	return true;
+}
+
+} /* namespace FUTILS */
+
+#endif /* FUTILS_CHECKSUM_H_ */
@@ -0,0 +1,870 @@
+/**
+ * @brief Block-framed compression for log and record streams.
+ *
+ * @details The utilities implemented include:
+ * 			- Built-in LZ4 block format codec (fast greedy and dense hash-chain compressors)
+ * 			- Optional zstd codec, enabled by defining FUTILS_HAVE_ZSTD and linking -lzstd
+ * 			- CompressedWriter: buffers records into blocks compressed on a background thread
+ * 			- CompressedReader: random access to the blocks of a compressed file
+ *
+ * 			File layout: a sequence of independent blocks, each preceded by a BlockHeader, so a
+ * 			reader can skip from header to header and decode any block alone (seekable files,
+ * 			truncated tails lose at most one block).
+ */
+
+#ifndef FUTILS_COMPRESS_H_
+#define FUTILS_COMPRESS_H_
+
+#include "futils.h"
+#include "futils_checksum.h"
+
+#include <cstdint>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <cerrno>
+
+#ifdef FUTILS_HAVE_ZSTD
+#	include <zstd.h>
+#endif
+
+namespace FUTILS
+{
+
+enum class CompressionCodec : uint8_t {
+	None = 0,	///< Stored as is
+	Fast = 1,	///< LZ4 block format, greedy single probe (hundreds of MB/s per core)
+	Dense = 2,	///< zstd if available, otherwise LZ4 block format with hash-chain search
+	Zstd = 3	///< Only written when FUTILS_HAVE_ZSTD is defined
+};
+
+namespace detail
+{
+
+const int kLz4MinMatch = 4;
+const int kLz4LastLiterals = 5;
+const int kLz4MfLimit = 12;
+const int kLz4MaxOffset = 65535;
+const int kLz4HashLog = 16;
+const int kLz4ChainSize = 1 << 16;
+
+inline uint32_t Lz4Read32(const unsigned char *p)
+{
+	uint32_t v;
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+inline uint32_t Lz4Hash(uint32_t seq)
+{
+	return (seq * 2654435761U) >> (32 - kLz4HashLog);
+}
+
+inline size_t Lz4MatchLength(const unsigned char *ip, const unsigned char *ref, const unsigned char *limit)
+{
+	const unsigned char *start = ip;
+	while (ip + 8 <= limit) {
+		uint64_t a, b;
+		memcpy(&a, ip, 8);
+		memcpy(&b, ref, 8);
+		if (a != b) {
+			return static_cast<size_t>(ip - start) + (__builtin_ctzll(a ^ b) >> 3);
+		}
+		ip += 8;
+		ref += 8;
+	}
+	while (ip < limit && *ip == *ref) {
+		ip++;
+		ref++;
+	}
+	return static_cast<size_t>(ip - start);
+}
+
+inline unsigned char* Lz4WriteLength(unsigned char *op, size_t len)
+{
+	while (len >= 255) {
+		*op++ = 255;
+		len -= 255;
+	}
+	*op++ = static_cast<unsigned char>(len);
+	return op;
+}
+
+/// Emits one sequence (literals + optional match); matchLen 0 means last literals only
+inline unsigned char* Lz4EmitSequence(unsigned char *op, const unsigned char *literals, size_t litLen,
+		size_t offset, size_t matchLen)
+{
+	unsigned char *token = op++;
+	unsigned char tok = static_cast<unsigned char>((litLen >= 15 ? 15 : litLen) << 4);
+	if (litLen >= 15) {
+		op = Lz4WriteLength(op, litLen - 15);
+	}
+	memcpy(op, literals, litLen);
+	op += litLen;
+	if (matchLen) {
+		*op++ = static_cast<unsigned char>(offset);
+		*op++ = static_cast<unsigned char>(offset >> 8);
+		size_t ml = matchLen - kLz4MinMatch;
+		tok |= static_cast<unsigned char>(ml >= 15 ? 15 : ml);
+		if (ml >= 15) {
+			op = Lz4WriteLength(op, ml - 15);
+		}
+	}
+	*token = tok;
+	return op;
+}
+
+} /* namespace detail */
+
+/// Worst case compressed size of len bytes in LZ4 block format
+inline size_t Lz4CompressBound(size_t len)
+{
+	return len + len / 255 + 16;
+}
+
+/**
+ * Match finder tables of Lz4Compress(), kept between calls so that compressing a block neither
+ * allocates nor clears them: positions are stored with an offset that grows by the size of every
+ * block, so entries left by earlier blocks are recognized as stale.
+ */
+struct Lz4CompressState
+{
+	std::vector<uint32_t> table;
+	std::vector<uint16_t> chain;
+	uint32_t offset = 0;
+};
+
+/**
+ * @brief Compresses a buffer in LZ4 block format.
+ *
+ * @param src input buffer
+ * @param srcLen input length
+ * @param dst output buffer of at least Lz4CompressBound(srcLen) bytes
+ * @param dense if true, searches hash chains for longer matches (slower, smaller output)
+ * @param state tables reused across calls (one per thread)
+ * @return compressed length
+ */
+inline size_t Lz4Compress(const void *src, size_t srcLen, void *dst, bool dense, Lz4CompressState &state)
+{
+	using namespace detail;
+	const unsigned char *base = static_cast<const unsigned char*>(src);
+	const unsigned char *ip = base;
+	const unsigned char *anchor = base;
+	const unsigned char *end = base + srcLen;
+	unsigned char *op = static_cast<unsigned char*>(dst);
+
+	if (srcLen < static_cast<size_t>(kLz4MfLimit + 1)) {
+		op = Lz4EmitSequence(op, anchor, srcLen, 0, 0);
+		return static_cast<size_t>(op - static_cast<unsigned char*>(dst));
+	}
+
+	const unsigned char *mfLimit = end - kLz4MfLimit;
+	const unsigned char *matchLimit = end - kLz4LastLiterals;
+	const int kMaxAttempts = 64;
+	if (state.table.empty() || srcLen >= UINT32_MAX - state.offset) {
+		state.table.assign(1 << kLz4HashLog, 0);
+		state.offset = 0;
+	}
+	if (dense && state.chain.empty()) {
+		state.chain.assign(kLz4ChainSize, 0);
+	}
+	// table holds offset + position; anything below offset comes from an earlier block
+	const uint32_t offset = state.offset;
+	uint32_t *table = state.table.data();
+	uint16_t *chain = state.chain.data();
+	state.offset += static_cast<uint32_t>(srcLen) + 1;
+
+	auto insert = [&](const unsigned char *p) {
+		uint32_t h = Lz4Hash(Lz4Read32(p));
+		uint32_t pos = offset + static_cast<uint32_t>(p - base);
+		if (dense) {
+			uint32_t delta = pos - table[h];
+			chain[pos & (kLz4ChainSize - 1)] = static_cast<uint16_t>(delta > kLz4MaxOffset ? kLz4MaxOffset : delta);
+		}
+		table[h] = pos;
+	};
+
+	ip++;
+	while (ip < mfLimit) {
+		const unsigned char *ref = nullptr;
+		size_t matchLen = 0;
+		uint32_t seq = Lz4Read32(ip);
+		uint32_t h = Lz4Hash(seq);
+
+		if (!dense) {
+			uint32_t stored = table[h];
+			table[h] = offset + static_cast<uint32_t>(ip - base);
+			if (stored >= offset) {
+				const unsigned char *cand = base + (stored - offset);
+				if (cand < ip && ip - cand <= kLz4MaxOffset && Lz4Read32(cand) == seq) {
+					ref = cand;
+					matchLen = kLz4MinMatch + Lz4MatchLength(ip + kLz4MinMatch, cand + kLz4MinMatch, matchLimit);
+				}
+			}
+		} else {
+			uint32_t pos = offset + static_cast<uint32_t>(ip - base);
+			uint32_t candPos = table[h];
+			for (int attempt = 0; attempt < kMaxAttempts && candPos >= offset && candPos < pos && pos - candPos <= static_cast<uint32_t>(kLz4MaxOffset); ++attempt) {
+				const unsigned char *cand = base + (candPos - offset);
+				if (cand[matchLen] == ip[matchLen] && Lz4Read32(cand) == seq) {
+					size_t len = kLz4MinMatch + Lz4MatchLength(ip + kLz4MinMatch, cand + kLz4MinMatch, matchLimit);
+					if (len > matchLen) {
+						matchLen = len;
+						ref = cand;
+					}
+				}
+				uint16_t delta = chain[candPos & (kLz4ChainSize - 1)];
+				if (delta == 0 || delta > candPos) {
+					break;
+				}
+				candPos -= delta;
+			}
+			insert(ip);
+		}
+
+		if (!ref) {
+			ip += dense ? 1 : 1 + ((ip - anchor) >> 6);
+			continue;
+		}
+		// Extend the match backwards into pending literals
+		while (ip > anchor && ref > base && ip[-1] == ref[-1]) {
+			ip--;
+			ref--;
+			matchLen++;
+		}
+		op = Lz4EmitSequence(op, anchor, static_cast<size_t>(ip - anchor), static_cast<size_t>(ip - ref), matchLen);
+		const unsigned char *matchEnd = ip + matchLen;
+		if (dense) {
+			for (const unsigned char *p = ip + 1; p < matchEnd && p < mfLimit; ++p) {
+				insert(p);
+			}
+		} else if (matchEnd - 2 < mfLimit) {
+			insert(matchEnd - 2);
+		}
+		ip = matchEnd;
+		anchor = ip;
+	}
+	op = Lz4EmitSequence(op, anchor, static_cast<size_t>(end - anchor), 0, 0);
+	return static_cast<size_t>(op - static_cast<unsigned char*>(dst));
+}
+
+/// Compresses a buffer in LZ4 block format with tables allocated for this call only
+inline size_t Lz4Compress(const void *src, size_t srcLen, void *dst, bool dense = false)
+{
+	Lz4CompressState state;
+	return Lz4Compress(src, srcLen, dst, dense, state);
+}
+
+/**
+ * @brief Decompresses an LZ4 block, with bounds checks on both buffers.
+ *
+ * @return decompressed length, or -1 if the input is malformed or dst is too small
+ */
+inline long Lz4Decompress(const void *src, size_t srcLen, void *dst, size_t dstCap)
+{
+	const unsigned char *ip = static_cast<const unsigned char*>(src);
+	const unsigned char *iend = ip + srcLen;
+	unsigned char *op = static_cast<unsigned char*>(dst);
+	unsigned char *ostart = op;
+	unsigned char *oend = op + dstCap;
+
+	while (ip < iend) {
+		unsigned token = *ip++;
+		size_t litLen = token >> 4;
+		if (litLen == 15) {
+			unsigned char b;
+			do {
+				if (ip >= iend) {
+					return -1;
+				}
+				b = *ip++;
+				litLen += b;
+			} while (b == 255);
+		}
+		if (litLen > static_cast<size_t>(iend - ip) || litLen > static_cast<size_t>(oend - op)) {
+			return -1;
+		}
+		memcpy(op, ip, litLen);
+		ip += litLen;
+		op += litLen;
+		if (ip == iend) {
+			break;
+		}
+		if (iend - ip < 2) {
+			return -1;
+		}
+		size_t offset = static_cast<size_t>(ip[0]) | (static_cast<size_t>(ip[1]) << 8);
+		ip += 2;
+		if (offset == 0 || offset > static_cast<size_t>(op - ostart)) {
+			return -1;
+		}
+		size_t matchLen = token & 15;
+		if (matchLen == 15) {
+			unsigned char b;
+			do {
+				if (ip >= iend) {
+					return -1;
+				}
+				b = *ip++;
+				matchLen += b;
+			} while (b == 255);
+		}
+		matchLen += detail::kLz4MinMatch;
+		if (matchLen > static_cast<size_t>(oend - op)) {
+			return -1;
+		}
+		const unsigned char *ref = op - offset;
+		if (offset >= matchLen) {
+			memcpy(op, ref, matchLen);
+			op += matchLen;
+		} else {
+			// Overlapping copy replicates the last offset bytes
+			for (size_t i = 0; i < matchLen; ++i) {
+				*op++ = *ref++;
+			}
+		}
+	}
+	return static_cast<long>(op - ostart);
+}
+
+/**
+ * Header in front of every block of a compressed file (little endian, 20 bytes).
+ */
+struct BlockHeader
+{
+	static const uint32_t kMagic = 0x31425a46; // "FZB1"
+	static const size_t kSize = 20;
+
+	uint32_t magic;
+	uint8_t codec;
+	uint8_t reserved[3];
+	uint32_t rawSize;
+	uint32_t compressedSize;
+	uint32_t crc;	///< CRC32C of the compressed bytes
+
+	void Serialize(unsigned char *out) const
+	{
+		memcpy(out, &magic, 4);
+		out[4] = codec;
+		memset(out + 5, 0, 3);
+		memcpy(out + 8, &rawSize, 4);
+		memcpy(out + 12, &compressedSize, 4);
+		memcpy(out + 16, &crc, 4);
+	}
+
+	bool Parse(const unsigned char *in)
+	{
+		memcpy(&magic, in, 4);
+		codec = in[4];
+		memcpy(&rawSize, in + 8, 4);
+		memcpy(&compressedSize, in + 12, 4);
+		memcpy(&crc, in + 16, 4);
+		return magic == kMagic;
+	}
+};
+
+/**
+ * @brief Compresses one block with the requested codec, falling back to stored if it does not shrink.
+ *
+ * @param out receives header + payload
+ * @param state LZ4 tables reused across blocks, nullptr to allocate them for this block
+ * @return the codec actually used
+ */
+inline CompressionCodec CompressBlock(CompressionCodec codec, const char *data, size_t len, std::vector<unsigned char> &out,
+		Lz4CompressState *state = nullptr)
+{
+	Lz4CompressState local;
+	if (state == nullptr) {
+		state = &local;
+	}
+	size_t bound = Lz4CompressBound(len);
+#ifdef FUTILS_HAVE_ZSTD
+	if (codec == CompressionCodec::Dense || codec == CompressionCodec::Zstd) {
+		bound = std::max(bound, ZSTD_compressBound(len));
+	}
+#endif
+	out.resize(BlockHeader::kSize + bound);
+	unsigned char *payload = out.data() + BlockHeader::kSize;
+	size_t compressed = 0;
+
+	switch (codec) {
+	case CompressionCodec::Fast:
+		compressed = Lz4Compress(data, len, payload, false, *state);
+		break;
+	case CompressionCodec::Dense:
+	case CompressionCodec::Zstd:
+#ifdef FUTILS_HAVE_ZSTD
+		compressed = ZSTD_compress(payload, bound, data, len, 9);
+		if (ZSTD_isError(compressed)) {
+			compressed = len + 1;
+		}
+		codec = CompressionCodec::Zstd;
+#else
+		compressed = Lz4Compress(data, len, payload, true, *state);
+		codec = CompressionCodec::Dense;
+#endif
+		break;
+	case CompressionCodec::None:
+		compressed = len + 1;
+		break;
+	}
+	if (compressed >= len) {
+		memcpy(payload, data, len);
+		compressed = len;
+		codec = CompressionCodec::None;
+	}
+
+	BlockHeader header;
+	header.magic = BlockHeader::kMagic;
+	header.codec = static_cast<uint8_t>(codec);
+	header.rawSize = static_cast<uint32_t>(len);
+	header.compressedSize = static_cast<uint32_t>(compressed);
+	header.crc = Crc32c(payload, compressed);
+	header.Serialize(out.data());
+	out.resize(BlockHeader::kSize + compressed);
+	return codec;
+}
+
+/**
+ * @brief Decodes the payload of a block described by header.
+ *
+ * @return true on success (checksum and codec valid)
+ */
+inline bool DecompressBlock(const BlockHeader &header, const unsigned char *payload, std::string &out)
+{
+	if (Crc32c(payload, header.compressedSize) != header.crc) {
+		return false;
+	}
+	out.resize(header.rawSize);
+	switch (static_cast<CompressionCodec>(header.codec)) {
+	case CompressionCodec::None:
+		if (header.compressedSize != header.rawSize) {
+			return false;
+		}
+		memcpy(&out[0], payload, header.rawSize);
+		return true;
+	case CompressionCodec::Fast:
+	case CompressionCodec::Dense:
+		return Lz4Decompress(payload, header.compressedSize, &out[0], header.rawSize) == static_cast<long>(header.rawSize);
+	case CompressionCodec::Zstd:
+#ifdef FUTILS_HAVE_ZSTD
+		return ZSTD_decompress(&out[0], header.rawSize, payload, header.compressedSize) == header.rawSize;
+#else
+		std::cerr << tc::redL << "zstd block found but FUTILS_HAVE_ZSTD is not defined" << tc::none << "\n";
+		return false;
+#endif
+	}
+	return false;
+}
+
+/**
+ * Writes records to a block-framed compressed file. Write() only copies into the current block;
+ * full blocks are compressed and written by a background thread. At most maxPendingBlocks are
+ * queued, after which Write() waits for the writer thread (bounded memory).
+ */
+class CompressedWriter
+{
+public:
+	CompressedWriter() :
+		fd(-1), codec(CompressionCodec::Fast), blockSize(0), maxPending(0), fileEnd(0), error(0), stopping(false), inFlight(0)
+	{
+	}
+
+	~CompressedWriter()
+	{
+		Close();
+	}
+
+	CompressedWriter(const CompressedWriter&) = delete;
+	CompressedWriter& operator=(const CompressedWriter&) = delete;
+
+	/**
+	 * @brief Opens (appending to) a file and starts the compression thread.
+	 *
+	 * A partial block left at the end of the file by a crash is cut off first, so that the blocks
+	 * appended now remain readable.
+	 *
+	 * @param path output file
+	 * @param codec codec used for the blocks
+	 * @param blockSize uncompressed size of a block (default 64 KiB)
+	 * @param maxPendingBlocks blocks that may wait for compression before Write() blocks
+	 * @return true on success
+	 */
+	bool Open(const std::string &path, CompressionCodec codec = CompressionCodec::Fast,
+			size_t blockSize = 64 * 1024, size_t maxPendingBlocks = 16)
+	{
+		Close();
+		fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+		if (fd < 0) {
+			std::cerr << tc::redL << "Could not open " << path << " (error: " << strerror(errno) << ")" << tc::none << "\n";
+			return false;
+		}
+		if (!TrimTornTail(path)) {
+			::close(fd);
+			fd = -1;
+			return false;
+		}
+		error = 0;
+		this->codec = codec;
+		this->blockSize = blockSize ? blockSize : 64 * 1024;
+		maxPending = maxPendingBlocks ? maxPendingBlocks : 1;
+		stopping = false;
+		current.reserve(this->blockSize);
+		worker = std::thread(&CompressedWriter::WorkerLoop, this);
+		return true;
+	}
+
+	bool IsOpen() const
+	{
+		return fd >= 0;
+	}
+
+	/// Appends raw bytes; records may span block boundaries. Ignored unless the writer is open.
+	void Write(const char *data, size_t len)
+	{
+		if (fd < 0) {
+			return;
+		}
+		while (len) {
+			size_t room = blockSize - current.size();
+			size_t chunk = len < room ? len : room;
+			current.insert(current.end(), data, data + chunk);
+			data += chunk;
+			len -= chunk;
+			if (current.size() == blockSize) {
+				SubmitCurrent();
+			}
+		}
+	}
+
+	void Write(const std::string &s)
+	{
+		Write(s.data(), s.size());
+	}
+
+	/// Appends a line (e.g. the output of DebugMsg() or ArrayToString())
+	void WriteLine(const std::string &s)
+	{
+		Write(s.data(), s.size());
+		Write("\n", 1);
+	}
+
+	/**
+	 * @brief Submits the partial block and waits until everything queued reached the file.
+	 *
+	 * @return false if a block could not be written since Open() (see Error())
+	 */
+	bool Flush()
+	{
+		if (fd < 0) {
+			return false;
+		}
+		if (!current.empty()) {
+			SubmitCurrent();
+		}
+		std::unique_lock<std::mutex> lock(mtx);
+		drained.wait(lock, [this] { return queue.empty() && inFlight == 0; });
+		return error == 0;
+	}
+
+	/// Flushes and stops the background thread; false if a block or the final fsync() failed
+	bool Close()
+	{
+		if (fd < 0) {
+			return false;
+		}
+		Flush();
+		{
+			std::lock_guard<std::mutex> lock(mtx);
+			stopping = true;
+		}
+		wakeWorker.notify_one();
+		worker.join();
+		if (::fsync(fd) != 0 && error == 0) {
+			error = errno;
+		}
+		::close(fd);
+		fd = -1;
+		return error == 0;
+	}
+
+	/// errno of the first failed write since Open(), 0 if none; the blocks that failed are lost, the file stays readable
+	int Error() const
+	{
+		return error;
+	}
+
+private:
+	void SubmitCurrent()
+	{
+		std::vector<char> block;
+		std::unique_lock<std::mutex> lock(mtx);
+		drained.wait(lock, [this] { return queue.size() < maxPending; });
+		if (!spare.empty()) {
+			block.swap(spare.back());
+			spare.pop_back();
+		}
+		block.clear();
+		block.reserve(blockSize);
+		block.swap(current);
+		queue.push_back(std::move(block));
+		lock.unlock();
+		wakeWorker.notify_one();
+	}
+
+	void WorkerLoop()
+	{
+		std::vector<unsigned char> out;
+		Lz4CompressState state;
+		std::unique_lock<std::mutex> lock(mtx);
+		for (;;) {
+			wakeWorker.wait(lock, [this] { return stopping || !queue.empty(); });
+			if (queue.empty()) {
+				return;
+			}
+			std::vector<char> block = std::move(queue.front());
+			queue.pop_front();
+			inFlight++;
+			lock.unlock();
+
+			CompressBlock(codec, block.data(), block.size(), out, &state);
+			if (WriteAll(out.data(), out.size())) {
+				fileEnd += out.size();
+			} else if (::ftruncate(fd, static_cast<off_t>(fileEnd)) != 0) {
+				// a partial block would hide the ones after it from readers
+				std::cerr << tc::redL << "CompressedWriter: could not remove a partial block (error: " << strerror(errno) << ")" << tc::none << "\n";
+			}
+
+			lock.lock();
+			inFlight--;
+			spare.push_back(std::move(block));
+			drained.notify_all();
+		}
+	}
+
+	bool WriteAll(const unsigned char *p, size_t len)
+	{
+		while (len) {
+			ssize_t n = ::write(fd, p, len);
+			if (n < 0) {
+				if (errno == EINTR) {
+					continue;
+				}
+				int err = errno;
+				std::cerr << tc::redL << "CompressedWriter: write failed (error: " << strerror(err) << ")" << tc::none << "\n";
+				int none = 0;
+				error.compare_exchange_strong(none, err);
+				return false;
+			}
+			p += n;
+			len -= static_cast<size_t>(n);
+		}
+		return true;
+	}
+
+	/**
+	 * @brief Cuts what follows the last complete block (a crash during a write), and trailing
+	 * blocks whose checksum fails (data not yet on disk when the system went down).
+	 */
+	bool TrimTornTail(const std::string &path)
+	{
+		struct stat st;
+		if (fstat(fd, &st) != 0) {
+			perror(("fstat " + path).c_str());
+			return false;
+		}
+		uint64_t size = static_cast<uint64_t>(st.st_size);
+		uint64_t offset = 0;
+		std::vector<uint64_t> starts;
+		unsigned char buf[BlockHeader::kSize];
+		BlockHeader header;
+		while (offset + BlockHeader::kSize <= size) {
+			if (::pread(fd, buf, sizeof(buf), static_cast<off_t>(offset)) != static_cast<ssize_t>(sizeof(buf)) ||
+					!header.Parse(buf) || offset + BlockHeader::kSize + header.compressedSize > size) {
+				break;
+			}
+			starts.push_back(offset);
+			offset += BlockHeader::kSize + header.compressedSize;
+		}
+		std::vector<unsigned char> payload;
+		while (!starts.empty()) {
+			uint64_t start = starts.back();
+			if (::pread(fd, buf, sizeof(buf), static_cast<off_t>(start)) == static_cast<ssize_t>(sizeof(buf)) && header.Parse(buf)) {
+				payload.resize(header.compressedSize);
+				ssize_t n = ::pread(fd, payload.data(), payload.size(), static_cast<off_t>(start + BlockHeader::kSize));
+				if (n == static_cast<ssize_t>(payload.size()) && Crc32c(payload.data(), payload.size()) == header.crc) {
+					break;
+				}
+			}
+			offset = start;
+			starts.pop_back();
+		}
+		if (offset < size) {
+			std::cerr << tc::yel << "CompressedWriter: " << path << ": dropping " << (size - offset) << " bytes after the last complete block" << tc::none << "\n";
+			if (::ftruncate(fd, static_cast<off_t>(offset)) != 0) {
+				perror(("ftruncate " + path).c_str());
+				return false;
+			}
+		}
+		fileEnd = offset;
+		return true;
+	}
+
+	int fd;
+	CompressionCodec codec;
+	size_t blockSize;
+	size_t maxPending;
+	std::vector<char> current;
+	uint64_t fileEnd;           ///< end of the last block written whole (worker thread)
+	std::atomic<int> error;
+
+	std::mutex mtx;
+	std::condition_variable wakeWorker, drained;
+	std::deque<std::vector<char> > queue;
+	std::vector<std::vector<char> > spare;
+	bool stopping;
+	int inFlight;
+	std::thread worker;
+};
+
+/**
+ * Random access reader for files produced by CompressedWriter. Open() scans the block headers
+ * only, so any block can then be decoded without touching the others.
+ */
+class CompressedReader
+{
+public:
+	struct BlockInfo
+	{
+		uint64_t fileOffset;	///< Offset of the block header
+		uint64_t rawOffset;		///< Offset of the block content in the uncompressed stream
+		BlockHeader header;
+	};
+
+	CompressedReader() :
+		fd(-1), rawSize(0)
+	{
+	}
+
+	~CompressedReader()
+	{
+		if (fd >= 0) {
+			::close(fd);
+		}
+	}
+
+	CompressedReader(const CompressedReader&) = delete;
+	CompressedReader& operator=(const CompressedReader&) = delete;
+
+	/**
+	 * @brief Opens a file and indexes its blocks. A truncated last block is ignored.
+	 *
+	 * @return true if the file could be opened and starts with a valid block (or is empty)
+	 */
+	bool Open(const std::string &path)
+	{
+		if (fd >= 0) {
+			::close(fd);
+		}
+		fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+		if (fd < 0) {
+			std::cerr << tc::redL << "Could not open " << path << " (error: " << strerror(errno) << ")" << tc::none << "\n";
+			return false;
+		}
+		struct stat st;
+		fstat(fd, &st);
+		uint64_t offset = 0, raw = 0;
+		unsigned char buf[BlockHeader::kSize];
+		blocks.clear();
+		while (offset + BlockHeader::kSize <= static_cast<uint64_t>(st.st_size)) {
+			if (::pread(fd, buf, sizeof(buf), static_cast<off_t>(offset)) != static_cast<ssize_t>(sizeof(buf))) {
+				break;
+			}
+			BlockInfo info;
+			if (!info.header.Parse(buf)) {
+				std::cerr << tc::redL << "CompressedReader: bad block magic at offset " << offset << tc::none << "\n";
+				break;
+			}
+			if (offset + BlockHeader::kSize + info.header.compressedSize > static_cast<uint64_t>(st.st_size)) {
+				break;
+			}
+			info.fileOffset = offset;
+			info.rawOffset = raw;
+			blocks.push_back(info);
+			offset += BlockHeader::kSize + info.header.compressedSize;
+			raw += info.header.rawSize;
+		}
+		rawSize = raw;
+		return offset == static_cast<uint64_t>(st.st_size) || !blocks.empty();
+	}
+
+	size_t BlockCount() const
+	{
+		return blocks.size();
+	}
+
+	const BlockInfo& Block(size_t i) const
+	{
+		return blocks[i];
+	}
+
+	/// Total uncompressed size of the indexed blocks
+	uint64_t RawSize() const
+	{
+		return rawSize;
+	}
+
+	/// Index of the block containing uncompressed offset rawOffset (BlockCount() if past the end)
+	size_t FindBlock(uint64_t rawOffset) const
+	{
+		size_t lo = 0, hi = blocks.size();
+		while (lo < hi) {
+			size_t mid = (lo + hi) / 2;
+			if (blocks[mid].rawOffset + blocks[mid].header.rawSize <= rawOffset) {
+				lo = mid + 1;
+			} else {
+				hi = mid;
+			}
+		}
+		return lo;
+	}
+
+	/// Decodes block i into out
+	bool ReadBlock(size_t i, std::string &out)
+	{
+		const BlockInfo &info = blocks[i];
+		payload.resize(info.header.compressedSize);
+		ssize_t n = ::pread(fd, payload.data(), payload.size(), static_cast<off_t>(info.fileOffset + BlockHeader::kSize));
+		if (n != static_cast<ssize_t>(payload.size())) {
+			return false;
+		}
+		return DecompressBlock(info.header, payload.data(), out);
+	}
+
+	/// Decodes the whole stream
+	bool ReadAll(std::string &out)
+	{
+		out.clear();
+		out.reserve(rawSize);
+		std::string block;
+		for (size_t i = 0; i < blocks.size(); ++i) {
+			if (!ReadBlock(i, block)) {
+				return false;
+			}
+			out += block;
+		}
+		return true;
+	}
+
+private:
+	int fd;
+	uint64_t rawSize;
+	std::vector<BlockInfo> blocks;
+	std::vector<unsigned char> payload;
+};
+
+} /* namespace FUTILS */
+
+#endif /* FUTILS_COMPRESS_H_ */
@@ -0,0 +1,789 @@
+/**
+ * @brief Configuration files with typed access and lock-free hot reload.
+ *
+ * @details The utilities implemented include:
+ * 			- ParseConfigFile(): single pass parser of an INI/TOML subset over an mmap'd file
+ * 			- ConfigSnapshot: immutable flat table of typed values, looked up in O(1)
+ * 			- ConfigKey: key handle whose hash is computed at compile time
+ * 			- ConfigSchema: declared keys with type, range and presence checks
+ * 			- ConfigStore: publishes a new reference counted snapshot on reload; readers keep
+ * 			  theirs for as long as they need it and Refresh() it with a single atomic load
+ *
+ * 			Supported syntax: "[section]" or "[a.b]" headers, "key = value" pairs, "#" and ";"
+ * 			comments. Values are double or single quoted strings, integers (decimal, 0x hex,
+ * 			"_" separators), floats, booleans (true/false/yes/no/on/off) and bare strings. Keys
+ * 			are addressed as "section.key".
+ *
+ * 			Example:
+ * 				static const FUTILS::ConfigKey kPort("sender.port");
+ * 				std::shared_ptr<const FUTILS::ConfigSnapshot> config = store.Current();
+ * 				...
+ * 				store.Refresh(config);     // once per cycle
+ * 				uint16_t port = static_cast<uint16_t>(config->GetInt(kPort, 5000));
+ */
+
+#ifndef FUTILS_CONFIG_H_
+#define FUTILS_CONFIG_H_
+
+#include "futils.h"
+#include "futils_eventloop.h"
+
+#if defined(__linux__) || defined(linux)
+
+#include <atomic>
+#include <climits>
+#include <cmath>
+#include <strings.h>
+#include <sys/inotify.h>
+#include <sys/mman.h>
+
+namespace FUTILS
+{
+
+namespace detail
+{
+const uint64_t kFnvBasis = 0xcbf29ce484222325ULL;
+const uint64_t kFnvPrime = 0x100000001b3ULL;
+
+constexpr uint64_t ConfigHash(const char *s, uint64_t h = kFnvBasis)
+{
+	return *s ? ConfigHash(s + 1, (h ^ static_cast<unsigned char>(*s)) * kFnvPrime) : h;
+}
+
+constexpr size_t ConfigKeyLength(const char *s, size_t n = 0)
+{
+	return *s ? ConfigKeyLength(s + 1, n + 1) : n;
+}
+
+inline uint64_t ConfigHashBytes(const char *s, size_t len)
+{
+	uint64_t h = kFnvBasis;
+	for (size_t i = 0; i < len; ++i) {
+		h = (h ^ static_cast<unsigned char>(s[i])) * kFnvPrime;
+	}
+	return h;
+}
+}
+
+/**
+ * Precomputed key handle. Declare it once (static const, constexpr) and reuse it for every
+ * lookup: hash and length are computed once, only the table probe remains at run time.
+ */
+struct ConfigKey
+{
+	constexpr ConfigKey(const char *name) :
+		name(name), hash(detail::ConfigHash(name)), length(detail::ConfigKeyLength(name))
+	{
+	}
+
+	const char *name;
+	uint64_t hash;
+	size_t length;
+};
+
+enum class ConfigType : uint8_t {
+	String, Int, Float, Bool,
+	IPv4Address	///< Only used by ConfigSchema: a string accepted by inet_aton()
+};
+
+inline const char* ConfigTypeName(ConfigType type)
+{
+	switch (type) {
+	case ConfigType::String:
+		return "string";
+	case ConfigType::Int:
+		return "integer";
+	case ConfigType::Float:
+		return "float";
+	case ConfigType::Bool:
+		return "boolean";
+	case ConfigType::IPv4Address:
+		return "IPv4 address";
+	}
+	return "?";
+}
+
+struct ConfigEntry
+{
+	uint64_t hash;
+	uint32_t keyOffset, keyLength;		///< In the snapshot string arena
+	uint32_t valueOffset, valueLength;	///< Textual value (string content for strings)
+	uint32_t line;
+	ConfigType type;
+	int64_t intValue;					///< Also set for Bool (0/1)
+	double floatValue;					///< Also set for Int
+};
+
+/**
+ * Immutable result of a parse. All strings live in one arena, entries in one array and the
+ * hash index is open addressed, so a snapshot is three allocations.
+ */
+class ConfigSnapshot
+{
+public:
+	ConfigSnapshot() :
+		generation(0)
+	{
+	}
+
+	const ConfigEntry* Find(const ConfigKey &key) const
+	{
+		return Find(key.hash, key.name, key.length);
+	}
+
+	const ConfigEntry* Find(const std::string &key) const
+	{
+		return Find(detail::ConfigHashBytes(key.data(), key.size()), key.data(), key.size());
+	}
+
+	bool Has(const ConfigKey &key) const
+	{
+		return Find(key) != nullptr;
+	}
+
+	/// Integer value, or def if missing or not an integer
+	int64_t GetInt(const ConfigKey &key, int64_t def = 0) const
+	{
+		const ConfigEntry *e = Find(key);
+		return (e && e->type == ConfigType::Int) ? e->intValue : def;
+	}
+
+	/// Float value (integers are promoted), or def
+	double GetDouble(const ConfigKey &key, double def = 0.0) const
+	{
+		const ConfigEntry *e = Find(key);
+		return (e && (e->type == ConfigType::Float || e->type == ConfigType::Int)) ? e->floatValue : def;
+	}
+
+	bool GetBool(const ConfigKey &key, bool def = false) const
+	{
+		const ConfigEntry *e = Find(key);
+		return (e && e->type == ConfigType::Bool) ? e->intValue != 0 : def;
+	}
+
+	/// String value, or def. The pointer stays valid as long as the snapshot
+	const char* GetString(const ConfigKey &key, const char *def = "") const
+	{
+		const ConfigEntry *e = Find(key);
+		return (e && e->type == ConfigType::String) ? arena.c_str() + e->valueOffset : def;
+	}
+
+	std::string Key(const ConfigEntry &e) const
+	{
+		return arena.substr(e.keyOffset, e.keyLength);
+	}
+
+	/// Textual value as written in the file (unescaped for strings)
+	std::string Text(const ConfigEntry &e) const
+	{
+		return arena.substr(e.valueOffset, e.valueLength);
+	}
+
+	const std::vector<ConfigEntry>& Entries() const
+	{
+		return entries;
+	}
+
+	/// Incremented by ConfigStore at every successful reload
+	uint64_t Generation() const
+	{
+		return generation;
+	}
+
+private:
+	friend class ConfigParser;
+	friend class ConfigStore;
+
+	const ConfigEntry* Find(uint64_t hash, const char *name, size_t len) const
+	{
+		if (index.empty()) {
+			return nullptr;
+		}
+		size_t mask = index.size() - 1;
+		for (size_t i = hash & mask;; i = (i + 1) & mask) {
+			uint32_t slot = index[i];
+			if (slot == 0) {
+				return nullptr;
+			}
+			const ConfigEntry &e = entries[slot - 1];
+			if (e.hash == hash && e.keyLength == len && arena.compare(e.keyOffset, len, name, len) == 0) {
+				return &e;
+			}
+		}
+	}
+
+	/// Builds the index; later duplicates override earlier keys
+	void BuildIndex()
+	{
+		size_t size = 16;
+		while (size < entries.size() * 2) {
+			size <<= 1;
+		}
+		index.assign(size, 0);
+		size_t mask = size - 1;
+		std::vector<ConfigEntry> unique;
+		unique.reserve(entries.size());
+		for (size_t n = 0; n < entries.size(); ++n) {
+			const ConfigEntry &e = entries[n];
+			size_t i = e.hash & mask;
+			for (;; i = (i + 1) & mask) {
+				uint32_t slot = index[i];
+				if (slot == 0) {
+					unique.push_back(e);
+					index[i] = static_cast<uint32_t>(unique.size());
+					break;
+				}
+				ConfigEntry &other = unique[slot - 1];
+				if (other.hash == e.hash && other.keyLength == e.keyLength &&
+						arena.compare(other.keyOffset, e.keyLength, arena, e.keyOffset, e.keyLength) == 0) {
+					other = e;
+					break;
+				}
+			}
+		}
+		entries.swap(unique);
+	}
+
+	std::string arena;
+	std::vector<ConfigEntry> entries;
+	std::vector<uint32_t> index;
+	uint64_t generation;
+};
+
+/**
+ * Single pass parser. Errors are collected with their line number; the parse goes on so that
+ * all problems are reported at once.
+ */
+class ConfigParser
+{
+public:
+	ConfigParser(const char *data, size_t len) :
+		p(data), end(data + len), line(1)
+	{
+	}
+
+	bool Parse(ConfigSnapshot &out, std::vector<std::string> &errors)
+	{
+		size_t errorsBefore = errors.size();
+		out.arena.reserve(static_cast<size_t>(end - p) + 64);
+		std::string section;
+		while (p < end) {
+			SkipBlanks();
+			if (p >= end) {
+				break;
+			}
+			char c = *p;
+			if (c == '\n') {
+				NextLine();
+			} else if (c == '#' || c == ';') {
+				SkipToEol();
+			} else if (c == '[') {
+				const char *close = static_cast<const char*>(memchr(p, ']', static_cast<size_t>(end - p)));
+				const char *eol = FindEol();
+				if (!close || close > eol) {
+					Error(errors, "unterminated section header");
+				} else {
+					section = Trim(p + 1, close);
+					p = close + 1;
+					SkipBlanks();
+					if (p < end && *p != '\n' && *p != '#' && *p != ';') {
+						Error(errors, "unexpected characters after section header");
+					}
+				}
+				SkipToEol();
+			} else {
+				ParsePair(out, section, errors);
+			}
+		}
+		out.BuildIndex();
+		return errors.size() == errorsBefore;
+	}
+
+private:
+	void ParsePair(ConfigSnapshot &out, const std::string &section, std::vector<std::string> &errors)
+	{
+		const char *eol = FindEol();
+		const char *eq = static_cast<const char*>(memchr(p, '=', static_cast<size_t>(eol - p)));
+		if (!eq) {
+			Error(errors, "expected key = value");
+			SkipToEol();
+			return;
+		}
+		std::string key = Trim(p, eq);
+		if (key.size() >= 2 && (key[0] == '"' || key[0] == '\'') && key.back() == key[0]) {
+			key = key.substr(1, key.size() - 2);
+		}
+		if (key.empty()) {
+			Error(errors, "empty key");
+			SkipToEol();
+			return;
+		}
+		std::string fullKey = section.empty() ? key : section + "." + key;
+
+		ConfigEntry e;
+		e.line = line;
+		e.keyOffset = static_cast<uint32_t>(out.arena.size());
+		e.keyLength = static_cast<uint32_t>(fullKey.size());
+		out.arena += fullKey;
+		out.arena += '\0';
+		e.hash = detail::ConfigHashBytes(fullKey.data(), fullKey.size());
+		e.intValue = 0;
+		e.floatValue = 0.0;
+
+		p = eq + 1;
+		SkipBlanks();
+		e.valueOffset = static_cast<uint32_t>(out.arena.size());
+		if (p < eol && (*p == '"' || *p == '\'')) {
+			if (!ParseQuoted(out.arena, eol, errors)) {
+				SkipToEol();
+				out.arena.resize(e.keyOffset);
+				return;
+			}
+			e.type = ConfigType::String;
+		} else {
+			const char *valueEnd = p;
+			while (valueEnd < eol && !((*valueEnd == '#' || *valueEnd == ';') &&
+					(valueEnd == p || valueEnd[-1] == ' ' || valueEnd[-1] == '\t'))) {
+				valueEnd++;
+			}
+			std::string text = Trim(p, valueEnd);
+			Classify(text, e);
+			out.arena += text;
+			p = valueEnd;
+		}
+		e.valueLength = static_cast<uint32_t>(out.arena.size() - e.valueOffset);
+		out.arena += '\0';
+		out.entries.push_back(e);
+
+		SkipBlanks();
+		if (p < end && *p != '\n' && *p != '#' && *p != ';') {
+			Error(errors, "unexpected characters after value of '" + fullKey + "'");
+		}
+		SkipToEol();
+	}
+
+	bool ParseQuoted(std::string &arena, const char *eol, std::vector<std::string> &errors)
+	{
+		char quote = *p++;
+		while (p < eol && *p != quote) {
+			char c = *p++;
+			if (c == '\\' && quote == '"' && p < eol) {
+				char esc = *p++;
+				switch (esc) {
+				case 'n':
+					c = '\n';
+					break;
+				case 't':
+					c = '\t';
+					break;
+				case 'r':
+					c = '\r';
+					break;
+				case '0':
+					c = '\0';
+					break;
+				default:
+					c = esc;
+					break;
+				}
+			}
+			arena += c;
+		}
+		if (p >= eol) {
+			Error(errors, "unterminated string");
+			return false;
+		}
+		p++;
+		return true;
+	}
+
+	static void Classify(const std::string &text, ConfigEntry &e)
+	{
+		e.type = ConfigType::String;
+		if (text.empty()) {
+			return;
+		}
+		static const char *const kTrue[] = { "true", "yes", "on" };
+		static const char *const kFalse[] = { "false", "no", "off" };
+		for (int i = 0; i < 3; ++i) {
+			if (strcasecmp(text.c_str(), kTrue[i]) == 0 || strcasecmp(text.c_str(), kFalse[i]) == 0) {
+				e.type = ConfigType::Bool;
+				e.intValue = strcasecmp(text.c_str(), kTrue[i]) == 0;
+				return;
+			}
+		}
+		std::string digits;
+		digits.reserve(text.size());
+		for (char c : text) {
+			if (c != '_') {
+				digits += c;
+			}
+		}
+		const char *s = digits.c_str();
+		char *endPtr = nullptr;
+		errno = 0;
+		long long iv = strtoll(s, &endPtr, (digits.size() > 2 && digits[0] == '0' && (digits[1] == 'x' || digits[1] == 'X')) ? 16 : 10);
+		if (*endPtr == '\0' && errno == 0 && endPtr != s) {
+			e.type = ConfigType::Int;
+			e.intValue = iv;
+			e.floatValue = static_cast<double>(iv);
+			return;
+		}
+		errno = 0;
+		double fv = strtod(s, &endPtr);
+		const char *mantissa = (*s == '+' || *s == '-') ? s + 1 : s;	// "inf", "-nan" stay strings
+		if (*endPtr == '\0' && errno == 0 && endPtr != s && !isalpha(static_cast<unsigned char>(*mantissa))) {
+			e.type = ConfigType::Float;
+			e.floatValue = fv;
+		}
+	}
+
+	void SkipBlanks()
+	{
+		while (p < end && (*p == ' ' || *p == '\t' || *p == '\r')) {
+			p++;
+		}
+	}
+
+	const char* FindEol() const
+	{
+		const char *eol = static_cast<const char*>(memchr(p, '\n', static_cast<size_t>(end - p)));
+		return eol ? eol : end;
+	}
+
+	void SkipToEol()
+	{
+		p = FindEol();
+		if (p < end) {
+			NextLine();
+		}
+	}
+
+	void NextLine()
+	{
+		p++;
+		line++;
+	}
+
+	static std::string Trim(const char *b, const char *e)
+	{
+		while (b < e && (*b == ' ' || *b == '\t')) {
+			b++;
+		}
+		while (e > b && (e[-1] == ' ' || e[-1] == '\t' || e[-1] == '\r')) {
+			e--;
+		}
+		return std::string(b, e);
+	}
+
+	void Error(std::vector<std::string> &errors, const std::string &msg)
+	{
+		errors.push_back("line " + std::to_string(line) + ": " + msg);
+	}
+
+	const char *p;
+	const char *end;
+	uint32_t line;
+};
+
+/**
+ * @brief Parses a configuration file through a read-only mapping.
+ *
+ * @return true if the file was read and parsed without errors
+ */
+inline bool ParseConfigFile(const std::string &path, ConfigSnapshot &out, std::vector<std::string> &errors)
+{
+	int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		errors.push_back(path + ": " + strerror(errno));
+		return false;
+	}
+	struct stat st;
+	if (fstat(fd, &st) != 0) {
+		errors.push_back(path + ": " + strerror(errno));
+		::close(fd);
+		return false;
+	}
+	size_t len = static_cast<size_t>(st.st_size);
+	bool ok;
+	if (len == 0) {
+		ok = ConfigParser("", 0).Parse(out, errors);
+	} else {
+		void *data = mmap(nullptr, len, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (data == MAP_FAILED) {
+			errors.push_back(path + ": " + strerror(errno));
+			::close(fd);
+			return false;
+		}
+		madvise(data, len, MADV_SEQUENTIAL);
+		ok = ConfigParser(static_cast<const char*>(data), len).Parse(out, errors);
+		munmap(data, len);
+	}
+	::close(fd);
+	return ok;
+}
+
+/**
+ * Declared keys of a configuration, checked before a snapshot is published.
+ */
+class ConfigSchema
+{
+public:
+	/**
+	 * @brief Declares a key.
+	 *
+	 * @param required the key must be present
+	 * @param min,max inclusive range for Int and Float values
+	 */
+	ConfigSchema& Add(const ConfigKey &key, ConfigType type, bool required = true,
+			double min = -HUGE_VAL, double max = HUGE_VAL)
+	{
+		Rule r = { key, type, required, min, max };
+		rules.push_back(r);
+		return *this;
+	}
+
+	/// Shorthand for a UDP/TCP port (integer in 1..65535)
+	ConfigSchema& AddPort(const ConfigKey &key, bool required = true)
+	{
+		return Add(key, ConfigType::Int, required, 1, 65535);
+	}
+
+	/// Rejects keys that were not declared (catches typos)
+	ConfigSchema& Strict(bool strict = true)
+	{
+		this->strict = strict;
+		return *this;
+	}
+
+	bool Validate(const ConfigSnapshot &snap, std::vector<std::string> &errors) const
+	{
+		size_t errorsBefore = errors.size();
+		for (const Rule &r : rules) {
+			const ConfigEntry *e = snap.Find(r.key);
+			if (!e) {
+				if (r.required) {
+					errors.push_back(std::string("missing key '") + r.key.name + "'");
+				}
+				continue;
+			}
+			std::string where = std::string("line ") + std::to_string(e->line) + ": '" + r.key.name + "'";
+			bool typeOk = e->type == r.type ||
+					(r.type == ConfigType::Float && e->type == ConfigType::Int) ||
+					(r.type == ConfigType::IPv4Address && e->type == ConfigType::String);
+			if (!typeOk) {
+				errors.push_back(where + " must be " + ConfigTypeName(r.type));
+				continue;
+			}
+			if (r.type == ConfigType::IPv4Address) {
+				struct in_addr addr;
+				if (inet_aton(snap.GetString(r.key), &addr) == 0) {
+					errors.push_back(where + " is not a valid IPv4 address");
+				}
+			} else if ((r.type == ConfigType::Int || r.type == ConfigType::Float) &&
+					(e->floatValue < r.min || e->floatValue > r.max)) {
+				errors.push_back(where + " out of range [" + toStringPointDecimal(r.min) + ", " + toStringPointDecimal(r.max) + "]");
+			}
+		}
+		if (strict) {
+			for (const ConfigEntry &e : snap.Entries()) {
+				bool declared = false;
+				for (const Rule &r : rules) {
+					if (r.key.hash == e.hash) {
+						declared = true;
+						break;
+					}
+				}
+				if (!declared) {
+					errors.push_back("line " + std::to_string(e.line) + ": unknown key '" + snap.Key(e) + "'");
+				}
+			}
+		}
+		return errors.size() == errorsBefore;
+	}
+
+private:
+	struct Rule
+	{
+		ConfigKey key;
+		ConfigType type;
+		bool required;
+		double min, max;
+	};
+
+	std::vector<Rule> rules;
+	bool strict = false;
+};
+
+/**
+ * Holds the current configuration of a file and reloads it on change.
+ *
+ * A reload builds and validates a new snapshot, then publishes it. Snapshots are reference
+ * counted: a reader keeps the one returned by Current() valid for as long as it holds it, and
+ * replaced snapshots are freed when their last reader lets go. Refresh() is the per cycle
+ * check: a single atomic load of the published generation while nothing changed. An invalid
+ * file never replaces a valid configuration.
+ */
+class ConfigStore
+{
+public:
+	typedef std::function<void(const ConfigSnapshot&)> ReloadCallback;
+
+	ConfigStore() :
+		published(0), inotifyFd(-1), watchFd(-1), loop(nullptr), generation(0), lastIno(0), lastSize(-1)
+	{
+		lastMtime.tv_sec = 0;
+		lastMtime.tv_nsec = 0;
+	}
+
+	~ConfigStore()
+	{
+		if (loop && inotifyFd >= 0) {
+			loop->Remove(inotifyFd);
+		}
+		if (inotifyFd >= 0) {
+			::close(inotifyFd);
+		}
+	}
+
+	ConfigStore(const ConfigStore&) = delete;
+	ConfigStore& operator=(const ConfigStore&) = delete;
+
+	/**
+	 * @brief Loads (or reloads) the file and publishes it if it parses and validates.
+	 *
+	 * @param errors receives the problems found
+	 * @return true if a new snapshot was published
+	 */
+	bool Load(const std::string &path, const ConfigSchema &schema, std::vector<std::string> &errors)
+	{
+		std::lock_guard<std::mutex> lock(writerMtx);
+		this->path = path;
+		this->schema = schema;
+		return LoadLocked(errors);
+	}
+
+	/// Reloads if the file changed (inode, size or modification time), e.g. once per second
+	bool ReloadIfChanged(std::vector<std::string> &errors)
+	{
+		std::lock_guard<std::mutex> lock(writerMtx);
+		struct stat st;
+		if (path.empty() || stat(path.c_str(), &st) != 0) {
+			return false;
+		}
+		if (st.st_ino == lastIno && st.st_size == lastSize &&
+				st.st_mtim.tv_sec == lastMtime.tv_sec && st.st_mtim.tv_nsec == lastMtime.tv_nsec) {
+			return false;
+		}
+		return LoadLocked(errors);
+	}
+
+	/**
+	 * @brief Reloads automatically when the file is rewritten or replaced (editors and
+	 * deployment tools usually rename a new file over the old one, so the directory is watched).
+	 *
+	 * @param onReload called on the loop thread after each published reload
+	 */
+	bool Watch(EventLoop &loop, ReloadCallback onReload = ReloadCallback())
+	{
+		if (inotifyFd >= 0) {
+			// watched already: replaces the previous watch
+			if (this->loop) {
+				this->loop->Remove(inotifyFd);
+				this->loop = nullptr;
+			}
+			::close(inotifyFd);
+		}
+		this->onReload = onReload;
+		inotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+		if (inotifyFd < 0) {
+			perror("inotify_init1");
+			return false;
+		}
+		std::string::size_type slash = path.find_last_of('/');
+		std::string dir = slash == std::string::npos ? "." : path.substr(0, slash + 1);
+		watchFd = inotify_add_watch(inotifyFd, dir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE);
+		if (watchFd < 0) {
+			perror("inotify_add_watch");
+			return false;
+		}
+		this->loop = &loop;
+		return loop.Add(inotifyFd, EPOLLIN, [this](uint32_t) {
+			char buf[4096];
+			while (::read(inotifyFd, buf, sizeof(buf)) > 0) {
+			}
+			std::vector<std::string> errors;
+			if (ReloadIfChanged(errors)) {
+				if (this->onReload) {
+					this->onReload(*Current());
+				}
+			} else {
+				for (const std::string &e : errors) {
+					std::cerr << DebugMsg(LogEntities::Generic, e + "\n", "config");
+				}
+			}
+		});
+	}
+
+	/// Current snapshot (nullptr before the first successful Load()), valid as long as it is held
+	std::shared_ptr<const ConfigSnapshot> Current() const
+	{
+		return std::atomic_load_explicit(&current, std::memory_order_acquire);
+	}
+
+	/**
+	 * @brief Replaces cached by the current snapshot if a reload was published since it was taken.
+	 *
+	 * @return true if cached changed
+	 */
+	bool Refresh(std::shared_ptr<const ConfigSnapshot> &cached) const
+	{
+		if (cached && cached->Generation() == published.load(std::memory_order_acquire)) {
+			return false;
+		}
+		std::shared_ptr<const ConfigSnapshot> latest = Current();
+		if (latest == cached) {
+			return false;
+		}
+		cached.swap(latest);
+		return true;
+	}
+
+private:
+	bool LoadLocked(std::vector<std::string> &errors)
+	{
+		struct stat st;
+		if (stat(path.c_str(), &st) == 0) {
+			lastIno = st.st_ino;
+			lastSize = st.st_size;
+			lastMtime = st.st_mtim;
+		}
+		std::unique_ptr<ConfigSnapshot> snap(new ConfigSnapshot());
+		if (!ParseConfigFile(path, *snap, errors) || !schema.Validate(*snap, errors)) {
+			return false;
+		}
+		snap->generation = ++generation;
+		std::atomic_store_explicit(&current, std::shared_ptr<const ConfigSnapshot>(std::move(snap)), std::memory_order_release);
+		published.store(generation, std::memory_order_release);
+		return true;
+	}
+
+	std::shared_ptr<const ConfigSnapshot> current;		///< only accessed with std::atomic_load/store
+	std::atomic<uint64_t> published;
+	std::mutex writerMtx;
+	std::string path;
+	ConfigSchema schema;
+	ReloadCallback onReload;
+	int inotifyFd, watchFd;
+	EventLoop *loop;
+	uint64_t generation;
+	ino_t lastIno;
+	off_t lastSize;
+	struct timespec lastMtime;
+};
+
+} /* namespace FUTILS */
+
+#endif /* Linux functions*/
+
+#endif /* FUTILS_CONFIG_H_ */
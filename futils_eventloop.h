@@ -0,0 +1,189 @@
+/**
+ * @brief Minimal epoll based event loop.
+ *
+ * @details One loop per thread: file descriptors are registered with a handler that receives the
+ * 			ready epoll events. Stop() and Post() may be called from any thread; the loop is woken
+ * 			through an eventfd.
+ */
+
+#ifndef FUTILS_EVENTLOOP_H_
+#define FUTILS_EVENTLOOP_H_
+
+#include "futils.h"
+
+#if defined(__linux__) || defined(linux)
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <unordered_map>
+#include <cerrno>
+
+namespace FUTILS
+{
+
+class EventLoop
+{
+public:
+	typedef std::function<void(uint32_t events)> Handler;
+
+	EventLoop() :
+		stopRequested(false)
+	{
+		if ((epfd = epoll_create1(EPOLL_CLOEXEC)) == -1) {
+			die("epoll_create1");
+		}
+		if ((wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) == -1) {
+			die("eventfd");
+		}
+		struct epoll_event ev;
+		ev.events = EPOLLIN;
+		ev.data.fd = wakeFd;
+		epoll_ctl(epfd, EPOLL_CTL_ADD, wakeFd, &ev);
+	}
+
+	~EventLoop()
+	{
+		::close(wakeFd);
+		::close(epfd);
+	}
+
+	EventLoop(const EventLoop&) = delete;
+	EventLoop& operator=(const EventLoop&) = delete;
+
+	/**
+	 * @brief Registers fd for the given epoll events (EPOLLIN, EPOLLOUT, EPOLLET, ...).
+	 *
+	 * @return true on success, false otherwise (sets errno)
+	 */
+	bool Add(int fd, uint32_t events, Handler handler)
+	{
+		struct epoll_event ev;
+		ev.events = events;
+		ev.data.fd = fd;
+		if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) == -1) {
+			return false;
+		}
+		handlers[fd] = std::make_shared<Handler>(std::move(handler));
+		return true;
+	}
+
+	/// Changes the events watched on fd
+	bool Modify(int fd, uint32_t events)
+	{
+		struct epoll_event ev;
+		ev.events = events;
+		ev.data.fd = fd;
+		return epoll_ctl(epfd, EPOLL_CTL_MOD, fd, &ev) == 0;
+	}
+
+	/// Unregisters fd; safe to call from within its own handler
+	bool Remove(int fd)
+	{
+		handlers.erase(fd);
+		return epoll_ctl(epfd, EPOLL_CTL_DEL, fd, nullptr) == 0;
+	}
+
+	/**
+	 * @brief Waits for events and dispatches them once.
+	 *
+	 * @param timeoutMs maximum wait in milliseconds (-1 blocks, 0 polls)
+	 * @return number of dispatched events, -1 on error
+	 */
+	int RunOnce(int timeoutMs)
+	{
+		const int kMaxEvents = 64;
+		struct epoll_event events[kMaxEvents];
+		int n = epoll_wait(epfd, events, kMaxEvents, timeoutMs);
+		if (n < 0) {
+			return errno == EINTR ? 0 : -1;
+		}
+		for (int i = 0; i < n; ++i) {
+			int fd = events[i].data.fd;
+			if (fd == wakeFd) {
+				uint64_t count;
+				while (::read(wakeFd, &count, sizeof(count)) > 0) {
+				}
+				RunPosted();
+				continue;
+			}
+			auto it = handlers.find(fd);
+			if (it != handlers.end()) {
+				std::shared_ptr<Handler> handler = it->second;
+				(*handler)(events[i].events);
+			}
+		}
+		return n;
+	}
+
+	/// Dispatches events until Stop() is called (at once if it was called before Run())
+	void Run()
+	{
+		while (!stopRequested.load(std::memory_order_relaxed)) {
+			if (RunOnce(-1) < 0) {
+				perror("epoll_wait");
+				break;
+			}
+		}
+		// consumed on the way out, not on entry: the loop may be run again
+		stopRequested.store(false, std::memory_order_relaxed);
+	}
+
+	/// Makes the current or next Run() return; thread safe
+	void Stop()
+	{
+		stopRequested.store(true, std::memory_order_relaxed);
+		Wake();
+	}
+
+	/// Runs task on the loop thread at the next iteration; thread safe
+	void Post(std::function<void()> task)
+	{
+		{
+			std::lock_guard<std::mutex> lock(postMtx);
+			posted.push_back(std::move(task));
+		}
+		Wake();
+	}
+
+	/// The epoll descriptor, so that this loop can be nested in another one
+	int Fd() const
+	{
+		return epfd;
+	}
+
+private:
+	void Wake()
+	{
+		uint64_t one = 1;
+		ssize_t ret = ::write(wakeFd, &one, sizeof(one));
+		(void)ret;
+	}
+
+	void RunPosted()
+	{
+		std::vector<std::function<void()> > tasks;
+		{
+			std::lock_guard<std::mutex> lock(postMtx);
+			tasks.swap(posted);
+		}
+		for (size_t i = 0; i < tasks.size(); ++i) {
+			tasks[i]();
+		}
+	}
+
+	int epfd;
+	int wakeFd;
+	std::atomic<bool> stopRequested;
+	std::unordered_map<int, std::shared_ptr<Handler> > handlers;
+	std::mutex postMtx;
+	std::vector<std::function<void()> > posted;
+};
+
+} /* namespace FUTILS */
+
+#endif /* Linux functions*/
+
+#endif /* FUTILS_EVENTLOOP_H_ */
@@ -0,0 +1,527 @@
+/**
+ * @brief Always-on flight recorder dumped on crashes and on die().
+ *
+ * @details Every thread owns a ring of fixed size binary events (log lines, timer laps, packet
+ * 			metadata) inside a single shared memory region. Recording an event is a thread_local
+ * 			lookup, a timestamp counter read and a 64 byte store: no lock, no syscall.
+ *
+ * 			The region is backed by a memfd, so a supervisor holding a duplicate of MemFd() can
+ * 			still read it after the process died. InstallCrashHandler() additionally writes the
+ * 			raw region to a file from an async-signal-safe handler on SIGSEGV, SIGBUS, SIGFPE,
+ * 			SIGILL and SIGABRT, and from die(). DecodeFlightRecording() turns a dump into text.
+ */
+
+#ifndef FUTILS_FLIGHTRECORDER_H_
+#define FUTILS_FLIGHTRECORDER_H_
+
+#include "futils.h"
+
+#if defined(__linux__) || defined(linux)
+
+#include <atomic>
+#include <csignal>
+#include <new>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#if defined(__x86_64__)
+#	include <x86intrin.h>
+#endif
+
+namespace FUTILS
+{
+
+enum FlightEventType : uint32_t {
+	FlightLog = 1,			///< data: message text (truncated)
+	FlightTimerLap = 2,		///< arg0: lap in nanoseconds, data: label
+	FlightPacket = 3,		///< arg0: IPv4 address (network order) << 16 | port, arg1: length, data: first bytes
+	FlightUser = 100		///< First application defined type
+};
+
+/// One recorded event, one cache line
+struct alignas(64) FlightEvent
+{
+	static const size_t kDataSize = 32;
+
+	uint64_t timestamp;	///< Timestamp counter ticks (see FlightRegionHeader)
+	uint32_t type;
+	uint32_t length;	///< Bytes used in data
+	uint64_t arg0;
+	uint64_t arg1;
+	char data[kDataSize];
+};
+
+/// Start of the recorder region
+struct alignas(64) FlightRegionHeader
+{
+	static const uint64_t kMagic = 0x31524346544c4654ULL; // "TFLTFCR1"
+
+	uint64_t magic;
+	uint32_t maxThreads;
+	uint32_t eventsPerThread;	///< Power of two
+	int32_t pid;
+	int32_t dumpSignal;			///< Signal that caused the dump, 0 for die() or manual dumps
+	uint64_t ticksAtInit;		///< Counter and CLOCK_MONOTONIC pairs used to convert timestamps
+	uint64_t nsAtInit;
+	uint64_t ticksAtDump;
+	uint64_t nsAtDump;
+	std::atomic<uint32_t> droppedThreads;
+};
+
+/// Per-thread ring header, followed by eventsPerThread events
+struct alignas(64) FlightRingHeader
+{
+	std::atomic<uint64_t> head;		///< Number of events ever written
+	std::atomic<int32_t> owner;		///< Thread id, 0 when free
+	int32_t tid;					///< Last owner, kept after the thread exited
+	char name[16];
+};
+
+namespace detail
+{
+
+inline uint64_t FlightTicks()
+{
+#if defined(__x86_64__)
+	return __rdtsc();
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return static_cast<uint64_t>(ts.tv_sec) * 1000000000ULL + static_cast<uint64_t>(ts.tv_nsec);
+#endif
+}
+
+inline uint64_t FlightMonotonicNs()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return static_cast<uint64_t>(ts.tv_sec) * 1000000000ULL + static_cast<uint64_t>(ts.tv_nsec);
+}
+
+inline size_t FlightRingStride(uint32_t eventsPerThread)
+{
+	return sizeof(FlightRingHeader) + static_cast<size_t>(eventsPerThread) * sizeof(FlightEvent);
+}
+
+const size_t kFlightAltStackSize = 64 * 1024;
+
+/// Gives the calling thread its own signal stack, so that a stack overflow can still be reported; nullptr if it already had one
+inline void* FlightAltStack()
+{
+	stack_t ss;
+	if (sigaltstack(nullptr, &ss) == 0 && !(ss.ss_flags & SS_DISABLE)) {
+		return nullptr;
+	}
+	ss.ss_size = kFlightAltStackSize;
+	ss.ss_sp = mmap(nullptr, ss.ss_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	ss.ss_flags = 0;
+	if (ss.ss_sp == MAP_FAILED) {
+		return nullptr;
+	}
+	if (sigaltstack(&ss, nullptr) != 0) {
+		munmap(ss.ss_sp, ss.ss_size);
+		return nullptr;
+	}
+	return ss.ss_sp;
+}
+
+/**
+ * Per thread recording state: releases the ring of an exiting thread (its events stay readable
+ * until the slot is reused) and the signal stack set up for it.
+ */
+struct FlightRingOwner
+{
+	FlightRingHeader *ring = nullptr;
+	bool noRing = false;        ///< all rings were taken when the thread first recorded
+	void *altStack = nullptr;
+
+	~FlightRingOwner()
+	{
+		if (ring) {
+			ring->owner.store(0, std::memory_order_release);
+		}
+		if (altStack) {
+			stack_t ss;
+			memset(&ss, 0, sizeof(ss));
+			ss.ss_flags = SS_DISABLE;
+			sigaltstack(&ss, nullptr);
+			munmap(altStack, kFlightAltStackSize);
+		}
+	}
+};
+
+} /* namespace detail */
+
+class FlightRecorder
+{
+public:
+	static FlightRecorder& Instance()
+	{
+		static FlightRecorder recorder;
+		return recorder;
+	}
+
+	/**
+	 * @brief Allocates the region. Must be called once, before any thread records.
+	 *
+	 * @param maxThreads threads that can record at the same time
+	 * @param eventsPerThread ring size, rounded up to a power of two
+	 * @return true on success
+	 */
+	bool Init(uint32_t maxThreads = 64, uint32_t eventsPerThread = 1024)
+	{
+		if (header) {
+			return true;
+		}
+		uint32_t events = 1;
+		while (events < eventsPerThread) {
+			events <<= 1;
+		}
+		size_t size = sizeof(FlightRegionHeader) + maxThreads * detail::FlightRingStride(events);
+
+		int fd = static_cast<int>(syscall(SYS_memfd_create, "futils-flightrec", 1U /* MFD_CLOEXEC */));
+		void *mem;
+		if (fd >= 0 && ftruncate(fd, static_cast<off_t>(size)) == 0) {
+			mem = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		} else {
+			if (fd >= 0) {
+				::close(fd);
+				fd = -1;
+			}
+			mem = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		}
+		if (mem == MAP_FAILED) {
+			perror("FlightRecorder mmap");
+			if (fd >= 0) {
+				::close(fd);
+			}
+			return false;
+		}
+		memFd = fd;
+		regionSize = size;
+		FlightRegionHeader *h = new (mem) FlightRegionHeader();
+		h->magic = FlightRegionHeader::kMagic;
+		h->maxThreads = maxThreads;
+		h->eventsPerThread = events;
+		h->pid = getpid();
+		h->dumpSignal = 0;
+		h->ticksAtInit = detail::FlightTicks();
+		h->nsAtInit = detail::FlightMonotonicNs();
+		h->ticksAtDump = 0;
+		h->nsAtDump = 0;
+		h->droppedThreads.store(0);
+		for (uint32_t i = 0; i < maxThreads; ++i) {
+			new (Ring(h, i)) FlightRingHeader();
+		}
+		header = h;
+		return true;
+	}
+
+	/// Names the calling thread in dumps (max 15 characters)
+	void SetThreadName(const char *name)
+	{
+		FlightRingHeader *ring = ThreadRing();
+		if (ring) {
+			strncpy(ring->name, name, sizeof(ring->name) - 1);
+		}
+	}
+
+	/**
+	 * @brief Records an event in the calling thread's ring.
+	 *
+	 * @param data optional payload, truncated to FlightEvent::kDataSize bytes
+	 */
+	void Record(uint32_t type, uint64_t arg0, uint64_t arg1, const void *data = nullptr, size_t len = 0)
+	{
+		FlightRingHeader *ring = ThreadRing();
+		if (!ring) {
+			return;
+		}
+		uint64_t head = ring->head.load(std::memory_order_relaxed);
+		FlightEvent *ev = reinterpret_cast<FlightEvent*>(ring + 1) + (head & (header->eventsPerThread - 1));
+		ev->timestamp = detail::FlightTicks();
+		ev->type = type;
+		ev->arg0 = arg0;
+		ev->arg1 = arg1;
+		if (len > FlightEvent::kDataSize) {
+			len = FlightEvent::kDataSize;
+		}
+		ev->length = static_cast<uint32_t>(len);
+		if (len) {
+			memcpy(ev->data, data, len);
+		}
+		ring->head.store(head + 1, std::memory_order_release);
+	}
+
+	void RecordLog(const char *msg)
+	{
+		Record(FlightLog, 0, 0, msg, strlen(msg));
+	}
+
+	void RecordLog(const std::string &msg)
+	{
+		Record(FlightLog, 0, 0, msg.data(), msg.size());
+	}
+
+	/// Records a lap, e.g. RecordLap("control", timer.Lap())
+	void RecordLap(const char *label, double seconds)
+	{
+		Record(FlightTimerLap, static_cast<uint64_t>(seconds * 1E9), 0, label, strlen(label));
+	}
+
+	/// Records the metadata and the first bytes of a datagram
+	void RecordPacket(const struct sockaddr_in &peer, const void *payload, size_t len)
+	{
+		uint64_t addr = (static_cast<uint64_t>(peer.sin_addr.s_addr) << 16) | ntohs(peer.sin_port);
+		Record(FlightPacket, addr, len, payload, len);
+	}
+
+	/**
+	 * @brief Installs the fatal signal handlers and a die() hook writing the region to a file.
+	 *
+	 * @param dumpPath output file, default "<executable dir>/flightrec-<pid>.bin"
+	 * @return true on success
+	 */
+	bool InstallCrashHandler(const std::string &dumpPath = "")
+	{
+		if (!header && !Init()) {
+			return false;
+		}
+		std::string path = dumpPath.empty() ?
+				get_selfpath() + "/flightrec-" + std::to_string(getpid()) + ".bin" : dumpPath;
+		if (path.size() >= sizeof(crashPath)) {
+			std::cerr << tc::redL << "FlightRecorder: dump path too long" << tc::none << "\n";
+			return false;
+		}
+		memcpy(crashPath, path.c_str(), path.size() + 1);
+
+		// Signal stacks are per thread: this one gets it here, recording threads in ThreadRing()
+		detail::FlightRingOwner &owner = ThreadOwner();
+		if (!owner.altStack) {
+			owner.altStack = detail::FlightAltStack();
+		}
+
+		struct sigaction sa;
+		memset(&sa, 0, sizeof(sa));
+		sa.sa_sigaction = &FlightRecorder::CrashHandler;
+		sa.sa_flags = SA_SIGINFO | SA_ONSTACK | SA_RESETHAND;
+		sigemptyset(&sa.sa_mask);
+		const int signals[] = { SIGSEGV, SIGBUS, SIGFPE, SIGILL, SIGABRT };
+		for (int sig : signals) {
+			if (sigaction(sig, &sa, nullptr) != 0) {
+				perror("sigaction");
+				return false;
+			}
+		}
+		AddDieHook([](const std::string&) { Instance().DumpToPath(0); });
+		return true;
+	}
+
+	/**
+	 * @brief Writes the raw region to fd. Async-signal-safe.
+	 *
+	 * @return bytes written, -1 on error
+	 */
+	ssize_t DumpTo(int fd, int signal = 0) const
+	{
+		if (!header) {
+			return -1;
+		}
+		header->dumpSignal = signal;
+		header->ticksAtDump = detail::FlightTicks();
+		header->nsAtDump = detail::FlightMonotonicNs();
+		const char *p = reinterpret_cast<const char*>(header);
+		size_t left = regionSize;
+		while (left) {
+			ssize_t n = ::write(fd, p, left);
+			if (n < 0) {
+				if (errno == EINTR) {
+					continue;
+				}
+				return -1;
+			}
+			p += n;
+			left -= static_cast<size_t>(n);
+		}
+		return static_cast<ssize_t>(regionSize);
+	}
+
+	/// Backing memfd (-1 if the region is anonymous memory)
+	int MemFd() const
+	{
+		return memFd;
+	}
+
+	const FlightRegionHeader* Region() const
+	{
+		return header;
+	}
+
+	size_t RegionSize() const
+	{
+		return regionSize;
+	}
+
+private:
+	FlightRecorder() :
+		header(nullptr), regionSize(0), memFd(-1)
+	{
+		crashPath[0] = '\0';
+	}
+
+	static FlightRingHeader* Ring(FlightRegionHeader *h, uint32_t i)
+	{
+		char *base = reinterpret_cast<char*>(h + 1);
+		return reinterpret_cast<FlightRingHeader*>(base + i * detail::FlightRingStride(h->eventsPerThread));
+	}
+
+	static detail::FlightRingOwner& ThreadOwner()
+	{
+		static thread_local detail::FlightRingOwner owner;
+		return owner;
+	}
+
+	FlightRingHeader* ThreadRing()
+	{
+		detail::FlightRingOwner &owner = ThreadOwner();
+		if (owner.ring || owner.noRing || !header) {
+			return owner.ring;
+		}
+		int32_t tid = static_cast<int32_t>(syscall(SYS_gettid));
+		for (uint32_t i = 0; i < header->maxThreads; ++i) {
+			FlightRingHeader *ring = Ring(header, i);
+			int32_t expected = 0;
+			if (ring->owner.compare_exchange_strong(expected, tid, std::memory_order_acq_rel)) {
+				ring->head.store(0, std::memory_order_relaxed);
+				ring->tid = tid;
+				memset(ring->name, 0, sizeof(ring->name));
+				owner.ring = ring;
+				if (!owner.altStack) {
+					owner.altStack = detail::FlightAltStack();
+				}
+				return ring;
+			}
+		}
+		// counted once per thread; later records return at once
+		owner.noRing = true;
+		header->droppedThreads.fetch_add(1, std::memory_order_relaxed);
+		return nullptr;
+	}
+
+	void DumpToPath(int signal) const
+	{
+		if (!crashPath[0]) {
+			return;
+		}
+		int fd = ::open(crashPath, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+		if (fd < 0) {
+			return;
+		}
+		DumpTo(fd, signal);
+		::close(fd);
+		const char msg[] = "flight recorder dumped to ";
+		ssize_t ret = ::write(STDERR_FILENO, msg, sizeof(msg) - 1);
+		ret = ::write(STDERR_FILENO, crashPath, strlen(crashPath));
+		ret = ::write(STDERR_FILENO, "\n", 1);
+		(void)ret;
+	}
+
+	static void CrashHandler(int sig, siginfo_t*, void*)
+	{
+		Instance().DumpToPath(sig);
+		// SA_RESETHAND restored the default action: re-raise to get the usual core dump
+		raise(sig);
+	}
+
+	FlightRegionHeader *header;
+	size_t regionSize;
+	int memFd;
+	char crashPath[512];
+};
+
+/// Shorthand for FlightRecorder::Instance().Record()
+inline void FlightRecord(uint32_t type, uint64_t arg0, uint64_t arg1, const void *data = nullptr, size_t len = 0)
+{
+	FlightRecorder::Instance().Record(type, arg0, arg1, data, len);
+}
+
+/**
+ * @brief Prints the events of a dump (or of a mapped memfd), merged across threads by time.
+ *
+ * @param region dump content
+ * @param len dump length
+ * @return false if the dump is not valid
+ */
+inline bool DecodeFlightRecording(const void *region, size_t len, std::ostream &os)
+{
+	const FlightRegionHeader *h = static_cast<const FlightRegionHeader*>(region);
+	if (len < sizeof(FlightRegionHeader) || h->magic != FlightRegionHeader::kMagic) {
+		return false;
+	}
+	size_t stride = detail::FlightRingStride(h->eventsPerThread);
+	if (len < sizeof(FlightRegionHeader) + h->maxThreads * stride) {
+		return false;
+	}
+	uint64_t ticksAtDump = h->ticksAtDump ? h->ticksAtDump : detail::FlightTicks();
+	uint64_t nsAtDump = h->nsAtDump ? h->nsAtDump : detail::FlightMonotonicNs();
+	double nsPerTick = (ticksAtDump > h->ticksAtInit) ?
+			static_cast<double>(nsAtDump - h->nsAtInit) / static_cast<double>(ticksAtDump - h->ticksAtInit) : 1.0;
+
+	struct Entry
+	{
+		const FlightEvent *ev;
+		const FlightRingHeader *ring;
+	};
+	std::vector<Entry> entries;
+	const char *base = reinterpret_cast<const char*>(h + 1);
+	for (uint32_t i = 0; i < h->maxThreads; ++i) {
+		const FlightRingHeader *ring = reinterpret_cast<const FlightRingHeader*>(base + i * stride);
+		uint64_t head = ring->head.load(std::memory_order_acquire);
+		uint64_t count = head < h->eventsPerThread ? head : h->eventsPerThread;
+		const FlightEvent *events = reinterpret_cast<const FlightEvent*>(ring + 1);
+		for (uint64_t k = head - count; k < head; ++k) {
+			Entry e = { &events[k & (h->eventsPerThread - 1)], ring };
+			entries.push_back(e);
+		}
+	}
+	std::sort(entries.begin(), entries.end(),
+			[](const Entry &a, const Entry &b) { return a.ev->timestamp < b.ev->timestamp; });
+
+	os << "flight recording of pid " << h->pid << ", " << entries.size() << " events";
+	if (h->dumpSignal) {
+		os << ", dumped on signal " << h->dumpSignal << " (" << strsignal(h->dumpSignal) << ")";
+	}
+	os << "\n";
+	for (const Entry &e : entries) {
+		const FlightEvent &ev = *e.ev;
+		double ago = (static_cast<double>(ticksAtDump) - static_cast<double>(ev.timestamp)) * nsPerTick / 1E6;
+		std::string data(ev.data, ev.length < FlightEvent::kDataSize ? ev.length : FlightEvent::kDataSize);
+		os << "-" << std::fixed << std::setprecision(3) << ago << "ms [" << e.ring->tid << " "
+				<< e.ring->name << "] ";
+		switch (ev.type) {
+		case FlightLog:
+			os << "log: " << data;
+			break;
+		case FlightTimerLap:
+			os << "lap " << data << ": " << static_cast<double>(ev.arg0) / 1E3 << "us";
+			break;
+		case FlightPacket: {
+			struct in_addr addr;
+			addr.s_addr = static_cast<uint32_t>(ev.arg0 >> 16);
+			os << "packet " << inet_ntoa(addr) << ":" << (ev.arg0 & 0xffff) << " len " << ev.arg1;
+			break;
+		}
+		default:
+			os << "type " << ev.type << " arg0 " << ev.arg0 << " arg1 " << ev.arg1 << " data " << ev.length << "B";
+			break;
+		}
+		os << "\n";
+	}
+	return true;
+}
+
+} /* namespace FUTILS */
+
+#endif /* Linux functions*/
+
+#endif /* FUTILS_FLIGHTRECORDER_H_ */
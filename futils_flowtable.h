@@ -0,0 +1,441 @@
+/**
+ * @brief Fixed-capacity per-source flow table with aging, for UDP receivers.
+ *
+ * @details The utilities implemented include:
+ * 			- FlowTable<Value>: open-addressed table of 64 byte (one cache line) entries keyed on
+ * 			  the source address and port, with linear probing and backward-shift deletion
+ * 			- CLOCK style aging: a hand sweeps a bounded number of slots per call, expiring the
+ * 			  flows idle for longer than the timeout
+ * 			- sampled LRU eviction: when the table is full the least recently seen flow of the new
+ * 			  one's probe sequence is replaced, so inserts never fail nor lengthen the probes
+ * 			- batch lookup over a PacketBatch with the home slots prefetched ahead of use
+ * 			- FlowStats: default per-flow state (counters, last sequence, rate estimate)
+ *
+ * 			Timestamps are CoarseClock milliseconds truncated to 32 bits: read the clock once per
+ * 			batch and pass it in. Every operation is O(1) whatever the number of flows.
+ */
+
+#ifndef FUTILS_FLOWTABLE_H_
+#define FUTILS_FLOWTABLE_H_
+
+#include "futils.h"
+#include "futils_time.h"
+#include "futils_udpbatch.h"
+
+#if defined(__linux__) || defined(linux)
+
+#include <sys/mman.h>
+#include <type_traits>
+
+namespace FUTILS
+{
+
+/// Default flow state: traffic counters and a packet rate estimate
+struct FlowStats
+{
+	uint64_t packets;
+	uint64_t bytes;
+	uint32_t lastSequence;
+	uint32_t windowStartMs;
+	uint32_t windowPackets;
+	float packetRate;       ///< packets per second, exponentially averaged over about one second
+
+	/// Accounts one packet of len bytes received at nowMs
+	void Update(size_t len, uint32_t nowMs)
+	{
+		if (packets == 0) {
+			windowStartMs = nowMs;
+		}
+		++packets;
+		bytes += len;
+		++windowPackets;
+		uint32_t dt = nowMs - windowStartMs;
+		if (dt >= kRateWindowMs) {
+			float instant = static_cast<float>(windowPackets) * 1000.0f / static_cast<float>(dt);
+			float alpha = std::min(1.0f, static_cast<float>(dt) / 1000.0f);
+			packetRate += alpha * (instant - packetRate);
+			windowStartMs = nowMs;
+			windowPackets = 0;
+		}
+	}
+
+	static const uint32_t kRateWindowMs = 100;
+};
+
+/// Key of a flow: IPv4 source address and port, host byte order
+inline uint64_t FlowKey(uint32_t addr, uint16_t port)
+{
+	return (static_cast<uint64_t>(addr) << 16) | port;
+}
+
+inline uint64_t FlowKey(const struct sockaddr_in &peer)
+{
+	return FlowKey(ntohl(peer.sin_addr.s_addr), ntohs(peer.sin_port));
+}
+
+/**
+ * Flow table of Value (trivially copyable, at most 48 bytes) per source.
+ *
+ * Not thread safe: use one table per receiving thread (e.g. with SO_REUSEPORT sharding).
+ */
+template<typename Value = FlowStats>
+class FlowTable
+{
+public:
+	/// One cache line per flow
+	struct alignas(64) Entry
+	{
+		uint64_t key;           ///< FlowKey() | kOccupied, 0 when the slot is free
+		uint32_t firstSeen;
+		uint32_t lastSeen;
+		Value value;
+
+		uint32_t Addr() const
+		{
+			return static_cast<uint32_t>(key >> 16);
+		}
+
+		uint16_t Port() const
+		{
+			return static_cast<uint16_t>(key);
+		}
+	};
+
+	static_assert(std::is_trivially_copyable<Value>::value, "FlowTable values must be trivially copyable");
+	static_assert(sizeof(Entry) == 64, "FlowTable values must fit in 48 bytes");
+
+	typedef std::function<void(const Entry&)> EvictionCallback;
+
+	/**
+	 * @param capacity number of slots, rounded up to a power of two
+	 * @param idleTimeoutMs flows not seen for this long are expired
+	 * @param maxLoad fraction of occupied slots above which inserts evict: every probed slot is a
+	 * cache line, so keep it low enough for short probe sequences
+	 */
+	explicit FlowTable(size_t capacity, uint32_t idleTimeoutMs = 30000, double maxLoad = 0.5) :
+		mask(0), count(0), hand(0), idleTimeout(idleTimeoutMs), evictions(0), expirations(0)
+	{
+		size_t slots = 64;
+		while (slots < capacity) {
+			slots <<= 1;
+		}
+		const size_t bytes = slots * sizeof(Entry);
+		void *mem = nullptr;
+		if (posix_memalign(&mem, bytes >= kHugePage ? kHugePage : 64, bytes) != 0) {
+			die("FlowTable: posix_memalign");
+		}
+		if (bytes >= kHugePage) {
+			// random probes over a large table otherwise miss the TLB on almost every packet
+			madvise(mem, bytes, MADV_HUGEPAGE);
+		}
+		memset(mem, 0, bytes);
+		table.reset(static_cast<Entry*>(mem));
+		mask = slots - 1;
+		maxCount = std::max<size_t>(1, static_cast<size_t>(static_cast<double>(slots) * std::min(maxLoad, 0.95)));
+	}
+
+	FlowTable(const FlowTable&) = delete;
+	FlowTable& operator=(const FlowTable&) = delete;
+
+	/// Called for each flow removed by aging or eviction (not by Erase())
+	void SetEvictionCallback(EvictionCallback callback)
+	{
+		onEvict = callback;
+	}
+
+	/// The flow of key, nullptr if absent (does not refresh it)
+	Entry* Find(uint64_t key)
+	{
+		uint64_t tagged = key | kOccupied;
+		for (size_t i = Home(key);; i = (i + 1) & mask) {
+			if (table[i].key == tagged) {
+				return &table[i];
+			}
+			if (table[i].key == 0) {
+				return nullptr;
+			}
+		}
+	}
+
+	/**
+	 * @brief Returns the flow of key, creating it (value zeroed) if absent, and marks it seen.
+	 *
+	 * @param inserted set to true for a new flow
+	 */
+	Entry& Touch(uint64_t key, uint32_t nowMs, bool &inserted)
+	{
+		uint64_t tagged = key | kOccupied;
+		const size_t home = Home(key);
+		size_t i = home;
+		for (;; i = (i + 1) & mask) {
+			if (table[i].key == tagged) {
+				table[i].lastSeen = nowMs;
+				inserted = false;
+				return table[i];
+			}
+			if (table[i].key == 0) {
+				break;
+			}
+		}
+		inserted = true;
+		if (count >= maxCount) {
+			if (i != home) {
+				// replace the least recently seen flow of the probe sequence, still in cache
+				return Replace(Oldest(home, i, nowMs), tagged, nowMs);
+			}
+			MakeRoom(home, nowMs);
+			// the removal may have shifted entries into the home slot, find the free slot again
+			for (i = home; table[i].key != 0; i = (i + 1) & mask) {
+			}
+		}
+		Entry &e = table[i];
+		memset(&e.value, 0, sizeof(Value));
+		e.key = tagged;
+		e.firstSeen = nowMs;
+		e.lastSeen = nowMs;
+		++count;
+		return e;
+	}
+
+	Entry& Touch(uint64_t key, uint32_t nowMs)
+	{
+		bool inserted;
+		return Touch(key, nowMs, inserted);
+	}
+
+	/**
+	 * @brief Touches the flows of every datagram of a batch.
+	 *
+	 * Home slots are prefetched kPrefetchDistance packets ahead, so the cache misses of a
+	 * large table overlap instead of being paid one after the other.
+	 *
+	 * @param entries receives batch.Size() entry pointers, valid until the next insertion; nullptr
+	 * only for a flow evicted again to make room for a later datagram of the same batch
+	 */
+	void TouchBatch(const PacketBatch &batch, uint32_t nowMs, Entry **entries)
+	{
+		const size_t n = batch.Size();
+		const uint32_t *addrs = batch.SrcAddrs();
+		const uint16_t *ports = batch.SrcPorts();
+		for (size_t i = 0; i < n && i < kPrefetchDistance; ++i) {
+			__builtin_prefetch(&table[Home(FlowKey(addrs[i], ports[i]))]);
+		}
+		const uint64_t removed = evictions + expirations;
+		for (size_t i = 0; i < n; ++i) {
+			if (i + kPrefetchDistance < n) {
+				__builtin_prefetch(&table[Home(FlowKey(addrs[i + kPrefetchDistance], ports[i + kPrefetchDistance]))]);
+			}
+			entries[i] = &Touch(FlowKey(addrs[i], ports[i]), nowMs);
+		}
+		// an eviction may have replaced or shifted entries returned earlier in the batch
+		if (evictions + expirations != removed) {
+			for (size_t i = 0; i < n; ++i) {
+				entries[i] = Find(FlowKey(addrs[i], ports[i]));
+			}
+		}
+	}
+
+	/// Touches the flows of a batch and accounts each datagram in their FlowStats
+	void UpdateBatch(const PacketBatch &batch, uint32_t nowMs)
+	{
+		const size_t n = batch.Size();
+		const uint32_t *addrs = batch.SrcAddrs();
+		const uint16_t *ports = batch.SrcPorts();
+		for (size_t i = 0; i < n && i < kPrefetchDistance; ++i) {
+			__builtin_prefetch(&table[Home(FlowKey(addrs[i], ports[i]))]);
+		}
+		for (size_t i = 0; i < n; ++i) {
+			if (i + kPrefetchDistance < n) {
+				__builtin_prefetch(&table[Home(FlowKey(addrs[i + kPrefetchDistance], ports[i + kPrefetchDistance]))]);
+			}
+			Touch(FlowKey(addrs[i], ports[i]), nowMs).value.Update(batch.Length(i), nowMs);
+		}
+	}
+
+	/// Removes a flow; returns false if absent
+	bool Erase(uint64_t key)
+	{
+		Entry *e = Find(key);
+		if (!e) {
+			return false;
+		}
+		Remove(static_cast<size_t>(e - table.get()));
+		return true;
+	}
+
+	/**
+	 * @brief Advances the aging hand over at most budget slots, expiring idle flows.
+	 *
+	 * Call it periodically (e.g. once per received batch with a small budget) so the whole table
+	 * is swept every few seconds without a latency spike.
+	 *
+	 * @return number of flows expired
+	 */
+	size_t Expire(uint32_t nowMs, size_t budget = 64)
+	{
+		size_t expired = 0;
+		for (size_t step = 0; step < budget && count > 0; ++step) {
+			Entry &e = table[hand];
+			if (e.key != 0 && nowMs - e.lastSeen > idleTimeout) {
+				Evicted(e, nowMs);
+				Remove(hand);   // a shifted entry may now sit under the hand: look again
+				++expired;
+				continue;
+			}
+			hand = (hand + 1) & mask;
+		}
+		return expired;
+	}
+
+	/// Calls fn(entry) for every flow
+	template<typename Fn>
+	void ForEach(Fn fn)
+	{
+		for (size_t i = 0; i <= mask; ++i) {
+			if (table[i].key != 0) {
+				fn(table[i]);
+			}
+		}
+	}
+
+	size_t Size() const
+	{
+		return count;
+	}
+
+	size_t Capacity() const
+	{
+		return mask + 1;
+	}
+
+	/// Flows removed to make room for new ones
+	uint64_t Evictions() const
+	{
+		return evictions;
+	}
+
+	/// Flows removed because idle
+	uint64_t Expirations() const
+	{
+		return expirations;
+	}
+
+private:
+	static const uint64_t kOccupied = 1ULL << 63;
+	static const size_t kPrefetchDistance = 8;
+	/// Slots inspected to pick an eviction victim when the home slot is empty
+	static const size_t kEvictionWindow = 8;
+	static const size_t kHugePage = 2 * 1024 * 1024;
+
+	struct FreeDeleter
+	{
+		void operator()(Entry *p) const
+		{
+			free(p);
+		}
+	};
+
+	size_t Home(uint64_t key) const
+	{
+		// murmur3 finalizer
+		key ^= key >> 33;
+		key *= 0xff51afd7ed558ccdULL;
+		key ^= key >> 33;
+		key *= 0xc4ceb9fe1a85ec53ULL;
+		key ^= key >> 33;
+		return static_cast<size_t>(key) & mask;
+	}
+
+	/// Least recently seen occupied slot of [first, last)
+	size_t Oldest(size_t first, size_t last, uint32_t nowMs) const
+	{
+		size_t victim = first;
+		for (size_t i = (first + 1) & mask; i != last; i = (i + 1) & mask) {
+			if (nowMs - table[i].lastSeen > nowMs - table[victim].lastSeen) {
+				victim = i;
+			}
+		}
+		return victim;
+	}
+
+	/// Reports the eviction of slot i and reuses it for a new flow (same probe sequence)
+	Entry& Replace(size_t i, uint64_t tagged, uint32_t nowMs)
+	{
+		Entry &e = table[i];
+		Evicted(e, nowMs);
+		memset(&e.value, 0, sizeof(Value));
+		e.key = tagged;
+		e.firstSeen = nowMs;
+		e.lastSeen = nowMs;
+		return e;
+	}
+
+	/**
+	 * Evicts the least recently seen of the flows following an empty home slot. Making room where
+	 * the new flow goes keeps the load even: evicting in hand order would pack the slots ahead of
+	 * the hand and lengthen their probe sequences.
+	 */
+	void MakeRoom(size_t home, uint32_t nowMs)
+	{
+		size_t first = home;
+		while (table[first].key == 0) {
+			first = (first + 1) & mask;
+		}
+		size_t last = first;
+		for (size_t step = 0; step < kEvictionWindow && table[last].key != 0; ++step) {
+			last = (last + 1) & mask;
+		}
+		size_t victim = Oldest(first, last, nowMs);
+		Evicted(table[victim], nowMs);
+		Remove(victim);
+	}
+
+	void Evicted(const Entry &e, uint32_t nowMs)
+	{
+		if (onEvict) {
+			onEvict(e);
+		}
+		if (nowMs - e.lastSeen > idleTimeout) {
+			++expirations;
+		} else {
+			++evictions;
+		}
+	}
+
+	/// Backward-shift deletion: keeps every probe sequence contiguous without tombstones
+	void Remove(size_t hole)
+	{
+		size_t i = hole;
+		for (;;) {
+			i = (i + 1) & mask;
+			if (table[i].key == 0) {
+				break;
+			}
+			size_t home = Home(table[i].key & ~kOccupied);
+			// move i into the hole unless its home lies cyclically in (hole, i]
+			bool stays = hole <= i ? (hole < home && home <= i) : (hole < home || home <= i);
+			if (!stays) {
+				table[hole] = table[i];
+				hole = i;
+			}
+		}
+		table[hole].key = 0;
+		--count;
+	}
+
+	std::unique_ptr<Entry[], FreeDeleter> table;
+	size_t mask;
+	size_t count;
+	size_t maxCount;
+	size_t hand;
+	uint32_t idleTimeout;
+	EvictionCallback onEvict;
+	uint64_t evictions;
+	uint64_t expirations;
+};
+
+} /* namespace FUTILS */
+
+#endif /* Linux functions*/
+
+#endif /* FUTILS_FLOWTABLE_H_ */
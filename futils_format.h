@@ -0,0 +1,896 @@
+/**
+ * @brief Type-safe "{}" formatting with format strings checked at compile time (requires C++17).
+ *
+ * @details The utilities implemented include:
+ * 			- FUTILS_FMT("..."): wraps a literal so that Format() can parse it at compile time;
+ * 			  malformed fields, wrong argument counts and specifiers not matching the argument
+ * 			  types are reported by static_assert
+ * 			- FormatTo(): formats into a caller supplied buffer (stack, arena) or a FormatBuffer
+ * 			- MemoryBuffer: FormatBuffer with inline storage that only spills to the heap
+ * 			- Format(), Print(): std::string result, FILE* and std::ostream output
+ * 			- Formatter<T>: customization point for user types; std::vector and std::array
+ * 			  are printed as "[a, b, c]"
+ *
+ * 			Field syntax: "{}" or "{:[color][:][[fill]align][+][0][width][.precision][type]}"
+ * 			- color: any tc name (redL, grnL, cyan, ...); the field is printed in that color
+ * 			- align: '<', '>', '^'; numbers are right aligned and strings left aligned by default
+ * 			- type: d x X o b (integers), f F e E g G (floats), s (strings, bools), c (chars),
+ * 			  p (pointers)
+ * 			"{{" and "}}" print literal braces. Widths count bytes, not UTF-8 characters.
+ *
+ * 			Example:
+ * 				std::string m = FUTILS::Format(FUTILS_FMT("{:redL} after {:.3f} s\n"), "timeout", t);
+ * 				FUTILS::Print(stderr, FUTILS_FMT("{:>8}|{:08.2f}|{:x}\n"), name, value, flags);
+ */
+
+#ifndef FUTILS_FORMAT_H_
+#define FUTILS_FORMAT_H_
+
+#include "futils.h"
+
+#include <cctype>
+#include <charconv>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+#include <type_traits>
+
+namespace FUTILS
+{
+
+/// Parsed field specifier, also handed to Formatter<T>::Format()
+struct FormatSpec
+{
+	char fill = ' ';
+	char align = 0;         ///< '<', '>', '^' or 0 for the default of the argument type
+	bool plus = false;
+	bool zero = false;
+	int width = 0;
+	int precision = -1;
+	char type = 0;
+	int color = -1;         ///< index in the tc color table, -1 for none
+};
+
+/**
+ * Output buffer of the formatting functions.
+ *
+ * Used directly it wraps a fixed buffer and truncates: Size() keeps counting what did not fit, as
+ * snprintf() does. Derived buffers grow instead (see MemoryBuffer).
+ */
+class FormatBuffer
+{
+public:
+	FormatBuffer(char *buffer, size_t capacity) :
+		data(buffer), size(0), capacity(capacity)
+	{
+	}
+
+	FormatBuffer(const FormatBuffer&) = delete;
+	FormatBuffer& operator=(const FormatBuffer&) = delete;
+
+	void Append(const char *s, size_t n)
+	{
+		if (size + n > capacity) {
+			Grow(size + n);
+		}
+		if (size < capacity) {
+			memcpy(data + size, s, std::min(n, capacity - size));
+		}
+		size += n;
+	}
+
+	void Append(std::string_view s)
+	{
+		Append(s.data(), s.size());
+	}
+
+	void Push(char c)
+	{
+		if (size >= capacity) {
+			Grow(size + 1);
+		}
+		if (size < capacity) {
+			data[size] = c;
+		}
+		++size;
+	}
+
+	void Fill(char c, size_t n)
+	{
+		if (size + n > capacity) {
+			Grow(size + n);
+		}
+		if (size < capacity) {
+			memset(data + size, c, std::min(n, capacity - size));
+		}
+		size += n;
+	}
+
+	const char* Data() const
+	{
+		return data;
+	}
+
+	/// Formatted length, including what did not fit
+	size_t Size() const
+	{
+		return size;
+	}
+
+	bool Truncated() const
+	{
+		return size > capacity;
+	}
+
+	std::string_view View() const
+	{
+		return std::string_view(data, std::min(size, capacity));
+	}
+
+	void Clear()
+	{
+		size = 0;
+	}
+
+protected:
+	~FormatBuffer()
+	{
+	}
+
+	/// Called when needed bytes do not fit; may enlarge data/capacity
+	virtual void Grow(size_t needed)
+	{
+		(void)needed;
+	}
+
+	char *data;
+	size_t size;
+	size_t capacity;
+};
+
+/// FormatBuffer over a fixed array, e.g. a stack buffer or a slice of an arena
+class FixedFormatBuffer : public FormatBuffer
+{
+public:
+	FixedFormatBuffer(char *buffer, size_t capacity) :
+		FormatBuffer(buffer, capacity)
+	{
+	}
+};
+
+/// FormatBuffer with N bytes of inline storage, moving to the heap only when they are exceeded
+template<size_t N = 256>
+class MemoryBuffer : public FormatBuffer
+{
+public:
+	MemoryBuffer() :
+		FormatBuffer(inlineStore, N)
+	{
+	}
+
+	std::string str() const
+	{
+		return std::string(data, size);
+	}
+
+	/// NUL terminated contents
+	const char* c_str()
+	{
+		Push('\0');
+		--size;
+		return data;
+	}
+
+protected:
+	void Grow(size_t needed) override
+	{
+		size_t grown = std::max(capacity * 2, needed);
+		std::unique_ptr<char[]> bigger(new char[grown]);
+		memcpy(bigger.get(), data, size);
+		heap = std::move(bigger);
+		data = heap.get();
+		capacity = grown;
+	}
+
+private:
+	char inlineStore[N];
+	std::unique_ptr<char[]> heap;
+};
+
+/**
+ * Customization point: specialize with
+ * 	static void Format(FormatBuffer &out, const T &value, const FormatSpec &spec);
+ * The spec is passed through unchecked (any type letter is accepted at compile time).
+ */
+template<typename T, typename Enable = void>
+struct Formatter;
+
+namespace detail
+{
+struct FormatStringTag
+{
+};
+
+enum class FmtKind : uint8_t {
+	None, Int, Uint, Float, Bool, Char, String, Pointer, Custom
+};
+
+enum FmtError {
+	kFmtOk = 0, kFmtMalformed, kFmtUnknownColor, kFmtTooFewArgs, kFmtTooManyArgs, kFmtTypeMismatch
+};
+
+inline constexpr std::string_view kFmtColorNames[] = {
+	"none", "blck", "grayD", "red", "redL", "grn", "grnL", "brwn", "yel",
+	"blu", "bluL", "mag", "magL", "cyan", "cyanL", "grayL", "white"
+};
+
+inline const char* FmtColorCode(int color)
+{
+#if defined(__linux__) || defined(linux)
+	static const char* const codes[] = {
+		tc::none, tc::blck, tc::grayD, tc::red, tc::redL, tc::grn, tc::grnL, tc::brwn, tc::yel,
+		tc::blu, tc::bluL, tc::mag, tc::magL, tc::cyan, tc::cyanL, tc::grayL, tc::white
+	};
+	return codes[color];
+#else
+	(void)color;
+	return "";
+#endif
+}
+
+constexpr bool FmtIsAlpha(char c)
+{
+	return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z');
+}
+
+constexpr bool FmtIsAlign(char c)
+{
+	return c == '<' || c == '>' || c == '^';
+}
+
+struct FmtField
+{
+	FormatSpec spec;
+	size_t next = 0;        ///< position after the closing brace
+	int error = kFmtOk;
+};
+
+/// Parses the field whose opening brace precedes position i
+constexpr FmtField ParseField(std::string_view s, size_t i)
+{
+	FmtField f;
+	if (i < s.size() && s[i] == '}') {
+		f.next = i + 1;
+		return f;
+	}
+	if (i >= s.size() || s[i] != ':') {
+		f.error = kFmtMalformed;
+		return f;
+	}
+	++i;
+	size_t j = i;
+	while (j < s.size() && FmtIsAlpha(s[j])) {
+		++j;
+	}
+	if (j - i >= 3) {   // one letter is a type, colors are longer
+		std::string_view name = s.substr(i, j - i);
+		for (size_t c = 0; c < sizeof(kFmtColorNames) / sizeof(kFmtColorNames[0]); ++c) {
+			if (kFmtColorNames[c] == name) {
+				f.spec.color = static_cast<int>(c);
+			}
+		}
+		if (f.spec.color < 0) {
+			f.error = kFmtUnknownColor;
+			return f;
+		}
+		i = j;
+		if (i < s.size() && s[i] == ':') {
+			++i;
+		}
+	}
+	if (i + 1 < s.size() && FmtIsAlign(s[i + 1]) && s[i] != '{' && s[i] != '}') {
+		f.spec.fill = s[i];
+		f.spec.align = s[i + 1];
+		i += 2;
+	} else if (i < s.size() && FmtIsAlign(s[i])) {
+		f.spec.align = s[i++];
+	}
+	if (i < s.size() && s[i] == '+') {
+		f.spec.plus = true;
+		++i;
+	}
+	if (i < s.size() && s[i] == '0') {
+		f.spec.zero = true;
+		++i;
+	}
+	while (i < s.size() && s[i] >= '0' && s[i] <= '9' && f.spec.width < 1000) {
+		f.spec.width = f.spec.width * 10 + (s[i++] - '0');
+	}
+	if (i < s.size() && s[i] == '.') {
+		++i;
+		if (i >= s.size() || s[i] < '0' || s[i] > '9') {
+			f.error = kFmtMalformed;
+			return f;
+		}
+		f.spec.precision = 0;
+		while (i < s.size() && s[i] >= '0' && s[i] <= '9' && f.spec.precision < 1000) {
+			f.spec.precision = f.spec.precision * 10 + (s[i++] - '0');
+		}
+	}
+	if (i < s.size() && FmtIsAlpha(s[i])) {
+		f.spec.type = s[i++];
+	}
+	if (i >= s.size() || s[i] != '}') {
+		f.error = kFmtMalformed;
+		return f;
+	}
+	f.next = i + 1;
+	return f;
+}
+
+constexpr bool FmtTypeAccepts(char type, FmtKind kind)
+{
+	switch (type) {
+	case 0:
+		return true;
+	case 'd': case 'x': case 'X': case 'o': case 'b':
+		return kind == FmtKind::Int || kind == FmtKind::Uint || kind == FmtKind::Char || kind == FmtKind::Bool || kind == FmtKind::Custom;
+	case 'f': case 'F': case 'e': case 'E': case 'g': case 'G':
+		return kind == FmtKind::Float || kind == FmtKind::Custom;
+	case 's':
+		return kind == FmtKind::String || kind == FmtKind::Bool || kind == FmtKind::Custom;
+	case 'c':
+		return kind == FmtKind::Char || kind == FmtKind::Int || kind == FmtKind::Uint || kind == FmtKind::Custom;
+	case 'p':
+		return kind == FmtKind::Pointer || kind == FmtKind::Custom;
+	default:
+		return kind == FmtKind::Custom;
+	}
+}
+
+/// Validates a format string against the kinds of its arguments (runs at compile time)
+constexpr int CheckFormat(std::string_view s, const FmtKind *kinds, size_t count)
+{
+	size_t arg = 0;
+	for (size_t i = 0; i < s.size(); ++i) {
+		if (s[i] == '{') {
+			if (i + 1 < s.size() && s[i + 1] == '{') {
+				++i;
+				continue;
+			}
+			FmtField f = ParseField(s, i + 1);
+			if (f.error != kFmtOk) {
+				return f.error;
+			}
+			if (arg >= count) {
+				return kFmtTooFewArgs;
+			}
+			if (!FmtTypeAccepts(f.spec.type, kinds[arg])) {
+				return kFmtTypeMismatch;
+			}
+			++arg;
+			i = f.next - 1;
+		} else if (s[i] == '}') {
+			if (i + 1 < s.size() && s[i + 1] == '}') {
+				++i;
+				continue;
+			}
+			return kFmtMalformed;
+		}
+	}
+	return arg == count ? kFmtOk : kFmtTooManyArgs;
+}
+
+template<typename T, typename = void>
+struct HasFormatter : std::false_type
+{
+};
+
+template<typename T>
+struct HasFormatter<T, decltype(void(sizeof(Formatter<T>)))> : std::true_type
+{
+};
+
+template<typename T>
+constexpr FmtKind FmtKindOf()
+{
+	using D = std::decay_t<T>;
+	if constexpr (std::is_same<D, bool>::value) {
+		return FmtKind::Bool;
+	} else if constexpr (std::is_same<D, char>::value) {
+		return FmtKind::Char;
+	} else if constexpr (std::is_integral<D>::value) {
+		return std::is_signed<D>::value ? FmtKind::Int : FmtKind::Uint;
+	} else if constexpr (std::is_enum<D>::value) {
+		return std::is_signed<std::underlying_type_t<D> >::value ? FmtKind::Int : FmtKind::Uint;
+	} else if constexpr (std::is_floating_point<D>::value) {
+		return FmtKind::Float;
+	} else if constexpr (std::is_same<D, const char*>::value || std::is_same<D, char*>::value
+			|| std::is_same<D, std::string>::value || std::is_same<D, std::string_view>::value) {
+		return FmtKind::String;
+	} else if constexpr (std::is_pointer<D>::value || std::is_null_pointer<D>::value) {
+		return FmtKind::Pointer;
+	} else {
+		return FmtKind::Custom;
+	}
+}
+
+struct FmtArg
+{
+	struct StringRef
+	{
+		const char *data;
+		size_t size;
+	};
+	struct CustomRef
+	{
+		const void *object;
+		void (*format)(FormatBuffer&, const void*, const FormatSpec&);
+	};
+
+	FmtKind kind;
+	union {
+		int64_t i;
+		uint64_t u;
+		double d;
+		bool b;
+		char c;
+		StringRef str;
+		const void *ptr;
+		CustomRef custom;
+	};
+};
+
+template<typename T>
+inline FmtArg MakeArg(const T &value)
+{
+	using D = std::decay_t<T>;
+	constexpr FmtKind kind = FmtKindOf<T>();
+	FmtArg a;
+	a.kind = kind;
+	if constexpr (kind == FmtKind::Bool) {
+		a.b = value;
+	} else if constexpr (kind == FmtKind::Char) {
+		a.c = value;
+	} else if constexpr (kind == FmtKind::Int) {
+		a.i = static_cast<int64_t>(value);
+	} else if constexpr (kind == FmtKind::Uint) {
+		a.u = static_cast<uint64_t>(value);
+	} else if constexpr (kind == FmtKind::Float) {
+		a.d = static_cast<double>(value);
+	} else if constexpr (kind == FmtKind::String) {
+		if constexpr (std::is_array<T>::value) {
+			a.str.data = value;
+			a.str.size = strlen(value);
+		} else if constexpr (std::is_pointer<D>::value) {
+			const char *p = value ? value : "(null)";
+			a.str.data = p;
+			a.str.size = strlen(p);
+		} else {
+			a.str.data = value.data();
+			a.str.size = value.size();
+		}
+	} else if constexpr (kind == FmtKind::Pointer) {
+		a.ptr = static_cast<const void*>(value);
+	} else {
+		static_assert(HasFormatter<D>::value, "no FUTILS::Formatter<T> specialization for this argument type");
+		a.custom.object = &value;
+		a.custom.format = [](FormatBuffer &out, const void *object, const FormatSpec &spec) {
+			Formatter<D>::Format(out, *static_cast<const D*>(object), spec);
+		};
+	}
+	return a;
+}
+
+/// Writes body padded to the field width; zero padding goes after the sign/prefix
+inline void WritePadded(FormatBuffer &out, const char *body, size_t len, const FormatSpec &spec, char defaultAlign, size_t prefixLen = 0)
+{
+	size_t width = static_cast<size_t>(spec.width);
+	if (len >= width) {
+		out.Append(body, len);
+		return;
+	}
+	size_t pad = width - len;
+	if (spec.zero && spec.align == 0 && defaultAlign == '>') {
+		out.Append(body, prefixLen);
+		out.Fill('0', pad);
+		out.Append(body + prefixLen, len - prefixLen);
+		return;
+	}
+	char align = spec.align ? spec.align : defaultAlign;
+	size_t left = align == '>' ? pad : (align == '^' ? pad / 2 : 0);
+	out.Fill(spec.fill, left);
+	out.Append(body, len);
+	out.Fill(spec.fill, pad - left);
+}
+
+inline const char* FmtDigitPairs()
+{
+	return "0001020304050607080910111213141516171819"
+			"2021222324252627282930313233343536373839"
+			"4041424344454647484950515253545556575859"
+			"6061626364656667686970717273747576777879"
+			"8081828384858687888990919293949596979899";
+}
+
+/// Writes v backwards ending at end, returns the first character
+inline char* FmtDecimal(char *end, uint64_t v)
+{
+	const char *pairs = FmtDigitPairs();
+	while (v >= 100) {
+		unsigned idx = static_cast<unsigned>(v % 100) * 2;
+		v /= 100;
+		*--end = pairs[idx + 1];
+		*--end = pairs[idx];
+	}
+	if (v >= 10) {
+		unsigned idx = static_cast<unsigned>(v) * 2;
+		*--end = pairs[idx + 1];
+		*--end = pairs[idx];
+	} else {
+		*--end = static_cast<char>('0' + v);
+	}
+	return end;
+}
+
+inline void WriteInteger(FormatBuffer &out, uint64_t magnitude, bool negative, const FormatSpec &spec)
+{
+	char buf[72];
+	char *end = buf + sizeof(buf);
+	char *p = end;
+	switch (spec.type) {
+	case 'x':
+	case 'X': {
+		const char *digits = spec.type == 'x' ? "0123456789abcdef" : "0123456789ABCDEF";
+		do {
+			*--p = digits[magnitude & 15];
+			magnitude >>= 4;
+		} while (magnitude);
+		break;
+	}
+	case 'o':
+		do {
+			*--p = static_cast<char>('0' + (magnitude & 7));
+			magnitude >>= 3;
+		} while (magnitude);
+		break;
+	case 'b':
+		do {
+			*--p = static_cast<char>('0' + (magnitude & 1));
+			magnitude >>= 1;
+		} while (magnitude);
+		break;
+	default:
+		p = FmtDecimal(end, magnitude);
+		break;
+	}
+	size_t prefixLen = 0;
+	if (negative) {
+		*--p = '-';
+		prefixLen = 1;
+	} else if (spec.plus) {
+		*--p = '+';
+		prefixLen = 1;
+	}
+	WritePadded(out, p, static_cast<size_t>(end - p), spec, '>', prefixLen);
+}
+
+inline void WriteSigned(FormatBuffer &out, int64_t v, const FormatSpec &spec)
+{
+	uint64_t magnitude = v < 0 ? 0 - static_cast<uint64_t>(v) : static_cast<uint64_t>(v);
+	WriteInteger(out, magnitude, v < 0, spec);
+}
+
+/**
+ * Fixed notation with up to 9 decimals through integer arithmetic, for values whose scaled
+ * magnitude stays below 1E12 (so the product keeps about 12 bits of fraction). Near ties, where
+ * the rounding error of the product could flip the last digit, are left to std::to_chars() so the
+ * output always matches printf().
+ *
+ * @return end of the text, nullptr if the value is out of range
+ */
+inline char* FmtFixedFast(char *p, double v, int precision)
+{
+	static const double kPow10[] = { 1E0, 1E1, 1E2, 1E3, 1E4, 1E5, 1E6, 1E7, 1E8, 1E9 };
+	static const uint64_t kPow10Int[] = { 1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000, 1000000000 };
+	double scaled = std::fabs(v) * kPow10[precision];
+	if (!(scaled < 1E12)) {   // also rejects NaN and infinities
+		return nullptr;
+	}
+	double integral = std::floor(scaled);
+	if (std::fabs(scaled - integral - 0.5) < 1E-3) {
+		return nullptr;
+	}
+	uint64_t n = static_cast<uint64_t>(integral) + (scaled - integral > 0.5 ? 1 : 0);
+	if (std::signbit(v)) {
+		*p++ = '-';
+	}
+	char digits[24];
+	char *end = digits + sizeof(digits);
+	char *first = FmtDecimal(end, n / kPow10Int[precision]);
+	memcpy(p, first, static_cast<size_t>(end - first));
+	p += end - first;
+	if (precision > 0) {
+		*p++ = '.';
+		uint64_t frac = n % kPow10Int[precision];
+		for (int i = precision - 1; i >= 0; --i) {
+			p[i] = static_cast<char>('0' + frac % 10);
+			frac /= 10;
+		}
+		p += precision;
+	}
+	return p;
+}
+
+inline void WriteFloat(FormatBuffer &out, double v, const FormatSpec &spec)
+{
+	char buf[400];
+	char *p = buf;
+	if (spec.plus && !std::signbit(v)) {
+		*p++ = '+';
+	}
+	char *end = buf + sizeof(buf);
+	int precision = std::min(spec.precision, 64);
+	std::to_chars_result r;
+	switch (spec.type) {
+	case 'f':
+	case 'F':
+		precision = precision < 0 ? 6 : precision;
+		r.ptr = precision <= 9 ? FmtFixedFast(p, v, precision) : nullptr;
+		if (!r.ptr) {
+			r = std::to_chars(p, end, v, std::chars_format::fixed, precision);
+		}
+		break;
+	case 'e':
+	case 'E':
+		r = std::to_chars(p, end, v, std::chars_format::scientific, precision < 0 ? 6 : precision);
+		break;
+	case 'g':
+	case 'G':
+		r = std::to_chars(p, end, v, std::chars_format::general, precision < 0 ? 6 : precision);
+		break;
+	default:
+		r = precision < 0 ? std::to_chars(p, end, v) : std::to_chars(p, end, v, std::chars_format::general, precision);
+		break;
+	}
+	if (spec.type == 'F' || spec.type == 'E' || spec.type == 'G') {
+		for (char *c = p; c < r.ptr; ++c) {
+			*c = static_cast<char>(toupper(*c));
+		}
+	}
+	bool sign = buf[0] == '+' || buf[0] == '-';
+	WritePadded(out, buf, static_cast<size_t>(r.ptr - buf), spec, '>', sign ? 1 : 0);
+}
+
+inline void WriteString(FormatBuffer &out, const char *s, size_t len, const FormatSpec &spec)
+{
+	if (spec.precision >= 0 && static_cast<size_t>(spec.precision) < len) {
+		len = static_cast<size_t>(spec.precision);
+	}
+	WritePadded(out, s, len, spec, '<');
+}
+
+/// Formats one argument; numeric conversions are lenient here since types were checked at compile time
+inline void WriteArg(FormatBuffer &out, const FmtArg &a, const FormatSpec &spec)
+{
+	switch (a.kind) {
+	case FmtKind::Int:
+		if (spec.type == 'c') {
+			char c = static_cast<char>(a.i);
+			WriteString(out, &c, 1, spec);
+		} else if (spec.type == 'f' || spec.type == 'e' || spec.type == 'g') {
+			WriteFloat(out, static_cast<double>(a.i), spec);
+		} else {
+			WriteSigned(out, a.i, spec);
+		}
+		break;
+	case FmtKind::Uint:
+		if (spec.type == 'c') {
+			char c = static_cast<char>(a.u);
+			WriteString(out, &c, 1, spec);
+		} else if (spec.type == 'f' || spec.type == 'e' || spec.type == 'g') {
+			WriteFloat(out, static_cast<double>(a.u), spec);
+		} else {
+			WriteInteger(out, a.u, false, spec);
+		}
+		break;
+	case FmtKind::Float:
+		WriteFloat(out, a.d, spec);
+		break;
+	case FmtKind::Bool:
+		if (spec.type && spec.type != 's') {
+			WriteInteger(out, a.b ? 1 : 0, false, spec);
+		} else {
+			WriteString(out, a.b ? "true" : "false", a.b ? 4 : 5, spec);
+		}
+		break;
+	case FmtKind::Char:
+		if (spec.type && spec.type != 'c') {
+			WriteSigned(out, static_cast<signed char>(a.c), spec);
+		} else {
+			WriteString(out, &a.c, 1, spec);
+		}
+		break;
+	case FmtKind::String:
+		WriteString(out, a.str.data, a.str.size, spec);
+		break;
+	case FmtKind::Pointer: {
+		FormatSpec hex = spec;
+		hex.type = 'x';
+		char buf[24] = { '0', 'x' };
+		FixedFormatBuffer tmp(buf + 2, sizeof(buf) - 2);
+		FormatSpec plain;
+		plain.type = 'x';
+		WriteInteger(tmp, reinterpret_cast<uintptr_t>(a.ptr), false, plain);
+		WritePadded(out, buf, tmp.Size() + 2, hex, '>', 2);
+		break;
+	}
+	case FmtKind::Custom:
+		a.custom.format(out, a.custom.object, spec);
+		break;
+	case FmtKind::None:
+		break;
+	}
+}
+
+/// Type-erased formatting loop shared by every call site
+inline void VFormat(FormatBuffer &out, std::string_view fmt, const FmtArg *args, size_t count)
+{
+	size_t arg = 0;
+	size_t i = 0;
+	while (i < fmt.size()) {
+		size_t brace = i;
+		while (brace < fmt.size() && fmt[brace] != '{' && fmt[brace] != '}') {
+			++brace;
+		}
+		out.Append(fmt.data() + i, brace - i);
+		if (brace == fmt.size()) {
+			break;
+		}
+		if (brace + 1 < fmt.size() && fmt[brace + 1] == fmt[brace]) {
+			out.Push(fmt[brace]);
+			i = brace + 2;
+			continue;
+		}
+		FmtField f = ParseField(fmt, brace + 1);
+		if (f.error != kFmtOk || arg >= count) {   // only reachable for unchecked strings
+			out.Append(fmt.data() + brace, fmt.size() - brace);
+			break;
+		}
+		if (f.spec.color >= 0) {
+			out.Append(FmtColorCode(f.spec.color), strlen(FmtColorCode(f.spec.color)));
+			WriteArg(out, args[arg++], f.spec);
+			out.Append(FmtColorCode(0), strlen(FmtColorCode(0)));
+		} else {
+			WriteArg(out, args[arg++], f.spec);
+		}
+		i = f.next;
+	}
+}
+
+template<typename F>
+using EnableIfFormat = std::enable_if_t<std::is_base_of<FormatStringTag, F>::value>;
+
+template<typename F, typename... Args>
+constexpr bool CheckArgs()
+{
+	constexpr FmtKind kinds[] = { FmtKindOf<Args>()..., FmtKind::None };
+	constexpr int error = CheckFormat(F::Get(), kinds, sizeof...(Args));
+	static_assert(error != kFmtMalformed, "FUTILS_FMT: malformed field or unmatched brace in format string");
+	static_assert(error != kFmtUnknownColor, "FUTILS_FMT: unknown tc color name in format specifier");
+	static_assert(error != kFmtTooFewArgs, "FUTILS_FMT: more fields than arguments");
+	static_assert(error != kFmtTooManyArgs, "FUTILS_FMT: more arguments than fields");
+	static_assert(error != kFmtTypeMismatch, "FUTILS_FMT: format specifier does not match the argument type");
+	return error == kFmtOk;
+}
+}
+
+/**
+ * Wraps a string literal into a unique type exposing it as a constant expression, so the format
+ * functions can validate it with static_assert.
+ */
+#define FUTILS_FMT(s) \
+	[] { \
+		struct FutilsFormatString : ::FUTILS::detail::FormatStringTag { \
+			static constexpr std::string_view Get() { return s; } \
+		}; \
+		return FutilsFormatString(); \
+	}()
+
+/// Formats into out (a fixed or growing buffer)
+template<typename F, typename... Args, typename = detail::EnableIfFormat<F> >
+inline void FormatTo(FormatBuffer &out, F, const Args&... args)
+{
+	static_assert(detail::CheckArgs<F, Args...>(), "invalid format");
+	const detail::FmtArg packed[] = { detail::MakeArg(args)..., detail::FmtArg() };
+	detail::VFormat(out, F::Get(), packed, sizeof...(Args));
+}
+
+/**
+ * @brief Formats into buf, truncating and NUL terminating like snprintf().
+ *
+ * @return length of the full formatted text (>= capacity means truncated)
+ */
+template<typename F, typename... Args, typename = detail::EnableIfFormat<F> >
+inline size_t FormatTo(char *buf, size_t capacity, F fmt, const Args&... args)
+{
+	FixedFormatBuffer out(buf, capacity ? capacity - 1 : 0);
+	FormatTo(out, fmt, args...);
+	if (capacity) {
+		buf[std::min(out.Size(), capacity - 1)] = '\0';
+	}
+	return out.Size();
+}
+
+template<typename F, typename... Args, typename = detail::EnableIfFormat<F> >
+inline std::string Format(F fmt, const Args&... args)
+{
+	MemoryBuffer<> out;
+	FormatTo(out, fmt, args...);
+	return out.str();
+}
+
+/// printf() replacement: formats on the stack and writes with a single fwrite()
+template<typename F, typename... Args, typename = detail::EnableIfFormat<F> >
+inline void Print(FILE *file, F fmt, const Args&... args)
+{
+	MemoryBuffer<> out;
+	FormatTo(out, fmt, args...);
+	fwrite(out.Data(), 1, out.Size(), file);
+}
+
+template<typename F, typename... Args, typename = detail::EnableIfFormat<F> >
+inline void Print(F fmt, const Args&... args)
+{
+	Print(stdout, fmt, args...);
+}
+
+template<typename F, typename... Args, typename = detail::EnableIfFormat<F> >
+inline void Print(std::ostream &os, F fmt, const Args&... args)
+{
+	MemoryBuffer<> out;
+	FormatTo(out, fmt, args...);
+	os.write(out.Data(), static_cast<std::streamsize>(out.Size()));
+}
+
+namespace detail
+{
+/// "[a, b, c]" with spec applied to every element (the color to the whole range)
+template<typename It>
+inline void FormatRange(FormatBuffer &out, It begin, It end, const FormatSpec &spec)
+{
+	FormatSpec element = spec;
+	element.color = -1;
+	out.Push('[');
+	for (It it = begin; it != end; ++it) {
+		if (it != begin) {
+			out.Append(", ", 2);
+		}
+		WriteArg(out, MakeArg(*it), element);
+	}
+	out.Push(']');
+}
+}
+
+template<typename T, typename A>
+struct Formatter<std::vector<T, A> >
+{
+	static void Format(FormatBuffer &out, const std::vector<T, A> &v, const FormatSpec &spec)
+	{
+		detail::FormatRange(out, v.begin(), v.end(), spec);
+	}
+};
+
+template<typename T, size_t N>
+struct Formatter<std::array<T, N> >
+{
+	static void Format(FormatBuffer &out, const std::array<T, N> &v, const FormatSpec &spec)
+	{
+		detail::FormatRange(out, v.begin(), v.end(), spec);
+	}
+};
+
+} /* namespace FUTILS */
+
+#endif /* FUTILS_FORMAT_H_ */
@@ -0,0 +1,418 @@
+/**
+ * @brief Interned strings for identifiers repeated across logs and metrics.
+ *
+ * @details The utilities implemented include:
+ * 			- StringInterner: concurrent string table handing out stable ids and views; lookups
+ * 			  never lock, only the first insertion of a string takes the writer mutex
+ * 			- InternedString: pointer-sized handle, compared and hashed in O(1)
+ * 			- Intern(): shortcut to the process-wide interner
+ * 			- DebugMsg() overload taking an interned tag
+ *
+ * 			Interned strings are never freed: the table is meant for a bounded set of names
+ * 			(entities, labels, hostnames, metric keys), not for arbitrary payloads.
+ *
+ * 			Example:
+ * 				static const FUTILS::InternedString kTag = FUTILS::Intern("sender");
+ * 				std::cerr << DebugMsg(LogEntities::Generic, "started\n", kTag);
+ */
+
+#ifndef FUTILS_INTERN_H_
+#define FUTILS_INTERN_H_
+
+#include "futils.h"
+#include "futils_checksum.h"
+
+#include <atomic>
+#include <mutex>
+#if __cplusplus >= 201703L
+#	include <string_view>
+#endif
+
+namespace FUTILS
+{
+
+namespace detail
+{
+/// Header of an interned string, followed in the arena by the NUL terminated characters
+struct InternEntry
+{
+	uint64_t hash;
+	uint32_t id;
+	uint32_t len;
+
+	const char* Data() const
+	{
+		return reinterpret_cast<const char*>(this + 1);
+	}
+};
+}
+
+/**
+ * Handle to an interned string. Two handles from the same interner are equal if and only if
+ * the strings are equal, so comparison is a pointer comparison. A default constructed handle
+ * is empty (id 0, "").
+ */
+class InternedString
+{
+public:
+	InternedString() :
+		entry(nullptr)
+	{
+	}
+
+	explicit InternedString(const detail::InternEntry *entry) :
+		entry(entry)
+	{
+	}
+
+	/// Dense id (1, 2, ...) in insertion order, usable as an array index; 0 for the empty handle
+	uint32_t Id() const
+	{
+		return entry ? entry->id : 0;
+	}
+
+	const char* c_str() const
+	{
+		return entry ? entry->Data() : "";
+	}
+
+	size_t size() const
+	{
+		return entry ? entry->len : 0;
+	}
+
+	bool Valid() const
+	{
+		return entry != nullptr;
+	}
+
+	uint64_t Hash() const
+	{
+		return entry ? entry->hash : 0;
+	}
+
+	std::string str() const
+	{
+		return std::string(c_str(), size());
+	}
+
+#if __cplusplus >= 201703L
+	std::string_view View() const
+	{
+		return std::string_view(c_str(), size());
+	}
+#endif
+
+	bool operator==(const InternedString &o) const
+	{
+		return entry == o.entry;
+	}
+
+	bool operator!=(const InternedString &o) const
+	{
+		return entry != o.entry;
+	}
+
+	/// Orders by id (insertion order), not alphabetically
+	bool operator<(const InternedString &o) const
+	{
+		return Id() < o.Id();
+	}
+
+private:
+	const detail::InternEntry *entry;
+};
+
+inline std::ostream& operator<<(std::ostream &os, const InternedString &s)
+{
+	return os.write(s.c_str(), static_cast<std::streamsize>(s.size()));
+}
+
+/**
+ * Concurrent string interner.
+ *
+ * Strings live in an append-only arena, so views and handles stay valid for the lifetime of the
+ * interner. The hash index is an open-addressed table of (hash tag, id) words: readers probe it
+ * without locking; the writer publishes the entry before the slot that points to it, and on growth
+ * publishes a rehashed copy with a single pointer swap (old tables are kept, never freed while in
+ * use). Ids map to entries through a two level directory that also only grows.
+ */
+class StringInterner
+{
+public:
+	/// Maximum number of strings: kSegmentSize * kMaxSegments
+	static const uint32_t kSegmentSize = 4096;
+	static const uint32_t kMaxSegments = 1024;
+
+	explicit StringInterner(size_t initialCapacity = 1024) :
+		count(0), arenaUsed(kChunkSize), arenaBytes(0)
+	{
+		size_t capacity = 16;
+		while (capacity < initialCapacity * 2) {
+			capacity <<= 1;
+		}
+		tables.push_back(std::unique_ptr<Table>(new Table(capacity)));
+		current.store(tables.back().get(), std::memory_order_release);
+		for (uint32_t i = 0; i < kMaxSegments; ++i) {
+			segments[i].store(nullptr, std::memory_order_relaxed);
+		}
+	}
+
+	~StringInterner()
+	{
+		for (uint32_t i = 0; i < kMaxSegments; ++i) {
+			delete[] segments[i].load(std::memory_order_relaxed);
+		}
+	}
+
+	StringInterner(const StringInterner&) = delete;
+	StringInterner& operator=(const StringInterner&) = delete;
+
+	/**
+	 * @brief Returns the handle of s, inserting it on first use.
+	 *
+	 * Lock-free when s is already interned. Dies when the id space is exhausted.
+	 */
+	InternedString Intern(const char *s, size_t len)
+	{
+		uint64_t hash = WyHash(s, len);
+		const detail::InternEntry *e = Probe(current.load(std::memory_order_acquire), hash, s, len);
+		if (e) {
+			return InternedString(e);
+		}
+		return Insert(hash, s, len);
+	}
+
+	InternedString Intern(const char *s)
+	{
+		return Intern(s, strlen(s));
+	}
+
+	InternedString Intern(const std::string &s)
+	{
+		return Intern(s.data(), s.size());
+	}
+
+	/// Lock-free lookup without insertion; returns an empty handle if s was never interned
+	InternedString Find(const char *s, size_t len) const
+	{
+		uint64_t hash = WyHash(s, len);
+		for (;;) {
+			const Table *table = current.load(std::memory_order_acquire);
+			const detail::InternEntry *e = Probe(table, hash, s, len);
+			// a miss is only final if no growth raced with the probe
+			if (e || table == current.load(std::memory_order_acquire)) {
+				return InternedString(e);
+			}
+		}
+	}
+
+	InternedString Find(const std::string &s) const
+	{
+		return Find(s.data(), s.size());
+	}
+
+	/// Handle of a previously returned id, empty if the id is unknown
+	InternedString Lookup(uint32_t id) const
+	{
+		if (id == 0 || id > count.load(std::memory_order_acquire)) {
+			return InternedString();
+		}
+		return InternedString(Entry(id));
+	}
+
+	/// Number of interned strings (also the largest id)
+	uint32_t Size() const
+	{
+		return count.load(std::memory_order_acquire);
+	}
+
+	/// Bytes used by the string arena
+	size_t ArenaBytes() const
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		return arenaBytes;
+	}
+
+private:
+	static const size_t kChunkSize = 64 * 1024;
+
+	struct Table
+	{
+		explicit Table(size_t capacity) :
+			mask(capacity - 1), slots(new std::atomic<uint64_t>[capacity])
+		{
+			for (size_t i = 0; i < capacity; ++i) {
+				slots[i].store(0, std::memory_order_relaxed);
+			}
+		}
+
+		size_t mask;
+		std::unique_ptr<std::atomic<uint64_t>[]> slots;
+	};
+
+	static uint64_t Tag(uint64_t hash)
+	{
+		return hash & 0xffffffff00000000ULL;
+	}
+
+	const detail::InternEntry* Entry(uint32_t id) const
+	{
+		uint32_t index = id - 1;
+		const std::atomic<const detail::InternEntry*> *segment = segments[index / kSegmentSize].load(std::memory_order_acquire);
+		return segment[index % kSegmentSize].load(std::memory_order_acquire);
+	}
+
+	const detail::InternEntry* Probe(const Table *table, uint64_t hash, const char *s, size_t len) const
+	{
+		for (size_t i = static_cast<size_t>(hash) & table->mask;; i = (i + 1) & table->mask) {
+			uint64_t slot = table->slots[i].load(std::memory_order_acquire);
+			if (slot == 0) {
+				return nullptr;
+			}
+			if (Tag(slot) == Tag(hash)) {
+				const detail::InternEntry *e = Entry(static_cast<uint32_t>(slot));
+				if (e->hash == hash && e->len == len && memcmp(e->Data(), s, len) == 0) {
+					return e;
+				}
+			}
+		}
+	}
+
+	static void Place(Table *table, uint64_t hash, uint32_t id)
+	{
+		size_t i = static_cast<size_t>(hash) & table->mask;
+		while (table->slots[i].load(std::memory_order_relaxed) != 0) {
+			i = (i + 1) & table->mask;
+		}
+		table->slots[i].store(Tag(hash) | id, std::memory_order_release);
+	}
+
+	InternedString Insert(uint64_t hash, const char *s, size_t len)
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		Table *table = current.load(std::memory_order_relaxed);
+		const detail::InternEntry *found = Probe(table, hash, s, len);
+		if (found) {
+			return InternedString(found);   // interned by another thread meanwhile
+		}
+		uint32_t id = count.load(std::memory_order_relaxed) + 1;
+		if (id > kSegmentSize * kMaxSegments || len > UINT32_MAX) {
+			die("StringInterner: capacity exhausted");
+		}
+
+		detail::InternEntry *e = Allocate(sizeof(detail::InternEntry) + len + 1);
+		e->hash = hash;
+		e->id = id;
+		e->len = static_cast<uint32_t>(len);
+		memcpy(const_cast<char*>(e->Data()), s, len);
+		const_cast<char*>(e->Data())[len] = '\0';
+
+		uint32_t index = id - 1;
+		std::atomic<const detail::InternEntry*> *segment = segments[index / kSegmentSize].load(std::memory_order_relaxed);
+		if (!segment) {
+			segment = new std::atomic<const detail::InternEntry*>[kSegmentSize];
+			segments[index / kSegmentSize].store(segment, std::memory_order_release);
+		}
+		segment[index % kSegmentSize].store(e, std::memory_order_release);
+
+		if ((static_cast<size_t>(id) * 2) > table->mask) {
+			Table *grown = new Table((table->mask + 1) * 2);
+			for (uint32_t i = 1; i <= id; ++i) {
+				const detail::InternEntry *old = Entry(i);
+				Place(grown, old->hash, old->id);
+			}
+			tables.push_back(std::unique_ptr<Table>(grown));
+			current.store(grown, std::memory_order_release);
+		} else {
+			Place(table, hash, id);
+		}
+		count.store(id, std::memory_order_release);
+		return InternedString(e);
+	}
+
+	/// Bump allocation from the current chunk; oversized strings get a chunk of their own
+	detail::InternEntry* Allocate(size_t bytes)
+	{
+		bytes = (bytes + alignof(detail::InternEntry) - 1) & ~(alignof(detail::InternEntry) - 1);
+		arenaBytes += bytes;
+		if (bytes > kChunkSize / 4) {
+			chunks.push_back(std::unique_ptr<uint64_t[]>(new uint64_t[bytes / sizeof(uint64_t)]));
+			return reinterpret_cast<detail::InternEntry*>(chunks.back().get());
+		}
+		if (arenaUsed + bytes > kChunkSize) {
+			chunks.push_back(std::unique_ptr<uint64_t[]>(new uint64_t[kChunkSize / sizeof(uint64_t)]));
+			head = reinterpret_cast<char*>(chunks.back().get());
+			arenaUsed = 0;
+		}
+		detail::InternEntry *e = reinterpret_cast<detail::InternEntry*>(head + arenaUsed);
+		arenaUsed += bytes;
+		return e;
+	}
+
+	std::atomic<Table*> current;
+	std::atomic<uint32_t> count;
+	std::atomic<std::atomic<const detail::InternEntry*>*> segments[kMaxSegments];
+
+	mutable std::mutex mtx;
+	std::vector<std::unique_ptr<Table> > tables;
+	std::vector<std::unique_ptr<uint64_t[]> > chunks;
+	char *head = nullptr;
+	size_t arenaUsed;
+	size_t arenaBytes;
+};
+
+/**
+ * @brief Process-wide interner used by Intern() and the logging helpers.
+ *
+ * Intentionally leaked, so handles stay valid in threads still logging while the program exits.
+ */
+inline StringInterner& GlobalInterner()
+{
+	static StringInterner *interner = new StringInterner();
+	return *interner;
+}
+
+inline InternedString Intern(const char *s, size_t len)
+{
+	return GlobalInterner().Intern(s, len);
+}
+
+inline InternedString Intern(const char *s)
+{
+	return GlobalInterner().Intern(s);
+}
+
+inline InternedString Intern(const std::string &s)
+{
+	return GlobalInterner().Intern(s);
+}
+
+} /* namespace FUTILS */
+
+namespace std
+{
+template<>
+struct hash<FUTILS::InternedString>
+{
+	size_t operator()(const FUTILS::InternedString &s) const
+	{
+		return static_cast<size_t>(s.Hash());
+	}
+};
+}
+
+/// DebugMsg() with an interned Generic tag: no temporary string is built for the tag
+inline std::string DebugMsg(const LogEntities entity, const std::string &inputMsg, const FUTILS::InternedString &generic)
+{
+	if (entity != LogEntities::Generic) {
+		return DebugMsg(entity, inputMsg);
+	}
+	std::string msg;
+	msg.reserve(generic.size() + inputMsg.size() + 24);
+	msg.append(LogEntityColor(LogEntities::Generic)).append("[", 1).append(generic.c_str(), generic.size()).append("] ", 2);
+	msg.append(tc::none).append(inputMsg);
+	return msg;
+}
+
+#endif /* FUTILS_INTERN_H_ */
@@ -0,0 +1,507 @@
+/**
+ * @brief Adaptive jitter buffer for periodic streams (sensor frames, audio) received over UDP.
+ *
+ * @details The utilities implemented include:
+ * 			- JitterOptions: frame period, fraction of frames allowed to miss their slot and
+ * 			  delay bounds (the latency/loss trade-off), slot count and payload size
+ * 			- JitterBuffer: the receive thread timestamps and stores frames with Push(), the
+ * 			  consumer thread takes one per period with Release() or Play(); the two threads only
+ * 			  share atomics (single producer, single consumer, no lock)
+ * 			- JitterStats: arrival, playout and adaptation counters, exported with ForEach()
+ *
+ * 			Frame k is due at base + k * period + delay. base is the shortest transit seen
+ * 			(arrival - k * period, minimum over the current and the previous epoch, so clock
+ * 			drift is followed) and delay the quantile of the transit variation above it that
+ * 			leaves lossTarget of the frames late. The variation is kept in a histogram whose
+ * 			counts are halved every historyFrames arrivals, so the delay follows the network:
+ * 			it rises as soon as the estimate does and decays slowly. When the delay grows the
+ * 			consumer gets a Stretch (no frame this period); when it shrinks a frame is skipped.
+ *
+ * 			Example:
+ * 			@code
+ * 			FUTILS::JitterOptions opt;
+ * 			opt.periodNs = 1000000;                         // 1 kHz sensor
+ * 			opt.lossTarget = 0.001;
+ * 			FUTILS::JitterBuffer jitter(opt);
+ * 			std::thread rx([&] {
+ * 				while (receiver.Receive(batch) > 0) {
+ * 					jitter.Push(batch, FUTILS::SequenceField(0, 4), FUTILS::MonotonicNs());
+ * 				}
+ * 			});
+ * 			FUTILS::PeriodicScheduler tick(opt.periodNs);
+ * 			for (;;) {                                      // control loop
+ * 				if (jitter.Play(tick, [](const FUTILS::JitterFrame &f) { Control(f.data, f.length); }) != FUTILS::JitterEvent::Frame) {
+ * 					Extrapolate();
+ * 				}
+ * 			}
+ * 			@endcode
+ */
+
+#ifndef FUTILS_JITTER_H_
+#define FUTILS_JITTER_H_
+
+#include "futils.h"
+#include "futils_sequence.h"
+#include "futils_time.h"
+#include "futils_udpbatch.h"
+
+#if defined(__linux__) || defined(linux)
+
+#include <atomic>
+#include <memory>
+
+namespace FUTILS
+{
+
+enum class JitterEvent
+{
+	Idle,       ///< nothing to play yet
+	Frame,      ///< the due frame was delivered
+	Missing,    ///< the due frame was lost or is late: conceal it
+	Stretch,    ///< the delay grew: no frame this period, hold the previous one
+};
+
+struct JitterOptions
+{
+	uint64_t periodNs = 1000000;        ///< frame period of the sender
+	double lossTarget = 0.01;           ///< fraction of frames allowed to arrive after their slot
+	uint64_t minDelayNs = 0;            ///< bounds of the adaptive delay
+	uint64_t maxDelayNs = 50000000;
+	uint64_t marginNs = 0;              ///< added to the estimated delay
+	uint32_t historyFrames = 4096;      ///< arrivals between two halvings of the histogram
+	uint32_t epochFrames = 4096;        ///< frames per minimum transit epoch
+	uint32_t slots = 256;               ///< frames buffered ahead of the playout (power of two)
+	uint32_t maxPayload = 2048;
+};
+
+/// A frame handed to the consumer, valid during the callback only
+struct JitterFrame
+{
+	uint64_t seq;           ///< sequence number extended to 64 bits
+	const uint8_t *data;
+	size_t length;
+	uint64_t arrivalNs;
+	uint64_t waitedNs;      ///< time spent in the buffer
+};
+
+struct JitterStats
+{
+	uint64_t received;
+	uint64_t played;
+	uint64_t missing;       ///< periods without the due frame
+	uint64_t late;          ///< arrived after their slot was played
+	uint64_t duplicates;
+	uint64_t overflows;     ///< too far ahead of the playout for the slots
+	uint64_t stretched;     ///< periods without frame because the delay grew
+	uint64_t skipped;       ///< frames dropped because the delay shrank or the consumer stalled
+	uint64_t resyncs;       ///< restarts on a new sequence (sender restart)
+	uint64_t invalid;
+	uint64_t delayNs;       ///< current playout delay
+
+	/// Calls f(name, value) for each counter, for a metrics exporter
+	template<typename F>
+	void ForEach(F &&f) const
+	{
+		f("received", received);
+		f("played", played);
+		f("missing", missing);
+		f("late", late);
+		f("duplicates", duplicates);
+		f("overflows", overflows);
+		f("stretched", stretched);
+		f("skipped", skipped);
+		f("resyncs", resyncs);
+		f("invalid", invalid);
+		f("delay_ns", delayNs);
+	}
+};
+
+namespace detail
+{
+
+/// Increment of a counter written by one thread only (no locked instruction)
+inline void JitterCount(std::atomic<uint64_t> &counter, uint64_t n = 1)
+{
+	counter.store(counter.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+}
+
+/// CLOCK_REALTIME in nanoseconds, the clock of the kernel receive timestamps
+inline uint64_t RealtimeNs()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	return static_cast<uint64_t>(ts.tv_sec) * 1000000000ULL + static_cast<uint64_t>(ts.tv_nsec);
+}
+
+} /* namespace detail */
+
+/**
+ * Playout of a periodic stream at a steady cadence. Push() is called by one receive thread and
+ * Release()/Play() by one consumer thread; the estimator belongs to the first, the playout
+ * position to the second.
+ *
+ * A frame is written into slot seq % slots only while it is ahead of the playout position and
+ * within slots of it, and published by a release store of its sequence number, so the consumer
+ * never reads a slot being written.
+ */
+class JitterBuffer
+{
+public:
+	static const uint32_t kBins = 512;
+	/// Histogram quantile recomputed every this many arrivals
+	static const unsigned kRecomputeEvery = 16;
+	/// A lower delay estimate closes 1/kReleaseDivisor of the gap per recomputation
+	static const unsigned kReleaseDivisor = 16;
+	/// Consecutive sequence numbers this many in a row, all behind the playout, mean the sender restarted
+	static const unsigned kResyncAfter = 16;
+
+	explicit JitterBuffer(const JitterOptions &options = JitterOptions()) :
+		opt(options), primed(false), highest(0), currentMin(0), previousMin(0), epochEnd(0),
+		histTotal(0), sinceRecompute(0), lateStreak(0), lateLast(0), playing(false),
+		started(false), base(0), delay(0), playHead(0), resync(0)
+	{
+		uint32_t n = 2;
+		while (n < opt.slots) {
+			n <<= 1;
+		}
+		mask = n - 1;
+		slots.reset(new Slot[n]);
+		for (uint32_t i = 0; i < n; ++i) {
+			slots[i].tag.store(kNoFrame, std::memory_order_relaxed);
+		}
+		storage.assign(static_cast<size_t>(n) * opt.maxPayload, 0);
+		opt.periodNs = std::max<uint64_t>(opt.periodNs, 1);
+		opt.maxDelayNs = std::max(opt.maxDelayNs, opt.minDelayNs);
+		binNs = std::max<uint64_t>(opt.maxDelayNs / kBins, 1);
+		memset(hist, 0, sizeof(hist));
+		delay.store(ClampDelay(0), std::memory_order_relaxed);
+		ResetCounters();
+	}
+
+	JitterBuffer(const JitterBuffer&) = delete;
+	JitterBuffer& operator=(const JitterBuffer&) = delete;
+
+	/**
+	 * @brief Receive thread: stores a frame that arrived at arrivalNs (MonotonicNs() clock).
+	 *
+	 * @return true if the frame was stored, false if it is late, a duplicate, too far ahead or
+	 * larger than maxPayload (counted in Stats())
+	 */
+	bool Push(uint32_t seq, const uint8_t *data, size_t len, uint64_t arrivalNs)
+	{
+		if (len > opt.maxPayload) {
+			detail::JitterCount(invalid);
+			return false;
+		}
+		uint64_t ext = primed ? highest + static_cast<uint64_t>(static_cast<int64_t>(SequenceDelta(seq, static_cast<uint32_t>(highest))))
+				: (1ULL << 32) + seq;
+		int64_t transit = static_cast<int64_t>(arrivalNs) - static_cast<int64_t>(ext * opt.periodNs);
+		detail::JitterCount(received);
+		if (!primed) {
+			Start(ext, transit);
+		}
+		if (ext > highest) {
+			highest = ext;
+			if (ext >= epochEnd) {
+				previousMin = currentMin;
+				currentMin = transit;
+				epochEnd = ext + opt.epochFrames;
+			}
+		}
+		currentMin = std::min(currentMin, transit);
+		Estimate(transit);
+
+		// the consumer applies a resync before it moves the playout position
+		if (resync.load(std::memory_order_acquire) != 0) {
+			detail::JitterCount(late);
+			return false;
+		}
+		uint64_t head = playHead.load(std::memory_order_acquire);
+		if (ext < head) {
+			detail::JitterCount(late);
+			lateStreak = (lateStreak > 0 && ext == lateLast + 1) ? lateStreak + 1 : 1;
+			lateLast = ext;
+			if (lateStreak >= kResyncAfter) {
+				Restart(ext, transit);
+			}
+			return false;
+		}
+		lateStreak = 0;
+		if (ext - head > mask) {
+			detail::JitterCount(overflows);
+			return false;
+		}
+		Slot &slot = slots[ext & mask];
+		if (slot.tag.load(std::memory_order_acquire) == ext) {
+			detail::JitterCount(duplicates);
+			return false;
+		}
+		memcpy(&storage[(ext & mask) * opt.maxPayload], data, len);
+		slot.length = static_cast<uint32_t>(len);
+		slot.arrivalNs = arrivalNs;
+		slot.tag.store(ext, std::memory_order_release);
+		return true;
+	}
+
+	/**
+	 * @brief Receive thread: stores the datagrams of a batch.
+	 *
+	 * Uses the kernel receive timestamps when the batch has them (converted to the monotonic
+	 * clock), nowNs otherwise.
+	 *
+	 * @return number of frames stored
+	 */
+	size_t Push(const PacketBatch &batch, const SequenceField &field, uint64_t nowNs)
+	{
+		size_t stored = 0;
+		int64_t offset = 0;
+		bool haveOffset = false;
+		for (size_t i = 0; i < batch.Size(); ++i) {
+			uint32_t seq;
+			if (!field.Read(batch.Payload(i), batch.Length(i), static_cast<uint32_t>(highest), seq)) {
+				detail::JitterCount(invalid);
+				continue;
+			}
+			uint64_t arrival = nowNs;
+			if (batch.Timestamp(i)) {
+				if (!haveOffset) {
+					offset = static_cast<int64_t>(detail::RealtimeNs()) - static_cast<int64_t>(MonotonicNs());
+					haveOffset = true;
+				}
+				arrival = std::min(nowNs, static_cast<uint64_t>(static_cast<int64_t>(batch.Timestamp(i)) - offset));
+			}
+			stored += Push(seq, batch.Payload(i), batch.Length(i), arrival);
+		}
+		return stored;
+	}
+
+	/**
+	 * @brief Consumer thread: plays the frame due at nowNs, once per period.
+	 *
+	 * deliver(const JitterFrame&) is called for a Frame only.
+	 */
+	template<typename Deliver>
+	JitterEvent Release(uint64_t nowNs, Deliver &&deliver)
+	{
+		if (!started.load(std::memory_order_acquire)) {
+			return JitterEvent::Idle;
+		}
+		uint64_t head = playHead.load(std::memory_order_relaxed);
+		uint64_t target = resync.load(std::memory_order_acquire);
+		if (target != 0) {
+			// the producer stores nothing until resync is cleared: old frames can be forgotten
+			for (uint32_t i = 0; i <= mask; ++i) {
+				slots[i].tag.store(kNoFrame, std::memory_order_relaxed);
+			}
+			head = target;
+			playHead.store(head, std::memory_order_relaxed);
+			resync.store(0, std::memory_order_release);
+			playing = false;
+		}
+
+		int64_t period = static_cast<int64_t>(opt.periodNs);
+		int64_t due = base.load(std::memory_order_relaxed) + static_cast<int64_t>(head * opt.periodNs)
+				+ static_cast<int64_t>(delay.load(std::memory_order_relaxed));
+		int64_t lead = static_cast<int64_t>(nowNs) - due;
+		// played in the period and a quarter after its due time, never before it: the band is wider
+		// than a period so a stretch is not followed by a skip when the ticks are a little late
+		if (lead < 0) {
+			if (!playing) {
+				return JitterEvent::Idle;
+			}
+			detail::JitterCount(stretched);
+			return JitterEvent::Stretch;
+		}
+		if (lead >= period + period / 4) {
+			// a shrinking delay drops one frame per period; a stall or a jump of the stream catches up at once
+			uint64_t behind = static_cast<uint64_t>(lead / period);
+			uint64_t skip = lead > static_cast<int64_t>(opt.maxDelayNs) ? behind : 1;
+			head += skip;
+			detail::JitterCount(skipped, skip);
+		}
+		playing = true;
+
+		JitterEvent event = JitterEvent::Missing;
+		Slot &slot = slots[head & mask];
+		if (slot.tag.load(std::memory_order_acquire) == head) {
+			JitterFrame frame;
+			frame.seq = head;
+			frame.data = &storage[(head & mask) * opt.maxPayload];
+			frame.length = slot.length;
+			frame.arrivalNs = slot.arrivalNs;
+			frame.waitedNs = nowNs > slot.arrivalNs ? nowNs - slot.arrivalNs : 0;
+			deliver(frame);
+			detail::JitterCount(played);
+			event = JitterEvent::Frame;
+		} else {
+			detail::JitterCount(missing);
+		}
+		// the slot may be reused by the producer from here on
+		playHead.store(head + 1, std::memory_order_release);
+		return event;
+	}
+
+	/// Consumer thread: waits for the next tick of scheduler, then Release()
+	template<typename Deliver>
+	JitterEvent Play(PeriodicScheduler &scheduler, Deliver &&deliver)
+	{
+		scheduler.Wait();
+		return Release(MonotonicNs(), deliver);
+	}
+
+	/// Current playout delay above the shortest transit, ns
+	uint64_t DelayNs() const
+	{
+		return delay.load(std::memory_order_relaxed);
+	}
+
+	/// Next sequence number to play (extended to 64 bits)
+	uint64_t PlayHead() const
+	{
+		return playHead.load(std::memory_order_relaxed);
+	}
+
+	const JitterOptions& Options() const
+	{
+		return opt;
+	}
+
+	/// Counters snapshot, from any thread
+	JitterStats Stats() const
+	{
+		JitterStats s;
+		s.received = received.load(std::memory_order_relaxed);
+		s.played = played.load(std::memory_order_relaxed);
+		s.missing = missing.load(std::memory_order_relaxed);
+		s.late = late.load(std::memory_order_relaxed);
+		s.duplicates = duplicates.load(std::memory_order_relaxed);
+		s.overflows = overflows.load(std::memory_order_relaxed);
+		s.stretched = stretched.load(std::memory_order_relaxed);
+		s.skipped = skipped.load(std::memory_order_relaxed);
+		s.resyncs = resyncs.load(std::memory_order_relaxed);
+		s.invalid = invalid.load(std::memory_order_relaxed);
+		s.delayNs = DelayNs();
+		return s;
+	}
+
+private:
+	static const uint64_t kNoFrame = ~0ULL;
+
+	struct Slot
+	{
+		std::atomic<uint64_t> tag;      ///< sequence number of the frame held, kNoFrame if none
+		uint32_t length;
+		uint64_t arrivalNs;
+	};
+
+	void Start(uint64_t ext, int64_t transit)
+	{
+		primed = true;
+		highest = ext;
+		currentMin = previousMin = transit;
+		epochEnd = ext + opt.epochFrames;
+		base.store(transit, std::memory_order_relaxed);
+		playHead.store(ext, std::memory_order_relaxed);
+		started.store(true, std::memory_order_release);
+	}
+
+	/// The sender restarted at ext: the consumer moves to it on its next Release()
+	void Restart(uint64_t ext, int64_t transit)
+	{
+		highest = ext;
+		currentMin = previousMin = transit;
+		epochEnd = ext + opt.epochFrames;
+		lateStreak = 0;
+		base.store(transit, std::memory_order_relaxed);
+		resync.store(ext + 1, std::memory_order_release);
+		detail::JitterCount(resyncs);
+	}
+
+	void Estimate(int64_t transit)
+	{
+		int64_t shortest = std::min(currentMin, previousMin);
+		base.store(shortest, std::memory_order_relaxed);
+		uint64_t bin = static_cast<uint64_t>(transit - shortest) / binNs;
+		++hist[std::min<uint64_t>(bin, kBins - 1)];
+		if (++histTotal >= opt.historyFrames) {
+			histTotal = 0;
+			for (uint32_t i = 0; i < kBins; ++i) {
+				hist[i] >>= 1;
+				histTotal += hist[i];
+			}
+		}
+		if (++sinceRecompute < kRecomputeEvery) {
+			return;
+		}
+		sinceRecompute = 0;
+		uint64_t keep = static_cast<uint64_t>(static_cast<double>(histTotal) * (1.0 - opt.lossTarget) + 0.5);
+		uint64_t sum = 0;
+		uint32_t q = 0;
+		while (q < kBins - 1 && (sum += hist[q]) < keep) {
+			++q;
+		}
+		// up at once, down by a fraction of the excess: a quiet spell does not cost the next burst
+		uint64_t current = delay.load(std::memory_order_relaxed);
+		uint64_t wanted = ClampDelay((q + 1) * binNs + opt.marginNs);
+		if (wanted < current) {
+			wanted = current - (current - wanted + kReleaseDivisor - 1) / kReleaseDivisor;
+		}
+		delay.store(wanted, std::memory_order_relaxed);
+	}
+
+	uint64_t ClampDelay(uint64_t ns) const
+	{
+		return std::min(std::max(ns, opt.minDelayNs), opt.maxDelayNs);
+	}
+
+	void ResetCounters()
+	{
+		received = played = missing = late = duplicates = overflows = 0;
+		stretched = skipped = resyncs = invalid = 0;
+	}
+
+	JitterOptions opt;
+	uint32_t mask;
+	uint64_t binNs;
+	std::unique_ptr<Slot[]> slots;
+	std::vector<uint8_t> storage;
+
+	// receive thread
+	bool primed;
+	uint64_t highest;
+	int64_t currentMin;
+	int64_t previousMin;
+	uint64_t epochEnd;
+	uint32_t hist[kBins];
+	uint64_t histTotal;
+	unsigned sinceRecompute;
+	unsigned lateStreak;
+	uint64_t lateLast;
+
+	// consumer thread
+	bool playing;
+
+	// shared
+	alignas(64) std::atomic<bool> started;
+	std::atomic<int64_t> base;          ///< shortest transit, written by the receive thread
+	std::atomic<uint64_t> delay;
+	alignas(64) std::atomic<uint64_t> playHead;     ///< written by the consumer thread
+	alignas(64) std::atomic<uint64_t> resync;       ///< sequence to restart at (after the frame that revealed the restart), 0 if none
+
+	alignas(64) std::atomic<uint64_t> received;
+	std::atomic<uint64_t> late;
+	std::atomic<uint64_t> duplicates;
+	std::atomic<uint64_t> overflows;
+	std::atomic<uint64_t> resyncs;
+	std::atomic<uint64_t> invalid;
+	alignas(64) std::atomic<uint64_t> played;
+	std::atomic<uint64_t> missing;
+	std::atomic<uint64_t> stretched;
+	std::atomic<uint64_t> skipped;
+};
+
+} /* namespace FUTILS */
+
+#endif /* Linux functions*/
+
+#endif /* FUTILS_JITTER_H_ */
@@ -0,0 +1,702 @@
+/**
+ * @brief Deferred logging: arguments are captured on the calling thread and formatted later by a
+ * background thread (requires C++17).
+ *
+ * @details The utilities implemented include:
+ * 			- FUTILS_LOG(entity, "format", args...), FUTILS_LOG_GENERIC("tag", "format", args...):
+ * 			  the format string is checked at compile time (see futils_format.h), the call site
+ * 			  keeps its metadata (entity, tag, file, line) in a static LogSite
+ * 			- per-thread single producer ring: a log call copies a pointer to the site, the
+ * 			  timestamp and the raw argument bytes, nothing is formatted or allocated
+ * 			- DeferredLogger: background thread merging the rings by timestamp, formatting the
+ * 			  lines as DebugMsg() does and handing them to a sink in batches
+ * 			- LogCodec<T>: customization point serializing arguments that are not trivially
+ * 			  copyable (strings are copied, so their lifetime does not matter)
+ *
+ * 			While the logger is not started the macros format and write synchronously, so nothing
+ * 			is lost in tools that never start it. A full ring drops the message and counts it.
+ *
+ * 			Example:
+ * 				FUTILS::DeferredLogger::Instance().Start();
+ * 				coordinator.RegisterFlushable("log", FUTILS::DeferredLogger::Instance());
+ * 				FUTILS_LOG(LogEntities::UDPSender, "sent {} bytes to {}", n, peerName);
+ */
+
+#ifndef FUTILS_LOG_H_
+#define FUTILS_LOG_H_
+
+#include "futils.h"
+#include "futils_format.h"
+#include "futils_intern.h"
+
+#if defined(__linux__) || defined(linux)
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <tuple>
+#if defined(__x86_64__)
+#	include <x86intrin.h>
+#endif
+
+namespace FUTILS
+{
+
+/// Static metadata of a log call site
+struct LogSite
+{
+	LogEntities entity;
+	const char *tag;        ///< label used for LogEntities::Generic
+	const char *file;
+	int line;
+};
+
+/**
+ * Serialization of a log argument into the ring. The default copies trivially copyable types;
+ * specialize it for other types with:
+ * 	using Decoded = ...;                                     // type handed to the formatter
+ * 	static size_t Size(const T &value);
+ * 	static void Encode(char *&dst, const T &value);           // advances dst by Size()
+ * 	static Decoded Decode(const char *&src);                  // advances src, may point into it
+ */
+template<typename T, typename Enable = void>
+struct LogCodec
+{
+	static_assert(std::is_trivially_copyable<T>::value, "specialize FUTILS::LogCodec<T> for log arguments that are not trivially copyable");
+
+	using Decoded = T;
+
+	static size_t Size(const T&)
+	{
+		return sizeof(T);
+	}
+
+	static void Encode(char *&dst, const T &value)
+	{
+		memcpy(dst, &value, sizeof(T));
+		dst += sizeof(T);
+	}
+
+	static T Decode(const char *&src)
+	{
+		T value;
+		memcpy(&value, src, sizeof(T));
+		src += sizeof(T);
+		return value;
+	}
+};
+
+namespace detail
+{
+/// Length prefixed copy of a string, decoded as a view into the ring
+struct LogStringCodec
+{
+	using Decoded = std::string_view;
+
+	static size_t Size(std::string_view s)
+	{
+		return sizeof(uint32_t) + s.size();
+	}
+
+	static void Encode(char *&dst, std::string_view s)
+	{
+		uint32_t len = static_cast<uint32_t>(s.size());
+		memcpy(dst, &len, sizeof(len));
+		memcpy(dst + sizeof(len), s.data(), len);
+		dst += sizeof(len) + len;
+	}
+
+	static std::string_view Decode(const char *&src)
+	{
+		uint32_t len;
+		memcpy(&len, src, sizeof(len));
+		std::string_view s(src + sizeof(len), len);
+		src += sizeof(len) + len;
+		return s;
+	}
+};
+}
+
+template<>
+struct LogCodec<const char*> : detail::LogStringCodec
+{
+	static size_t Size(const char *s)
+	{
+		return LogStringCodec::Size(s ? s : "(null)");
+	}
+
+	static void Encode(char *&dst, const char *s)
+	{
+		LogStringCodec::Encode(dst, s ? s : "(null)");
+	}
+};
+
+template<>
+struct LogCodec<char*> : LogCodec<const char*>
+{
+};
+
+template<>
+struct LogCodec<std::string> : detail::LogStringCodec
+{
+};
+
+template<>
+struct LogCodec<std::string_view> : detail::LogStringCodec
+{
+};
+
+template<typename T, typename A>
+struct LogCodec<std::vector<T, A> >
+{
+	static_assert(std::is_trivially_copyable<T>::value, "vector elements must be trivially copyable");
+
+	using Decoded = std::vector<T>;
+
+	static size_t Size(const std::vector<T, A> &v)
+	{
+		return sizeof(uint32_t) + v.size() * sizeof(T);
+	}
+
+	static void Encode(char *&dst, const std::vector<T, A> &v)
+	{
+		uint32_t count = static_cast<uint32_t>(v.size());
+		memcpy(dst, &count, sizeof(count));
+		if (count) {
+			memcpy(dst + sizeof(count), v.data(), count * sizeof(T));
+		}
+		dst += sizeof(count) + count * sizeof(T);
+	}
+
+	static Decoded Decode(const char *&src)
+	{
+		uint32_t count;
+		memcpy(&count, src, sizeof(count));
+		Decoded v(count);
+		if (count) {
+			memcpy(v.data(), src + sizeof(count), count * sizeof(T));
+		}
+		src += sizeof(count) + count * sizeof(T);
+		return v;
+	}
+};
+
+/// Interned strings are logged as their handle (8 bytes) and printed as text
+template<>
+struct Formatter<InternedString>
+{
+	static void Format(FormatBuffer &out, const InternedString &s, const FormatSpec &spec)
+	{
+		detail::WriteString(out, s.c_str(), s.size(), spec);
+	}
+};
+
+namespace detail
+{
+typedef void (*LogFormatFn)(FormatBuffer &out, const char *args);
+
+/// Record header in the ring, followed by the encoded arguments; site == nullptr marks padding
+struct LogRecord
+{
+	const LogSite *site;
+	LogFormatFn format;
+	uint64_t ticks;
+	uint32_t size;          ///< header + arguments, rounded up to 8 bytes
+	uint32_t reserved;
+};
+
+template<typename F, typename... Args>
+inline void FormatLogRecord(FormatBuffer &out, const char *args)
+{
+	// braced initialization decodes the arguments left to right
+	std::tuple<typename LogCodec<Args>::Decoded...> values { LogCodec<Args>::Decode(args)... };
+	(void)args;
+	std::apply([&out](const auto&... v) { FormatTo(out, F(), v...); }, values);
+}
+
+inline uint64_t LogTicks()
+{
+#if defined(__x86_64__)
+	return __rdtsc();
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return static_cast<uint64_t>(ts.tv_sec) * 1000000000ULL + static_cast<uint64_t>(ts.tv_nsec);
+#endif
+}
+
+inline uint64_t LogRealtimeNs()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	return static_cast<uint64_t>(ts.tv_sec) * 1000000000ULL + static_cast<uint64_t>(ts.tv_nsec);
+}
+
+/**
+ * Single producer (the owning thread), single consumer (the logger thread) byte ring.
+ * Records never wrap: when one does not fit before the end, the rest of the buffer is padding.
+ */
+struct LogRing
+{
+	explicit LogRing(size_t capacity) :
+		head(0), tail(0), cachedTail(0), closed(false), dropped(0), reported(0),
+		storage(new uint64_t[capacity / sizeof(uint64_t)]), data(reinterpret_cast<char*>(storage.get())),
+		capacity(capacity)
+	{
+	}
+
+	/// Producer: returns space for bytes (multiple of 8) or nullptr if the ring is full
+	char* Reserve(size_t bytes, size_t &padding)
+	{
+		uint64_t h = head.load(std::memory_order_relaxed);
+		size_t offset = static_cast<size_t>(h & (capacity - 1));
+		padding = bytes <= capacity - offset ? 0 : capacity - offset;
+		if (h + padding + bytes - cachedTail > capacity) {
+			cachedTail = tail.load(std::memory_order_acquire);
+			if (h + padding + bytes - cachedTail > capacity) {
+				return nullptr;
+			}
+		}
+		if (padding) {
+			reinterpret_cast<LogRecord*>(data + offset)->site = nullptr;
+			offset = 0;
+		}
+		return data + offset;
+	}
+
+	void Commit(size_t bytes, size_t padding)
+	{
+		head.store(head.load(std::memory_order_relaxed) + padding + bytes, std::memory_order_release);
+	}
+
+	/// Consumer: next record, skipping padding, or nullptr if empty
+	const LogRecord* Peek()
+	{
+		uint64_t t = tail.load(std::memory_order_relaxed);
+		uint64_t h = head.load(std::memory_order_acquire);
+		while (t != h) {
+			const LogRecord *r = reinterpret_cast<const LogRecord*>(data + (t & (capacity - 1)));
+			if (r->site) {
+				return r;
+			}
+			t += capacity - (t & (capacity - 1));
+			tail.store(t, std::memory_order_release);
+		}
+		return nullptr;
+	}
+
+	void Pop(const LogRecord *r)
+	{
+		tail.store(tail.load(std::memory_order_relaxed) + r->size, std::memory_order_release);
+	}
+
+	alignas(64) std::atomic<uint64_t> head;
+	alignas(64) std::atomic<uint64_t> tail;
+	alignas(64) uint64_t cachedTail;        ///< producer's last view of tail
+	std::atomic<bool> closed;               ///< owner thread exited
+	std::atomic<uint64_t> dropped;
+	uint64_t reported;                      ///< drops already reported (consumer)
+	std::unique_ptr<uint64_t[]> storage;
+	char *data;
+	size_t capacity;
+};
+
+/// Marks the ring of an exiting thread, the logger frees it once drained
+struct LogRingOwner
+{
+	~LogRingOwner()
+	{
+		if (ring) {
+			ring->closed.store(true, std::memory_order_release);
+		}
+	}
+
+	std::shared_ptr<LogRing> ring;
+};
+}
+
+/**
+ * Background side of the deferred logging. A process-wide instance, started once in main().
+ */
+class DeferredLogger
+{
+public:
+	typedef std::function<void(const char*, size_t)> Sink;
+
+	static DeferredLogger& Instance()
+	{
+		// leaked on purpose: threads may still log while static destructors run
+		static DeferredLogger *logger = new DeferredLogger();
+		return *logger;
+	}
+
+	DeferredLogger(const DeferredLogger&) = delete;
+	DeferredLogger& operator=(const DeferredLogger&) = delete;
+
+	/**
+	 * @brief Starts the formatting thread.
+	 *
+	 * @param sink receives batches of formatted lines (default: stderr)
+	 * @param pollInterval how often the rings are drained
+	 * @param ringBytes per-thread ring size (power of two)
+	 */
+	void Start(Sink sink = Sink(), std::chrono::microseconds pollInterval = std::chrono::microseconds(1000), size_t ringBytes = 256 * 1024)
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		if (running.load(std::memory_order_relaxed)) {
+			return;
+		}
+		if (ringBytes & (ringBytes - 1)) {
+			die("DeferredLogger: ring size must be a power of two");
+		}
+		{
+			std::lock_guard<std::mutex> formatLock(formatMtx);
+			this->sink = sink ? sink : Sink(WriteStderr);
+		}
+		this->pollInterval = pollInterval;
+		this->ringBytes = ringBytes;
+		Calibrate();
+		stopRequested = false;
+		running.store(true, std::memory_order_release);
+		worker = std::thread([this] { Run(); });
+		if (!dieHookAdded) {
+			dieHookAdded = true;
+			AddDieHook([](const std::string&) { DeferredLogger::Instance().Flush(); });
+		}
+	}
+
+	/// Drains every ring and joins the formatting thread; later calls log synchronously
+	void Stop()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mtx);
+			if (!running.load(std::memory_order_relaxed)) {
+				return;
+			}
+			running.store(false, std::memory_order_release);   // new messages take the synchronous path
+			stopRequested = true;
+			cv.notify_all();
+		}
+		worker.join();
+		Drain();
+	}
+
+	/// Returns once every message logged before the call has reached the sink
+	void Flush()
+	{
+		std::unique_lock<std::mutex> lock(mtx);
+		if (!running.load(std::memory_order_relaxed) || std::this_thread::get_id() == worker.get_id()) {
+			lock.unlock();
+			Drain();
+			return;
+		}
+		uint64_t ticket = ++flushRequested;
+		cv.notify_all();
+		flushedCv.wait(lock, [this, ticket] { return flushDone >= ticket || !running.load(std::memory_order_relaxed); });
+	}
+
+	bool Running() const
+	{
+		return running.load(std::memory_order_acquire);
+	}
+
+	/// Prefix lines with the wall clock time (default on)
+	void ShowTime(bool show)
+	{
+		showTime.store(show, std::memory_order_relaxed);
+	}
+
+	/// Prefix lines with file:line (default off)
+	void ShowLocation(bool show)
+	{
+		showLocation.store(show, std::memory_order_relaxed);
+	}
+
+	/// Messages dropped because a ring was full
+	uint64_t Dropped() const
+	{
+		std::lock_guard<std::mutex> lock(ringsMtx);
+		uint64_t total = droppedRetired;
+		for (size_t i = 0; i < rings.size(); ++i) {
+			total += rings[i]->dropped.load(std::memory_order_relaxed);
+		}
+		return total;
+	}
+
+	/// Ring of the calling thread, created on first use; nullptr when not running
+	detail::LogRing* ThreadRing()
+	{
+		thread_local detail::LogRingOwner owner;
+		if (!owner.ring) {
+			std::shared_ptr<detail::LogRing> ring = std::make_shared<detail::LogRing>(ringBytes);
+			std::lock_guard<std::mutex> lock(ringsMtx);
+			rings.push_back(ring);
+			owner.ring = ring;
+		}
+		return owner.ring.get();
+	}
+
+	/// Formats a line as the logger thread does (used for synchronous logging and by Drain(), both under formatMtx)
+	void FormatLine(FormatBuffer &out, const LogSite &site, uint64_t realtimeNs, detail::LogFormatFn format, const char *args)
+	{
+		if (showTime.load(std::memory_order_relaxed)) {
+			time_t secs = static_cast<time_t>(realtimeNs / 1000000000ULL);
+			if (secs != cachedSecond) {
+				struct tm tmv;
+				localtime_r(&secs, &tmv);
+				strftime(cachedClock, sizeof(cachedClock), "%H:%M:%S", &tmv);
+				cachedSecond = secs;
+			}
+			FormatTo(out, FUTILS_FMT("{}.{:06} "), static_cast<const char*>(cachedClock), (realtimeNs / 1000) % 1000000);
+		}
+		if (showLocation.load(std::memory_order_relaxed)) {
+			const char *slash = strrchr(site.file, '/');
+			FormatTo(out, FUTILS_FMT("{}:{} "), slash ? slash + 1 : site.file, site.line);
+		}
+		out.Append(std::string_view(LogEntityColor(site.entity)));
+		out.Push('[');
+		out.Append(std::string_view(site.entity == LogEntities::Generic ? site.tag : LogEntityName(site.entity)));
+		out.Append("] ", 2);
+		out.Append(std::string_view(tc::none));
+		size_t before = out.Size();
+		format(out, args);
+		if (out.Size() == before || out.View().back() != '\n') {
+			out.Push('\n');
+		}
+	}
+
+	/// Synchronous path, taken while the logger is not running or for oversized records
+	template<typename F, typename... Args>
+	void WriteNow(const LogSite &site, const Args&... args)
+	{
+		MemoryBuffer<512> encoded;
+		size_t argsSize = (static_cast<size_t>(0) + ... + LogCodec<std::decay_t<Args> >::Size(args));
+		encoded.Fill(0, argsSize);
+		char *p = const_cast<char*>(encoded.Data());
+		(LogCodec<std::decay_t<Args> >::Encode(p, args), ...);
+		(void)p;
+		MemoryBuffer<512> line;
+		std::lock_guard<std::mutex> lock(formatMtx);
+		FormatLine(line, site, detail::LogRealtimeNs(), &detail::FormatLogRecord<F, std::decay_t<Args>...>, encoded.Data());
+		(sink ? sink : Sink(WriteStderr))(line.Data(), line.Size());
+	}
+
+private:
+	DeferredLogger() :
+		running(false), stopRequested(false), dieHookAdded(false), flushRequested(0), flushDone(0),
+		ringBytes(256 * 1024), pollInterval(1000), showTime(true), showLocation(false),
+		droppedRetired(0), baseTicks(0), baseNs(0), nsPerTick(1.0), cachedSecond(-1)
+	{
+		cachedClock[0] = '\0';
+	}
+
+	static void WriteStderr(const char *data, size_t len)
+	{
+		while (len > 0) {
+			ssize_t n = ::write(STDERR_FILENO, data, len);
+			if (n < 0 && errno == EINTR) {
+				continue;
+			}
+			if (n <= 0) {
+				return;
+			}
+			data += n;
+			len -= static_cast<size_t>(n);
+		}
+	}
+
+	/// Maps TSC ticks to wall clock nanoseconds
+	void Calibrate()
+	{
+#if defined(__x86_64__)
+		uint64_t t0 = detail::LogTicks();
+		uint64_t n0 = detail::LogRealtimeNs();
+		std::this_thread::sleep_for(std::chrono::milliseconds(5));
+		uint64_t t1 = detail::LogTicks();
+		uint64_t n1 = detail::LogRealtimeNs();
+		nsPerTick = static_cast<double>(n1 - n0) / static_cast<double>(t1 - t0);
+		baseTicks = t1;
+		baseNs = n1;
+#else
+		baseTicks = detail::LogTicks();
+		baseNs = detail::LogRealtimeNs();
+		nsPerTick = 1.0;
+#endif
+	}
+
+	uint64_t TicksToRealtime(uint64_t ticks) const
+	{
+		return baseNs + static_cast<uint64_t>(static_cast<double>(static_cast<int64_t>(ticks - baseTicks)) * nsPerTick);
+	}
+
+	void Run()
+	{
+		std::unique_lock<std::mutex> lock(mtx);
+		while (!stopRequested) {
+			uint64_t ticket = flushRequested;
+			lock.unlock();
+			Drain();
+			lock.lock();
+			if (ticket > flushDone) {
+				flushDone = ticket;
+				flushedCv.notify_all();
+			}
+			cv.wait_for(lock, pollInterval, [this] { return stopRequested || flushRequested > flushDone; });
+		}
+		flushDone = flushRequested;
+		flushedCv.notify_all();
+	}
+
+	/// Formats every pending record, merging the threads by timestamp
+	void Drain()
+	{
+		std::lock_guard<std::mutex> drainLock(formatMtx);
+		std::vector<std::shared_ptr<detail::LogRing> > snapshot;
+		{
+			std::lock_guard<std::mutex> lock(ringsMtx);
+			snapshot = rings;
+		}
+		MemoryBuffer<64 * 1024> batch;
+		for (;;) {
+			detail::LogRing *oldest = nullptr;
+			const detail::LogRecord *record = nullptr;
+			for (size_t i = 0; i < snapshot.size(); ++i) {
+				const detail::LogRecord *r = snapshot[i]->Peek();
+				if (r && (!record || static_cast<int64_t>(r->ticks - record->ticks) < 0)) {
+					record = r;
+					oldest = snapshot[i].get();
+				}
+			}
+			if (!record) {
+				break;
+			}
+			FormatLine(batch, *record->site, TicksToRealtime(record->ticks), record->format,
+					reinterpret_cast<const char*>(record + 1));
+			oldest->Pop(record);
+			if (batch.Size() >= 48 * 1024) {
+				sink(batch.Data(), batch.Size());
+				batch.Clear();
+			}
+		}
+		for (size_t i = 0; i < snapshot.size(); ++i) {
+			detail::LogRing &ring = *snapshot[i];
+			uint64_t dropped = ring.dropped.load(std::memory_order_relaxed);
+			if (dropped != ring.reported) {
+				static const LogSite site = { LogEntities::Logger, "", __FILE__, __LINE__ };
+				auto format = FUTILS_FMT("{} messages dropped (ring full)");
+				uint64_t lost = dropped - ring.reported;
+				FormatLine(batch, site, detail::LogRealtimeNs(), &detail::FormatLogRecord<decltype(format), uint64_t>,
+						reinterpret_cast<const char*>(&lost));
+				ring.reported = dropped;
+			}
+		}
+		if (batch.Size()) {
+			sink(batch.Data(), batch.Size());
+		}
+		std::lock_guard<std::mutex> lock(ringsMtx);
+		for (size_t i = 0; i < rings.size();) {
+			if (rings[i]->closed.load(std::memory_order_acquire) && !rings[i]->Peek()) {
+				droppedRetired += rings[i]->dropped.load(std::memory_order_relaxed);
+				rings.erase(rings.begin() + static_cast<std::ptrdiff_t>(i));
+			} else {
+				++i;
+			}
+		}
+	}
+
+	std::atomic<bool> running;
+	bool stopRequested;
+	bool dieHookAdded;
+	uint64_t flushRequested;
+	uint64_t flushDone;
+	size_t ringBytes;
+	std::chrono::microseconds pollInterval;
+	std::atomic<bool> showTime;
+	std::atomic<bool> showLocation;
+	Sink sink;                              ///< guarded by formatMtx
+	std::thread worker;
+	std::mutex mtx;                         ///< start/stop/flush state
+	std::condition_variable cv;
+	std::condition_variable flushedCv;
+	std::mutex formatMtx;                   ///< serializes Drain() and WriteNow(), guards sink and the clock cache
+	mutable std::mutex ringsMtx;
+	std::vector<std::shared_ptr<detail::LogRing> > rings;
+	uint64_t droppedRetired;
+	uint64_t baseTicks;
+	uint64_t baseNs;
+	double nsPerTick;
+	time_t cachedSecond;
+	char cachedClock[16];
+};
+
+/**
+ * @brief Producer side of FUTILS_LOG: checks the format, copies the arguments into the ring.
+ */
+template<typename F, typename... Args>
+inline void DeferredLog(const LogSite &site, F, const Args&... args)
+{
+	static_assert(detail::CheckArgs<F, Args...>(), "invalid format");
+	DeferredLogger &logger = DeferredLogger::Instance();
+	if (!logger.Running()) {
+		logger.WriteNow<F>(site, args...);
+		return;
+	}
+	size_t argsSize = (static_cast<size_t>(0) + ... + LogCodec<std::decay_t<Args> >::Size(args));
+	size_t bytes = (sizeof(detail::LogRecord) + argsSize + 7) & ~static_cast<size_t>(7);
+	detail::LogRing *ring = logger.ThreadRing();
+	if (bytes > ring->capacity / 4) {
+		logger.WriteNow<F>(site, args...);
+		return;
+	}
+	size_t padding;
+	char *p = ring->Reserve(bytes, padding);
+	if (!p) {
+		ring->dropped.fetch_add(1, std::memory_order_relaxed);
+		return;
+	}
+	detail::LogRecord *record = reinterpret_cast<detail::LogRecord*>(p);
+	record->site = &site;
+	record->format = &detail::FormatLogRecord<F, std::decay_t<Args>...>;
+	record->ticks = detail::LogTicks();
+	record->size = static_cast<uint32_t>(bytes);
+	char *dst = p + sizeof(detail::LogRecord);
+	(LogCodec<std::decay_t<Args> >::Encode(dst, args), ...);
+	(void)dst;
+	ring->Commit(bytes, padding);
+}
+
+namespace detail
+{
+/// Target of the logging macros, which pass the format literal twice: as a type and as the first argument (skipped)
+template<typename F, size_t N, typename... Args>
+inline void DeferredLogLiteral(const LogSite &site, F format, const char (&)[N], const Args&... args)
+{
+	DeferredLog(site, format, args...);
+}
+} /* namespace detail */
+
+} /* namespace FUTILS */
+
+/// First argument of a macro argument list (the trailing ~ keeps "..." non-empty, as ISO C++17 requires)
+#define FUTILS_LOG_FORMAT(...) FUTILS_LOG_FORMAT_(__VA_ARGS__, ~)
+#define FUTILS_LOG_FORMAT_(format, ...) format
+
+/// Deferred log line of a LogEntities entity: FUTILS_LOG(entity, format, args...); the format is a string literal checked at compile time
+#define FUTILS_LOG(entity, ...) \
+	do { \
+		static const ::FUTILS::LogSite futilsLogSite = { entity, "", __FILE__, __LINE__ }; \
+		::FUTILS::detail::DeferredLogLiteral(futilsLogSite, FUTILS_FMT(FUTILS_LOG_FORMAT(__VA_ARGS__)), __VA_ARGS__); \
+	} while (0)
+
+/// Deferred log line with a LogEntities::Generic tag (a string literal): FUTILS_LOG_GENERIC(tag, format, args...)
+#define FUTILS_LOG_GENERIC(tag, ...) \
+	do { \
+		static const ::FUTILS::LogSite futilsLogSite = { LogEntities::Generic, tag, __FILE__, __LINE__ }; \
+		::FUTILS::detail::DeferredLogLiteral(futilsLogSite, FUTILS_FMT(FUTILS_LOG_FORMAT(__VA_ARGS__)), __VA_ARGS__); \
+	} while (0)
+
+#endif /* Linux functions*/
+
+#endif /* FUTILS_LOG_H_ */
@@ -0,0 +1,614 @@
+/**
+ * @brief Network interfaces and addresses through rtnetlink, without running ip/ifconfig.
+ *
+ * @details The utilities implemented include:
+ * 			- NetInterface/NetAddress: index, name, flags, link state, MTU and hardware address of
+ * 			  an interface; family, address, prefix length, broadcast, scope and label of an address
+ * 			- NetlinkRoute: RTM_GETLINK/RTM_GETADDR dumps over one NETLINK_ROUTE socket, reused
+ * 			  between queries; the dump is restarted if the kernel reports it was interrupted by a
+ * 			  change
+ * 			- InterfaceIpv4(): the primary IPv4 address of an interface, e.g. for the sin_addr of
+ * 			  ConfigureSenderSocket()/ConfigureReceiverSocket() sockets bound to one interface
+ * 			- NetlinkMonitor: link and address change notifications (RTNLGRP_LINK, RTNLGRP_IPV4_IFADDR,
+ * 			  RTNLGRP_IPV6_IFADDR) dispatched on an EventLoop, or polled through Fd()/Process()
+ *
+ * 			When the kernel drops notifications (the socket buffer overflowed), the monitor reports
+ * 			a NetlinkEventType::Overflow event: the state must then be listed again.
+ *
+ * 			Example:
+ * 			@code
+ * 			FUTILS::NetlinkRoute route;
+ * 			std::vector<FUTILS::NetAddress> addresses;
+ * 			if (route.ListAddresses(addresses, AF_INET)) {
+ * 				for (auto &a : addresses) {
+ * 					printf("%d %s/%u\n", a.index, a.Text().c_str(), a.prefixLen);
+ * 				}
+ * 			}
+ *
+ * 			FUTILS::EventLoop loop;
+ * 			FUTILS::NetlinkMonitor monitor;
+ * 			monitor.Attach(loop, [](const FUTILS::NetlinkEvent &e) {
+ * 				if (e.type == FUTILS::NetlinkEventType::AddressAdded) {
+ * 					Rebind(e.address);
+ * 				}
+ * 			});
+ * 			loop.Run();
+ * 			@endcode
+ */
+
+#ifndef FUTILS_NETLINK_H_
+#define FUTILS_NETLINK_H_
+
+#include "futils.h"
+#include "futils_eventloop.h"
+
+#if defined(__linux__) || defined(linux)
+
+#include <cerrno>
+#include <net/if.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+
+namespace FUTILS
+{
+
+/// One network interface, from RTM_NEWLINK
+struct NetInterface
+{
+	int index = 0;
+	std::string name;
+	uint32_t flags = 0;             ///< IFF_UP, IFF_RUNNING, IFF_LOOPBACK, ...
+	uint16_t type = 0;              ///< ARPHRD_ETHER, ARPHRD_LOOPBACK, ...
+	uint8_t operState = 0;          ///< RFC 2863 operational state (IF_OPER_*)
+	uint32_t mtu = 0;
+	uint8_t mac[6] = {0, 0, 0, 0, 0, 0};
+	bool hasMac = false;
+
+	bool Up() const
+	{
+		return (flags & IFF_UP) != 0;
+	}
+
+	/// Administratively up with carrier; virtual interfaces without an operational state count if running
+	bool Running() const
+	{
+		const uint8_t kOperUnknown = 0, kOperUp = 6;
+		return Up() && (operState == kOperUp || (operState == kOperUnknown && (flags & IFF_RUNNING)));
+	}
+
+	bool Loopback() const
+	{
+		return (flags & IFF_LOOPBACK) != 0;
+	}
+};
+
+/// One address of an interface, from RTM_NEWADDR
+struct NetAddress
+{
+	int index = 0;                  ///< interface index
+	int family = AF_UNSPEC;         ///< AF_INET or AF_INET6
+	uint8_t address[16] = {};       ///< network byte order, 4 bytes used for AF_INET
+	uint8_t broadcast[4] = {};
+	bool hasBroadcast = false;
+	uint8_t prefixLen = 0;
+	uint8_t scope = 0;              ///< RT_SCOPE_UNIVERSE, RT_SCOPE_LINK, RT_SCOPE_HOST, ...
+	uint32_t flags = 0;             ///< IFA_F_SECONDARY, IFA_F_TENTATIVE, ...
+	std::string label;              ///< IPv4 only, e.g. "eth0:1"
+
+	/// The IPv4 address, for sockaddr_in::sin_addr
+	struct in_addr Ipv4() const
+	{
+		struct in_addr a;
+		memcpy(&a, address, 4);
+		return a;
+	}
+
+	/// Dotted-quad or RFC 5952 text
+	std::string Text() const
+	{
+		char text[INET6_ADDRSTRLEN];
+		if (inet_ntop(family, address, text, sizeof(text)) == nullptr) {
+			return std::string();
+		}
+		return text;
+	}
+};
+
+enum class NetlinkEventType
+{
+	LinkChanged,        ///< new interface, or flags/state/MTU/name changed
+	LinkRemoved,
+	AddressAdded,
+	AddressRemoved,
+	Overflow,           ///< notifications were lost, list again
+};
+
+struct NetlinkEvent
+{
+	NetlinkEventType type;
+	NetInterface link;              ///< LinkChanged, LinkRemoved
+	NetAddress address;             ///< AddressAdded, AddressRemoved
+};
+
+namespace detail
+{
+
+/// Opens a NETLINK_ROUTE socket subscribed to groups (RTMGRP_* mask, 0 for queries only)
+inline int NetlinkOpen(uint32_t groups, bool nonBlocking)
+{
+	int fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC | (nonBlocking ? SOCK_NONBLOCK : 0), NETLINK_ROUTE);
+	if (fd < 0) {
+		perror("socket(AF_NETLINK)");
+		return -1;
+	}
+	struct sockaddr_nl local;
+	memset(&local, 0, sizeof(local));
+	local.nl_family = AF_NETLINK;
+	local.nl_groups = groups;
+	if (bind(fd, reinterpret_cast<struct sockaddr*>(&local), sizeof(local)) == -1) {
+		perror("bind(AF_NETLINK)");
+		::close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+inline bool NetlinkParseLink(const struct nlmsghdr *h, NetInterface &link)
+{
+	if (h->nlmsg_len < NLMSG_LENGTH(sizeof(struct ifinfomsg))) {
+		return false;
+	}
+	const struct ifinfomsg *ifi = static_cast<const struct ifinfomsg*>(NLMSG_DATA(h));
+	link = NetInterface();
+	link.index = ifi->ifi_index;
+	link.flags = ifi->ifi_flags;
+	link.type = ifi->ifi_type;
+	int len = static_cast<int>(h->nlmsg_len - NLMSG_LENGTH(sizeof(*ifi)));
+	for (const struct rtattr *a = IFLA_RTA(ifi); RTA_OK(a, len); a = RTA_NEXT(a, len)) {
+		const char *data = static_cast<const char*>(RTA_DATA(a));
+		size_t size = RTA_PAYLOAD(a);
+		switch (a->rta_type) {
+		case IFLA_IFNAME:
+			link.name.assign(data, strnlen(data, size));
+			break;
+		case IFLA_MTU:
+			if (size >= 4) {
+				memcpy(&link.mtu, data, 4);
+			}
+			break;
+		case IFLA_OPERSTATE:
+			if (size >= 1) {
+				link.operState = static_cast<uint8_t>(data[0]);
+			}
+			break;
+		case IFLA_ADDRESS:
+			if (size == 6) {
+				memcpy(link.mac, data, 6);
+				link.hasMac = true;
+			}
+			break;
+		}
+	}
+	return true;
+}
+
+inline bool NetlinkParseAddress(const struct nlmsghdr *h, NetAddress &address)
+{
+	if (h->nlmsg_len < NLMSG_LENGTH(sizeof(struct ifaddrmsg))) {
+		return false;
+	}
+	const struct ifaddrmsg *ifa = static_cast<const struct ifaddrmsg*>(NLMSG_DATA(h));
+	address = NetAddress();
+	address.index = static_cast<int>(ifa->ifa_index);
+	address.family = ifa->ifa_family;
+	address.prefixLen = ifa->ifa_prefixlen;
+	address.scope = ifa->ifa_scope;
+	address.flags = ifa->ifa_flags;
+	size_t addrLen = ifa->ifa_family == AF_INET ? 4 : ifa->ifa_family == AF_INET6 ? 16 : 0;
+	bool haveLocal = false, haveAddress = false;
+	int len = static_cast<int>(h->nlmsg_len - NLMSG_LENGTH(sizeof(*ifa)));
+	for (const struct rtattr *a = IFA_RTA(ifa); RTA_OK(a, len); a = RTA_NEXT(a, len)) {
+		const char *data = static_cast<const char*>(RTA_DATA(a));
+		size_t size = RTA_PAYLOAD(a);
+		switch (a->rta_type) {
+		case IFA_LOCAL:
+			// on point-to-point links IFA_ADDRESS is the peer, IFA_LOCAL ours
+			if (size == addrLen && addrLen != 0) {
+				memcpy(address.address, data, addrLen);
+				haveLocal = true;
+			}
+			break;
+		case IFA_ADDRESS:
+			if (size == addrLen && addrLen != 0 && !haveLocal) {
+				memcpy(address.address, data, addrLen);
+				haveAddress = true;
+			}
+			break;
+		case IFA_BROADCAST:
+			if (size == 4) {
+				memcpy(address.broadcast, data, 4);
+				address.hasBroadcast = true;
+			}
+			break;
+		case IFA_LABEL:
+			address.label.assign(data, strnlen(data, size));
+			break;
+		case IFA_FLAGS:
+			if (size >= 4) {
+				memcpy(&address.flags, data, 4);   // all 32 flags, ifa_flags only has the low 8
+			}
+			break;
+		}
+	}
+	return haveLocal || haveAddress;
+}
+
+} /* namespace detail */
+
+/**
+ * @brief Queries the interfaces and addresses of the host over rtnetlink.
+ *
+ * @details Each query is a dump request answered by the kernel in a few multipart messages; the
+ * 			socket and receive buffer are kept between queries. Not thread safe: one instance per
+ * 			thread.
+ */
+class NetlinkRoute
+{
+public:
+	NetlinkRoute() :
+		fd(-1),
+		seq(0),
+		buffer(kBufferSize)
+	{
+	}
+
+	~NetlinkRoute()
+	{
+		if (fd >= 0) {
+			::close(fd);
+		}
+	}
+
+	NetlinkRoute(const NetlinkRoute&) = delete;
+	NetlinkRoute& operator=(const NetlinkRoute&) = delete;
+
+	/// Lists all interfaces, in kernel (index) order
+	bool ListInterfaces(std::vector<NetInterface> &links)
+	{
+		links.clear();
+		NetInterface link;
+		return Dump(RTM_GETLINK, AF_UNSPEC, [&](const struct nlmsghdr *h) {
+			if (h->nlmsg_type == RTM_NEWLINK && detail::NetlinkParseLink(h, link)) {
+				links.push_back(link);
+			}
+		}, [&]() { links.clear(); });
+	}
+
+	/// Lists the addresses of all interfaces; family is AF_INET, AF_INET6 or AF_UNSPEC for both
+	bool ListAddresses(std::vector<NetAddress> &addresses, int family = AF_UNSPEC)
+	{
+		addresses.clear();
+		NetAddress address;
+		return Dump(RTM_GETADDR, family, [&](const struct nlmsghdr *h) {
+			if (h->nlmsg_type == RTM_NEWADDR && detail::NetlinkParseAddress(h, address)) {
+				addresses.push_back(address);
+			}
+		}, [&]() { addresses.clear(); });
+	}
+
+	/// Finds an interface by name
+	bool GetInterface(const std::string &ifname, NetInterface &link)
+	{
+		std::vector<NetInterface> links;
+		if (!ListInterfaces(links)) {
+			return false;
+		}
+		for (size_t i = 0; i < links.size(); ++i) {
+			if (links[i].name == ifname) {
+				link = links[i];
+				return true;
+			}
+		}
+		return false;
+	}
+
+private:
+	static const size_t kBufferSize = 64 * 1024;   // larger than the kernel's dump messages (32 KB at most)
+	static const int kDumpRetries = 8;
+
+	bool EnsureOpen()
+	{
+		if (fd < 0) {
+			fd = detail::NetlinkOpen(0, false);
+		}
+		return fd >= 0;
+	}
+
+	/**
+	 * Sends a dump request and passes every reply message to onMessage. When the dump was
+	 * interrupted by a concurrent change, onRestart is called and the dump is requested again.
+	 */
+	template<typename OnMessage, typename OnRestart>
+	bool Dump(uint16_t type, int family, OnMessage onMessage, OnRestart onRestart)
+	{
+		if (!EnsureOpen()) {
+			return false;
+		}
+		for (int attempt = 0; attempt < kDumpRetries; ++attempt) {
+			bool interrupted = false;
+			if (!Request(type, family) || !Receive(onMessage, interrupted)) {
+				return false;
+			}
+			if (!interrupted) {
+				return true;
+			}
+			onRestart();
+		}
+		std::cerr << tc::redL << "NetlinkRoute: dump kept being interrupted by changes" << tc::none << std::endl;
+		return false;
+	}
+
+	bool Request(uint16_t type, int family)
+	{
+		struct
+		{
+			struct nlmsghdr h;
+			struct rtgenmsg g;
+		} req;
+		memset(&req, 0, sizeof(req));
+		req.h.nlmsg_len = NLMSG_LENGTH(sizeof(req.g));
+		req.h.nlmsg_type = type;
+		req.h.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+		req.h.nlmsg_seq = ++seq;
+		req.g.rtgen_family = static_cast<unsigned char>(family);
+		struct sockaddr_nl kernel;
+		memset(&kernel, 0, sizeof(kernel));
+		kernel.nl_family = AF_NETLINK;
+		if (sendto(fd, &req, req.h.nlmsg_len, 0, reinterpret_cast<struct sockaddr*>(&kernel), sizeof(kernel)) < 0) {
+			perror("sendto(AF_NETLINK)");
+			return false;
+		}
+		return true;
+	}
+
+	template<typename OnMessage>
+	bool Receive(OnMessage &onMessage, bool &interrupted)
+	{
+		for (;;) {
+			struct sockaddr_nl from;
+			struct iovec iov = { buffer.data(), buffer.size() };
+			struct msghdr msg;
+			memset(&msg, 0, sizeof(msg));
+			msg.msg_name = &from;
+			msg.msg_namelen = sizeof(from);
+			msg.msg_iov = &iov;
+			msg.msg_iovlen = 1;
+			ssize_t n = recvmsg(fd, &msg, 0);
+			if (n < 0) {
+				if (errno == EINTR) {
+					continue;
+				}
+				perror("recvmsg(AF_NETLINK)");
+				return false;
+			}
+			if (msg.msg_flags & MSG_TRUNC) {
+				std::cerr << tc::redL << "NetlinkRoute: truncated reply" << tc::none << std::endl;
+				return false;
+			}
+			if (from.nl_pid != 0) {
+				continue;   // not from the kernel
+			}
+			int len = static_cast<int>(n);
+			for (const struct nlmsghdr *h = reinterpret_cast<const struct nlmsghdr*>(buffer.data()); NLMSG_OK(h, len); h = NLMSG_NEXT(h, len)) {
+				if (h->nlmsg_seq != seq) {
+					continue;   // answer to an earlier, abandoned request
+				}
+				if (h->nlmsg_flags & NLM_F_DUMP_INTR) {
+					interrupted = true;
+				}
+				if (h->nlmsg_type == NLMSG_DONE) {
+					return true;
+				}
+				if (h->nlmsg_type == NLMSG_ERROR) {
+					const struct nlmsgerr *err = static_cast<const struct nlmsgerr*>(NLMSG_DATA(h));
+					if (err->error == 0) {
+						return true;
+					}
+					errno = -err->error;
+					perror("rtnetlink dump");
+					return false;
+				}
+				onMessage(h);
+			}
+		}
+	}
+
+	int fd;
+	uint32_t seq;
+	std::vector<char> buffer;
+};
+
+/**
+ * @brief The primary (first, non secondary) IPv4 address of an interface.
+ *
+ * @return false if the interface does not exist or has no IPv4 address
+ */
+inline bool InterfaceIpv4(const std::string &ifname, struct in_addr &addr)
+{
+	int index = static_cast<int>(if_nametoindex(ifname.c_str()));
+	if (index == 0) {
+		return false;
+	}
+	NetlinkRoute route;
+	std::vector<NetAddress> addresses;
+	if (!route.ListAddresses(addresses, AF_INET)) {
+		return false;
+	}
+	const NetAddress *found = nullptr;
+	for (size_t i = 0; i < addresses.size(); ++i) {
+		if (addresses[i].index == index && (found == nullptr || (found->flags & IFA_F_SECONDARY))) {
+			found = &addresses[i];
+		}
+	}
+	if (found == nullptr) {
+		return false;
+	}
+	addr = found->Ipv4();
+	return true;
+}
+
+/**
+ * @brief Link and address change notifications.
+ *
+ * @details Handlers run on the thread of the EventLoop the monitor is attached to (or the one
+ * 			calling Process()). A single change may be notified more than once, e.g. a link going
+ * 			down produces several RTM_NEWLINK messages: compare with the known state.
+ */
+class NetlinkMonitor
+{
+public:
+	typedef std::function<void(const NetlinkEvent&)> Handler;
+
+	static const uint32_t kDefaultGroups = RTMGRP_LINK | RTMGRP_IPV4_IFADDR | RTMGRP_IPV6_IFADDR;
+
+	NetlinkMonitor() :
+		fd(-1),
+		loop(nullptr),
+		buffer(kBufferSize)
+	{
+	}
+
+	~NetlinkMonitor()
+	{
+		Close();
+	}
+
+	NetlinkMonitor(const NetlinkMonitor&) = delete;
+	NetlinkMonitor& operator=(const NetlinkMonitor&) = delete;
+
+	/**
+	 * @brief Subscribes to the notification groups (RTMGRP_* mask).
+	 *
+	 * @param rcvBuf socket receive buffer in bytes, 0 to keep the default; a burst of changes
+	 *        larger than it is reported as an Overflow event
+	 */
+	bool Open(uint32_t groups = kDefaultGroups, int rcvBuf = 1 << 20)
+	{
+		Close();
+		if ((fd = detail::NetlinkOpen(groups, true)) < 0) {
+			return false;
+		}
+		if (rcvBuf > 0 && setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvBuf, sizeof(rcvBuf)) == -1) {
+			perror("setsockopt(SO_RCVBUF)");
+		}
+		return true;
+	}
+
+	/// Opens the monitor if needed and dispatches its events to handler from loop
+	bool Attach(EventLoop &eventLoop, Handler h, uint32_t groups = kDefaultGroups)
+	{
+		if (fd < 0 && !Open(groups)) {
+			return false;
+		}
+		Detach();
+		handler = std::move(h);
+		if (!eventLoop.Add(fd, EPOLLIN, [this](uint32_t) { Process(handler); })) {
+			perror("EventLoop::Add(netlink)");
+			return false;
+		}
+		loop = &eventLoop;
+		return true;
+	}
+
+	/// Stops dispatching from the event loop; call from the loop thread
+	void Detach()
+	{
+		if (loop != nullptr) {
+			loop->Remove(fd);
+			loop = nullptr;
+		}
+	}
+
+	void Close()
+	{
+		Detach();
+		if (fd >= 0) {
+			::close(fd);
+			fd = -1;
+		}
+	}
+
+	/// Non-blocking descriptor, readable when notifications are pending
+	int Fd() const
+	{
+		return fd;
+	}
+
+	/**
+	 * @brief Reads all pending notifications and passes them to h.
+	 *
+	 * @return number of events passed, -1 on error
+	 */
+	template<typename Callback>
+	int Process(Callback &&h)
+	{
+		int count = 0;
+		NetlinkEvent event;
+		for (;;) {
+			ssize_t n = recv(fd, buffer.data(), buffer.size(), 0);
+			if (n < 0) {
+				if (errno == EINTR) {
+					continue;
+				}
+				if (errno == EAGAIN || errno == EWOULDBLOCK) {
+					return count;
+				}
+				if (errno == ENOBUFS) {
+					event.type = NetlinkEventType::Overflow;
+					h(static_cast<const NetlinkEvent&>(event));
+					++count;
+					continue;
+				}
+				perror("recv(AF_NETLINK)");
+				return -1;
+			}
+			int len = static_cast<int>(n);
+			for (const struct nlmsghdr *msg = reinterpret_cast<const struct nlmsghdr*>(buffer.data()); NLMSG_OK(msg, len); msg = NLMSG_NEXT(msg, len)) {
+				switch (msg->nlmsg_type) {
+				case RTM_NEWLINK:
+				case RTM_DELLINK:
+					if (!detail::NetlinkParseLink(msg, event.link)) {
+						continue;
+					}
+					event.type = msg->nlmsg_type == RTM_NEWLINK ? NetlinkEventType::LinkChanged : NetlinkEventType::LinkRemoved;
+					break;
+				case RTM_NEWADDR:
+				case RTM_DELADDR:
+					if (!detail::NetlinkParseAddress(msg, event.address)) {
+						continue;
+					}
+					event.type = msg->nlmsg_type == RTM_NEWADDR ? NetlinkEventType::AddressAdded : NetlinkEventType::AddressRemoved;
+					break;
+				default:
+					continue;
+				}
+				h(static_cast<const NetlinkEvent&>(event));
+				++count;
+			}
+		}
+	}
+
+private:
+	static const size_t kBufferSize = 64 * 1024;
+
+	int fd;
+	EventLoop *loop;
+	Handler handler;
+	std::vector<char> buffer;
+};
+
+} /* namespace FUTILS */
+
+#endif /* Linux functions*/
+
+#endif /* FUTILS_NETLINK_H_ */
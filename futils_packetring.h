@@ -0,0 +1,537 @@
+/**
+ * @brief Passive packet capture on AF_PACKET memory-mapped TPACKET_V3 rings.
+ *
+ * @details The utilities implemented include:
+ * 			- PacketRing: one AF_PACKET socket whose block ring is shared with the kernel, so that
+ * 			  frames of every port of an interface are read in place, a block (many frames) per
+ * 			  wakeup, without a system call or a copy per packet
+ * 			- PacketView/UdpView: zero-copy views of a captured frame and of the IPv4/UDP datagram
+ * 			  it carries (ParseUdp())
+ * 			- UdpPortFilter(): classic BPF program keeping one UDP destination port, run in the
+ * 			  kernel before the frames reach the ring
+ * 			- PacketCaptureGroup: one ring and thread per worker in a PACKET_FANOUT group, the
+ * 			  kernel spreading the flows (or CPUs) across them
+ *
+ * 			Requires CAP_NET_RAW. Works on any interface, loopback and veth included.
+ *
+ * 			Example:
+ * 			@code
+ * 			FUTILS::PacketRingOptions options;
+ * 			options.filter = FUTILS::UdpPortFilter(5000);
+ * 			FUTILS::PacketRing ring;
+ * 			if (ring.Open("eth0", options)) {
+ * 				while (running) {
+ * 					ring.Receive([](const FUTILS::PacketView &frame) {
+ * 						FUTILS::UdpView udp;
+ * 						if (FUTILS::ParseUdp(frame, udp)) {
+ * 							Consume(udp.payload, udp.length);
+ * 						}
+ * 					}, 100);
+ * 				}
+ * 			}
+ * 			@endcode
+ */
+
+#ifndef FUTILS_PACKETRING_H_
+#define FUTILS_PACKETRING_H_
+
+#include "futils.h"
+
+#if defined(__linux__) || defined(linux)
+
+#include <atomic>
+#include <thread>
+#include <cerrno>
+#include <poll.h>
+#include <sys/mman.h>
+#include <net/if.h>
+#include <linux/if_packet.h>
+#include <linux/if_ether.h>
+#include <linux/filter.h>
+
+namespace FUTILS
+{
+
+/// Captured frame, valid until the callback that received it returns
+struct PacketView
+{
+	const uint8_t *frame;   ///< link layer header first (none on tun and similar links)
+	const uint8_t *network; ///< network header
+	uint32_t length;        ///< captured bytes from frame
+	uint32_t wireLength;    ///< original length (larger when the snap length cut the frame)
+	uint64_t timestampNs;   ///< CLOCK_REALTIME
+	uint16_t protocol;      ///< ethertype, host byte order
+	uint16_t vlan;          ///< VLAN id stripped by the NIC, 0 if none
+	uint8_t packetType;     ///< PACKET_HOST, PACKET_OUTGOING, PACKET_BROADCAST, ...
+	int ifindex;
+};
+
+/// IPv4/UDP datagram inside a PacketView, addresses and ports in host byte order
+struct UdpView
+{
+	uint32_t srcAddr;
+	uint32_t dstAddr;
+	uint16_t srcPort;
+	uint16_t dstPort;
+	uint32_t length;        ///< payload bytes (may exceed the captured part, see captured)
+	uint32_t captured;      ///< payload bytes present in the frame
+	const uint8_t *payload;
+};
+
+/**
+ * @brief Locates the UDP payload of a captured IPv4 frame.
+ *
+ * @return false for other protocols and for non-first fragments
+ */
+inline bool ParseUdp(const PacketView &view, UdpView &udp)
+{
+	if (view.protocol != ETH_P_IP) {
+		return false;
+	}
+	const uint8_t *ip = view.network;
+	size_t offset = static_cast<size_t>(view.network - view.frame);
+	if (offset >= view.length) {
+		return false;    // snap length shorter than the link header
+	}
+	size_t len = view.length - offset;
+	if (len < 20 || (ip[0] >> 4) != 4 || ip[9] != IPPROTO_UDP || ((ip[6] & 0x1f) | ip[7]) != 0) {
+		return false;
+	}
+	size_t ihl = (ip[0] & 0x0f) * 4u;
+	if (ihl < 20 || len < ihl + 8) {
+		return false;
+	}
+	const uint8_t *h = ip + ihl;
+	size_t udpLen = static_cast<size_t>(h[4] << 8 | h[5]);
+	if (udpLen < 8) {
+		return false;
+	}
+	uint32_t a;
+	memcpy(&a, ip + 12, 4);
+	udp.srcAddr = ntohl(a);
+	memcpy(&a, ip + 16, 4);
+	udp.dstAddr = ntohl(a);
+	udp.srcPort = static_cast<uint16_t>(h[0] << 8 | h[1]);
+	udp.dstPort = static_cast<uint16_t>(h[2] << 8 | h[3]);
+	udp.length = static_cast<uint32_t>(udpLen - 8);
+	udp.captured = static_cast<uint32_t>(std::min(udpLen, len - ihl) - 8);
+	udp.payload = h + 8;
+	return true;
+}
+
+/**
+ * @brief Classic BPF program accepting the IPv4 UDP datagrams sent to port (first fragments only).
+ *
+ * Written for Ethernet framing, loopback included.
+ *
+ * @param snapLength bytes kept per accepted frame
+ */
+inline std::vector<struct sock_filter> UdpPortFilter(uint16_t port, uint32_t snapLength = 0xffff)
+{
+	struct sock_filter program[] = {
+		BPF_STMT(BPF_LD | BPF_H | BPF_ABS, 12),                 // ethertype
+		BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, ETH_P_IP, 0, 8),
+		BPF_STMT(BPF_LD | BPF_B | BPF_ABS, 23),                 // IPv4 protocol
+		BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, IPPROTO_UDP, 0, 6),
+		BPF_STMT(BPF_LD | BPF_H | BPF_ABS, 20),                 // fragment offset
+		BPF_JUMP(BPF_JMP | BPF_JSET | BPF_K, 0x1fff, 4, 0),
+		BPF_STMT(BPF_LDX | BPF_B | BPF_MSH, 14),                // X = IPv4 header length
+		BPF_STMT(BPF_LD | BPF_H | BPF_IND, 16),                 // UDP destination port
+		BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, port, 0, 1),
+		BPF_STMT(BPF_RET | BPF_K, snapLength),
+		BPF_STMT(BPF_RET | BPF_K, 0),
+	};
+	return std::vector<struct sock_filter>(program, program + sizeof(program) / sizeof(program[0]));
+}
+
+struct PacketRingOptions
+{
+	uint32_t blockSize = 1 << 22;     ///< power of two multiple of the page size
+	uint32_t blockCount = 64;
+	uint32_t frameSize = 2048;        ///< upper bound of a frame slot (V3 packs frames tightly)
+	uint32_t blockTimeoutMs = 10;     ///< a partly filled block is handed over after this delay
+	int fanoutGroup = -1;             ///< PACKET_FANOUT group id (0-65535), -1 for none
+	int fanoutMode = PACKET_FANOUT_HASH;
+	bool promiscuous = false;
+	bool ignoreOutgoing = false;      ///< skip the frames this host sends (seen twice on loopback otherwise)
+	std::vector<struct sock_filter> filter; ///< classic BPF, empty for everything
+};
+
+struct PacketRingStats
+{
+	uint64_t packets;   ///< passed the filter
+	uint64_t drops;     ///< ring full
+	uint64_t freezes;   ///< times the kernel found no free block
+};
+
+/**
+ * AF_PACKET TPACKET_V3 capture socket and its block ring.
+ */
+class PacketRing
+{
+public:
+	PacketRing() :
+		fd(-1), ring(nullptr), ringSize(0), blockSize(0), blockCount(0), current(0), ifindex(0), skipOutgoing(false)
+	{
+		memset(&totals, 0, sizeof(totals));
+	}
+
+	~PacketRing()
+	{
+		Close();
+	}
+
+	PacketRing(const PacketRing&) = delete;
+	PacketRing& operator=(const PacketRing&) = delete;
+
+	/**
+	 * @brief Creates the socket and its ring, then binds it to the interface.
+	 *
+	 * @param ifname interface name, empty to capture on all interfaces
+	 */
+	bool Open(const std::string &ifname, const PacketRingOptions &options = PacketRingOptions())
+	{
+		Close();
+		if (!ifname.empty() && (ifindex = static_cast<int>(if_nametoindex(ifname.c_str()))) == 0) {
+			perror(("if_nametoindex " + ifname).c_str());
+			return false;
+		}
+		// protocol 0: nothing is captured until bind() below, once the filter and the ring are in place
+		if ((fd = socket(AF_PACKET, SOCK_RAW | SOCK_CLOEXEC, 0)) == -1) {
+			perror("socket(AF_PACKET)");
+			return false;
+		}
+		if (!options.filter.empty() && !SetFilter(options.filter)) {
+			Close();
+			return false;
+		}
+		int version = TPACKET_V3;
+		if (setsockopt(fd, SOL_PACKET, PACKET_VERSION, &version, sizeof(version)) == -1) {
+			perror("setsockopt(PACKET_VERSION)");
+			Close();
+			return false;
+		}
+#ifdef PACKET_IGNORE_OUTGOING
+		int one = 1;
+		if (options.ignoreOutgoing && setsockopt(fd, SOL_PACKET, PACKET_IGNORE_OUTGOING, &one, sizeof(one)) == -1) {
+			perror("setsockopt(PACKET_IGNORE_OUTGOING)");
+		}
+#endif
+		struct tpacket_req3 req;
+		memset(&req, 0, sizeof(req));
+		req.tp_block_size = options.blockSize;
+		req.tp_block_nr = options.blockCount;
+		req.tp_frame_size = options.frameSize;
+		req.tp_frame_nr = static_cast<unsigned int>((static_cast<uint64_t>(options.blockSize) / options.frameSize) * options.blockCount);
+		req.tp_retire_blk_tov = options.blockTimeoutMs;
+		req.tp_feature_req_word = TP_FT_REQ_FILL_RXHASH;
+		if (setsockopt(fd, SOL_PACKET, PACKET_RX_RING, &req, sizeof(req)) == -1) {
+			perror("setsockopt(PACKET_RX_RING)");
+			Close();
+			return false;
+		}
+		ringSize = static_cast<size_t>(options.blockSize) * options.blockCount;
+		void *p = mmap(nullptr, ringSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_LOCKED, fd, 0);
+		if (p == MAP_FAILED) {
+			// MAP_LOCKED fails beyond RLIMIT_MEMLOCK; the ring still works unlocked
+			p = mmap(nullptr, ringSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		}
+		if (p == MAP_FAILED) {
+			perror("mmap");
+			ringSize = 0;
+			Close();
+			return false;
+		}
+		ring = static_cast<uint8_t*>(p);
+		blockSize = options.blockSize;
+		blockCount = options.blockCount;
+		current = 0;
+
+		struct sockaddr_ll ll;
+		memset(&ll, 0, sizeof(ll));
+		ll.sll_family = AF_PACKET;
+		ll.sll_protocol = htons(ETH_P_ALL);
+		ll.sll_ifindex = ifindex;
+		if (bind(fd, (struct sockaddr*)&ll, sizeof(ll)) == -1) {
+			perror("bind(AF_PACKET)");
+			Close();
+			return false;
+		}
+		if (options.promiscuous && ifindex != 0) {
+			struct packet_mreq mreq;
+			memset(&mreq, 0, sizeof(mreq));
+			mreq.mr_ifindex = ifindex;
+			mreq.mr_type = PACKET_MR_PROMISC;
+			if (setsockopt(fd, SOL_PACKET, PACKET_ADD_MEMBERSHIP, &mreq, sizeof(mreq)) == -1) {
+				perror("setsockopt(PACKET_ADD_MEMBERSHIP)");
+			}
+		}
+		if (options.fanoutGroup >= 0) {
+			// a group has its own hook: the per-socket PACKET_IGNORE_OUTGOING does not apply to it
+			int arg = (options.fanoutGroup & 0xffff) | (options.fanoutMode << 16);
+			int flagged = arg | (options.ignoreOutgoing ? kFanoutIgnoreOutgoing << 16 : 0);
+			if (setsockopt(fd, SOL_PACKET, PACKET_FANOUT, &flagged, sizeof(flagged)) == -1 &&
+					(flagged == arg || errno != EINVAL || setsockopt(fd, SOL_PACKET, PACKET_FANOUT, &arg, sizeof(arg)) == -1)) {
+				perror("setsockopt(PACKET_FANOUT)");
+				Close();
+				return false;
+			}
+		}
+		skipOutgoing = options.ignoreOutgoing;
+		return true;
+	}
+
+	/// Replaces the kernel filter (classic BPF), empty to remove it
+	bool SetFilter(const std::vector<struct sock_filter> &program)
+	{
+		if (program.empty()) {
+			int dummy = 0;
+			setsockopt(fd, SOL_SOCKET, SO_DETACH_FILTER, &dummy, sizeof(dummy));
+			return true;
+		}
+		struct sock_fprog prog;
+		prog.len = static_cast<unsigned short>(program.size());
+		prog.filter = const_cast<struct sock_filter*>(program.data());
+		if (setsockopt(fd, SOL_SOCKET, SO_ATTACH_FILTER, &prog, sizeof(prog)) == -1) {
+			perror("setsockopt(SO_ATTACH_FILTER)");
+			return false;
+		}
+		return true;
+	}
+
+	/**
+	 * @brief Hands every frame of the blocks ready now to handler, then returns the blocks to the kernel.
+	 *
+	 * @param handler callable as handler(const PacketView&)
+	 * @param maxBlocks stops after this many blocks (the ring keeps filling meanwhile)
+	 * @return number of frames
+	 */
+	template<typename Handler>
+	size_t Process(Handler &&handler, size_t maxBlocks = SIZE_MAX)
+	{
+		size_t frames = 0;
+		for (size_t b = 0; b < maxBlocks; ++b) {
+			struct tpacket_block_desc *block = Block(current);
+			if (!(__atomic_load_n(&block->hdr.bh1.block_status, __ATOMIC_ACQUIRE) & TP_STATUS_USER)) {
+				break;
+			}
+			uint32_t n = block->hdr.bh1.num_pkts;
+			const uint8_t *p = reinterpret_cast<const uint8_t*>(block) + block->hdr.bh1.offset_to_first_pkt;
+			for (uint32_t i = 0; i < n; ++i) {
+				const struct tpacket3_hdr *h = reinterpret_cast<const struct tpacket3_hdr*>(p);
+				const struct sockaddr_ll *ll = reinterpret_cast<const struct sockaddr_ll*>(p + TPACKET_ALIGN(sizeof(struct tpacket3_hdr)));
+				PacketView view;
+				view.frame = p + h->tp_mac;
+				view.network = p + h->tp_net;
+				view.length = h->tp_snaplen;
+				view.wireLength = h->tp_len;
+				view.timestampNs = static_cast<uint64_t>(h->tp_sec) * 1000000000ULL + h->tp_nsec;
+				view.protocol = ntohs(ll->sll_protocol);
+				view.vlan = (h->tp_status & TP_STATUS_VLAN_VALID) ? static_cast<uint16_t>(h->hv1.tp_vlan_tci & 0x0fff) : 0;
+				view.packetType = ll->sll_pkttype;
+				view.ifindex = ll->sll_ifindex;
+				p += h->tp_next_offset;
+				if (skipOutgoing && view.packetType == PACKET_OUTGOING) {
+					// older kernels still deliver them to fanout groups
+					continue;
+				}
+				handler(static_cast<const PacketView&>(view));
+			}
+			frames += n;
+			__atomic_store_n(&block->hdr.bh1.block_status, TP_STATUS_KERNEL, __ATOMIC_RELEASE);
+			current = (current + 1) % blockCount;
+		}
+		return frames;
+	}
+
+	/**
+	 * @brief Waits up to timeoutMs for a block, then processes the ready blocks (see Process()).
+	 *
+	 * @return number of frames, 0 on timeout, -1 on error
+	 */
+	template<typename Handler>
+	int Receive(Handler &&handler, int timeoutMs = -1)
+	{
+		size_t n = Process(handler);
+		if (n > 0) {
+			return static_cast<int>(n);
+		}
+		struct pollfd pfd;
+		pfd.fd = fd;
+		pfd.events = POLLIN | POLLERR;
+		pfd.revents = 0;
+		int ready = poll(&pfd, 1, timeoutMs);
+		if (ready < 0) {
+			if (errno == EINTR) {
+				return 0;
+			}
+			perror("poll");
+			return -1;
+		}
+		return static_cast<int>(Process(handler));
+	}
+
+	/// Kernel counters since Open() (reading them resets the kernel side, the totals are kept here)
+	PacketRingStats Stats()
+	{
+		struct tpacket_stats_v3 st;
+		socklen_t len = sizeof(st);
+		memset(&st, 0, sizeof(st));
+		if (fd >= 0 && getsockopt(fd, SOL_PACKET, PACKET_STATISTICS, &st, &len) == 0) {
+			totals.packets += st.tp_packets;
+			totals.drops += st.tp_drops;
+			totals.freezes += st.tp_freeze_q_cnt;
+		}
+		return totals;
+	}
+
+	int Fd() const
+	{
+		return fd;
+	}
+
+	int InterfaceIndex() const
+	{
+		return ifindex;
+	}
+
+	void Close()
+	{
+		if (ring) {
+			munmap(ring, ringSize);
+			ring = nullptr;
+		}
+		if (fd >= 0) {
+			::close(fd);
+			fd = -1;
+		}
+		ringSize = 0;
+		memset(&totals, 0, sizeof(totals));
+	}
+
+private:
+	/// PACKET_FANOUT_FLAG_IGNORE_OUTGOING (Linux 6.7), rejected with EINVAL before
+	static const int kFanoutIgnoreOutgoing = 0x4000;
+
+	struct tpacket_block_desc* Block(uint32_t i) const
+	{
+		return reinterpret_cast<struct tpacket_block_desc*>(ring + static_cast<size_t>(i) * blockSize);
+	}
+
+	int fd;
+	uint8_t *ring;
+	size_t ringSize;
+	uint32_t blockSize;
+	uint32_t blockCount;
+	uint32_t current;
+	int ifindex;
+	bool skipOutgoing;
+	PacketRingStats totals;
+};
+
+namespace detail
+{
+
+/// Fanout group ids are per network namespace: distinct for every group of this process, seeded by the pid
+inline int NextFanoutGroup()
+{
+	static std::atomic<unsigned int> next(0);
+	return static_cast<int>((static_cast<unsigned int>(getpid()) + next.fetch_add(1, std::memory_order_relaxed)) & 0xffff);
+}
+
+} /* namespace detail */
+
+/**
+ * Capture threads sharing the traffic of an interface through a PACKET_FANOUT group.
+ */
+class PacketCaptureGroup
+{
+public:
+	/// Called on the capture thread of worker index
+	typedef std::function<void(size_t worker, const PacketView&)> Handler;
+
+	PacketCaptureGroup() :
+		running(false)
+	{
+	}
+
+	~PacketCaptureGroup()
+	{
+		Stop();
+	}
+
+	PacketCaptureGroup(const PacketCaptureGroup&) = delete;
+	PacketCaptureGroup& operator=(const PacketCaptureGroup&) = delete;
+
+	/**
+	 * @brief Opens one ring per worker in the group options.fanoutGroup (a new id per group if unset) and starts the threads.
+	 *
+	 * With PACKET_FANOUT_HASH the frames of a flow always reach the same worker.
+	 */
+	bool Start(const std::string &ifname, size_t workers, PacketRingOptions options, Handler handler)
+	{
+		Stop();
+		if (options.fanoutGroup < 0) {
+			options.fanoutGroup = detail::NextFanoutGroup();
+		}
+		rings.clear();
+		for (size_t i = 0; i < workers; ++i) {
+			rings.emplace_back(new PacketRing());
+			if (!rings.back()->Open(ifname, options)) {
+				rings.clear();
+				return false;
+			}
+		}
+		running = true;
+		for (size_t i = 0; i < workers; ++i) {
+			threads.emplace_back([this, i, handler]() {
+				PacketRing &ring = *rings[i];
+				while (running.load(std::memory_order_relaxed)) {
+					ring.Receive([&](const PacketView &view) { handler(i, view); }, 100);
+				}
+			});
+		}
+		return true;
+	}
+
+	/// Joins the threads (within the 100 ms poll period) and closes the rings
+	void Stop()
+	{
+		running = false;
+		for (size_t i = 0; i < threads.size(); ++i) {
+			threads[i].join();
+		}
+		threads.clear();
+		rings.clear();
+	}
+
+	/// Counters summed over the workers
+	PacketRingStats Stats()
+	{
+		PacketRingStats sum;
+		memset(&sum, 0, sizeof(sum));
+		for (size_t i = 0; i < rings.size(); ++i) {
+			PacketRingStats s = rings[i]->Stats();
+			sum.packets += s.packets;
+			sum.drops += s.drops;
+			sum.freezes += s.freezes;
+		}
+		return sum;
+	}
+
+	size_t Workers() const
+	{
+		return rings.size();
+	}
+
+private:
+	std::vector<std::unique_ptr<PacketRing> > rings;
+	std::vector<std::thread> threads;
+	std::atomic<bool> running;
+};
+
+} /* namespace FUTILS */
+
+#endif /* Linux functions*/
+
+#endif /* FUTILS_PACKETRING_H_ */
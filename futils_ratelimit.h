@@ -0,0 +1,437 @@
+/**
+ * @brief Lock-free rate limiters and paced UDP sending.
+ *
+ * @details The utilities implemented include:
+ * 			- TokenBucket: admits requests of n units while the bucket holds enough tokens
+ * 			- Gcra: generic cell rate algorithm (leaky bucket as a meter), which can also schedule
+ * 			  the departure time of every request for pacing
+ * 			- SetMaxPacingRate/EnableTxTime: kernel pacing socket options (fq / etf qdiscs)
+ * 			- PacedSender: UdpBatchSender that spaces datagrams at a byte rate, either in user space
+ * 			  or by handing the departure times to the kernel with SO_TXTIME
+ *
+ * 			Both limiters keep their whole state in one atomic word updated with compare-and-swap,
+ * 			so they can be shared by sender threads without locks. Time is passed in as CLOCK_MONOTONIC
+ * 			nanoseconds: CoarseClock::NowNs() is enough for admission control, since the state
+ * 			keeps sub-nanosecond precision whatever the resolution of the clock.
+ *
+ * 			Example:
+ * 			@code
+ * 			FUTILS::PacedSender sender;
+ * 			sender.Open();
+ * 			sender.SetRate(125000000, 0, FUTILS::PacingMode::TxTime); // 1 Gbit/s
+ * 			sender.Send(batch);
+ * 			@endcode
+ */
+
+#ifndef FUTILS_RATELIMIT_H_
+#define FUTILS_RATELIMIT_H_
+
+#include "futils.h"
+#include "futils_time.h"
+#include "futils_udpbatch.h"
+
+#if defined(__linux__) || defined(linux)
+
+#include <atomic>
+#include <cerrno>
+#include <linux/net_tstamp.h>
+
+namespace FUTILS
+{
+
+namespace detail
+{
+
+/**
+ * Limiter time unit: 1/16 ns, counted from the construction of the limiter. Fine enough for the
+ * rounding of Cost() at 100 Gb/s, and coarse enough for the tick count to stay below 2^63 (room
+ * for the additions of burst times) for 16 years: past that it stops, it never wraps.
+ */
+static const unsigned kRateFracBits = 4;
+/// Tick of the construction time, so that a new limiter starts idle (state 0 is far in the past)
+static const uint64_t kRateEpoch = 1ULL << 60;
+/// Elapsed time beyond which Ticks() saturates (2^63 ticks)
+static const uint64_t kRateMaxElapsedNs = ((1ULL << 63) - kRateEpoch) >> kRateFracBits;
+
+/// Shared parameters and time base of TokenBucket and Gcra
+class RateBase
+{
+public:
+	RateBase(double ratePerSec, double burst) :
+		origin(CoarseClock::NowNs()), unitCost(0), burstTime(0)
+	{
+		SetRate(ratePerSec, burst);
+	}
+
+	/**
+	 * @brief Changes the rate; safe while other threads acquire.
+	 *
+	 * @param ratePerSec units (bytes, packets...) per second
+	 * @param burst TokenBucket capacity, or Gcra units admitted back to back on top of the rate
+	 */
+	void SetRate(double ratePerSec, double burst)
+	{
+		double cost = 1E9 * (1 << kRateFracBits) / ratePerSec;
+		unitCost.store(cost, std::memory_order_relaxed);
+		burstTime.store(static_cast<uint64_t>(burst * cost), std::memory_order_relaxed);
+	}
+
+	double Rate() const
+	{
+		return 1E9 * (1 << kRateFracBits) / unitCost.load(std::memory_order_relaxed);
+	}
+
+protected:
+	uint64_t Ticks(uint64_t nowNs) const
+	{
+		const uint64_t elapsed = nowNs > origin ? nowNs - origin : 0;
+		return kRateEpoch + (std::min(elapsed, kRateMaxElapsedNs) << kRateFracBits);
+	}
+
+	uint64_t Ns(uint64_t ticks) const
+	{
+		return origin + ((ticks - kRateEpoch) >> kRateFracBits);
+	}
+
+	uint64_t Cost(uint64_t n) const
+	{
+		return static_cast<uint64_t>(static_cast<double>(n) * unitCost.load(std::memory_order_relaxed) + 0.5);
+	}
+
+	const uint64_t origin;
+	std::atomic<double> unitCost;       ///< ticks per unit
+	std::atomic<uint64_t> burstTime;    ///< ticks of credit an idle limiter may accumulate
+};
+
+} /* namespace detail */
+
+/**
+ * Token bucket of capacity tokens refilled at ratePerSec, stored as the time at which the bucket
+ * was (or will be) empty. With CoarseClock time the capacity must cover at least one clock tick of
+ * tokens (rate * CoarseClock::ResolutionNs()), otherwise the refill of a tick is lost.
+ */
+class TokenBucket : public detail::RateBase
+{
+public:
+	TokenBucket(double ratePerSec, double capacity) :
+		RateBase(ratePerSec, capacity), emptyAt(0)
+	{
+	}
+
+	/**
+	 * @brief Takes n tokens if available.
+	 *
+	 * A request larger than the capacity never succeeds.
+	 */
+	bool TryAcquire(uint64_t n, uint64_t nowNs)
+	{
+		const uint64_t now = Ticks(nowNs);
+		const uint64_t capacity = burstTime.load(std::memory_order_relaxed);
+		const uint64_t full = now - capacity;
+		const uint64_t cost = Cost(n);
+		uint64_t empty = emptyAt.load(std::memory_order_relaxed);
+		for (;;) {
+			uint64_t next = std::max(empty, full) + cost;
+			if (next > now) {
+				return false;
+			}
+			if (emptyAt.compare_exchange_weak(empty, next, std::memory_order_relaxed)) {
+				return true;
+			}
+		}
+	}
+
+	bool TryAcquire(uint64_t n = 1)
+	{
+		return TryAcquire(n, CoarseClock::NowNs());
+	}
+
+	/// Gives back tokens acquired but not used (e.g. a send that failed)
+	void Refund(uint64_t n)
+	{
+		const uint64_t cost = Cost(n);
+		uint64_t empty = emptyAt.load(std::memory_order_relaxed);
+		while (!emptyAt.compare_exchange_weak(empty, empty > cost ? empty - cost : 0, std::memory_order_relaxed)) {
+		}
+	}
+
+	/// Tokens currently in the bucket
+	double Available(uint64_t nowNs) const
+	{
+		const uint64_t now = Ticks(nowNs);
+		const uint64_t empty = emptyAt.load(std::memory_order_relaxed);
+		const uint64_t credit = now > empty ? std::min(now - empty, burstTime.load(std::memory_order_relaxed)) : 0;
+		return static_cast<double>(credit) / unitCost.load(std::memory_order_relaxed);
+	}
+
+private:
+	std::atomic<uint64_t> emptyAt;
+};
+
+/**
+ * Generic cell rate algorithm: tracks the theoretical arrival time (TAT) of the next unit. A request
+ * conforms when the TAT is less than burst units ahead of now.
+ */
+class Gcra : public detail::RateBase
+{
+public:
+	Gcra(double ratePerSec, double burst) :
+		RateBase(ratePerSec, burst), tat(0)
+	{
+	}
+
+	/// Admits n units if conforming (policing)
+	bool TryAcquire(uint64_t n, uint64_t nowNs)
+	{
+		const uint64_t now = Ticks(nowNs);
+		const uint64_t cost = Cost(n);
+		const uint64_t tau = burstTime.load(std::memory_order_relaxed);
+		uint64_t current = tat.load(std::memory_order_relaxed);
+		for (;;) {
+			if (current > now + tau) {
+				return false;
+			}
+			if (tat.compare_exchange_weak(current, std::max(current, now) + cost, std::memory_order_relaxed)) {
+				return true;
+			}
+		}
+	}
+
+	bool TryAcquire(uint64_t n = 1)
+	{
+		return TryAcquire(n, CoarseClock::NowNs());
+	}
+
+	/**
+	 * @brief Books n units unconditionally (shaping).
+	 *
+	 * @return the time (ns, same clock as nowNs) at which the n units may leave; consecutive
+	 * reservations are spaced exactly by the rate, independently of the clock resolution
+	 */
+	uint64_t Reserve(uint64_t n, uint64_t nowNs)
+	{
+		const uint64_t now = Ticks(nowNs);
+		const uint64_t cost = Cost(n);
+		const uint64_t tau = burstTime.load(std::memory_order_relaxed);
+		uint64_t current = tat.load(std::memory_order_relaxed);
+		uint64_t departure;
+		do {
+			departure = std::max(now, current > tau ? current - tau : 0);
+		} while (!tat.compare_exchange_weak(current, std::max(current, departure) + cost, std::memory_order_relaxed));
+		return Ns(departure);
+	}
+
+	/// Gives back n units reserved but not used (e.g. datagrams the kernel did not accept)
+	void Unreserve(uint64_t n)
+	{
+		const uint64_t cost = Cost(n);
+		uint64_t current = tat.load(std::memory_order_relaxed);
+		while (!tat.compare_exchange_weak(current, current > cost ? current - cost : 0, std::memory_order_relaxed)) {
+		}
+	}
+
+	/// Nanoseconds until a request would conform (0 if now)
+	uint64_t WaitTime(uint64_t nowNs) const
+	{
+		const uint64_t now = Ticks(nowNs);
+		const uint64_t limit = tat.load(std::memory_order_relaxed);
+		const uint64_t tau = burstTime.load(std::memory_order_relaxed);
+		return limit > now + tau ? (limit - now - tau) >> detail::kRateFracBits : 0;
+	}
+
+private:
+	std::atomic<uint64_t> tat;
+};
+
+/**
+ * @brief Caps the rate of a socket in the kernel (bytes per second).
+ *
+ * Enforced by the fq qdisc for UDP sockets (tc qdisc replace dev ethX root fq), ignored otherwise.
+ */
+inline bool SetMaxPacingRate(int sockfd, uint64_t bytesPerSec)
+{
+	int ret;
+	if (bytesPerSec > 0xffffffffULL) {
+		ret = setsockopt(sockfd, SOL_SOCKET, SO_MAX_PACING_RATE, &bytesPerSec, sizeof(bytesPerSec));
+	} else {
+		uint32_t rate = static_cast<uint32_t>(bytesPerSec);
+		ret = setsockopt(sockfd, SOL_SOCKET, SO_MAX_PACING_RATE, &rate, sizeof(rate));
+	}
+	if (ret < 0) {
+		perror("setsockopt(SO_MAX_PACING_RATE)");
+		return false;
+	}
+	return true;
+}
+
+/**
+ * @brief Enables per-datagram departure times (PacketBatch::SetTxTime()) on a socket.
+ *
+ * Honored by the fq (CLOCK_MONOTONIC) and etf (CLOCK_TAI) qdiscs.
+ */
+inline bool EnableTxTime(int sockfd, clockid_t clock = CLOCK_MONOTONIC)
+{
+	struct sock_txtime config;
+	config.clockid = clock;
+	config.flags = 0;
+	if (setsockopt(sockfd, SOL_SOCKET, SO_TXTIME, &config, sizeof(config)) < 0) {
+		perror("setsockopt(SO_TXTIME)");
+		return false;
+	}
+	return true;
+}
+
+/// Where PacedSender spaces the datagrams
+enum class PacingMode
+{
+	Userspace,      ///< waits (SleepUntil()) for the departure time of each datagram
+	MaxPacingRate,  ///< SO_MAX_PACING_RATE, the fq qdisc paces
+	TxTime          ///< SO_TXTIME, each datagram carries its departure time
+};
+
+/**
+ * Sends batches of datagrams at a steady byte rate, without the bursts that come from sending a
+ * whole batch after each (imprecise) sleep.
+ */
+class PacedSender
+{
+public:
+	PacedSender() :
+		limiter(1E9, 0), mode(PacingMode::Userspace), maxLeadNs(1000000), overhead(0), paced(false)
+	{
+	}
+
+	PacedSender(const PacedSender&) = delete;
+	PacedSender& operator=(const PacedSender&) = delete;
+
+	bool Open()
+	{
+		return sender.Open();
+	}
+
+	/// Uses an already configured socket (not closed by this object)
+	void Attach(int fd)
+	{
+		sender.Attach(fd);
+	}
+
+	/**
+	 * @brief Sets the rate and the pacing mode.
+	 *
+	 * Falls back to PacingMode::Userspace when the kernel rejects the socket option.
+	 *
+	 * @param bytesPerSec payload bytes (plus the per-datagram overhead) per second
+	 * @param burstBytes bytes that may leave back to back after an idle period
+	 */
+	bool SetRate(uint64_t bytesPerSec, uint64_t burstBytes = 0, PacingMode pacing = PacingMode::Userspace)
+	{
+		limiter.SetRate(static_cast<double>(bytesPerSec), static_cast<double>(burstBytes));
+		mode = pacing;
+		paced = true;
+		if (mode == PacingMode::MaxPacingRate && !SetMaxPacingRate(sender.Fd(), bytesPerSec)) {
+			mode = PacingMode::Userspace;
+		}
+		if (mode == PacingMode::TxTime && !EnableTxTime(sender.Fd())) {
+			mode = PacingMode::Userspace;
+		}
+		return mode == pacing;
+	}
+
+	/// Bytes charged per datagram on top of the payload (e.g. 28 for IPv4 + UDP headers)
+	void SetOverhead(size_t bytes)
+	{
+		overhead = bytes;
+	}
+
+	/// With SO_TXTIME, how far ahead of their departure datagrams are queued to the kernel
+	void SetMaxLead(uint64_t ns)
+	{
+		maxLeadNs = ns;
+	}
+
+	PacingMode Mode() const
+	{
+		return mode;
+	}
+
+	/**
+	 * @brief Sends every datagram of the batch, spaced at the configured rate.
+	 *
+	 * Blocks until the last datagram has been handed to the kernel. Stops at the first datagram
+	 * the kernel does not accept: the rate reserved for it and for the following ones is given
+	 * back, so the caller can retry them.
+	 *
+	 * @return number of datagrams sent, always the first ones of the batch (see UdpBatchSender::Send())
+	 */
+	size_t Send(PacketBatch &batch)
+	{
+		if (!paced || mode == PacingMode::MaxPacingRate) {
+			return sender.Send(batch);
+		}
+		const size_t n = batch.Size();
+		size_t first = 0;
+		uint64_t now = MonotonicNs();
+		for (size_t i = 0; i < n; ++i) {
+			uint64_t departure = limiter.Reserve(batch.Length(i) + overhead, now);
+			uint64_t lead = mode == PacingMode::TxTime ? maxLeadNs : 0;
+			if (departure > now + lead) {
+				// flush what is due, then wait for this datagram's turn
+				size_t sent = Flush(batch, first, i);
+				if (first + sent < i) {
+					return Abandon(batch, first + sent, i + 1);
+				}
+				first = i;
+				SleepUntil(departure - lead);
+				now = MonotonicNs();
+			}
+			if (mode == PacingMode::TxTime) {
+				batch.SetTxTime(i, departure);
+			}
+		}
+		size_t sent = Flush(batch, first, n);
+		if (first + sent < n) {
+			return Abandon(batch, first + sent, n);
+		}
+		return n;
+	}
+
+	int Fd() const
+	{
+		return sender.Fd();
+	}
+
+	void Close()
+	{
+		sender.Close();
+	}
+
+private:
+	size_t Flush(PacketBatch &batch, size_t first, size_t last)
+	{
+		return last > first ? sender.Send(batch, first, last - first) : 0;
+	}
+
+	/// Credits back the datagrams [unsent, reserved) and returns the count of those sent before them
+	size_t Abandon(const PacketBatch &batch, size_t unsent, size_t reserved)
+	{
+		uint64_t bytes = 0;
+		for (size_t i = unsent; i < reserved; ++i) {
+			bytes += batch.Length(i) + overhead;
+		}
+		limiter.Unreserve(bytes);
+		return unsent;
+	}
+
+	UdpBatchSender sender;
+	Gcra limiter;
+	PacingMode mode;
+	uint64_t maxLeadNs;
+	size_t overhead;
+	bool paced;
+};
+
+} /* namespace FUTILS */
+
+#endif /* Linux functions*/
+
+#endif /* FUTILS_RATELIMIT_H_ */
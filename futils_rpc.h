@@ -0,0 +1,715 @@
+/**
+ * @brief Asynchronous request/response over UDP on the epoll EventLoop.
+ *
+ * @details The utilities implemented include:
+ * 			- RpcClient: many outstanding requests multiplexed on one socket, matched to their
+ * 			  replies by a correlation id in a pending-request table; each request has a deadline
+ * 			  (and optional retransmissions) kept in a TimerQueue driven by one timerfd, and
+ * 			  completes a callback or a std::future
+ * 			- RpcServer: method id -> handler dispatch, replying immediately or later (Respond())
+ * 			- batching on both sides: requests and replies produced during one loop iteration
+ * 			  leave in a single sendmmsg(), datagrams arrive through recvmmsg()
+ *
+ * 			Wire format: an 8 byte header (id, method, type, status code; network byte order)
+ * 			followed by the payload, one message per datagram. Delivery is at-most-once without
+ * 			retransmissions, at-least-once with them: handlers of retried methods must be
+ * 			idempotent.
+ *
+ * 			Example:
+ * 			@code
+ * 			FUTILS::EventLoop loop;
+ * 			FUTILS::RpcClient client(loop);
+ * 			client.Open("10.0.0.5", 7000);
+ * 			client.Call(kGetStatus, nullptr, 0, 50000000, [](const FUTILS::RpcResponse &r) {
+ * 				if (r.status == FUTILS::RpcStatus::Ok) {
+ * 					Use(r.data, r.length);
+ * 				}
+ * 			});
+ * 			loop.Run();
+ * 			@endcode
+ */
+
+#ifndef FUTILS_RPC_H_
+#define FUTILS_RPC_H_
+
+#include "futils.h"
+#include "futils_eventloop.h"
+#include "futils_time.h"
+#include "futils_udpbatch.h"
+
+#if defined(__linux__) || defined(linux)
+
+#include <future>
+#include <random>
+#include <unordered_map>
+#include <sys/timerfd.h>
+
+namespace FUTILS
+{
+
+enum class RpcStatus
+{
+	Ok,             ///< reply received, code 0
+	RemoteError,    ///< reply received with a non-zero code
+	Timeout,
+	SendFailed,
+	Cancelled,      ///< Cancel() or Close()
+};
+
+/// Reply codes reserved by the server; applications use 1-252
+static const uint8_t kRpcUnknownMethod = 0xff;
+static const uint8_t kRpcReplyTooLarge = 0xfe;
+/// Returned by a handler that will answer later with RpcServer::Respond()
+static const uint8_t kRpcDeferred = 0xfd;
+
+/// Outcome of a call; data is valid during the callback only
+struct RpcResponse
+{
+	RpcStatus status;
+	uint8_t code;
+	const uint8_t *data;
+	size_t length;
+	uint64_t latencyNs;     ///< first transmission to completion
+};
+
+/// Exception set on the future of a call that does not complete with RpcStatus::Ok
+class RpcError : public std::runtime_error
+{
+public:
+	RpcError(RpcStatus status, uint8_t code) :
+		std::runtime_error(Describe(status, code)), status(status), code(code)
+	{
+	}
+
+	RpcStatus Status() const
+	{
+		return status;
+	}
+
+	uint8_t Code() const
+	{
+		return code;
+	}
+
+private:
+	static std::string Describe(RpcStatus status, uint8_t code)
+	{
+		switch (status) {
+		case RpcStatus::RemoteError:
+			return "rpc: remote error " + std::to_string(code);
+		case RpcStatus::Timeout:
+			return "rpc: timeout";
+		case RpcStatus::SendFailed:
+			return "rpc: send failed";
+		case RpcStatus::Cancelled:
+			return "rpc: cancelled";
+		default:
+			return "rpc: ok";
+		}
+	}
+
+	RpcStatus status;
+	uint8_t code;
+};
+
+namespace detail
+{
+
+static const size_t kRpcHeaderSize = 8;
+static const uint8_t kRpcRequest = 0;
+static const uint8_t kRpcReply = 1;
+
+struct RpcHeader
+{
+	uint32_t id;
+	uint16_t method;
+	uint8_t type;
+	uint8_t code;
+};
+
+inline void PutRpcHeader(uint8_t *p, const RpcHeader &h)
+{
+	uint32_t id = htonl(h.id);
+	uint16_t method = htons(h.method);
+	memcpy(p, &id, 4);
+	memcpy(p + 4, &method, 2);
+	p[6] = h.type;
+	p[7] = h.code;
+}
+
+inline bool GetRpcHeader(const uint8_t *p, size_t len, RpcHeader &h)
+{
+	if (len < kRpcHeaderSize) {
+		return false;
+	}
+	uint32_t id;
+	uint16_t method;
+	memcpy(&id, p, 4);
+	memcpy(&method, p + 4, 2);
+	h.id = ntohl(id);
+	h.method = ntohs(method);
+	h.type = p[6];
+	h.code = p[7];
+	return h.type == kRpcRequest || h.type == kRpcReply;
+}
+
+/**
+ * Outgoing datagrams of one loop iteration, sent together by a task posted on the loop.
+ */
+class RpcOutbox
+{
+public:
+	RpcOutbox(EventLoop &loop, size_t capacity, size_t maxPayload) :
+		loop(loop), batch(capacity, maxPayload), alive(std::make_shared<char>(0)), flushPosted(false), failures(0)
+	{
+	}
+
+	void Attach(int fd)
+	{
+		sender.Attach(fd);
+	}
+
+	/// Slot for a message of len bytes (header included), nullptr if it cannot be sent
+	uint8_t* Reserve(const struct sockaddr_in &peer, size_t len)
+	{
+		if (len > batch.MaxPayload()) {
+			return nullptr;
+		}
+		if (batch.Size() == batch.Capacity()) {
+			Flush();
+		}
+		ssize_t slot = batch.AddInPlace(peer, len);
+		if (!flushPosted) {
+			flushPosted = true;
+			std::weak_ptr<char> token = alive;
+			loop.Post([this, token]() {
+				std::shared_ptr<char> live = token.lock();
+				if (live) {
+					flushPosted = false;
+					Flush();
+				}
+			});
+		}
+		return batch.Payload(static_cast<size_t>(slot));
+	}
+
+	void Flush()
+	{
+		if (batch.Size() == 0) {
+			return;
+		}
+		size_t sent = sender.Send(batch);
+		failures += batch.Size() - sent;
+		batch.Clear();
+	}
+
+	size_t MaxMessage() const
+	{
+		return batch.MaxPayload();
+	}
+
+	/// Datagrams the kernel refused (buffer full, unreachable)
+	uint64_t Failures() const
+	{
+		return failures;
+	}
+
+private:
+	EventLoop &loop;
+	PacketBatch batch;
+	UdpBatchSender sender;
+	std::shared_ptr<char> alive;
+	bool flushPosted;
+	uint64_t failures;
+};
+
+} /* namespace detail */
+
+/**
+ * Client side: Call() must run on the loop thread, CallAsync() may be used from any thread.
+ *
+ * Destroy the client on the loop thread: requests it posted and has not run yet are then dropped.
+ */
+class RpcClient
+{
+public:
+	typedef std::function<void(const RpcResponse&)> Callback;
+
+	/// @param maxMessage largest request or reply, header included
+	explicit RpcClient(EventLoop &loop, size_t maxMessage = 4096) :
+		loop(loop), outbox(loop, 64, maxMessage), inbox(64, maxMessage), alive(std::make_shared<char>(0)),
+		sockfd(-1), timerFd(-1), armedNs(UINT64_MAX), sent(0), retransmits(0), timeouts(0), strayReplies(0)
+	{
+		std::random_device rd;
+		nextId = rd();
+		memset(&server, 0, sizeof(server));
+	}
+
+	~RpcClient()
+	{
+		Close();
+	}
+
+	RpcClient(const RpcClient&) = delete;
+	RpcClient& operator=(const RpcClient&) = delete;
+
+	/// Creates the socket and registers it and the timeout timer on the loop
+	bool Open(const std::string &ip, uint16_t port)
+	{
+		Close();
+		ConfigureSenderSocket(server, const_cast<char*>(ip.c_str()), port);
+		if ((sockfd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) == -1) {
+			perror("socket");
+			return false;
+		}
+		if ((timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC)) == -1) {
+			perror("timerfd_create");
+			Close();
+			return false;
+		}
+		outbox.Attach(sockfd);
+		receiver.Attach(sockfd);
+		if (!loop.Add(sockfd, EPOLLIN, [this](uint32_t) { ReceiveReplies(); }) ||
+				!loop.Add(timerFd, EPOLLIN, [this](uint32_t) { Expire(); })) {
+			perror("epoll_ctl");
+			Close();
+			return false;
+		}
+		return true;
+	}
+
+	/**
+	 * @brief Sends a request; callback runs on the loop thread with the reply, or on timeout.
+	 *
+	 * @param timeoutNs deadline from now
+	 * @param attempts transmissions spread over the timeout (1: no retransmission)
+	 * @return the correlation id, 0 if the request could not be queued (callback already run)
+	 */
+	uint32_t Call(uint16_t method, const void *data, size_t len, uint64_t timeoutNs, Callback callback, unsigned attempts = 1)
+	{
+		uint32_t id = NewId();
+		uint64_t now = MonotonicNs();
+		attempts = std::max(attempts, 1u);
+		if (!Transmit(id, method, data, len)) {
+			Complete(callback, RpcStatus::SendFailed, 0, nullptr, 0, 0);
+			return 0;
+		}
+		PendingCall &call = pending[id];
+		call.callback = std::move(callback);
+		call.firstSentNs = now;
+		call.deadlineNs = now + timeoutNs;
+		call.interval = timeoutNs / attempts;
+		call.attemptsLeft = attempts - 1;
+		call.method = method;
+		if (call.attemptsLeft > 0) {
+			call.request.assign(static_cast<const uint8_t*>(data), static_cast<const uint8_t*>(data) + len);
+		}
+		call.timer = timers.Schedule(now + call.interval, [this, id]() { Timeout(id); });
+		ArmTimer();
+		return id;
+	}
+
+	/**
+	 * @brief Thread safe call whose future yields the reply payload, or throws RpcError.
+	 *
+	 * The request is posted to the loop thread; do not wait on the future from that thread. If the
+	 * client is destroyed before the request runs, the future throws RpcError(RpcStatus::Cancelled).
+	 */
+	std::future<std::vector<uint8_t> > CallAsync(uint16_t method, std::vector<uint8_t> request, uint64_t timeoutNs, unsigned attempts = 1)
+	{
+		std::shared_ptr<std::promise<std::vector<uint8_t> > > promise = std::make_shared<std::promise<std::vector<uint8_t> > >();
+		std::future<std::vector<uint8_t> > future = promise->get_future();
+		std::shared_ptr<std::vector<uint8_t> > payload = std::make_shared<std::vector<uint8_t> >(std::move(request));
+		std::weak_ptr<char> token = alive;
+		loop.Post([this, token, method, payload, timeoutNs, attempts, promise]() {
+			if (token.expired()) {
+				promise->set_exception(std::make_exception_ptr(RpcError(RpcStatus::Cancelled, 0)));
+				return;
+			}
+			Call(method, payload->data(), payload->size(), timeoutNs, [promise](const RpcResponse &r) {
+				if (r.status == RpcStatus::Ok) {
+					promise->set_value(std::vector<uint8_t>(r.data, r.data + r.length));
+				} else {
+					promise->set_exception(std::make_exception_ptr(RpcError(r.status, r.code)));
+				}
+			}, attempts);
+		});
+		return future;
+	}
+
+	/// Completes a pending call with RpcStatus::Cancelled; a late reply is then ignored
+	bool Cancel(uint32_t id)
+	{
+		std::unordered_map<uint32_t, PendingCall>::iterator it = pending.find(id);
+		if (it == pending.end()) {
+			return false;
+		}
+		Finish(it, RpcStatus::Cancelled, 0, nullptr, 0);
+		return true;
+	}
+
+	/// Sends the queued requests now instead of at the end of the loop iteration
+	void Flush()
+	{
+		outbox.Flush();
+	}
+
+	/// Calls waiting for their reply
+	size_t Pending() const
+	{
+		return pending.size();
+	}
+
+	/// Datagrams sent, retransmissions included
+	uint64_t Sent() const
+	{
+		return sent;
+	}
+
+	uint64_t Retransmits() const
+	{
+		return retransmits;
+	}
+
+	uint64_t Timeouts() const
+	{
+		return timeouts;
+	}
+
+	/// Replies to no pending call (late, duplicated or from another host)
+	uint64_t StrayReplies() const
+	{
+		return strayReplies;
+	}
+
+	/// Cancels the pending calls and closes the socket
+	void Close()
+	{
+		while (!pending.empty()) {
+			Finish(pending.begin(), RpcStatus::Cancelled, 0, nullptr, 0);
+		}
+		if (sockfd >= 0) {
+			loop.Remove(sockfd);
+			::close(sockfd);
+			sockfd = -1;
+		}
+		if (timerFd >= 0) {
+			loop.Remove(timerFd);
+			::close(timerFd);
+			timerFd = -1;
+		}
+		armedNs = UINT64_MAX;
+	}
+
+private:
+	struct PendingCall
+	{
+		Callback callback;
+		TimerQueue::TimerId timer;
+		uint64_t firstSentNs;
+		uint64_t deadlineNs;
+		uint64_t interval;
+		unsigned attemptsLeft;
+		uint16_t method;
+		std::vector<uint8_t> request;   ///< kept for retransmissions only
+	};
+
+	uint32_t NewId()
+	{
+		uint32_t id;
+		do {
+			id = nextId++;
+		} while (id == 0 || pending.count(id));
+		return id;
+	}
+
+	bool Transmit(uint32_t id, uint16_t method, const void *data, size_t len)
+	{
+		uint8_t *p = sockfd >= 0 ? outbox.Reserve(server, detail::kRpcHeaderSize + len) : nullptr;
+		if (!p) {
+			return false;
+		}
+		detail::RpcHeader h = { id, method, detail::kRpcRequest, 0 };
+		detail::PutRpcHeader(p, h);
+		if (len) {
+			memcpy(p + detail::kRpcHeaderSize, data, len);
+		}
+		++sent;
+		return true;
+	}
+
+	void ReceiveReplies()
+	{
+		// bounded, so that a flood of replies cannot starve the other descriptors of the loop
+		for (int round = 0; round < 4; ++round) {
+			int n = receiver.Receive(inbox);
+			for (int i = 0; i < n; ++i) {
+				const struct sockaddr_in &from = inbox.Peer(static_cast<size_t>(i));
+				detail::RpcHeader h;
+				const uint8_t *p = inbox.Payload(static_cast<size_t>(i));
+				size_t len = inbox.Length(static_cast<size_t>(i));
+				std::unordered_map<uint32_t, PendingCall>::iterator it;
+				if (from.sin_addr.s_addr != server.sin_addr.s_addr || from.sin_port != server.sin_port ||
+						!detail::GetRpcHeader(p, len, h) || h.type != detail::kRpcReply ||
+						(it = pending.find(h.id)) == pending.end() || it->second.method != h.method) {
+					++strayReplies;
+					continue;
+				}
+				Finish(it, h.code == 0 ? RpcStatus::Ok : RpcStatus::RemoteError, h.code,
+						p + detail::kRpcHeaderSize, len - detail::kRpcHeaderSize);
+			}
+			if (n < static_cast<int>(inbox.Capacity())) {
+				break;
+			}
+		}
+	}
+
+	void Timeout(uint32_t id)
+	{
+		std::unordered_map<uint32_t, PendingCall>::iterator it = pending.find(id);
+		if (it == pending.end()) {
+			return;
+		}
+		PendingCall &call = it->second;
+		uint64_t now = MonotonicNs();
+		if (call.attemptsLeft > 0 && now < call.deadlineNs) {
+			--call.attemptsLeft;
+			++retransmits;
+			Transmit(id, call.method, call.request.data(), call.request.size());
+			call.timer = timers.Schedule(std::min(now + call.interval, call.deadlineNs), [this, id]() { Timeout(id); });
+			return;
+		}
+		++timeouts;
+		call.timer = 0;
+		Finish(it, RpcStatus::Timeout, 0, nullptr, 0);
+	}
+
+	void Finish(std::unordered_map<uint32_t, PendingCall>::iterator it, RpcStatus status, uint8_t code, const uint8_t *data, size_t len)
+	{
+		Callback callback = std::move(it->second.callback);
+		uint64_t latency = MonotonicNs() - it->second.firstSentNs;
+		if (it->second.timer) {
+			timers.Cancel(it->second.timer);
+		}
+		pending.erase(it);
+		Complete(callback, status, code, data, len, latency);
+	}
+
+	static void Complete(const Callback &callback, RpcStatus status, uint8_t code, const uint8_t *data, size_t len, uint64_t latency)
+	{
+		if (callback) {
+			RpcResponse r = { status, code, data, len, latency };
+			callback(r);
+		}
+	}
+
+	void Expire()
+	{
+		uint64_t expirations;
+		while (::read(timerFd, &expirations, sizeof(expirations)) > 0) {
+		}
+		armedNs = UINT64_MAX;
+		timers.RunExpired(MonotonicNs());
+		ArmTimer();
+	}
+
+	/// Re-arms the timerfd only when the earliest deadline moved earlier (usually not: timeouts are alike)
+	void ArmTimer()
+	{
+		uint64_t next = timers.NextDeadline();
+		if (next >= armedNs || timerFd < 0) {
+			return;
+		}
+		struct itimerspec its;
+		memset(&its, 0, sizeof(its));
+		its.it_value.tv_sec = static_cast<time_t>(next / 1000000000ULL);
+		its.it_value.tv_nsec = static_cast<long>(next % 1000000000ULL);
+		if (timerfd_settime(timerFd, TFD_TIMER_ABSTIME, &its, nullptr) == -1) {
+			perror("timerfd_settime");
+			return;
+		}
+		armedNs = next;
+	}
+
+	EventLoop &loop;
+	detail::RpcOutbox outbox;
+	PacketBatch inbox;
+	UdpBatchReceiver receiver;
+	TimerQueue timers;
+	std::unordered_map<uint32_t, PendingCall> pending;
+	std::shared_ptr<char> alive;    ///< expires with the client: tasks it posted check it first
+	struct sockaddr_in server;
+	int sockfd;
+	int timerFd;
+	uint64_t armedNs;
+	uint32_t nextId;
+	uint64_t sent;
+	uint64_t retransmits;
+	uint64_t timeouts;
+	uint64_t strayReplies;
+};
+
+/// Request being served; data is valid during the handler call only, the rest until Respond()
+struct RpcRequest
+{
+	uint32_t id;
+	uint16_t method;
+	const uint8_t *data;
+	size_t length;
+	struct sockaddr_in peer;
+};
+
+/**
+ * Server side, on the loop thread.
+ */
+class RpcServer
+{
+public:
+	/**
+	 * Fills reply and returns its code (0 for success), or returns kRpcDeferred and calls
+	 * Respond() later.
+	 */
+	typedef std::function<uint8_t(const RpcRequest &request, std::vector<uint8_t> &reply)> Handler;
+
+	explicit RpcServer(EventLoop &loop, size_t maxMessage = 4096) :
+		loop(loop), outbox(loop, 64, maxMessage), inbox(64, maxMessage), sockfd(-1), served(0), rejected(0)
+	{
+	}
+
+	~RpcServer()
+	{
+		Close();
+	}
+
+	RpcServer(const RpcServer&) = delete;
+	RpcServer& operator=(const RpcServer&) = delete;
+
+	void Register(uint16_t method, Handler handler)
+	{
+		handlers[method] = std::move(handler);
+	}
+
+	/// Binds the UDP port on all addresses and registers it on the loop; false if the port is taken
+	bool Listen(uint16_t port)
+	{
+		Close();
+		if ((sockfd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, IPPROTO_UDP)) == -1) {
+			perror("socket");
+			return false;
+		}
+		struct sockaddr_in addr;
+		memset(&addr, 0, sizeof(addr));
+		addr.sin_family = AF_INET;
+		addr.sin_port = htons(port);
+		addr.sin_addr.s_addr = htonl(INADDR_ANY);
+		if (bind(sockfd, (struct sockaddr*)&addr, sizeof(addr)) == -1) {
+			perror("bind");
+			Close();
+			return false;
+		}
+		outbox.Attach(sockfd);
+		receiver.Attach(sockfd);
+		if (!loop.Add(sockfd, EPOLLIN, [this](uint32_t) { Serve(); })) {
+			perror("epoll_ctl");
+			Close();
+			return false;
+		}
+		return true;
+	}
+
+	/// Answers a request a handler deferred with kRpcDeferred
+	bool Respond(const RpcRequest &request, uint8_t code, const void *data, size_t len)
+	{
+		uint8_t *p = sockfd >= 0 ? outbox.Reserve(request.peer, detail::kRpcHeaderSize + len) : nullptr;
+		if (!p) {
+			return false;
+		}
+		detail::RpcHeader h = { request.id, request.method, detail::kRpcReply, code };
+		detail::PutRpcHeader(p, h);
+		if (len) {
+			memcpy(p + detail::kRpcHeaderSize, data, len);
+		}
+		++served;
+		return true;
+	}
+
+	/// Replies sent
+	uint64_t Served() const
+	{
+		return served;
+	}
+
+	/// Malformed requests and unknown methods
+	uint64_t Rejected() const
+	{
+		return rejected;
+	}
+
+	void Close()
+	{
+		if (sockfd >= 0) {
+			outbox.Flush();
+			loop.Remove(sockfd);
+			::close(sockfd);
+			sockfd = -1;
+		}
+	}
+
+private:
+	void Serve()
+	{
+		for (int round = 0; round < 4; ++round) {
+			int n = receiver.Receive(inbox);
+			for (int i = 0; i < n; ++i) {
+				Dispatch(static_cast<size_t>(i));
+			}
+			// one sendmmsg() for the replies of the batch
+			outbox.Flush();
+			if (n < static_cast<int>(inbox.Capacity())) {
+				break;
+			}
+		}
+	}
+
+	void Dispatch(size_t i)
+	{
+		detail::RpcHeader h;
+		const uint8_t *p = inbox.Payload(i);
+		size_t len = inbox.Length(i);
+		if (!detail::GetRpcHeader(p, len, h) || h.type != detail::kRpcRequest) {
+			++rejected;
+			return;
+		}
+		RpcRequest request = { h.id, h.method, p + detail::kRpcHeaderSize, len - detail::kRpcHeaderSize, inbox.Peer(i) };
+		std::unordered_map<uint16_t, Handler>::iterator it = handlers.find(h.method);
+		if (it == handlers.end()) {
+			++rejected;
+			Respond(request, kRpcUnknownMethod, nullptr, 0);
+			return;
+		}
+		reply.clear();
+		uint8_t code = it->second(request, reply);
+		if (code == kRpcDeferred) {
+			return;
+		}
+		if (!Respond(request, code, reply.data(), reply.size())) {
+			Respond(request, kRpcReplyTooLarge, nullptr, 0);
+		}
+	}
+
+	EventLoop &loop;
+	detail::RpcOutbox outbox;
+	PacketBatch inbox;
+	UdpBatchReceiver receiver;
+	std::unordered_map<uint16_t, Handler> handlers;
+	std::vector<uint8_t> reply;
+	int sockfd;
+	uint64_t served;
+	uint64_t rejected;
+};
+
+} /* namespace FUTILS */
+
+#endif /* Linux functions*/
+
+#endif /* FUTILS_RPC_H_ */
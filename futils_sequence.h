@@ -0,0 +1,585 @@
+/**
+ * @brief Sequence tracking of datagram streams: gaps, reordering and duplicates.
+ *
+ * @details The utilities implemented include:
+ * 			- SequenceField: where a stream carries its sequence number (offset, 16 or 32 bits,
+ * 			  big endian); 16 bit numbers are extended to 32 bits around the expected one
+ * 			- SequenceTracker: classification only (in order, reordered, duplicate, late) over a
+ * 			  sliding bitmap window, a few instructions per packet; drops the copies received
+ * 			  over redundant paths or multicast groups
+ * 			- ReorderBuffer: delivers a stream in order through a ring of slots; in-order packets
+ * 			  are delivered straight from the receive batch, early ones are copied into their slot
+ * 			  until the missing ones arrive, the window overflows or they have waited too long
+ * 			- SequenceStats: gap, late, duplicate and reorder counters, exported with ForEach()
+ *
+ * 			Sequence numbers compare in serial number arithmetic (RFC 1982), so they may wrap.
+ * 			One tracker or buffer per stream: demultiplex by source first.
+ *
+ * 			Example:
+ * 			@code
+ * 			FUTILS::ReorderBuffer reorder(256);
+ * 			FUTILS::SequenceField field(0, 4);       // first 4 payload bytes
+ * 			while (receiver.Receive(batch) > 0) {
+ * 				reorder.Push(batch, field, FUTILS::CoarseClock::NowNs(), [](uint32_t seq, const uint8_t *p, size_t len) {
+ * 					Consume(seq, p, len);
+ * 				});
+ * 			}
+ * 			@endcode
+ */
+
+#ifndef FUTILS_SEQUENCE_H_
+#define FUTILS_SEQUENCE_H_
+
+#include "futils.h"
+#include "futils_udpbatch.h"
+
+#if defined(__linux__) || defined(linux)
+
+namespace FUTILS
+{
+
+/// Signed distance from b to a in serial number arithmetic
+inline int32_t SequenceDelta(uint32_t a, uint32_t b)
+{
+	return static_cast<int32_t>(a - b);
+}
+
+/// Location of the sequence number in a payload
+struct SequenceField
+{
+	size_t offset;
+	unsigned width;     ///< 2 or 4 bytes, big endian
+
+	explicit SequenceField(size_t offset = 0, unsigned width = 4) :
+		offset(offset), width(width)
+	{
+	}
+
+	/**
+	 * @brief Reads the number; a 16 bit one is extended to the 32 bit value nearest to reference.
+	 *
+	 * @return false if the payload is too short
+	 */
+	bool Read(const uint8_t *p, size_t len, uint32_t reference, uint32_t &seq) const
+	{
+		if (len < offset + width) {
+			return false;
+		}
+		p += offset;
+		if (width == 2) {
+			uint16_t raw = static_cast<uint16_t>(p[0] << 8 | p[1]);
+			seq = reference + static_cast<uint32_t>(static_cast<int16_t>(raw - static_cast<uint16_t>(reference)));
+		} else {
+			seq = static_cast<uint32_t>(p[0]) << 24 | static_cast<uint32_t>(p[1]) << 16 | static_cast<uint32_t>(p[2]) << 8 | p[3];
+		}
+		return true;
+	}
+};
+
+enum class SequenceVerdict
+{
+	InOrder,        ///< the next one expected (or the first)
+	Reordered,      ///< ahead of the next expected: earlier ones are missing for now
+	Filled,         ///< behind the highest seen, filling a gap
+	Duplicate,
+	Late,           ///< behind the window: too old to tell, or already declared lost
+	Invalid,        ///< no sequence number (payload too short)
+};
+
+struct SequenceStats
+{
+	uint64_t received;
+	uint64_t delivered;
+	uint64_t duplicates;
+	uint64_t reordered;     ///< delivered after a later packet
+	uint64_t late;          ///< arrived after being given up, or too old
+	uint64_t lost;          ///< given up (skipped) sequence numbers
+	uint64_t resyncs;       ///< restarts on a new sequence (sender restart)
+	uint64_t invalid;
+
+	/// Calls f(name, value) for each counter, for a metrics exporter
+	template<typename F>
+	void ForEach(F &&f) const
+	{
+		f("received", received);
+		f("delivered", delivered);
+		f("duplicates", duplicates);
+		f("reordered", reordered);
+		f("late", late);
+		f("lost", lost);
+		f("resyncs", resyncs);
+		f("invalid", invalid);
+	}
+};
+
+/**
+ * Duplicate and gap detection over a window of the last window sequence numbers (anti-replay
+ * bitmap kept as a ring of 64 bit words, so sliding never shifts the whole map).
+ */
+class SequenceTracker
+{
+public:
+	/**
+	 * Consecutive sequence numbers behind the window, with nothing inside it meanwhile, that mean
+	 * a sender restart once the stream has been silent for a while (ReorderBuffer: maxHold).
+	 * Without a clock the tracker waits for a whole window of them: a redundant path lagging by
+	 * more than the window sends short runs in every burst, and any packet inside the window
+	 * ends the run.
+	 */
+	static const unsigned kResyncAfter = 3;
+
+	/// @param window bits of history, rounded up to a power of two (at least 64)
+	explicit SequenceTracker(uint32_t window = 1024) :
+		highest(0), origin(0), originInWindow(false), started(false), staleStreak(0), staleLast(0)
+	{
+		uint32_t w = 64;
+		while (w < window) {
+			w <<= 1;
+		}
+		// twice the window: the words cleared ahead never hold bits still inside it
+		bits.assign(2 * w / 64, 0);
+		windowSize = w;
+		memset(&stats, 0, sizeof(stats));
+	}
+
+	SequenceVerdict Accept(uint32_t seq)
+	{
+		++stats.received;
+		if (!started) {
+			Start(seq);
+			++stats.delivered;
+			return SequenceVerdict::InOrder;
+		}
+		int32_t d = SequenceDelta(seq, highest);
+		if (d > 0) {
+			staleStreak = 0;
+			// clear the words the window slides over (word numbers wrap at 2^26 with the sequence)
+			uint32_t fromWord = (highest >> 6) + 1;
+			uint32_t advanced = ((seq >> 6) - (highest >> 6)) & ((1u << 26) - 1);
+			uint32_t words = static_cast<uint32_t>(bits.size());
+			for (uint32_t n = 0; n < std::min(advanced, words); ++n) {
+				bits[(fromWord + n) & (words - 1)] = 0;
+			}
+			stats.lost += static_cast<uint32_t>(d - 1);
+			highest = seq;
+			if (originInWindow && seq - origin >= windowSize) {
+				originInWindow = false;
+			}
+			Set(seq);
+			++stats.delivered;
+			return d == 1 ? SequenceVerdict::InOrder : SequenceVerdict::Reordered;
+		}
+		if (static_cast<uint32_t>(-d) >= windowSize) {
+			staleStreak = staleStreak && seq == staleLast + 1 ? staleStreak + 1 : 1;
+			staleLast = seq;
+			if (staleStreak >= windowSize) {
+				++stats.resyncs;
+				Start(seq);
+				++stats.delivered;
+				return SequenceVerdict::InOrder;
+			}
+			++stats.late;
+			return SequenceVerdict::Late;
+		}
+		staleStreak = 0;
+		if (Test(seq)) {
+			++stats.duplicates;
+			return SequenceVerdict::Duplicate;
+		}
+		Set(seq);
+		// it had been counted lost when the window jumped over it, unless it precedes the first one seen
+		if (!originInWindow || SequenceDelta(seq, origin) > 0) {
+			--stats.lost;
+		}
+		++stats.reordered;
+		++stats.delivered;
+		return SequenceVerdict::Filled;
+	}
+
+	/// Accepts each datagram of batch; keep[i] is false for the ones to drop (duplicates, late, invalid)
+	size_t Accept(const PacketBatch &batch, const SequenceField &field, bool *keep)
+	{
+		size_t kept = 0;
+		for (size_t i = 0; i < batch.Size(); ++i) {
+			uint32_t seq;
+			if (!field.Read(batch.Payload(i), batch.Length(i), highest, seq)) {
+				++stats.received;
+				++stats.invalid;
+				keep[i] = false;
+				continue;
+			}
+			SequenceVerdict v = Accept(seq);
+			keep[i] = v != SequenceVerdict::Duplicate && v != SequenceVerdict::Late;
+			kept += keep[i];
+		}
+		return kept;
+	}
+
+	uint32_t Highest() const
+	{
+		return highest;
+	}
+
+	const SequenceStats& Stats() const
+	{
+		return stats;
+	}
+
+	void Reset()
+	{
+		started = false;
+		staleStreak = 0;
+		std::fill(bits.begin(), bits.end(), 0);
+	}
+
+private:
+	void Start(uint32_t seq)
+	{
+		std::fill(bits.begin(), bits.end(), 0);
+		highest = seq;
+		origin = seq;
+		originInWindow = true;
+		started = true;
+		staleStreak = 0;
+		Set(seq);
+	}
+
+	bool Test(uint32_t seq) const
+	{
+		return (bits[(seq >> 6) & (bits.size() - 1)] >> (seq & 63)) & 1;
+	}
+
+	void Set(uint32_t seq)
+	{
+		bits[(seq >> 6) & (bits.size() - 1)] |= 1ULL << (seq & 63);
+	}
+
+	std::vector<uint64_t> bits;
+	uint32_t windowSize;
+	uint32_t highest;
+	uint32_t origin;            ///< sequence number tracking (re)started at: nothing before it was counted lost
+	bool originInWindow;
+	bool started;
+	unsigned staleStreak;
+	uint32_t staleLast;
+	SequenceStats stats;
+};
+
+/**
+ * In-order delivery of one stream through a window of slots (seq % window).
+ *
+ * Deliver callbacks are called as deliver(uint32_t seq, const uint8_t *data, size_t len).
+ */
+class ReorderBuffer
+{
+public:
+	/**
+	 * @param window slots, rounded up to a power of two: the largest reordering distance repaired
+	 * @param maxPayload largest datagram buffered (larger early ones are delivered at once)
+	 * @param maxHoldNs longest wait for a missing packet before it is given up (see Flush())
+	 */
+	explicit ReorderBuffer(uint32_t window = 256, size_t maxPayload = 2048, uint64_t maxHoldNs = 5000000) :
+		maxPayload(maxPayload), maxHold(maxHoldNs), next(0), started(false), buffered(0), early(0), staleStreak(0), staleLast(0),
+		progressNs(0)
+	{
+		uint32_t w = 64;
+		while (w < window) {
+			w <<= 1;
+		}
+		mask = w - 1;
+		tags.assign(w, 0);
+		states.assign(w, kEmpty);
+		lengths.assign(w, 0);
+		arrivals.assign(w, 0);
+		storage.resize(static_cast<size_t>(w) * maxPayload);
+		memset(&stats, 0, sizeof(stats));
+	}
+
+	ReorderBuffer(const ReorderBuffer&) = delete;
+	ReorderBuffer& operator=(const ReorderBuffer&) = delete;
+
+	/**
+	 * @brief Takes one packet, delivering it and whatever it unblocks.
+	 *
+	 * data is copied only if the packet must wait for earlier ones.
+	 */
+	template<typename Deliver>
+	SequenceVerdict Push(uint32_t seq, const uint8_t *data, size_t len, uint64_t nowNs, Deliver &&deliver)
+	{
+		++stats.received;
+		if (!started) {
+			started = true;
+			next = seq;
+		}
+		int32_t d = SequenceDelta(seq, next);
+		if (d >= 0) {
+			staleStreak = 0;
+			progressNs = nowNs;
+		}
+		if (d == 0) {
+			Deliver1(seq, data, len, deliver);
+			Advance(deliver);
+			return SequenceVerdict::InOrder;
+		}
+		if (d < 0) {
+			return Behind(seq, data, len, nowNs, deliver);
+		}
+		if (static_cast<uint32_t>(d) > mask) {
+			// the window must slide: give up what is missing before seq - window + 1
+			SkipTo(seq - mask, deliver);
+			if (seq == next) {
+				Deliver1(seq, data, len, deliver);
+				Advance(deliver);
+				return SequenceVerdict::InOrder;
+			}
+		}
+		uint32_t slot = seq & mask;
+		if (states[slot] != kEmpty && states[slot] != kLost && tags[slot] == seq) {
+			++stats.duplicates;
+			return SequenceVerdict::Duplicate;
+		}
+		if (len > maxPayload) {
+			// cannot wait: deliver out of order rather than drop, next passes over it later
+			++stats.delivered;
+			deliver(seq, data, len);
+			Mark(seq, kDelivered);
+			++early;
+			return SequenceVerdict::Reordered;
+		}
+		memcpy(&storage[static_cast<size_t>(slot) * maxPayload], data, len);
+		lengths[slot] = static_cast<uint32_t>(len);
+		arrivals[slot] = nowNs;
+		Mark(seq, kBuffered);
+		++buffered;
+		return SequenceVerdict::Reordered;
+	}
+
+	/// Pushes the datagrams of a batch (sequence numbers read with field)
+	template<typename Deliver>
+	size_t Push(const PacketBatch &batch, const SequenceField &field, uint64_t nowNs, Deliver &&deliver)
+	{
+		size_t before = stats.delivered;
+		for (size_t i = 0; i < batch.Size(); ++i) {
+			uint32_t seq;
+			if (!field.Read(batch.Payload(i), batch.Length(i), next, seq)) {
+				++stats.received;
+				++stats.invalid;
+				continue;
+			}
+			Push(seq, batch.Payload(i), batch.Length(i), nowNs, deliver);
+		}
+		if (buffered) {
+			Flush(nowNs, deliver);
+		}
+		return static_cast<size_t>(stats.delivered - before);
+	}
+
+	/**
+	 * @brief Gives up the missing packets ahead of any buffered one that has waited maxHoldNs.
+	 *
+	 * Call it periodically when the stream may stall (Push() of a batch calls it).
+	 *
+	 * @return packets delivered
+	 */
+	template<typename Deliver>
+	size_t Flush(uint64_t nowNs, Deliver &&deliver)
+	{
+		size_t before = stats.delivered;
+		while (buffered) {
+			uint32_t first = FirstBuffered();
+			if (nowNs - arrivals[first & mask] < maxHold) {
+				break;
+			}
+			SkipTo(first, deliver);
+		}
+		return static_cast<size_t>(stats.delivered - before);
+	}
+
+	/// Delivers everything buffered, giving up the gaps (end of stream)
+	template<typename Deliver>
+	void Drain(Deliver &&deliver)
+	{
+		while (buffered) {
+			SkipTo(FirstBuffered(), deliver);
+		}
+	}
+
+	/// Next sequence number to deliver
+	uint32_t Expected() const
+	{
+		return next;
+	}
+
+	size_t Buffered() const
+	{
+		return buffered;
+	}
+
+	uint32_t Window() const
+	{
+		return mask + 1;
+	}
+
+	const SequenceStats& Stats() const
+	{
+		return stats;
+	}
+
+	/// Forgets the stream position and the buffered packets (counters are kept)
+	void Reset()
+	{
+		started = false;
+		buffered = 0;
+		early = 0;
+		staleStreak = 0;
+		std::fill(states.begin(), states.end(), kEmpty);
+	}
+
+private:
+	enum SlotState : uint8_t
+	{
+		kEmpty,
+		kBuffered,
+		kDelivered,
+		kLost,
+	};
+
+	template<typename Deliver>
+	void Deliver1(uint32_t seq, const uint8_t *data, size_t len, Deliver &deliver)
+	{
+		Mark(seq, kDelivered);
+		++next;
+		++stats.delivered;
+		deliver(seq, data, len);
+	}
+
+	/// True (and next moved past it) if next was delivered ahead of its turn
+	bool PassEarly()
+	{
+		uint32_t slot = next & mask;
+		if (early == 0 || states[slot] != kDelivered || tags[slot] != next) {
+			return false;
+		}
+		--early;
+		++next;
+		return true;
+	}
+
+	/// Delivers the buffered run starting at next
+	template<typename Deliver>
+	void Advance(Deliver &deliver)
+	{
+		while (buffered || early) {
+			if (PassEarly()) {
+				continue;
+			}
+			uint32_t slot = next & mask;
+			if (states[slot] != kBuffered || tags[slot] != next) {
+				break;
+			}
+			--buffered;
+			++stats.reordered;
+			Deliver1(next, &storage[static_cast<size_t>(slot) * maxPayload], lengths[slot], deliver);
+		}
+	}
+
+	/// Moves next up to target, delivering the buffered packets and giving up the others
+	template<typename Deliver>
+	void SkipTo(uint32_t target, Deliver &deliver)
+	{
+		while (SequenceDelta(target, next) > 0) {
+			if (buffered == 0 && early == 0 && static_cast<uint32_t>(SequenceDelta(target, next)) > mask) {
+				// long outage: nothing left to walk through
+				stats.lost += static_cast<uint32_t>(SequenceDelta(target, next));
+				next = target;
+				break;
+			}
+			uint32_t slot = next & mask;
+			if (PassEarly()) {
+				continue;
+			}
+			if (states[slot] == kBuffered && tags[slot] == next) {
+				--buffered;
+				++stats.reordered;
+				Deliver1(next, &storage[static_cast<size_t>(slot) * maxPayload], lengths[slot], deliver);
+			} else {
+				Mark(next, kLost);
+				++stats.lost;
+				++next;
+			}
+		}
+		Advance(deliver);
+	}
+
+	template<typename Deliver>
+	SequenceVerdict Behind(uint32_t seq, const uint8_t *data, size_t len, uint64_t nowNs, Deliver &deliver)
+	{
+		uint32_t slot = seq & mask;
+		if (static_cast<uint32_t>(SequenceDelta(next, seq)) <= mask + 1) {
+			staleStreak = 0;
+			progressNs = nowNs;
+			if (tags[slot] == seq && states[slot] == kDelivered) {
+				++stats.duplicates;
+				return SequenceVerdict::Duplicate;
+			}
+			if (tags[slot] == seq) {
+				// given up already: counted late, not delivered out of order; a copy is a duplicate
+				states[slot] = kDelivered;
+			}
+			++stats.late;
+			return SequenceVerdict::Late;
+		}
+		staleStreak = staleStreak && seq == staleLast + 1 ? staleStreak + 1 : 1;
+		staleLast = seq;
+		// a window of them, or a few once nothing in the window has come for maxHold
+		if (staleStreak > mask || (staleStreak >= SequenceTracker::kResyncAfter && nowNs > progressNs && nowNs - progressNs >= maxHold)) {
+			// the sender restarted: follow the new numbering
+			++stats.resyncs;
+			stats.received--;
+			Drain(deliver);
+			Reset();
+			return Push(seq, data, len, nowNs, deliver);
+		}
+		++stats.late;
+		return SequenceVerdict::Late;
+	}
+
+	uint32_t FirstBuffered() const
+	{
+		for (uint32_t s = next;; ++s) {
+			uint32_t slot = s & mask;
+			if (states[slot] == kBuffered && tags[slot] == s) {
+				return s;
+			}
+		}
+	}
+
+	void Mark(uint32_t seq, SlotState state)
+	{
+		tags[seq & mask] = seq;
+		states[seq & mask] = state;
+	}
+
+	size_t maxPayload;
+	uint64_t maxHold;
+	uint32_t mask;
+	uint32_t next;
+	bool started;
+	size_t buffered;
+	size_t early;               ///< delivered out of order (too large to buffer), ahead of next
+	unsigned staleStreak;
+	uint32_t staleLast;
+	uint64_t progressNs;        ///< last packet inside the window
+	std::vector<uint32_t> tags;
+	std::vector<uint8_t> states;
+	std::vector<uint32_t> lengths;
+	std::vector<uint64_t> arrivals;
+	std::vector<uint8_t> storage;
+	SequenceStats stats;
+};
+
+} /* namespace FUTILS */
+
+#endif /* Linux functions*/
+
+#endif /* FUTILS_SEQUENCE_H_ */
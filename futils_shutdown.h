@@ -0,0 +1,442 @@
+/**
+ * @brief Signal handling and graceful shutdown coordination.
+ *
+ * @details The utilities implemented include:
+ * 			- StopSource/StopToken: one-shot stop notification fanned out to worker threads,
+ * 			  observable as an eventfd (for epoll/poll) or through callbacks
+ * 			- ShutdownCoordinator: receives SIGINT/SIGTERM through a signalfd, requests the stop
+ * 			  and runs the registered flush hooks (loggers, recorders, senders) within a deadline
+ *
+ * 			Workers blocked in epoll add StopToken::Fd() to their set, so they wake up on the stop
+ * 			request without a flag being tested on every iteration of the hot path.
+ */
+
+#ifndef FUTILS_SHUTDOWN_H_
+#define FUTILS_SHUTDOWN_H_
+
+#include "futils.h"
+#include "futils_eventloop.h"
+
+#if defined(__linux__) || defined(linux)
+
+#include <csignal>
+#include <sys/signalfd.h>
+#include <poll.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <initializer_list>
+#include <mutex>
+#include <thread>
+
+namespace FUTILS
+{
+
+namespace detail
+{
+struct StopState
+{
+	StopState() :
+		stopped(false)
+	{
+		if ((fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) == -1) {
+			die("eventfd");
+		}
+	}
+
+	~StopState()
+	{
+		::close(fd);
+	}
+
+	std::atomic<bool> stopped;
+	int fd;
+	std::mutex mtx;
+	std::vector<std::function<void()> > callbacks;
+};
+}
+
+/**
+ * Read side of a stop request. Cheap to copy, one per worker thread.
+ */
+class StopToken
+{
+public:
+	StopToken()
+	{
+	}
+
+	explicit StopToken(std::shared_ptr<detail::StopState> state) :
+		state(state)
+	{
+	}
+
+	bool StopRequested() const
+	{
+		return state && state->stopped.load(std::memory_order_acquire);
+	}
+
+	/// Becomes (and stays) readable once the stop is requested; never read it, just poll it
+	int Fd() const
+	{
+		return state ? state->fd : -1;
+	}
+
+	/**
+	 * @brief Waits for the stop request.
+	 *
+	 * @param timeoutMs maximum wait (-1 forever)
+	 * @return true if the stop was requested
+	 */
+	bool Wait(int timeoutMs = -1) const
+	{
+		if (!state) {
+			return false;
+		}
+		struct pollfd pfd;
+		pfd.fd = state->fd;
+		pfd.events = POLLIN;
+		while (poll(&pfd, 1, timeoutMs) < 0 && errno == EINTR) {
+		}
+		return StopRequested();
+	}
+
+private:
+	std::shared_ptr<detail::StopState> state;
+};
+
+/**
+ * Write side of a stop request.
+ */
+class StopSource
+{
+public:
+	StopSource() :
+		state(std::make_shared<detail::StopState>())
+	{
+	}
+
+	StopToken Token() const
+	{
+		return StopToken(state);
+	}
+
+	/**
+	 * @brief Registers a callback run once on the thread requesting the stop
+	 * (immediately if the stop was already requested). Typical use: EventLoop::Stop().
+	 */
+	void OnStop(std::function<void()> callback)
+	{
+		std::unique_lock<std::mutex> lock(state->mtx);
+		if (state->stopped.load(std::memory_order_acquire)) {
+			lock.unlock();
+			callback();
+			return;
+		}
+		state->callbacks.push_back(std::move(callback));
+	}
+
+	/// @return true for the call that actually requested the stop
+	bool RequestStop()
+	{
+		std::vector<std::function<void()> > callbacks;
+		{
+			std::lock_guard<std::mutex> lock(state->mtx);
+			if (state->stopped.exchange(true, std::memory_order_acq_rel)) {
+				return false;
+			}
+			callbacks.swap(state->callbacks);
+		}
+		uint64_t one = 1;
+		ssize_t ret = ::write(state->fd, &one, sizeof(one));
+		(void)ret;
+		for (size_t i = 0; i < callbacks.size(); ++i) {
+			callbacks[i]();
+		}
+		return true;
+	}
+
+	bool StopRequested() const
+	{
+		return state->stopped.load(std::memory_order_acquire);
+	}
+
+private:
+	std::shared_ptr<detail::StopState> state;
+};
+
+/**
+ * Turns termination signals into an orderly shutdown:
+ * 	1. Install() blocks the signals (call it in main() before starting any thread, so that every
+ * 	   thread inherits the mask) and opens a signalfd
+ * 	2. the signalfd is watched by an EventLoop (Attach()) or by WaitForSignal()
+ * 	3. on the first signal the stop is requested: the StopToken fires and OnStop callbacks run
+ * 	4. Shutdown() runs the flush hooks by increasing priority, abandoning them at the deadline
+ *
+ * die() also runs the flush hooks once Install() was called (until the coordinator is destroyed),
+ * so fatal errors keep buffered data.
+ */
+class ShutdownCoordinator
+{
+public:
+	/// Suggested priorities: producers stop first, then data drains towards the disk
+	enum Priority {
+		StopWorkers = 0,
+		FlushSenders = 100,
+		FlushRecorders = 200,
+		FlushLoggers = 300
+	};
+
+	ShutdownCoordinator() :
+		sigFd(-1), dieHook(0), lastSignal(0), loop(nullptr), stopHooked(false), shuttingDown(false)
+	{
+	}
+
+	~ShutdownCoordinator()
+	{
+		if (dieHook != 0) {
+			RemoveDieHook(dieHook);
+		}
+		Detach();
+		if (sigFd >= 0) {
+			::close(sigFd);
+		}
+	}
+
+	ShutdownCoordinator(const ShutdownCoordinator&) = delete;
+	ShutdownCoordinator& operator=(const ShutdownCoordinator&) = delete;
+
+	/**
+	 * @brief Blocks the signals in the calling thread and routes them to a signalfd.
+	 *
+	 * @param signals signals that trigger the shutdown
+	 * @param dieDeadlineMs time budget of the flush hooks when die() is called (0 disables)
+	 * @return true on success, false also if this coordinator is already installed
+	 */
+	bool Install(std::initializer_list<int> signals = { SIGINT, SIGTERM, SIGHUP }, int dieDeadlineMs = 2000)
+	{
+		if (sigFd >= 0) {
+			std::cerr << tc::redL << "ShutdownCoordinator: already installed" << tc::none << std::endl;
+			return false;
+		}
+		sigset_t mask;
+		sigemptyset(&mask);
+		for (int sig : signals) {
+			sigaddset(&mask, sig);
+		}
+		if (pthread_sigmask(SIG_BLOCK, &mask, nullptr) != 0) {
+			perror("pthread_sigmask");
+			return false;
+		}
+		if ((sigFd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC)) == -1) {
+			perror("signalfd");
+			return false;
+		}
+		if (dieDeadlineMs > 0) {
+			dieHook = AddDieHook([this, dieDeadlineMs](const std::string&) {
+				Shutdown(std::chrono::milliseconds(dieDeadlineMs));
+			});
+		}
+		return true;
+	}
+
+	/// The signalfd, for integration with a foreign event loop (call HandleSignals() when readable)
+	int SignalFd() const
+	{
+		return sigFd;
+	}
+
+	/**
+	 * @brief Watches the signalfd from loop; the loop is also stopped when the shutdown is requested.
+	 *
+	 * The loop must outlive the coordinator, or be detached (Detach()) before it is destroyed.
+	 */
+	bool Attach(EventLoop &loop)
+	{
+		Detach();
+		this->loop.store(&loop);
+		if (!stopHooked) {
+			stopHooked = true;
+			source.OnStop([this] {
+				EventLoop *attached = this->loop.load();
+				if (attached) {
+					attached->Stop();
+				}
+			});
+		}
+		return loop.Add(sigFd, EPOLLIN, [this](uint32_t) { HandleSignals(); });
+	}
+
+	/// Stops watching the signalfd from the attached loop (on the loop thread), which then may go away first
+	void Detach()
+	{
+		EventLoop *attached = loop.exchange(nullptr);
+		if (attached && sigFd >= 0) {
+			attached->Remove(sigFd);
+		}
+	}
+
+	/// Reads pending signals; the first one requests the stop
+	void HandleSignals()
+	{
+		struct signalfd_siginfo info;
+		while (::read(sigFd, &info, sizeof(info)) == static_cast<ssize_t>(sizeof(info))) {
+			lastSignal.store(static_cast<int>(info.ssi_signo), std::memory_order_relaxed);
+			std::cerr << DebugMsg(LogEntities::Generic, std::string("received ") + strsignal(static_cast<int>(info.ssi_signo)) + ", shutting down\n", "shutdown");
+			source.RequestStop();
+		}
+	}
+
+	/**
+	 * @brief Blocks until a signal arrives or the stop is requested otherwise.
+	 *
+	 * @return the signal number, 0 if the stop was requested without a signal
+	 */
+	int WaitForSignal()
+	{
+		struct pollfd pfds[2];
+		pfds[0].fd = sigFd;
+		pfds[0].events = POLLIN;
+		pfds[1].fd = source.Token().Fd();
+		pfds[1].events = POLLIN;
+		while (!source.StopRequested()) {
+			if (poll(pfds, 2, -1) < 0 && errno != EINTR) {
+				perror("poll");
+				break;
+			}
+			if (pfds[0].revents & POLLIN) {
+				HandleSignals();
+			}
+		}
+		return lastSignal.load(std::memory_order_relaxed);
+	}
+
+	/// Token for the worker threads
+	StopToken Token() const
+	{
+		return source.Token();
+	}
+
+	/// Registers a callback run as soon as the stop is requested (see StopSource::OnStop())
+	void OnStop(std::function<void()> callback)
+	{
+		source.OnStop(std::move(callback));
+	}
+
+	/// Requests the stop programmatically, as a signal would
+	void RequestShutdown()
+	{
+		source.RequestStop();
+	}
+
+	/**
+	 * @brief Registers a hook run by Shutdown().
+	 *
+	 * @param name used in diagnostics when the deadline expires
+	 * @param hook flush/close function
+	 * @param priority hooks run by increasing priority (see Priority)
+	 */
+	void RegisterFlush(const std::string &name, std::function<void()> hook, int priority = FlushLoggers)
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		FlushHook h;
+		h.name = name;
+		h.hook = std::move(hook);
+		h.priority = priority;
+		auto pos = std::upper_bound(hooks.begin(), hooks.end(), h,
+				[](const FlushHook &a, const FlushHook &b) { return a.priority < b.priority; });
+		hooks.insert(pos, std::move(h));
+	}
+
+	/// Registers obj.Flush() (CompressedWriter, loggers, ...)
+	template<typename T>
+	void RegisterFlushable(const std::string &name, T &obj, int priority = FlushLoggers)
+	{
+		RegisterFlush(name, [&obj] { obj.Flush(); }, priority);
+	}
+
+	/**
+	 * @brief Requests the stop and runs the flush hooks, at most once.
+	 *
+	 * The hooks run on a helper thread; if they do not complete within the deadline the helper is
+	 * abandoned (detached) so that the caller can still exit.
+	 *
+	 * @return true if every hook completed in time
+	 */
+	bool Shutdown(std::chrono::milliseconds deadline)
+	{
+		if (shuttingDown.exchange(true)) {
+			return false;
+		}
+		source.RequestStop();
+
+		struct Progress
+		{
+			std::mutex mtx;
+			std::condition_variable cv;
+			bool done = false;
+			std::string current;
+		};
+		std::shared_ptr<Progress> progress = std::make_shared<Progress>();
+		std::vector<FlushHook> toRun;
+		{
+			std::lock_guard<std::mutex> lock(mtx);
+			toRun = hooks;
+		}
+
+		std::thread runner([progress, toRun] {
+			for (size_t i = 0; i < toRun.size(); ++i) {
+				{
+					std::lock_guard<std::mutex> lock(progress->mtx);
+					progress->current = toRun[i].name;
+				}
+				toRun[i].hook();
+			}
+			std::lock_guard<std::mutex> lock(progress->mtx);
+			progress->done = true;
+			progress->cv.notify_all();
+		});
+
+		std::unique_lock<std::mutex> lock(progress->mtx);
+		bool completed = progress->cv.wait_for(lock, deadline, [&progress] { return progress->done; });
+		if (completed) {
+			lock.unlock();
+			runner.join();
+		} else {
+			std::cerr << DebugMsg(LogEntities::Generic, "deadline expired while running '" + progress->current + "'\n", "shutdown");
+			lock.unlock();
+			runner.detach();
+		}
+		return completed;
+	}
+
+	/// Signal that triggered the shutdown (0 if none)
+	int Signal() const
+	{
+		return lastSignal.load(std::memory_order_relaxed);
+	}
+
+private:
+	struct FlushHook
+	{
+		std::string name;
+		std::function<void()> hook;
+		int priority;
+	};
+
+	int sigFd;
+	int dieHook;
+	std::atomic<int> lastSignal;
+	std::atomic<EventLoop*> loop;
+	bool stopHooked;
+	StopSource source;
+	std::atomic<bool> shuttingDown;
+	std::mutex mtx;
+	std::vector<FlushHook> hooks;
+};
+
+} /* namespace FUTILS */
+
+#endif /* Linux functions*/
+
+#endif /* FUTILS_SHUTDOWN_H_ */
@@ -0,0 +1,429 @@
+/**
+ * @brief Allocation-free string utilities over std::string_view (requires C++17).
+ *
+ * @details The utilities implemented include:
+ * 			- StartsWith/EndsWith, Trim, case-insensitive compare
+ * 			- DelimiterSet: set of ASCII delimiters searched 32 (AVX2) or 16 (SSSE3) bytes at a time
+ * 			  with the "shufti" nibble lookup, so the cost does not depend on the set size
+ * 			- Split(): range over the parts between single character delimiters (empty parts kept)
+ * 			- Tokenize(): range over the tokens between delimiter runs (empty tokens skipped)
+ * 			- ParseNumber(), ParseIPv4(): strict parsers that never allocate
+ */
+
+#ifndef FUTILS_STRING_H_
+#define FUTILS_STRING_H_
+
+#include <charconv>
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+
+#if defined(__x86_64__)
+#	include <immintrin.h>
+#endif
+
+namespace FUTILS
+{
+
+inline bool StartsWith(std::string_view s, std::string_view prefix)
+{
+	return s.size() >= prefix.size() && memcmp(s.data(), prefix.data(), prefix.size()) == 0;
+}
+
+inline bool EndsWith(std::string_view s, std::string_view suffix)
+{
+	return s.size() >= suffix.size() && memcmp(s.data() + s.size() - suffix.size(), suffix.data(), suffix.size()) == 0;
+}
+
+inline bool IsSpace(char c)
+{
+	return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\v' || c == '\f';
+}
+
+inline std::string_view TrimLeft(std::string_view s)
+{
+	size_t i = 0;
+	while (i < s.size() && IsSpace(s[i])) {
+		i++;
+	}
+	return s.substr(i);
+}
+
+inline std::string_view TrimRight(std::string_view s)
+{
+	size_t n = s.size();
+	while (n > 0 && IsSpace(s[n - 1])) {
+		n--;
+	}
+	return s.substr(0, n);
+}
+
+inline std::string_view Trim(std::string_view s)
+{
+	return TrimRight(TrimLeft(s));
+}
+
+inline char ToLowerAscii(char c)
+{
+	return (c >= 'A' && c <= 'Z') ? static_cast<char>(c + ('a' - 'A')) : c;
+}
+
+/// ASCII case-insensitive three-way comparison (<0, 0, >0)
+inline int CompareIgnoreCase(std::string_view a, std::string_view b)
+{
+	size_t n = a.size() < b.size() ? a.size() : b.size();
+	for (size_t i = 0; i < n; ++i) {
+		unsigned char ca = static_cast<unsigned char>(ToLowerAscii(a[i]));
+		unsigned char cb = static_cast<unsigned char>(ToLowerAscii(b[i]));
+		if (ca != cb) {
+			return ca < cb ? -1 : 1;
+		}
+	}
+	return a.size() == b.size() ? 0 : (a.size() < b.size() ? -1 : 1);
+}
+
+inline bool EqualsIgnoreCase(std::string_view a, std::string_view b)
+{
+	return a.size() == b.size() && CompareIgnoreCase(a, b) == 0;
+}
+
+/// Position of c at or after pos, npos if absent (glibc memchr is vectorised)
+inline size_t FindByte(std::string_view s, char c, size_t pos = 0)
+{
+	if (pos >= s.size()) {
+		return std::string_view::npos;
+	}
+	const void *hit = memchr(s.data() + pos, c, s.size() - pos);
+	return hit ? static_cast<size_t>(static_cast<const char*>(hit) - s.data()) : std::string_view::npos;
+}
+
+/**
+ * Set of delimiter characters. ASCII members are found with the shufti technique: a byte
+ * matches when lowTable[low nibble] & highTable[high nibble] != 0, where each of the 8 ASCII
+ * high nibbles owns one bit. Two table lookups (pshufb) classify 16 or 32 bytes at once.
+ */
+class DelimiterSet
+{
+public:
+	DelimiterSet(std::string_view chars)
+	{
+		memset(member, 0, sizeof(member));
+		memset(lowTable, 0, sizeof(lowTable));
+		memset(highTable, 0, sizeof(highTable));
+		ascii = true;
+		for (char ch : chars) {
+			unsigned char c = static_cast<unsigned char>(ch);
+			member[c] = true;
+			if (c >= 0x80) {
+				ascii = false;
+			} else {
+				lowTable[c & 0xf] |= static_cast<uint8_t>(1U << (c >> 4));
+			}
+		}
+		for (int h = 0; h < 8; ++h) {
+			highTable[h] = static_cast<uint8_t>(1U << h);
+		}
+	}
+
+	bool Contains(char c) const
+	{
+		return member[static_cast<unsigned char>(c)];
+	}
+
+	/// Position of the first member at or after pos, npos if none
+	inline size_t FindIn(std::string_view s, size_t pos = 0) const;
+
+	/// Position of the first non member at or after pos, npos if none
+	size_t FindNotIn(std::string_view s, size_t pos = 0) const
+	{
+		for (size_t i = pos; i < s.size(); ++i) {
+			if (!member[static_cast<unsigned char>(s[i])]) {
+				return i;
+			}
+		}
+		return std::string_view::npos;
+	}
+
+	bool member[256];
+	alignas(16) uint8_t lowTable[16];
+	alignas(16) uint8_t highTable[16];
+	bool ascii;
+};
+
+namespace detail
+{
+
+inline size_t FindInScalar(const DelimiterSet &set, const char *p, size_t begin, size_t len)
+{
+	for (size_t i = begin; i < len; ++i) {
+		if (set.member[static_cast<unsigned char>(p[i])]) {
+			return i;
+		}
+	}
+	return std::string_view::npos;
+}
+
+#if defined(__x86_64__)
+__attribute__((target("ssse3")))
+inline size_t FindInSsse3(const DelimiterSet &set, const char *p, size_t i, size_t len)
+{
+	const __m128i lo = _mm_load_si128(reinterpret_cast<const __m128i*>(set.lowTable));
+	const __m128i hi = _mm_load_si128(reinterpret_cast<const __m128i*>(set.highTable));
+	const __m128i nibble = _mm_set1_epi8(0x0f);
+	for (; i + 16 <= len; i += 16) {
+		__m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i));
+		__m128i l = _mm_shuffle_epi8(lo, _mm_and_si128(v, nibble));
+		// Bytes >= 0x80 have the pshufb zeroing bit set, so they never match
+		__m128i h = _mm_shuffle_epi8(hi, _mm_or_si128(_mm_and_si128(_mm_srli_epi16(v, 4), nibble), _mm_and_si128(v, _mm_set1_epi8(static_cast<char>(0x80)))));
+		__m128i hit = _mm_cmpeq_epi8(_mm_and_si128(l, h), _mm_setzero_si128());
+		unsigned mask = static_cast<unsigned>(_mm_movemask_epi8(hit)) ^ 0xffffU;
+		if (mask) {
+			return i + static_cast<size_t>(__builtin_ctz(mask));
+		}
+	}
+	return FindInScalar(set, p, i, len);
+}
+
+__attribute__((target("avx2")))
+inline size_t FindInAvx2(const DelimiterSet &set, const char *p, size_t i, size_t len)
+{
+	const __m256i lo = _mm256_broadcastsi128_si256(_mm_load_si128(reinterpret_cast<const __m128i*>(set.lowTable)));
+	const __m256i hi = _mm256_broadcastsi128_si256(_mm_load_si128(reinterpret_cast<const __m128i*>(set.highTable)));
+	const __m256i nibble = _mm256_set1_epi8(0x0f);
+	const __m256i top = _mm256_set1_epi8(static_cast<char>(0x80));
+	for (; i + 32 <= len; i += 32) {
+		__m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + i));
+		__m256i l = _mm256_shuffle_epi8(lo, _mm256_and_si256(v, nibble));
+		__m256i h = _mm256_shuffle_epi8(hi, _mm256_or_si256(_mm256_and_si256(_mm256_srli_epi16(v, 4), nibble), _mm256_and_si256(v, top)));
+		__m256i miss = _mm256_cmpeq_epi8(_mm256_and_si256(l, h), _mm256_setzero_si256());
+		uint32_t mask = ~static_cast<uint32_t>(_mm256_movemask_epi8(miss));
+		if (mask) {
+			return i + static_cast<size_t>(__builtin_ctz(mask));
+		}
+	}
+	return FindInSsse3(set, p, i, len);
+}
+#endif
+
+typedef size_t (*FindInKernel)(const DelimiterSet&, const char*, size_t, size_t);
+
+inline FindInKernel SelectFindIn()
+{
+#if defined(__x86_64__)
+	if (__builtin_cpu_supports("avx2")) {
+		return FindInAvx2;
+	}
+	if (__builtin_cpu_supports("ssse3")) {
+		return FindInSsse3;
+	}
+#endif
+	return FindInScalar;
+}
+
+} /* namespace detail */
+
+inline size_t DelimiterSet::FindIn(std::string_view s, size_t pos) const
+{
+	static const detail::FindInKernel kernel = detail::SelectFindIn();
+	if (pos >= s.size()) {
+		return std::string_view::npos;
+	}
+	if (!ascii || s.size() - pos < 16) {
+		return detail::FindInScalar(*this, s.data(), pos, s.size());
+	}
+	return kernel(*this, s.data(), pos, s.size());
+}
+
+/**
+ * Range over the parts of a string separated by one character. Empty parts are kept, so
+ * "a,,b" gives "a", "", "b".
+ *
+ * 	for (std::string_view part : FUTILS::Split(line, ',')) { ... }
+ */
+class Split
+{
+public:
+	Split(std::string_view s, char delimiter) :
+		s(s), delimiter(delimiter)
+	{
+	}
+
+	class Iterator
+	{
+	public:
+		Iterator(std::string_view s, char delimiter, bool end) :
+			s(s), delimiter(delimiter), pos(0), done(end)
+		{
+			if (!done) {
+				Advance();
+			}
+		}
+
+		std::string_view operator*() const
+		{
+			return current;
+		}
+
+		Iterator& operator++()
+		{
+			if (pos > s.size()) {
+				done = true;
+			} else {
+				Advance();
+			}
+			return *this;
+		}
+
+		bool operator!=(const Iterator &other) const
+		{
+			return done != other.done;
+		}
+
+	private:
+		void Advance()
+		{
+			size_t next = FindByte(s, delimiter, pos);
+			if (next == std::string_view::npos) {
+				next = s.size();
+			}
+			current = s.substr(pos, next - pos);
+			pos = next + 1;
+		}
+
+		std::string_view s;
+		char delimiter;
+		size_t pos;
+		bool done;
+		std::string_view current;
+	};
+
+	Iterator begin() const
+	{
+		return Iterator(s, delimiter, false);
+	}
+
+	Iterator end() const
+	{
+		return Iterator(s, delimiter, true);
+	}
+
+private:
+	std::string_view s;
+	char delimiter;
+};
+
+/**
+ * Range over the tokens of a string separated by runs of delimiters; empty tokens are skipped.
+ *
+ * 	FUTILS::DelimiterSet blanks(" \t,");
+ * 	for (std::string_view tok : FUTILS::Tokenize(line, blanks)) { ... }
+ */
+class Tokenize
+{
+public:
+	Tokenize(std::string_view s, const DelimiterSet &set) :
+		s(s), set(&set)
+	{
+	}
+
+	class Iterator
+	{
+	public:
+		Iterator(std::string_view s, const DelimiterSet *set, bool end) :
+			s(s), set(set), pos(end ? std::string_view::npos : 0)
+		{
+			if (!end) {
+				Advance();
+			}
+		}
+
+		std::string_view operator*() const
+		{
+			return current;
+		}
+
+		Iterator& operator++()
+		{
+			Advance();
+			return *this;
+		}
+
+		bool operator!=(const Iterator &other) const
+		{
+			return pos != other.pos;
+		}
+
+	private:
+		void Advance()
+		{
+			size_t start = set->FindNotIn(s, pos);
+			if (start == std::string_view::npos) {
+				pos = std::string_view::npos;
+				return;
+			}
+			size_t stop = set->FindIn(s, start);
+			if (stop == std::string_view::npos) {
+				stop = s.size();
+			}
+			current = s.substr(start, stop - start);
+			pos = stop;
+		}
+
+		std::string_view s;
+		const DelimiterSet *set;
+		size_t pos;
+		std::string_view current;
+	};
+
+	Iterator begin() const
+	{
+		return Iterator(s, set, false);
+	}
+
+	Iterator end() const
+	{
+		return Iterator(s, set, true);
+	}
+
+private:
+	std::string_view s;
+	const DelimiterSet *set;
+};
+
+/**
+ * @brief Parses the whole string as a number (integer or floating point type).
+ *
+ * @return false if s is empty, has trailing characters or does not fit in T
+ */
+template<typename T>
+inline bool ParseNumber(std::string_view s, T &out)
+{
+	if (s.empty()) {
+		return false;
+	}
+	auto res = std::from_chars(s.data(), s.data() + s.size(), out);
+	return res.ec == std::errc() && res.ptr == s.data() + s.size();
+}
+
+/**
+ * @brief Strict dotted-quad parser (same output as ParseIPString(), with validation).
+ *
+ * @param ip receives the four octets, most significant first
+ * @return false unless s is exactly four decimal octets in 0..255
+ */
+inline bool ParseIPv4(std::string_view s, unsigned char ip[4])
+{
+	int octet = 0;
+	for (std::string_view part : Split(s, '.')) {
+		unsigned value;
+		if (octet == 4 || part.size() > 3 || !ParseNumber(part, value) || value > 255) {
+			return false;
+		}
+		ip[octet++] = static_cast<unsigned char>(value);
+	}
+	return octet == 4;
+}
+
+} /* namespace FUTILS */
+
+#endif /* FUTILS_STRING_H_ */
@@ -0,0 +1,738 @@
+/**
+ * @brief System and process probes reading /proc and /sys directly, cheap enough to sample every cycle.
+ *
+ * @details The utilities implemented include:
+ * 			- CpuCount()/UsableCpuCount(): online CPUs, and the CPUs this thread may run on (what
+ * 			  nproc prints)
+ * 			- SystemProbe: load average and task counts, memory, CPU times (total and per CPU),
+ * 			  context switches, interrupts and forks, CPU frequency and thermal zone temperatures
+ * 			- ProcessProbe: resident and virtual memory, CPU time, page faults, threads and
+ * 			  voluntary/involuntary context switches of one process (this one by default)
+ *
+ * 			Every file is opened once and read again with pread() from offset 0 to its end, which makes the
+ * 			kernel regenerate its contents; the text is parsed in place, so sampling neither forks
+ * 			nor allocates and costs a few microseconds per file instead of the milliseconds of
+ * 			exec("cat ..."), exec("free") or exec("sensors"). Counters are cumulative since boot
+ * 			(or process start): sample twice and subtract for rates. Not thread safe: one probe
+ * 			per sampling thread.
+ *
+ * 			Example:
+ * 			@code
+ * 			FUTILS::SystemProbe system;
+ * 			FUTILS::ProcessProbe self;
+ * 			FUTILS::MemoryInfo mem;
+ * 			FUTILS::ProcessSample proc;
+ * 			while (running) {
+ * 				if (system.Memory(mem) && self.Sample(proc)) {
+ * 					printf("available %llu rss %llu\n", (unsigned long long)mem.available, (unsigned long long)proc.rss);
+ * 				}
+ * 				...
+ * 			}
+ * 			@endcode
+ */
+
+#ifndef FUTILS_SYSPROBE_H_
+#define FUTILS_SYSPROBE_H_
+
+#include "futils.h"
+
+#if defined(__linux__) || defined(linux)
+
+#include <algorithm>
+#include <cerrno>
+#include <dirent.h>
+#include <sched.h>
+
+namespace FUTILS
+{
+
+/// Online CPUs
+inline int CpuCount()
+{
+	long n = sysconf(_SC_NPROCESSORS_ONLN);
+	return n > 0 ? static_cast<int>(n) : 1;
+}
+
+/// CPUs the calling thread may run on (affinity mask, cpusets), like nproc
+inline int UsableCpuCount()
+{
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+		int n = CPU_COUNT(&set);
+		if (n > 0) {
+			return n;
+		}
+	}
+	return CpuCount();
+}
+
+struct LoadAverage
+{
+	double load1 = 0;
+	double load5 = 0;
+	double load15 = 0;
+	uint32_t runnable = 0;          ///< tasks running or ready to run
+	uint32_t tasks = 0;             ///< threads in the system
+
+	template<typename F>
+	void ForEach(F &&f) const
+	{
+		f("load1", load1);
+		f("load5", load5);
+		f("load15", load15);
+		f("runnable", runnable);
+		f("tasks", tasks);
+	}
+};
+
+/// Memory in bytes, from /proc/meminfo
+struct MemoryInfo
+{
+	uint64_t total = 0;
+	uint64_t free = 0;
+	uint64_t available = 0;         ///< estimate of what can be allocated without swapping
+	uint64_t buffers = 0;
+	uint64_t cached = 0;
+	uint64_t swapTotal = 0;
+	uint64_t swapFree = 0;
+
+	uint64_t Used() const
+	{
+		return total - available;
+	}
+
+	template<typename F>
+	void ForEach(F &&f) const
+	{
+		f("total", total);
+		f("free", free);
+		f("available", available);
+		f("buffers", buffers);
+		f("cached", cached);
+		f("swap_total", swapTotal);
+		f("swap_free", swapFree);
+	}
+};
+
+/// CPU time in clock ticks (sysconf(_SC_CLK_TCK) per second), from /proc/stat
+struct CpuTimes
+{
+	uint64_t user = 0;
+	uint64_t nice = 0;
+	uint64_t system = 0;
+	uint64_t idle = 0;
+	uint64_t iowait = 0;
+	uint64_t irq = 0;
+	uint64_t softirq = 0;
+	uint64_t steal = 0;             ///< taken by the hypervisor for other guests
+
+	uint64_t Total() const
+	{
+		return user + nice + system + idle + iowait + irq + softirq + steal;
+	}
+
+	uint64_t Busy() const
+	{
+		return Total() - idle - iowait;
+	}
+
+	/// Busy fraction between an earlier sample and this one, 0 to 1
+	double Utilization(const CpuTimes &before) const
+	{
+		uint64_t total = Total() - before.Total();
+		return total == 0 ? 0.0 : static_cast<double>(Busy() - before.Busy()) / static_cast<double>(total);
+	}
+
+	template<typename F>
+	void ForEach(F &&f) const
+	{
+		f("user", user);
+		f("nice", nice);
+		f("system", system);
+		f("idle", idle);
+		f("iowait", iowait);
+		f("irq", irq);
+		f("softirq", softirq);
+		f("steal", steal);
+	}
+};
+
+/// System wide counters of /proc/stat, all CPUs summed
+struct SchedulerStats
+{
+	CpuTimes cpu;
+	uint64_t contextSwitches = 0;
+	uint64_t interrupts = 0;
+	uint64_t forks = 0;
+	uint32_t running = 0;
+	uint32_t blocked = 0;           ///< waiting for I/O
+
+	template<typename F>
+	void ForEach(F &&f) const
+	{
+		cpu.ForEach(f);
+		f("context_switches", contextSwitches);
+		f("interrupts", interrupts);
+		f("forks", forks);
+		f("running", running);
+		f("blocked", blocked);
+	}
+};
+
+struct ProcessSample
+{
+	uint64_t rss = 0;               ///< resident memory, bytes
+	uint64_t vsize = 0;             ///< virtual memory, bytes
+	uint64_t userTicks = 0;         ///< CPU time in user mode, clock ticks
+	uint64_t systemTicks = 0;
+	uint64_t minorFaults = 0;
+	uint64_t majorFaults = 0;
+	uint64_t voluntarySwitches = 0;         ///< blocked or yielded
+	uint64_t involuntarySwitches = 0;       ///< preempted
+	uint32_t threads = 0;
+
+	template<typename F>
+	void ForEach(F &&f) const
+	{
+		f("rss", rss);
+		f("vsize", vsize);
+		f("user_ticks", userTicks);
+		f("system_ticks", systemTicks);
+		f("minor_faults", minorFaults);
+		f("major_faults", majorFaults);
+		f("voluntary_switches", voluntarySwitches);
+		f("involuntary_switches", involuntarySwitches);
+		f("threads", threads);
+	}
+};
+
+namespace detail
+{
+
+inline const char *ProbeSkipSpaces(const char *p)
+{
+	while (*p == ' ' || *p == '\t') {
+		++p;
+	}
+	return p;
+}
+
+/// Parses the decimal number at p (after blanks) and moves p past it
+inline uint64_t ProbeParseU64(const char *&p)
+{
+	p = ProbeSkipSpaces(p);
+	uint64_t v = 0;
+	while (*p >= '0' && *p <= '9') {
+		v = v * 10 + static_cast<uint64_t>(*p - '0');
+		++p;
+	}
+	return v;
+}
+
+/// Parses "12.34" (loadavg, cpuinfo) without strtod and its locale
+inline double ProbeParseFixed(const char *&p)
+{
+	double v = static_cast<double>(ProbeParseU64(p));
+	if (*p == '.') {
+		++p;
+		double scale = 0.1;
+		while (*p >= '0' && *p <= '9') {
+			v += (*p - '0') * scale;
+			scale *= 0.1;
+			++p;
+		}
+	}
+	return v;
+}
+
+/// Skips n blank separated fields
+inline const char *ProbeSkipFields(const char *p, int n)
+{
+	for (int i = 0; i < n; ++i) {
+		p = ProbeSkipSpaces(p);
+		while (*p != ' ' && *p != '\t' && *p != '\n' && *p != '\0') {
+			++p;
+		}
+	}
+	return p;
+}
+
+/// The rest of the line starting with key, searching from p; nullptr if there is none
+inline const char *ProbeFindLine(const char *p, const char *key)
+{
+	size_t keyLen = strlen(key);
+	for (const char *line = p; *line != '\0'; ) {
+		if (strncmp(line, key, keyLen) == 0) {
+			return line + keyLen;
+		}
+		const char *next = strchr(line, '\n');
+		if (next == nullptr) {
+			break;
+		}
+		line = next + 1;
+	}
+	return nullptr;
+}
+
+/// "key: value kB" lines of /proc/meminfo and /proc/<pid>/status
+inline bool ProbeKeyValue(const char *buf, const char *key, uint64_t &value)
+{
+	const char *p = ProbeFindLine(buf, key);
+	if (p == nullptr) {
+		return false;
+	}
+	value = ProbeParseU64(p);
+	if (strncmp(ProbeSkipSpaces(p), "kB", 2) == 0) {
+		value *= 1024;
+	}
+	return true;
+}
+
+inline void ProbeParseCpuTimes(const char *p, CpuTimes &t)
+{
+	t.user = ProbeParseU64(p);
+	t.nice = ProbeParseU64(p);
+	t.system = ProbeParseU64(p);
+	t.idle = ProbeParseU64(p);
+	t.iowait = ProbeParseU64(p);
+	t.irq = ProbeParseU64(p);
+	t.softirq = ProbeParseU64(p);
+	t.steal = ProbeParseU64(p);
+}
+
+/**
+ * @brief A /proc or /sys file kept open and read whole with pread(), into a reusable buffer.
+ *
+ * Files such as /proc/cpuinfo return about a page per call, so it reads on until pread() returns
+ * 0. The buffer only grows when the file no longer fits, so steady state reads do not allocate.
+ */
+class ProbeFile
+{
+public:
+	ProbeFile() :
+		fd(-1)
+	{
+	}
+
+	~ProbeFile()
+	{
+		Close();
+	}
+
+	ProbeFile(const ProbeFile&) = delete;
+	ProbeFile& operator=(const ProbeFile&) = delete;
+
+	ProbeFile(ProbeFile &&other) noexcept :
+		fd(other.fd),
+		buffer(std::move(other.buffer))
+	{
+		other.fd = -1;
+	}
+
+	ProbeFile& operator=(ProbeFile &&other) noexcept
+	{
+		if (this != &other) {
+			Close();
+			fd = other.fd;
+			buffer = std::move(other.buffer);
+			other.fd = -1;
+		}
+		return *this;
+	}
+
+	/// Opens path; quiet when it does not exist (optional files such as cpufreq or thermal)
+	bool Open(const char *path, size_t initialSize = 4096, bool quiet = false)
+	{
+		Close();
+		if ((fd = ::open(path, O_RDONLY | O_CLOEXEC)) < 0) {
+			if (!quiet) {
+				perror(path);
+			}
+			return false;
+		}
+		buffer.resize(initialSize);
+		return true;
+	}
+
+	void Close()
+	{
+		if (fd >= 0) {
+			::close(fd);
+			fd = -1;
+		}
+	}
+
+	bool IsOpen() const
+	{
+		return fd >= 0;
+	}
+
+	/// Reads the current contents, NUL terminated; nullptr on error
+	const char *Read()
+	{
+		if (fd < 0) {
+			return nullptr;
+		}
+		size_t used = 0;
+		for (;;) {
+			if (buffer.size() - used < 2) {
+				buffer.resize(buffer.size() * 2);
+			}
+			ssize_t n = pread(fd, &buffer[used], buffer.size() - 1 - used, static_cast<off_t>(used));
+			if (n < 0) {
+				if (errno == EINTR) {
+					continue;
+				}
+				return nullptr;
+			}
+			if (n == 0) {
+				buffer[used] = '\0';
+				return buffer.data();
+			}
+			used += static_cast<size_t>(n);
+		}
+	}
+
+private:
+	int fd;
+	std::vector<char> buffer;
+};
+
+/// Highest possible CPU number + 1 (numbers may be sparse, offline CPUs keep theirs)
+inline int ProbeCpuSlots()
+{
+	long conf = sysconf(_SC_NPROCESSORS_CONF);
+	int slots = std::max(conf > 0 ? static_cast<int>(conf) : 1, CpuCount());
+	ProbeFile possible;
+	const char *p;
+	if (possible.Open("/sys/devices/system/cpu/possible", 64, true) && (p = possible.Read()) != nullptr) {
+		// "0-7", "0,2-5": the last number is the highest
+		const char *last = p;
+		for (; *p != '\0' && *p != '\n'; ++p) {
+			if (*p == ',' || *p == '-') {
+				last = p + 1;
+			}
+		}
+		int highest = static_cast<int>(ProbeParseU64(last));
+		slots = std::max(slots, highest + 1);
+	}
+	return slots;
+}
+
+} /* namespace detail */
+
+/**
+ * @brief System wide probes over /proc/loadavg, /proc/meminfo, /proc/stat, cpufreq and thermal zones.
+ *
+ * @details The files are opened at construction (thermal zones are enumerated then too). CPU
+ * 			frequency comes from cpufreq (scaling_cur_freq) when the kernel exposes it, else from
+ * 			the "cpu MHz" lines of /proc/cpuinfo, which is slower on large machines.
+ */
+class SystemProbe
+{
+public:
+	SystemProbe() :
+		cpus(detail::ProbeCpuSlots())
+	{
+		loadavg.Open("/proc/loadavg");
+		meminfo.Open("/proc/meminfo");
+		stat.Open("/proc/stat", 8192);
+		freqFiles.resize(static_cast<size_t>(cpus));
+		freqState.assign(static_cast<size_t>(cpus), kFreqUntried);
+		OpenThermalZones();
+	}
+
+	SystemProbe(const SystemProbe&) = delete;
+	SystemProbe& operator=(const SystemProbe&) = delete;
+
+	/// Number of CPU numbers the per CPU queries accept (highest possible + 1, not the online count)
+	int Cpus() const
+	{
+		return cpus;
+	}
+
+	bool Load(LoadAverage &load)
+	{
+		const char *p = loadavg.Read();
+		if (p == nullptr) {
+			return false;
+		}
+		load.load1 = detail::ProbeParseFixed(p);
+		load.load5 = detail::ProbeParseFixed(p);
+		load.load15 = detail::ProbeParseFixed(p);
+		load.runnable = static_cast<uint32_t>(detail::ProbeParseU64(p));
+		if (*p == '/') {
+			++p;
+		}
+		load.tasks = static_cast<uint32_t>(detail::ProbeParseU64(p));
+		return true;
+	}
+
+	bool Memory(MemoryInfo &mem)
+	{
+		const char *p = meminfo.Read();
+		if (p == nullptr) {
+			return false;
+		}
+		bool ok = detail::ProbeKeyValue(p, "MemTotal:", mem.total)
+				&& detail::ProbeKeyValue(p, "MemFree:", mem.free);
+		if (!detail::ProbeKeyValue(p, "MemAvailable:", mem.available)) {
+			mem.available = mem.free;   // kernels before 3.14
+		}
+		detail::ProbeKeyValue(p, "Buffers:", mem.buffers);
+		detail::ProbeKeyValue(p, "Cached:", mem.cached);
+		detail::ProbeKeyValue(p, "SwapTotal:", mem.swapTotal);
+		detail::ProbeKeyValue(p, "SwapFree:", mem.swapFree);
+		return ok;
+	}
+
+	/// CPU times of all CPUs, context switches, interrupts, forks and task states
+	bool Scheduler(SchedulerStats &s)
+	{
+		const char *buf = stat.Read();
+		const char *p;
+		if (buf == nullptr || (p = detail::ProbeFindLine(buf, "cpu ")) == nullptr) {
+			return false;
+		}
+		detail::ProbeParseCpuTimes(p, s.cpu);
+		if ((p = detail::ProbeFindLine(p, "intr ")) != nullptr) {
+			s.interrupts = detail::ProbeParseU64(p);
+		}
+		if ((p = detail::ProbeFindLine(p != nullptr ? p : buf, "ctxt ")) != nullptr) {
+			s.contextSwitches = detail::ProbeParseU64(p);
+		}
+		if ((p = detail::ProbeFindLine(p != nullptr ? p : buf, "processes ")) != nullptr) {
+			s.forks = detail::ProbeParseU64(p);
+		}
+		if ((p = detail::ProbeFindLine(p != nullptr ? p : buf, "procs_running ")) != nullptr) {
+			s.running = static_cast<uint32_t>(detail::ProbeParseU64(p));
+		}
+		if ((p = detail::ProbeFindLine(p != nullptr ? p : buf, "procs_blocked ")) != nullptr) {
+			s.blocked = static_cast<uint32_t>(detail::ProbeParseU64(p));
+		}
+		return true;
+	}
+
+	/**
+	 * @brief CPU times of each online CPU.
+	 *
+	 * @param times indexed by CPU number, at least Cpus() entries; offline CPUs are left untouched
+	 * @return number of CPUs read, -1 on error
+	 */
+	int PerCpu(CpuTimes *times, int count)
+	{
+		const char *p = stat.Read();
+		if (p == nullptr) {
+			return -1;
+		}
+		int found = 0;
+		while ((p = detail::ProbeFindLine(p, "cpu")) != nullptr) {
+			if (*p < '0' || *p > '9') {
+				continue;   // the "cpu " total line
+			}
+			int cpu = static_cast<int>(detail::ProbeParseU64(p));
+			if (cpu < count) {
+				detail::ProbeParseCpuTimes(p, times[cpu]);
+				++found;
+			}
+		}
+		return found;
+	}
+
+	/// Current frequency of cpu in kHz, 0 if unknown
+	uint32_t CpuFrequencyKHz(int cpu)
+	{
+		if (cpu < 0 || cpu >= cpus) {
+			return 0;
+		}
+		size_t i = static_cast<size_t>(cpu);
+		if (freqState[i] == kFreqUntried) {
+			char path[96];
+			snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/cpufreq/scaling_cur_freq", cpu);
+			freqState[i] = freqFiles[i].Open(path, 64, true) ? kFreqCpufreq : kFreqCpuinfo;
+		}
+		if (freqState[i] == kFreqCpufreq) {
+			const char *p = freqFiles[i].Read();
+			return p != nullptr ? static_cast<uint32_t>(detail::ProbeParseU64(p)) : 0;
+		}
+		if (!cpuinfo.IsOpen() && !cpuinfo.Open("/proc/cpuinfo", 16384, true)) {
+			return 0;
+		}
+		// "processor : n" precedes the "cpu MHz" line of each CPU
+		const char *p = cpuinfo.Read();
+		while (p != nullptr && (p = detail::ProbeFindLine(p, "processor")) != nullptr) {
+			p = detail::ProbeSkipSpaces(p);
+			if (*p == ':') {
+				++p;
+			}
+			if (static_cast<int>(detail::ProbeParseU64(p)) != cpu) {
+				continue;
+			}
+			if ((p = detail::ProbeFindLine(p, "cpu MHz")) == nullptr) {
+				return 0;
+			}
+			p = detail::ProbeSkipSpaces(p);
+			if (*p == ':') {
+				++p;
+			}
+			return static_cast<uint32_t>(detail::ProbeParseFixed(p) * 1000.0);
+		}
+		return 0;
+	}
+
+	/// Thermal zones found at construction (/sys/class/thermal/thermal_zone*)
+	size_t ThermalZones() const
+	{
+		return zones.size();
+	}
+
+	/// Sensor type of zone i, e.g. "x86_pkg_temp", "acpitz", "cpu-thermal"
+	const char *ThermalZoneType(size_t i) const
+	{
+		return i < zones.size() ? zones[i].type : "";
+	}
+
+	/// Temperature of zone i in millidegrees Celsius
+	bool Temperature(size_t i, int32_t &milliCelsius)
+	{
+		if (i >= zones.size()) {
+			return false;
+		}
+		const char *p = zones[i].temp.Read();
+		if (p == nullptr) {
+			return false;   // e.g. EAGAIN/ENODATA while the sensor is not ready
+		}
+		p = detail::ProbeSkipSpaces(p);
+		bool negative = *p == '-';
+		if (negative) {
+			++p;
+		}
+		int32_t v = static_cast<int32_t>(detail::ProbeParseU64(p));
+		milliCelsius = negative ? -v : v;
+		return true;
+	}
+
+private:
+	enum : uint8_t
+	{
+		kFreqUntried,
+		kFreqCpufreq,
+		kFreqCpuinfo,
+	};
+
+	struct ThermalZone
+	{
+		int index;
+		char type[32];
+		detail::ProbeFile temp;
+	};
+
+	void OpenThermalZones()
+	{
+		DIR *dir = opendir("/sys/class/thermal");
+		if (dir == nullptr) {
+			return;
+		}
+		char path[300];
+		struct dirent *e;
+		while ((e = readdir(dir)) != nullptr) {
+			int index;
+			if (sscanf(e->d_name, "thermal_zone%d", &index) != 1) {
+				continue;
+			}
+			ThermalZone zone;
+			zone.index = index;
+			snprintf(zone.type, sizeof(zone.type), "%.31s", e->d_name);
+			snprintf(path, sizeof(path), "/sys/class/thermal/%s/type", e->d_name);
+			detail::ProbeFile typeFile;
+			const char *type;
+			if (typeFile.Open(path, 64, true) && (type = typeFile.Read()) != nullptr) {
+				snprintf(zone.type, sizeof(zone.type), "%.*s", static_cast<int>(strcspn(type, "\n")), type);
+			}
+			snprintf(path, sizeof(path), "/sys/class/thermal/%s/temp", e->d_name);
+			if (zone.temp.Open(path, 64, true)) {
+				zones.push_back(std::move(zone));
+			}
+		}
+		closedir(dir);
+		std::sort(zones.begin(), zones.end(), [](const ThermalZone &a, const ThermalZone &b) {
+			return a.index < b.index;
+		});
+	}
+
+	int cpus;
+	detail::ProbeFile loadavg;
+	detail::ProbeFile meminfo;
+	detail::ProbeFile stat;
+	detail::ProbeFile cpuinfo;
+	std::vector<detail::ProbeFile> freqFiles;
+	std::vector<uint8_t> freqState;
+	std::vector<ThermalZone> zones;
+};
+
+/**
+ * @brief Memory, CPU time, faults and context switches of one process, from /proc/<pid>/stat and status.
+ *
+ * @details The files stay open for the life of the probe: when the process exits, Sample() fails
+ * 			(ESRCH), even if the pid is reused.
+ */
+class ProcessProbe
+{
+public:
+	/// pid 0 is the calling process
+	explicit ProcessProbe(pid_t pid = 0) :
+		pageSize(static_cast<uint64_t>(sysconf(_SC_PAGESIZE)))
+	{
+		char path[64];
+		if (pid == 0) {
+			snprintf(path, sizeof(path), "/proc/self/stat");
+		} else {
+			snprintf(path, sizeof(path), "/proc/%d/stat", static_cast<int>(pid));
+		}
+		stat.Open(path, 1024);
+		memcpy(path + strlen(path) - 4, "status", 7);
+		status.Open(path, 2048);
+	}
+
+	ProcessProbe(const ProcessProbe&) = delete;
+	ProcessProbe& operator=(const ProcessProbe&) = delete;
+
+	bool Sample(ProcessSample &s)
+	{
+		const char *p = stat.Read();
+		if (p == nullptr || (p = strrchr(p, ')')) == nullptr) {
+			return false;   // the command name, in parentheses, may contain spaces
+		}
+		// fields from 3 (state) on, see proc(5)
+		p = detail::ProbeSkipFields(p + 1, 7);
+		s.minorFaults = detail::ProbeParseU64(p);
+		p = detail::ProbeSkipFields(p, 1);
+		s.majorFaults = detail::ProbeParseU64(p);
+		p = detail::ProbeSkipFields(p, 1);
+		s.userTicks = detail::ProbeParseU64(p);
+		s.systemTicks = detail::ProbeParseU64(p);
+		p = detail::ProbeSkipFields(p, 4);
+		s.threads = static_cast<uint32_t>(detail::ProbeParseU64(p));
+		p = detail::ProbeSkipFields(p, 2);
+		s.vsize = detail::ProbeParseU64(p);
+		s.rss = detail::ProbeParseU64(p) * pageSize;
+		if ((p = status.Read()) == nullptr) {
+			return false;
+		}
+		detail::ProbeKeyValue(p, "voluntary_ctxt_switches:", s.voluntarySwitches);
+		detail::ProbeKeyValue(p, "nonvoluntary_ctxt_switches:", s.involuntarySwitches);
+		return true;
+	}
+
+private:
+	uint64_t pageSize;
+	detail::ProbeFile stat;
+	detail::ProbeFile status;
+};
+
+} /* namespace FUTILS */
+
+#endif /* Linux functions*/
+
+#endif /* FUTILS_SYSPROBE_H_ */
@@ -0,0 +1,1103 @@
+/**
+ * @brief Non-blocking TCP server and client on the epoll EventLoop.
+ *
+ * @details The utilities implemented include:
+ * 			- TcpBuffer: contiguous read buffer, filled with readv() so that one call drains the
+ * 			  socket even when the buffer is small
+ * 			- TcpConnection: edge-triggered connection with an output queue flushed by writev()
+ * 			  (gathering every queued chunk), sendfile() for file bodies, splice() to receive a
+ * 			  body straight into a file, TCP_NODELAY/TCP_CORK control and graceful shutdown
+ * 			- TcpServer: listening socket draining the accept queue with accept4() on each wakeup
+ * 			- TcpClient: non-blocking connect
+ *
+ * 			One EventLoop (one thread) serves thousands of connections; for more cores run one loop
+ * 			and one TcpServer per thread on the same port with reusePort.
+ *
+ * 			Example:
+ * 			@code
+ * 			FUTILS::EventLoop loop;
+ * 			FUTILS::TcpServer server(loop);
+ * 			server.SetMessageCallback([](const FUTILS::TcpConnectionPtr &conn, FUTILS::TcpBuffer &in) {
+ * 				conn->Send(in.Data(), in.Size());   // echo
+ * 				in.Clear();
+ * 			});
+ * 			server.Listen(9000);
+ * 			loop.Run();
+ * 			@endcode
+ */
+
+#ifndef FUTILS_TCP_H_
+#define FUTILS_TCP_H_
+
+#include "futils.h"
+#include "futils_eventloop.h"
+
+#if defined(__linux__) || defined(linux)
+
+#include <netinet/tcp.h>
+#include <sys/sendfile.h>
+#include <sys/uio.h>
+#include <csignal>
+#include <cerrno>
+#include <deque>
+#include <limits.h>
+
+namespace FUTILS
+{
+
+/**
+ * Byte buffer with a consumed prefix, compacted lazily.
+ */
+class TcpBuffer
+{
+public:
+	TcpBuffer() :
+		readPos(0), writePos(0), storage(kInitialSize)
+	{
+	}
+
+	const char* Data() const
+	{
+		return storage.data() + readPos;
+	}
+
+	size_t Size() const
+	{
+		return writePos - readPos;
+	}
+
+	/// Drops n bytes from the front
+	void Consume(size_t n)
+	{
+		readPos += std::min(n, Size());
+		if (readPos == writePos) {
+			readPos = writePos = 0;
+		}
+	}
+
+	void Clear()
+	{
+		readPos = writePos = 0;
+	}
+
+	void Append(const void *data, size_t len)
+	{
+		Reserve(len);
+		memcpy(&storage[writePos], data, len);
+		writePos += len;
+	}
+
+	/**
+	 * @brief Reads what the socket holds, up to the free space plus a 64 KiB stack spill area.
+	 *
+	 * @return bytes read, 0 on end of stream, -1 on error (errno, EAGAIN when drained)
+	 */
+	ssize_t ReadFrom(int fd)
+	{
+		char spill[65536];
+		struct iovec iov[2];
+		const size_t space = storage.size() - writePos;
+		iov[0].iov_base = &storage[writePos];
+		iov[0].iov_len = space;
+		iov[1].iov_base = spill;
+		iov[1].iov_len = sizeof(spill);
+		ssize_t n;
+		do {
+			n = ::readv(fd, iov, 2);
+		} while (n < 0 && errno == EINTR);
+		if (n <= 0) {
+			return n;
+		}
+		if (static_cast<size_t>(n) <= space) {
+			writePos += static_cast<size_t>(n);
+		} else {
+			writePos = storage.size();
+			Append(spill, static_cast<size_t>(n) - space);
+		}
+		return n;
+	}
+
+private:
+	static const size_t kInitialSize = 4096;
+
+	void Reserve(size_t len)
+	{
+		if (storage.size() - writePos >= len) {
+			return;
+		}
+		if (readPos > 0) {
+			memmove(&storage[0], &storage[readPos], Size());
+			writePos -= readPos;
+			readPos = 0;
+		}
+		if (storage.size() - writePos < len) {
+			storage.resize(std::max(storage.size() * 2, writePos + len));
+		}
+	}
+
+	size_t readPos;
+	size_t writePos;
+	std::vector<char> storage;
+};
+
+class TcpConnection;
+typedef std::shared_ptr<TcpConnection> TcpConnectionPtr;
+
+namespace detail
+{
+
+/**
+ * @brief Blocks SIGPIPE on the calling thread while in scope, so that sendfile() (which has no
+ * MSG_NOSIGNAL) to a closed peer fails with EPIPE instead of killing the process.
+ *
+ * The SIGPIPE raised meanwhile is consumed before the mask is restored; the process-wide
+ * disposition is left alone.
+ */
+class SigpipeGuard
+{
+public:
+	SigpipeGuard() :
+		wasPending(false)
+	{
+		sigemptyset(&pipeSet);
+		sigaddset(&pipeSet, SIGPIPE);
+		sigset_t pending;
+		sigemptyset(&pending);
+		if (sigpending(&pending) == 0) {
+			wasPending = sigismember(&pending, SIGPIPE) == 1;
+		}
+		pthread_sigmask(SIG_BLOCK, &pipeSet, &saved);
+	}
+
+	~SigpipeGuard()
+	{
+		int savedErrno = errno;
+		sigset_t pending;
+		sigemptyset(&pending);
+		if (!wasPending && sigpending(&pending) == 0 && sigismember(&pending, SIGPIPE) == 1) {
+			struct timespec zero = {0, 0};
+			while (sigtimedwait(&pipeSet, nullptr, &zero) < 0 && errno == EINTR) {
+			}
+		}
+		pthread_sigmask(SIG_SETMASK, &saved, nullptr);
+		errno = savedErrno;
+	}
+
+	SigpipeGuard(const SigpipeGuard&) = delete;
+	SigpipeGuard& operator=(const SigpipeGuard&) = delete;
+
+private:
+	sigset_t pipeSet;
+	sigset_t saved;
+	bool wasPending;
+};
+
+} /* namespace detail */
+
+/**
+ * One established connection, owned by its TcpServer/TcpClient and driven by the loop thread.
+ *
+ * Every method must be called on the loop thread (use EventLoop::Post() from elsewhere).
+ */
+class TcpConnection : public std::enable_shared_from_this<TcpConnection>
+{
+public:
+	typedef std::function<void(const TcpConnectionPtr&, TcpBuffer&)> MessageCallback;
+	typedef std::function<void(const TcpConnectionPtr&)> Callback;
+	typedef std::function<void(const TcpConnectionPtr&, bool ok)> ReceiveCallback;
+
+	TcpConnection(EventLoop &loop, int fd, const struct sockaddr_in &peer) :
+		loop(loop), sockfd(fd), peer(peer), state(kConnected), queued(0), maxInput(kDefaultMaxInput), sink()
+	{
+		sink.pipe[0] = sink.pipe[1] = -1;
+	}
+
+	~TcpConnection()
+	{
+		ClosePipe();
+		for (size_t i = 0; i < out.size(); ++i) {
+			ReleaseChunk(out[i]);
+		}
+		if (sockfd >= 0) {
+			::close(sockfd);
+		}
+	}
+
+	TcpConnection(const TcpConnection&) = delete;
+	TcpConnection& operator=(const TcpConnection&) = delete;
+
+	/// Called with the input buffer after each read; consume what was parsed, leave the rest
+	void SetMessageCallback(MessageCallback callback)
+	{
+		onMessage = callback;
+	}
+
+	void SetCloseCallback(Callback callback)
+	{
+		onClose = callback;
+	}
+
+	/// Called from the loop once the output queue has been fully handed to the kernel
+	void SetWriteCompleteCallback(Callback callback)
+	{
+		onWriteComplete = callback;
+	}
+
+	/// The connection is closed when onMessage leaves more than this in the input buffer
+	void SetMaxInputBytes(size_t bytes)
+	{
+		maxInput = bytes;
+	}
+
+	/**
+	 * @brief Sends bytes, writing directly when nothing is queued and queueing what the kernel did not take.
+	 *
+	 * @return false if the connection is closed or failed
+	 */
+	bool Send(const void *data, size_t len)
+	{
+		if (state != kConnected) {
+			return false;
+		}
+		const char *p = static_cast<const char*>(data);
+		if (out.empty()) {
+			ssize_t n;
+			do {
+				n = ::send(sockfd, p, len, MSG_NOSIGNAL);
+			} while (n < 0 && errno == EINTR);
+			if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+				Fail("send");
+				return false;
+			}
+			if (n > 0) {
+				p += n;
+				len -= static_cast<size_t>(n);
+			}
+			if (len == 0) {
+				NotifyWriteComplete();
+				return true;
+			}
+		}
+		QueueBytes(p, len);
+		return true;
+	}
+
+	bool Send(const std::string &data)
+	{
+		return Send(data.data(), data.size());
+	}
+
+	/**
+	 * @brief Queues len bytes of a file at offset, sent with sendfile() (no copy through user space).
+	 *
+	 * @param closeWhenDone closes fileFd once sent (or when the connection goes away)
+	 */
+	bool SendFile(int fileFd, off_t offset, size_t len, bool closeWhenDone = false)
+	{
+		if (state != kConnected) {
+			if (closeWhenDone) {
+				::close(fileFd);
+			}
+			return false;
+		}
+		Chunk chunk;
+		chunk.fileFd = fileFd;
+		chunk.fileOffset = offset;
+		chunk.fileRemaining = len;
+		chunk.closeFile = closeWhenDone;
+		out.push_back(chunk);
+		queued += len;
+		if (out.size() == 1) {
+			return Flush();
+		}
+		return true;
+	}
+
+	/**
+	 * @brief Moves the next len bytes of the stream into a file with splice() (socket -> pipe -> file).
+	 *
+	 * Bytes already buffered are written first. Reads resume to the input buffer (and the message
+	 * callback) once done(conn, true) has been called; done(conn, false) reports an error or a peer
+	 * closing early.
+	 */
+	bool ReceiveToFile(int fileFd, off_t offset, size_t len, ReceiveCallback done)
+	{
+		if (state != kConnected || sink.remaining > 0) {
+			return false;
+		}
+		size_t buffered = std::min(len, input.Size());
+		if (buffered > 0) {
+			if (pwrite(fileFd, input.Data(), buffered, offset) != static_cast<ssize_t>(buffered)) {
+				perror("pwrite");
+				return false;
+			}
+			input.Consume(buffered);
+		}
+		sink.fileFd = fileFd;
+		sink.offset = offset + static_cast<off_t>(buffered);
+		sink.remaining = len - buffered;
+		sink.done = done;
+		if (sink.remaining == 0) {
+			FinishSink(true);
+			return true;
+		}
+		if (pipe2(sink.pipe, O_NONBLOCK | O_CLOEXEC) != 0) {
+			perror("pipe2");
+			sink.remaining = 0;
+			sink.done = nullptr;
+			return false;
+		}
+		// edge triggered: data already queued in the socket will not be signalled again
+		HandleRead();
+		return true;
+	}
+
+	/// TCP_NODELAY: send small segments at once instead of waiting for the previous ACK
+	bool SetNoDelay(bool on)
+	{
+		return SetOption(IPPROTO_TCP, TCP_NODELAY, on, "setsockopt(TCP_NODELAY)");
+	}
+
+	/// TCP_CORK: hold partial segments until uncorked (header + sendfile body in full segments)
+	bool SetCork(bool on)
+	{
+		return SetOption(IPPROTO_TCP, TCP_CORK, on, "setsockopt(TCP_CORK)");
+	}
+
+	/// Closes the write side once the output queue is drained
+	void Shutdown()
+	{
+		if (state != kConnected) {
+			return;
+		}
+		state = kDraining;
+		if (out.empty()) {
+			::shutdown(sockfd, SHUT_WR);
+		}
+	}
+
+	/// Closes immediately, dropping the output queue
+	void Close()
+	{
+		if (state == kClosed) {
+			return;
+		}
+		TcpConnectionPtr self = shared_from_this();
+		state = kClosed;
+		loop.Remove(sockfd);
+		::shutdown(sockfd, SHUT_RDWR);
+		if (sink.remaining > 0) {
+			FinishSink(false);
+		}
+		// owners drop their reference in onClose: release the callbacks that may capture it, but
+		// only on return, since Close() may run inside one of them
+		MessageCallback message;
+		Callback writeComplete;
+		Callback close;
+		message.swap(onMessage);
+		writeComplete.swap(onWriteComplete);
+		close.swap(onClose);
+		if (close) {
+			close(self);
+		}
+	}
+
+	bool Connected() const
+	{
+		return state == kConnected;
+	}
+
+	/// Bytes queued and not yet taken by the kernel (for backpressure)
+	size_t QueuedBytes() const
+	{
+		return queued;
+	}
+
+	int Fd() const
+	{
+		return sockfd;
+	}
+
+	const struct sockaddr_in& Peer() const
+	{
+		return peer;
+	}
+
+	TcpBuffer& Input()
+	{
+		return input;
+	}
+
+	/// Registers the socket on the loop (done by TcpServer/TcpClient)
+	bool Start()
+	{
+		TcpConnection *self = this;
+		if (!loop.Add(sockfd, EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET, [self](uint32_t events) { self->HandleEvents(events); })) {
+			perror("epoll_ctl");
+			return false;
+		}
+		return true;
+	}
+
+private:
+	enum State
+	{
+		kConnected,
+		kDraining,      ///< Shutdown() called, flushing
+		kClosed
+	};
+
+	/// Output queue element: owned bytes, or a file range for sendfile()
+	struct Chunk
+	{
+		std::string data;
+		size_t offset;
+		int fileFd;
+		off_t fileOffset;
+		size_t fileRemaining;
+		bool closeFile;
+
+		Chunk() :
+			offset(0), fileFd(-1), fileOffset(0), fileRemaining(0), closeFile(false)
+		{
+		}
+	};
+
+	struct Sink
+	{
+		int pipe[2];
+		int fileFd;
+		off_t offset;
+		size_t remaining;
+		size_t inPipe;
+		ReceiveCallback done;
+
+		Sink() :
+			fileFd(-1), offset(0), remaining(0), inPipe(0)
+		{
+		}
+	};
+
+	/// Chunks smaller than this are merged, so writev() needs fewer iovecs
+	static const size_t kCoalesceBytes = 16384;
+	/// Unparsed input tolerated before the peer is considered abusive
+	static const size_t kDefaultMaxInput = 64 << 20;
+
+	void HandleEvents(uint32_t events)
+	{
+		TcpConnectionPtr self = shared_from_this();
+		if (events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
+			HandleRead();
+		}
+		if (state != kClosed && (events & EPOLLOUT) && !out.empty()) {
+			Flush();
+		}
+	}
+
+	void HandleRead()
+	{
+		if (sink.remaining > 0 && !DrainToSink()) {
+			return;
+		}
+		bool got = false;
+		for (;;) {
+			ssize_t n = input.ReadFrom(sockfd);
+			if (n > 0) {
+				got = true;
+				if (input.Size() < maxInput) {
+					continue;
+				}
+				// let the application consume what it can before judging the peer
+				got = false;
+				DeliverInput();
+				if (state == kClosed || sink.remaining > 0) {
+					return;
+				}
+				if (input.Size() >= maxInput) {
+					std::cerr << tc::redL << "TcpConnection: more than " << maxInput << " unparsed input bytes, closing" << tc::none << std::endl;
+					Close();
+					return;
+				}
+				continue;
+			}
+			if (n == 0) {
+				if (got) {
+					DeliverInput();
+				}
+				Close();
+				return;
+			}
+			if (errno == EAGAIN || errno == EWOULDBLOCK) {
+				break;
+			}
+			Fail("read");
+			return;
+		}
+		if (got) {
+			DeliverInput();
+		}
+	}
+
+	/// Calls onMessage through a copy: the callback may Close() the connection, which releases it
+	void DeliverInput()
+	{
+		if (!onMessage) {
+			return;
+		}
+		MessageCallback callback = onMessage;
+		callback(shared_from_this(), input);
+	}
+
+	/// @return true when the sink is complete and reads continue to the input buffer
+	bool DrainToSink()
+	{
+		while (sink.remaining > 0) {
+			if (sink.inPipe == 0) {
+				ssize_t n = splice(sockfd, nullptr, sink.pipe[1], nullptr, std::min<size_t>(sink.remaining, 1 << 20), SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+				if (n == 0) {
+					FinishSink(false);
+					Close();
+					return false;
+				}
+				if (n < 0) {
+					if (errno == EINTR) {
+						continue;
+					}
+					if (errno == EAGAIN || errno == EWOULDBLOCK) {
+						return false;
+					}
+					perror("splice");
+					FinishSink(false);
+					Close();
+					return false;
+				}
+				sink.inPipe = static_cast<size_t>(n);
+			}
+			while (sink.inPipe > 0) {
+				ssize_t n = splice(sink.pipe[0], nullptr, sink.fileFd, &sink.offset, sink.inPipe, SPLICE_F_MOVE);
+				if (n <= 0) {
+					if (n < 0 && errno == EINTR) {
+						continue;
+					}
+					perror("splice");
+					FinishSink(false);
+					Close();
+					return false;
+				}
+				sink.inPipe -= static_cast<size_t>(n);
+				sink.remaining -= static_cast<size_t>(n);
+			}
+		}
+		FinishSink(true);
+		return state != kClosed;
+	}
+
+	void FinishSink(bool ok)
+	{
+		ReceiveCallback done;
+		done.swap(sink.done);
+		sink.remaining = 0;
+		sink.inPipe = 0;
+		ClosePipe();
+		if (done) {
+			done(shared_from_this(), ok);
+		}
+	}
+
+	void ClosePipe()
+	{
+		for (int i = 0; i < 2; ++i) {
+			if (sink.pipe[i] >= 0) {
+				::close(sink.pipe[i]);
+				sink.pipe[i] = -1;
+			}
+		}
+	}
+
+	void QueueBytes(const char *p, size_t len)
+	{
+		queued += len;
+		if (!out.empty() && out.back().fileFd < 0 && out.back().data.size() - out.back().offset < kCoalesceBytes) {
+			out.back().data.append(p, len);
+			return;
+		}
+		Chunk chunk;
+		chunk.data.assign(p, len);
+		out.push_back(chunk);
+	}
+
+	/**
+	 * @brief Hands the (non empty) output queue to the kernel until it is empty or the socket is full.
+	 *
+	 * Runs of byte chunks leave in one sendmsg() (writev with MSG_NOSIGNAL), file chunks with sendfile().
+	 *
+	 * @return false if the connection failed
+	 */
+	bool Flush()
+	{
+		while (!out.empty()) {
+			Chunk &front = out.front();
+			if (front.fileFd >= 0) {
+				ssize_t n;
+				{
+					detail::SigpipeGuard guard;
+					n = sendfile(sockfd, front.fileFd, &front.fileOffset, std::min<size_t>(front.fileRemaining, 1 << 30));
+				}
+				if (n < 0) {
+					if (errno == EINTR) {
+						continue;
+					}
+					if (errno == EAGAIN || errno == EWOULDBLOCK) {
+						return true;
+					}
+					Fail("sendfile");
+					return false;
+				}
+				if (n == 0 && front.fileRemaining > 0) {
+					std::cerr << tc::redL << "TcpConnection: file shorter than the range to send" << tc::none << std::endl;
+					Close();
+					return false;
+				}
+				front.fileRemaining -= static_cast<size_t>(n);
+				queued -= static_cast<size_t>(n);
+				if (front.fileRemaining == 0) {
+					ReleaseChunk(front);
+					out.pop_front();
+				}
+				continue;
+			}
+			struct iovec iov[IOV_MAX < 64 ? IOV_MAX : 64];
+			const int kMaxIov = static_cast<int>(sizeof(iov) / sizeof(iov[0]));
+			int count = 0;
+			for (size_t i = 0; i < out.size() && count < kMaxIov && out[i].fileFd < 0; ++i) {
+				iov[count].iov_base = const_cast<char*>(out[i].data.data() + out[i].offset);
+				iov[count].iov_len = out[i].data.size() - out[i].offset;
+				++count;
+			}
+			struct msghdr msg;
+			memset(&msg, 0, sizeof(msg));
+			msg.msg_iov = iov;
+			msg.msg_iovlen = static_cast<size_t>(count);
+			ssize_t n = ::sendmsg(sockfd, &msg, MSG_NOSIGNAL);
+			if (n < 0) {
+				if (errno == EINTR) {
+					continue;
+				}
+				if (errno == EAGAIN || errno == EWOULDBLOCK) {
+					return true;
+				}
+				Fail("sendmsg");
+				return false;
+			}
+			size_t sent = static_cast<size_t>(n);
+			queued -= sent;
+			while (sent > 0) {
+				Chunk &chunk = out.front();
+				size_t left = chunk.data.size() - chunk.offset;
+				if (sent < left) {
+					chunk.offset += sent;
+					break;
+				}
+				sent -= left;
+				out.pop_front();
+			}
+		}
+		if (state == kDraining) {
+			::shutdown(sockfd, SHUT_WR);
+		}
+		NotifyWriteComplete();
+		return true;
+	}
+
+	/// Deferred to the loop: a callback that sends again must not recurse into Send()/Flush()
+	void NotifyWriteComplete()
+	{
+		if (!onWriteComplete) {
+			return;
+		}
+		std::weak_ptr<TcpConnection> weak = shared_from_this();
+		loop.Post([weak]() {
+			TcpConnectionPtr self = weak.lock();
+			if (self && self->onWriteComplete && self->out.empty()) {
+				Callback callback = self->onWriteComplete;
+				callback(self);
+			}
+		});
+	}
+
+	static void ReleaseChunk(Chunk &chunk)
+	{
+		if (chunk.fileFd >= 0 && chunk.closeFile) {
+			::close(chunk.fileFd);
+		}
+		chunk.fileFd = -1;
+	}
+
+	bool SetOption(int level, int option, bool on, const char *what)
+	{
+		int value = on ? 1 : 0;
+		if (setsockopt(sockfd, level, option, &value, sizeof(value)) < 0) {
+			perror(what);
+			return false;
+		}
+		return true;
+	}
+
+	void Fail(const char *what)
+	{
+		if (errno != ECONNRESET && errno != EPIPE) {
+			perror(what);
+		}
+		Close();
+	}
+
+	EventLoop &loop;
+	int sockfd;
+	struct sockaddr_in peer;
+	State state;
+	TcpBuffer input;
+	std::deque<Chunk> out;
+	size_t queued;
+	size_t maxInput;
+	Sink sink;
+	MessageCallback onMessage;
+	Callback onClose;
+	Callback onWriteComplete;
+};
+
+/**
+ * Accepts connections on a port and keeps them until they close.
+ */
+class TcpServer
+{
+public:
+	explicit TcpServer(EventLoop &loop) :
+		loop(loop), listenFd(-1), spareFd(-1), maxInput(0)
+	{
+	}
+
+	~TcpServer()
+	{
+		Close();
+	}
+
+	TcpServer(const TcpServer&) = delete;
+	TcpServer& operator=(const TcpServer&) = delete;
+
+	/// Called for each accepted connection, before any message
+	void SetConnectionCallback(TcpConnection::Callback callback)
+	{
+		onConnection = callback;
+	}
+
+	void SetMessageCallback(TcpConnection::MessageCallback callback)
+	{
+		onMessage = callback;
+	}
+
+	void SetCloseCallback(TcpConnection::Callback callback)
+	{
+		onClose = callback;
+	}
+
+	/// See TcpConnection::SetMaxInputBytes(); 0 keeps the connection default
+	void SetMaxInputBytes(size_t bytes)
+	{
+		maxInput = bytes;
+	}
+
+	/**
+	 * @brief Binds and listens on all addresses.
+	 *
+	 * @param port 0 for an ephemeral port (see Port())
+	 * @param reusePort SO_REUSEPORT, to spread connections over one server per thread
+	 */
+	bool Listen(uint16_t port, bool reusePort = false, int backlog = SOMAXCONN)
+	{
+		Close();
+		if ((listenFd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, IPPROTO_TCP)) == -1) {
+			perror("socket");
+			return false;
+		}
+		int on = 1;
+		setsockopt(listenFd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+		if (reusePort && setsockopt(listenFd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) < 0) {
+			perror("setsockopt(SO_REUSEPORT)");
+		}
+		struct sockaddr_in addr;
+		memset(&addr, 0, sizeof(addr));
+		addr.sin_family = AF_INET;
+		addr.sin_port = htons(port);
+		addr.sin_addr.s_addr = htonl(INADDR_ANY);
+		if (bind(listenFd, (struct sockaddr*)&addr, sizeof(addr)) == -1) {
+			perror("bind");
+			Close();
+			return false;
+		}
+		if (listen(listenFd, backlog) == -1) {
+			perror("listen");
+			Close();
+			return false;
+		}
+		// kept to recover from EMFILE: closed to accept-and-drop the pending connection
+		spareFd = ::open("/dev/null", O_RDONLY | O_CLOEXEC);
+		if (!loop.Add(listenFd, EPOLLIN | EPOLLET, [this](uint32_t) { AcceptAll(); })) {
+			perror("epoll_ctl");
+			Close();
+			return false;
+		}
+		return true;
+	}
+
+	/// Bound port (useful after Listen(0))
+	uint16_t Port() const
+	{
+		struct sockaddr_in addr;
+		socklen_t len = sizeof(addr);
+		if (listenFd < 0 || getsockname(listenFd, (struct sockaddr*)&addr, &len) != 0) {
+			return 0;
+		}
+		return ntohs(addr.sin_port);
+	}
+
+	size_t Connections() const
+	{
+		return connections.size();
+	}
+
+	/// Stops listening and closes every connection
+	void Close()
+	{
+		if (listenFd >= 0) {
+			loop.Remove(listenFd);
+			::close(listenFd);
+			listenFd = -1;
+		}
+		if (spareFd >= 0) {
+			::close(spareFd);
+			spareFd = -1;
+		}
+		std::vector<TcpConnectionPtr> open;
+		for (auto it = connections.begin(); it != connections.end(); ++it) {
+			open.push_back(it->second);
+		}
+		for (size_t i = 0; i < open.size(); ++i) {
+			open[i]->Close();
+		}
+		connections.clear();
+	}
+
+private:
+	/// Edge triggered: accepts until the queue is empty
+	void AcceptAll()
+	{
+		for (;;) {
+			struct sockaddr_in peer;
+			socklen_t len = sizeof(peer);
+			int fd = accept4(listenFd, (struct sockaddr*)&peer, &len, SOCK_NONBLOCK | SOCK_CLOEXEC);
+			if (fd < 0) {
+				if (errno == EINTR || errno == ECONNABORTED) {
+					continue;
+				}
+				if ((errno == EMFILE || errno == ENFILE) && spareFd >= 0) {
+					// out of descriptors: drop the connection rather than spin on a ready listener
+					::close(spareFd);
+					fd = accept4(listenFd, nullptr, nullptr, SOCK_CLOEXEC);
+					if (fd >= 0) {
+						::close(fd);
+					}
+					spareFd = ::open("/dev/null", O_RDONLY | O_CLOEXEC);
+					std::cerr << tc::yel << "TcpServer: out of file descriptors, connection dropped" << tc::none << std::endl;
+					continue;
+				}
+				if (errno != EAGAIN && errno != EWOULDBLOCK) {
+					perror("accept4");
+				}
+				return;
+			}
+			TcpConnectionPtr conn = std::make_shared<TcpConnection>(loop, fd, peer);
+			conn->SetMessageCallback(onMessage);
+			if (maxInput > 0) {
+				conn->SetMaxInputBytes(maxInput);
+			}
+			conn->SetCloseCallback([this](const TcpConnectionPtr &c) {
+				if (onClose) {
+					onClose(c);
+				}
+				connections.erase(c->Fd());
+			});
+			connections[fd] = conn;
+			if (onConnection) {
+				onConnection(conn);
+			}
+			if (conn->Connected() && !conn->Start()) {
+				conn->Close();
+			}
+		}
+	}
+
+	EventLoop &loop;
+	int listenFd;
+	int spareFd;
+	std::unordered_map<int, TcpConnectionPtr> connections;
+	size_t maxInput;
+	TcpConnection::Callback onConnection;
+	TcpConnection::MessageCallback onMessage;
+	TcpConnection::Callback onClose;
+};
+
+/**
+ * Connects to a server without blocking the loop.
+ */
+class TcpClient
+{
+public:
+	explicit TcpClient(EventLoop &loop) :
+		loop(loop), connectFd(-1), maxInput(0)
+	{
+	}
+
+	~TcpClient()
+	{
+		Disconnect();
+	}
+
+	TcpClient(const TcpClient&) = delete;
+	TcpClient& operator=(const TcpClient&) = delete;
+
+	/// Called with the connection once established, or with nullptr if the connection failed
+	void SetConnectionCallback(TcpConnection::Callback callback)
+	{
+		onConnection = callback;
+	}
+
+	void SetMessageCallback(TcpConnection::MessageCallback callback)
+	{
+		onMessage = callback;
+	}
+
+	void SetCloseCallback(TcpConnection::Callback callback)
+	{
+		onClose = callback;
+	}
+
+	/// See TcpConnection::SetMaxInputBytes(); 0 keeps the connection default
+	void SetMaxInputBytes(size_t bytes)
+	{
+		maxInput = bytes;
+	}
+
+	/// Starts connecting; the result is reported to the connection callback
+	bool Connect(const std::string &ip, uint16_t port)
+	{
+		Disconnect();
+		struct sockaddr_in addr;
+		memset(&addr, 0, sizeof(addr));
+		addr.sin_family = AF_INET;
+		addr.sin_port = htons(port);
+		if (inet_pton(AF_INET, ip.c_str(), &addr.sin_addr) != 1) {
+			std::cerr << tc::redL << "TcpClient: invalid address " << ip << tc::none << std::endl;
+			return false;
+		}
+		if ((connectFd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, IPPROTO_TCP)) == -1) {
+			perror("socket");
+			return false;
+		}
+		if (::connect(connectFd, (struct sockaddr*)&addr, sizeof(addr)) == 0) {
+			Established(addr);
+			return true;
+		}
+		if (errno != EINPROGRESS) {
+			perror("connect");
+			::close(connectFd);
+			connectFd = -1;
+			return false;
+		}
+		if (!loop.Add(connectFd, EPOLLOUT | EPOLLET, [this, addr](uint32_t) { ConnectDone(addr); })) {
+			perror("epoll_ctl");
+			::close(connectFd);
+			connectFd = -1;
+			return false;
+		}
+		return true;
+	}
+
+	/// The established connection, nullptr if none
+	TcpConnectionPtr Connection() const
+	{
+		return connection;
+	}
+
+	void Disconnect()
+	{
+		if (connectFd >= 0) {
+			loop.Remove(connectFd);
+			::close(connectFd);
+			connectFd = -1;
+		}
+		if (connection) {
+			TcpConnectionPtr conn = connection;
+			conn->Close();
+			connection.reset();
+		}
+	}
+
+private:
+	void ConnectDone(const struct sockaddr_in &addr)
+	{
+		loop.Remove(connectFd);
+		int err = 0;
+		socklen_t len = sizeof(err);
+		getsockopt(connectFd, SOL_SOCKET, SO_ERROR, &err, &len);
+		if (err != 0) {
+			std::cerr << tc::redL << "TcpClient: connect: " << strerror(err) << tc::none << std::endl;
+			::close(connectFd);
+			connectFd = -1;
+			if (onConnection) {
+				onConnection(nullptr);
+			}
+			return;
+		}
+		Established(addr);
+	}
+
+	void Established(const struct sockaddr_in &addr)
+	{
+		connection = std::make_shared<TcpConnection>(loop, connectFd, addr);
+		connectFd = -1;
+		connection->SetMessageCallback(onMessage);
+		if (maxInput > 0) {
+			connection->SetMaxInputBytes(maxInput);
+		}
+		connection->SetCloseCallback([this](const TcpConnectionPtr &c) {
+			if (onClose) {
+				onClose(c);
+			}
+			if (connection == c) {
+				connection.reset();
+			}
+		});
+		TcpConnectionPtr conn = connection;
+		if (!conn->Start()) {
+			conn->Close();
+			return;
+		}
+		if (onConnection) {
+			onConnection(conn);
+		}
+	}
+
+	EventLoop &loop;
+	int connectFd;
+	TcpConnectionPtr connection;
+	size_t maxInput;
+	TcpConnection::Callback onConnection;
+	TcpConnection::MessageCallback onMessage;
+	TcpConnection::Callback onClose;
+};
+
+} /* namespace FUTILS */
+
+#endif /* Linux functions*/
+
+#endif /* FUTILS_TCP_H_ */
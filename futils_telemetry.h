@@ -0,0 +1,764 @@
+/**
+ * @brief Zero-copy parsers for telemetry records received over UDP (requires C++17).
+ *
+ * @details The utilities implemented include:
+ * 			- JsonDocument: two stage JSON parser. Stage 1 classifies 64 bytes at a time with
+ * 			  SSE2/AVX2 and builds an index of structural characters (simdjson style: escaped
+ * 			  characters and string interiors are masked with bit tricks, no per-byte branches).
+ * 			  Stage 2 walks the index on demand, only for the fields that are asked for.
+ * 			- KeyValueRecord: "key=value key2=value2" and InfluxDB-like
+ * 			  "measurement,tag=a field=1,other=2 1700000000" line records
+ *
+ * 			Every string returned is a std::string_view into the receive buffer, which must outlive
+ * 			the parsed document. Parsing allocates nothing once the index has grown to the largest
+ * 			datagram size.
+ */
+
+#ifndef FUTILS_TELEMETRY_H_
+#define FUTILS_TELEMETRY_H_
+
+#include <charconv>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#if defined(__x86_64__)
+#	include <immintrin.h>
+#endif
+
+namespace FUTILS
+{
+
+namespace detail
+{
+
+/// Per-block character classes, one bit per byte
+struct JsonBlockMasks
+{
+	uint64_t quote;
+	uint64_t backslash;
+	uint64_t op;	///< { } [ ] : ,
+	uint64_t space;
+};
+
+inline void JsonClassifyScalar(const uint8_t *p, JsonBlockMasks &m)
+{
+	m.quote = m.backslash = m.op = m.space = 0;
+	for (int i = 0; i < 64; ++i) {
+		uint64_t bit = 1ULL << i;
+		switch (p[i]) {
+		case '"':
+			m.quote |= bit;
+			break;
+		case '\\':
+			m.backslash |= bit;
+			break;
+		case '{': case '}': case '[': case ']': case ':': case ',':
+			m.op |= bit;
+			break;
+		case ' ': case '\t': case '\n': case '\r':
+			m.space |= bit;
+			break;
+		default:
+			break;
+		}
+	}
+}
+
+#if defined(__x86_64__)
+inline void JsonClassifySse2(const uint8_t *p, JsonBlockMasks &m)
+{
+	m.quote = m.backslash = m.op = m.space = 0;
+	const __m128i q = _mm_set1_epi8('"');
+	const __m128i bs = _mm_set1_epi8('\\');
+	const __m128i colon = _mm_set1_epi8(':');
+	const __m128i comma = _mm_set1_epi8(',');
+	const __m128i sp = _mm_set1_epi8(' ');
+	const __m128i tab = _mm_set1_epi8('\t');
+	const __m128i nl = _mm_set1_epi8('\n');
+	const __m128i cr = _mm_set1_epi8('\r');
+	// '{' '}' '[' ']' become '[' or ']' once bit 5 is cleared
+	const __m128i lowerBit = _mm_set1_epi8(static_cast<char>(~0x20));
+	const __m128i lb = _mm_set1_epi8('[');
+	const __m128i rb = _mm_set1_epi8(']');
+	for (int i = 0; i < 4; ++i) {
+		__m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 16 * i));
+		__m128i folded = _mm_and_si128(v, lowerBit);
+		uint64_t quote = static_cast<uint16_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(v, q)));
+		uint64_t back = static_cast<uint16_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(v, bs)));
+		__m128i ops = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(folded, lb), _mm_cmpeq_epi8(folded, rb)),
+				_mm_or_si128(_mm_cmpeq_epi8(v, colon), _mm_cmpeq_epi8(v, comma)));
+		__m128i ws = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, sp), _mm_cmpeq_epi8(v, tab)),
+				_mm_or_si128(_mm_cmpeq_epi8(v, nl), _mm_cmpeq_epi8(v, cr)));
+		m.quote |= quote << (16 * i);
+		m.backslash |= back << (16 * i);
+		m.op |= static_cast<uint64_t>(static_cast<uint16_t>(_mm_movemask_epi8(ops))) << (16 * i);
+		m.space |= static_cast<uint64_t>(static_cast<uint16_t>(_mm_movemask_epi8(ws))) << (16 * i);
+	}
+}
+
+__attribute__((target("avx2")))
+inline void JsonClassifyAvx2(const uint8_t *p, JsonBlockMasks &m)
+{
+	m.quote = m.backslash = m.op = m.space = 0;
+	const __m256i q = _mm256_set1_epi8('"');
+	const __m256i bs = _mm256_set1_epi8('\\');
+	const __m256i colon = _mm256_set1_epi8(':');
+	const __m256i comma = _mm256_set1_epi8(',');
+	const __m256i sp = _mm256_set1_epi8(' ');
+	const __m256i tab = _mm256_set1_epi8('\t');
+	const __m256i nl = _mm256_set1_epi8('\n');
+	const __m256i cr = _mm256_set1_epi8('\r');
+	const __m256i lowerBit = _mm256_set1_epi8(static_cast<char>(~0x20));
+	const __m256i lb = _mm256_set1_epi8('[');
+	const __m256i rb = _mm256_set1_epi8(']');
+	for (int i = 0; i < 2; ++i) {
+		__m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + 32 * i));
+		__m256i folded = _mm256_and_si256(v, lowerBit);
+		__m256i ops = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(folded, lb), _mm256_cmpeq_epi8(folded, rb)),
+				_mm256_or_si256(_mm256_cmpeq_epi8(v, colon), _mm256_cmpeq_epi8(v, comma)));
+		__m256i ws = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(v, sp), _mm256_cmpeq_epi8(v, tab)),
+				_mm256_or_si256(_mm256_cmpeq_epi8(v, nl), _mm256_cmpeq_epi8(v, cr)));
+		m.quote |= static_cast<uint64_t>(static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, q)))) << (32 * i);
+		m.backslash |= static_cast<uint64_t>(static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, bs)))) << (32 * i);
+		m.op |= static_cast<uint64_t>(static_cast<uint32_t>(_mm256_movemask_epi8(ops))) << (32 * i);
+		m.space |= static_cast<uint64_t>(static_cast<uint32_t>(_mm256_movemask_epi8(ws))) << (32 * i);
+	}
+}
+#endif
+
+typedef void (*JsonClassifier)(const uint8_t*, JsonBlockMasks&);
+
+inline JsonClassifier SelectJsonClassifier()
+{
+#if defined(__x86_64__)
+	if (__builtin_cpu_supports("avx2")) {
+		return JsonClassifyAvx2;
+	}
+	return JsonClassifySse2;
+#else
+	return JsonClassifyScalar;
+#endif
+}
+
+/// Bit i of the result is the XOR of bits 0..i of x
+inline uint64_t PrefixXor(uint64_t x)
+{
+	x ^= x << 1;
+	x ^= x << 2;
+	x ^= x << 4;
+	x ^= x << 8;
+	x ^= x << 16;
+	x ^= x << 32;
+	return x;
+}
+
+} /* namespace detail */
+
+class JsonDocument;
+
+enum class JsonType {
+	Object, Array, String, Number, Bool, Null, Invalid
+};
+
+/**
+ * Lazily evaluated JSON value: a position in the structural index of a JsonDocument.
+ */
+class JsonValue
+{
+public:
+	JsonValue() :
+		doc(nullptr), tok(0)
+	{
+	}
+
+	JsonValue(const JsonDocument *doc, uint32_t tok) :
+		doc(doc), tok(tok)
+	{
+	}
+
+	inline JsonType Type() const;
+
+	bool Valid() const
+	{
+		return Type() != JsonType::Invalid;
+	}
+
+	/// Member of an object (first match), invalid value if missing
+	inline JsonValue operator[](std::string_view key) const;
+
+	/// Element of an array, invalid value if out of range
+	inline JsonValue At(size_t index) const;
+
+	/// Calls fn(std::string_view key, JsonValue value) for every member; stops if fn returns false
+	template<typename F>
+	inline void ForEachField(F fn) const;
+
+	/// Calls fn(JsonValue element) for every element; stops if fn returns false
+	template<typename F>
+	inline void ForEachElement(F fn) const;
+
+	/// String content without quotes, escapes not decoded (see JsonUnescape())
+	inline bool GetString(std::string_view &out) const;
+
+	inline bool GetInt64(int64_t &out) const;
+	inline bool GetUint64(uint64_t &out) const;
+	inline bool GetDouble(double &out) const;
+	inline bool GetBool(bool &out) const;
+
+	/// Raw text of the value (objects and arrays included)
+	inline std::string_view Raw() const;
+
+private:
+	friend class JsonDocument;
+
+	const JsonDocument *doc;
+	uint32_t tok;
+};
+
+class JsonDocument
+{
+public:
+	/**
+	 * @brief Runs stage 1 over json.
+	 *
+	 * @return false if a string is not terminated or the nesting is unbalanced
+	 */
+	bool Parse(std::string_view json)
+	{
+		static const detail::JsonClassifier classify = detail::SelectJsonClassifier();
+		text = json;
+		index.clear();
+		if (index.capacity() < json.size() / 2 + 16) {
+			index.reserve(json.size() / 2 + 16);
+		}
+		const uint8_t *p = reinterpret_cast<const uint8_t*>(json.data());
+		size_t len = json.size();
+
+		uint64_t prevEscaped = 0, prevInString = 0, prevScalar = 0;
+		int depth = 0;
+		uint8_t tail[64];
+		for (size_t offset = 0; offset < len; offset += 64) {
+			const uint8_t *block = p + offset;
+			if (len - offset < 64) {
+				memset(tail, ' ', sizeof(tail));
+				memcpy(tail, block, len - offset);
+				block = tail;
+			}
+			detail::JsonBlockMasks m;
+			classify(block, m);
+
+			// Characters escaped by an odd-length run of backslashes
+			const uint64_t kEvenBits = 0x5555555555555555ULL;
+			uint64_t backslash = m.backslash & ~prevEscaped;
+			uint64_t followsEscape = (backslash << 1) | prevEscaped;
+			uint64_t oddStarts = backslash & ~kEvenBits & ~followsEscape;
+			uint64_t evenStarts;
+			prevEscaped = __builtin_add_overflow(oddStarts, backslash, &evenStarts) ? 1 : 0;
+			uint64_t escaped = (kEvenBits ^ (evenStarts << 1)) & followsEscape;
+
+			uint64_t quotes = m.quote & ~escaped;
+			uint64_t inString = detail::PrefixXor(quotes) ^ prevInString;
+			prevInString = static_cast<uint64_t>(static_cast<int64_t>(inString) >> 63);
+
+			uint64_t ops = m.op & ~inString;
+			uint64_t scalar = ~(m.op | m.space | quotes) & ~inString;
+			uint64_t scalarStarts = scalar & ~((scalar << 1) | prevScalar);
+			prevScalar = scalar >> 63;
+			uint64_t structurals = ops | quotes | scalarStarts;
+			if (len - offset < 64) {
+				structurals &= (1ULL << (len - offset)) - 1;
+			}
+
+			while (structurals) {
+				uint32_t pos = static_cast<uint32_t>(offset) + static_cast<uint32_t>(__builtin_ctzll(structurals));
+				index.push_back(pos);
+				char c = json[pos];
+				if (c == '{' || c == '[') {
+					depth++;
+				} else if (c == '}' || c == ']') {
+					depth--;
+				}
+				structurals &= structurals - 1;
+			}
+		}
+		index.push_back(static_cast<uint32_t>(len));	// sentinel
+		return prevInString == 0 && depth == 0 && index.size() > 1;
+	}
+
+	JsonValue Root() const
+	{
+		return JsonValue(this, 0);
+	}
+
+	std::string_view Text() const
+	{
+		return text;
+	}
+
+private:
+	friend class JsonValue;
+
+	char CharAt(uint32_t tok) const
+	{
+		return tok + 1 < index.size() ? text[index[tok]] : '\0';
+	}
+
+	/// Token following the value that starts at tok
+	uint32_t Skip(uint32_t tok) const
+	{
+		char c = CharAt(tok);
+		if (c == '"') {
+			return tok + 2;
+		}
+		if (c != '{' && c != '[') {
+			return tok + 1;
+		}
+		int depth = 0;
+		for (uint32_t t = tok; t + 1 < index.size(); ++t) {
+			char d = text[index[t]];
+			if (d == '"') {
+				t++;	// skip the closing quote
+			} else if (d == '{' || d == '[') {
+				depth++;
+			} else if (d == '}' || d == ']') {
+				if (--depth == 0) {
+					return t + 1;
+				}
+			}
+		}
+		return static_cast<uint32_t>(index.size() - 1);
+	}
+
+	std::string_view ScalarText(uint32_t tok) const
+	{
+		size_t begin = index[tok], end = index[tok + 1];
+		while (end > begin && (text[end - 1] == ' ' || text[end - 1] == '\t' || text[end - 1] == '\n' || text[end - 1] == '\r')) {
+			end--;
+		}
+		return text.substr(begin, end - begin);
+	}
+
+	std::string_view text;
+	std::vector<uint32_t> index;
+};
+
+inline JsonType JsonValue::Type() const
+{
+	if (!doc) {
+		return JsonType::Invalid;
+	}
+	switch (doc->CharAt(tok)) {
+	case '{':
+		return JsonType::Object;
+	case '[':
+		return JsonType::Array;
+	case '"':
+		return JsonType::String;
+	case 't': case 'f':
+		return JsonType::Bool;
+	case 'n':
+		return JsonType::Null;
+	case '-': case '0': case '1': case '2': case '3': case '4':
+	case '5': case '6': case '7': case '8': case '9':
+		return JsonType::Number;
+	default:
+		return JsonType::Invalid;
+	}
+}
+
+template<typename F>
+inline void JsonValue::ForEachField(F fn) const
+{
+	if (Type() != JsonType::Object) {
+		return;
+	}
+	uint32_t t = tok + 1;
+	while (doc->CharAt(t) == '"') {
+		std::string_view key = doc->text.substr(doc->index[t] + 1, doc->index[t + 1] - doc->index[t] - 1);
+		if (doc->CharAt(t + 2) != ':') {
+			return;
+		}
+		JsonValue value(doc, t + 3);
+		if (!fn(key, value)) {
+			return;
+		}
+		t = doc->Skip(t + 3);
+		if (doc->CharAt(t) != ',') {
+			return;
+		}
+		t++;
+	}
+}
+
+template<typename F>
+inline void JsonValue::ForEachElement(F fn) const
+{
+	if (Type() != JsonType::Array) {
+		return;
+	}
+	uint32_t t = tok + 1;
+	if (doc->CharAt(t) == ']') {
+		return;
+	}
+	for (;;) {
+		if (!fn(JsonValue(doc, t))) {
+			return;
+		}
+		t = doc->Skip(t);
+		if (doc->CharAt(t) != ',') {
+			return;
+		}
+		t++;
+	}
+}
+
+inline JsonValue JsonValue::operator[](std::string_view key) const
+{
+	JsonValue found;
+	ForEachField([&](std::string_view k, JsonValue v) {
+		if (k == key) {
+			found = v;
+			return false;
+		}
+		return true;
+	});
+	return found;
+}
+
+inline JsonValue JsonValue::At(size_t i) const
+{
+	JsonValue found;
+	size_t n = 0;
+	ForEachElement([&](JsonValue v) {
+		if (n++ == i) {
+			found = v;
+			return false;
+		}
+		return true;
+	});
+	return found;
+}
+
+inline bool JsonValue::GetString(std::string_view &out) const
+{
+	if (Type() != JsonType::String) {
+		return false;
+	}
+	out = doc->text.substr(doc->index[tok] + 1, doc->index[tok + 1] - doc->index[tok] - 1);
+	return true;
+}
+
+inline bool JsonValue::GetInt64(int64_t &out) const
+{
+	if (Type() != JsonType::Number) {
+		return false;
+	}
+	std::string_view s = doc->ScalarText(tok);
+	auto res = std::from_chars(s.data(), s.data() + s.size(), out);
+	return res.ec == std::errc() && res.ptr == s.data() + s.size();
+}
+
+inline bool JsonValue::GetUint64(uint64_t &out) const
+{
+	if (Type() != JsonType::Number) {
+		return false;
+	}
+	std::string_view s = doc->ScalarText(tok);
+	auto res = std::from_chars(s.data(), s.data() + s.size(), out);
+	return res.ec == std::errc() && res.ptr == s.data() + s.size();
+}
+
+inline bool JsonValue::GetDouble(double &out) const
+{
+	if (Type() != JsonType::Number) {
+		return false;
+	}
+	std::string_view s = doc->ScalarText(tok);
+	auto res = std::from_chars(s.data(), s.data() + s.size(), out);
+	return res.ec == std::errc() && res.ptr == s.data() + s.size();
+}
+
+inline bool JsonValue::GetBool(bool &out) const
+{
+	if (Type() != JsonType::Bool) {
+		return false;
+	}
+	std::string_view s = doc->ScalarText(tok);
+	if (s == "true") {
+		out = true;
+		return true;
+	}
+	if (s == "false") {
+		out = false;
+		return true;
+	}
+	return false;
+}
+
+inline std::string_view JsonValue::Raw() const
+{
+	if (!doc) {
+		return std::string_view();
+	}
+	JsonType type = Type();
+	if (type == JsonType::Object || type == JsonType::Array) {
+		uint32_t end = doc->Skip(tok);
+		return doc->text.substr(doc->index[tok], doc->index[end - 1] + 1 - doc->index[tok]);
+	}
+	if (type == JsonType::String) {
+		return doc->text.substr(doc->index[tok], doc->index[tok + 1] + 1 - doc->index[tok]);
+	}
+	return doc->ScalarText(tok);
+}
+
+/**
+ * @brief Decodes the escapes of a JSON string (\uXXXX is converted to UTF-8, surrogate pairs included).
+ *
+ * @return false on malformed escapes and unpaired surrogates
+ */
+inline bool JsonUnescape(std::string_view in, std::string &out)
+{
+	out.clear();
+	out.reserve(in.size());
+	for (size_t i = 0; i < in.size(); ++i) {
+		char c = in[i];
+		if (c != '\\') {
+			out += c;
+			continue;
+		}
+		if (++i >= in.size()) {
+			return false;
+		}
+		switch (in[i]) {
+		case '"': out += '"'; break;
+		case '\\': out += '\\'; break;
+		case '/': out += '/'; break;
+		case 'b': out += '\b'; break;
+		case 'f': out += '\f'; break;
+		case 'n': out += '\n'; break;
+		case 'r': out += '\r'; break;
+		case 't': out += '\t'; break;
+		case 'u': {
+			// i at the 'u': reads the 4 hex digits after it
+			auto hex4 = [&in](size_t at, unsigned &v) {
+				return at + 4 < in.size() && std::from_chars(in.data() + at + 1, in.data() + at + 5, v, 16).ptr == in.data() + at + 5;
+			};
+			unsigned cp = 0;
+			if (!hex4(i, cp)) {
+				return false;
+			}
+			i += 4;
+			if (cp >= 0xdc00 && cp <= 0xdfff) {
+				return false;   // low surrogate without its high one
+			}
+			if (cp >= 0xd800 && cp <= 0xdbff) {
+				// outside the BMP: a UTF-16 pair, combined into one code point
+				unsigned low = 0;
+				if (i + 2 >= in.size() || in[i + 1] != '\\' || in[i + 2] != 'u' || !hex4(i + 2, low) || low < 0xdc00 || low > 0xdfff) {
+					return false;
+				}
+				i += 6;
+				cp = 0x10000 + ((cp - 0xd800) << 10) + (low - 0xdc00);
+				out += static_cast<char>(0xf0 | (cp >> 18));
+				out += static_cast<char>(0x80 | ((cp >> 12) & 0x3f));
+				out += static_cast<char>(0x80 | ((cp >> 6) & 0x3f));
+				out += static_cast<char>(0x80 | (cp & 0x3f));
+			} else if (cp < 0x80) {
+				out += static_cast<char>(cp);
+			} else if (cp < 0x800) {
+				out += static_cast<char>(0xc0 | (cp >> 6));
+				out += static_cast<char>(0x80 | (cp & 0x3f));
+			} else {
+				out += static_cast<char>(0xe0 | (cp >> 12));
+				out += static_cast<char>(0x80 | ((cp >> 6) & 0x3f));
+				out += static_cast<char>(0x80 | (cp & 0x3f));
+			}
+			break;
+		}
+		default:
+			return false;
+		}
+	}
+	return true;
+}
+
+/**
+ * One "key=value" line record. Both forms are accepted:
+ * 	"temp=21.5 id=7 name=\"left arm\""
+ * 	"joint,robot=r1,arm=left pos=1.2,vel=0.1 1700000000000000000"
+ * In the second form the first token is the measurement, the tags follow it after commas,
+ * and a trailing bare token is the timestamp.
+ */
+class KeyValueRecord
+{
+public:
+	static const size_t kMaxFields = 64;
+
+	struct Field
+	{
+		std::string_view key;
+		std::string_view value;	///< Quotes removed, escapes not decoded
+		bool tag;				///< Belongs to the measurement part
+	};
+
+	KeyValueRecord() :
+		count(0)
+	{
+	}
+
+	/**
+	 * @brief Parses one line (without its newline).
+	 *
+	 * @return false if the line is malformed or has more than kMaxFields fields
+	 */
+	bool Parse(std::string_view line)
+	{
+		count = 0;
+		measurement = std::string_view();
+		timestamp = std::string_view();
+		size_t i = 0, n = line.size();
+		while (i < n && line[i] == ' ') {
+			i++;
+		}
+		size_t firstEnd = i;
+		while (firstEnd < n && line[firstEnd] != ' ' && line[firstEnd] != ',' && line[firstEnd] != '=') {
+			firstEnd++;
+		}
+		bool tagSection = false;
+		if (firstEnd < n && line[firstEnd] != '=' && firstEnd > i) {
+			measurement = line.substr(i, firstEnd - i);
+			tagSection = line[firstEnd] == ',';
+			i = firstEnd + 1;
+		}
+		while (i < n) {
+			while (i < n && line[i] == ' ') {
+				i++;
+				tagSection = false;
+			}
+			if (i >= n) {
+				break;
+			}
+			size_t keyStart = i;
+			while (i < n && line[i] != '=' && line[i] != ' ' && line[i] != ',') {
+				i++;
+			}
+			if (i >= n || line[i] != '=') {
+				// A bare token at the end is the timestamp
+				if (i >= n || line.find('=', i) == std::string_view::npos) {
+					timestamp = line.substr(keyStart, i - keyStart);
+					return i >= n || line.find_first_not_of(' ', i) == std::string_view::npos;
+				}
+				return false;
+			}
+			if (count == kMaxFields) {
+				return false;
+			}
+			Field &f = fields[count++];
+			f.key = line.substr(keyStart, i - keyStart);
+			f.tag = tagSection;
+			i++;
+			if (i < n && line[i] == '"') {
+				size_t start = ++i;
+				while (i < n && line[i] != '"') {
+					i += (line[i] == '\\') ? 2 : 1;
+				}
+				if (i >= n) {
+					return false;
+				}
+				f.value = line.substr(start, i - start);
+				i++;
+			} else {
+				size_t start = i;
+				while (i < n && line[i] != ' ' && line[i] != ',') {
+					i++;
+				}
+				f.value = line.substr(start, i - start);
+			}
+			if (i < n && line[i] == ',') {
+				i++;
+			}
+		}
+		return true;
+	}
+
+	size_t Count() const
+	{
+		return count;
+	}
+
+	const Field& operator[](size_t i) const
+	{
+		return fields[i];
+	}
+
+	/// Value of a key, empty view if missing
+	std::string_view Get(std::string_view key) const
+	{
+		for (size_t i = 0; i < count; ++i) {
+			if (fields[i].key == key) {
+				return fields[i].value;
+			}
+		}
+		return std::string_view();
+	}
+
+	bool GetDouble(std::string_view key, double &out) const
+	{
+		std::string_view v = Get(key);
+		return !v.empty() && std::from_chars(v.data(), v.data() + v.size(), out).ptr == v.data() + v.size();
+	}
+
+	bool GetInt64(std::string_view key, int64_t &out) const
+	{
+		std::string_view v = Get(key);
+		if (!v.empty() && v.back() == 'i') {
+			v.remove_suffix(1);	// InfluxDB integer suffix
+		}
+		return !v.empty() && std::from_chars(v.data(), v.data() + v.size(), out).ptr == v.data() + v.size();
+	}
+
+	std::string_view Measurement() const
+	{
+		return measurement;
+	}
+
+	std::string_view Timestamp() const
+	{
+		return timestamp;
+	}
+
+private:
+	Field fields[kMaxFields];
+	size_t count;
+	std::string_view measurement, timestamp;
+};
+
+/**
+ * @brief Calls fn(std::string_view line) for every non-empty line of a datagram.
+ * The newline scan uses memchr, which glibc vectorises.
+ */
+template<typename F>
+inline void ForEachLine(std::string_view buffer, F fn)
+{
+	const char *p = buffer.data();
+	const char *end = p + buffer.size();
+	while (p < end) {
+		const char *nl = static_cast<const char*>(memchr(p, '\n', static_cast<size_t>(end - p)));
+		const char *lineEnd = nl ? nl : end;
+		const char *trimmed = lineEnd;
+		if (trimmed > p && trimmed[-1] == '\r') {
+			trimmed--;
+		}
+		if (trimmed > p) {
+			fn(std::string_view(p, static_cast<size_t>(trimmed - p)));
+		}
+		p = lineEnd + 1;
+	}
+}
+
+} /* namespace FUTILS */
+
+#endif /* FUTILS_TELEMETRY_H_ */
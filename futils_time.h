@@ -0,0 +1,309 @@
+/**
+ * @brief Clocks and timing helpers for the networking utilities.
+ *
+ * @details The utilities implemented include:
+ * 			- CoarseClock: monotonic time read from the vDSO coarse clock (a few ns per call,
+ * 			  resolution of one kernel tick), for bookkeeping that does not need precision
+ * 			- MonotonicNs/SleepUntil: precise monotonic time and an absolute-deadline wait that
+ * 			  sleeps for the bulk of the interval and spins over the last few tens of microseconds
+ * 			- PeriodicScheduler: fixed-rate ticks on absolute deadlines (no drift), with overrun
+ * 			  accounting
+ * 			- TimerQueue: one-shot deadlines with callbacks on a binary heap, cancellable in O(1),
+ * 			  for the many short timeouts of request/response protocols
+ */
+
+#ifndef FUTILS_TIME_H_
+#define FUTILS_TIME_H_
+
+#include "futils.h"
+
+#if defined(__linux__) || defined(linux)
+
+#include <ctime>
+#include <cerrno>
+#include <unordered_map>
+
+#if defined(__x86_64__)
+#	include <immintrin.h>
+#endif
+
+namespace FUTILS
+{
+
+/**
+ * Monotonic clock with tick resolution (1-4 ms), cheap enough to be read once per packet batch.
+ */
+struct CoarseClock
+{
+	static uint64_t NowNs()
+	{
+		struct timespec ts;
+		clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+		return static_cast<uint64_t>(ts.tv_sec) * 1000000000ULL + static_cast<uint64_t>(ts.tv_nsec);
+	}
+
+	static uint64_t NowMs()
+	{
+		return NowNs() / 1000000ULL;
+	}
+
+	/// Milliseconds truncated to 32 bits, for compact timestamps compared with wrap-safe subtraction
+	static uint32_t NowMs32()
+	{
+		return static_cast<uint32_t>(NowMs());
+	}
+
+	/// Resolution of the clock in nanoseconds
+	static uint64_t ResolutionNs()
+	{
+		struct timespec ts;
+		clock_getres(CLOCK_MONOTONIC_COARSE, &ts);
+		return static_cast<uint64_t>(ts.tv_sec) * 1000000000ULL + static_cast<uint64_t>(ts.tv_nsec);
+	}
+};
+
+/// CLOCK_MONOTONIC in nanoseconds (same time base as CoarseClock)
+inline uint64_t MonotonicNs()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return static_cast<uint64_t>(ts.tv_sec) * 1000000000ULL + static_cast<uint64_t>(ts.tv_nsec);
+}
+
+/**
+ * @brief Waits until MonotonicNs() >= deadlineNs.
+ *
+ * Timer wakeups are late by tens of microseconds (timer slack, scheduling), so the thread sleeps
+ * until spinNs before the deadline and busy-waits the rest.
+ *
+ * @return lateness in ns (0 if the deadline had already passed on entry)
+ */
+inline uint64_t SleepUntil(uint64_t deadlineNs, uint64_t spinNs = 50000)
+{
+	uint64_t now = MonotonicNs();
+	if (now >= deadlineNs) {
+		return 0;
+	}
+	if (deadlineNs - now > spinNs) {
+		uint64_t wake = deadlineNs - spinNs;
+		struct timespec ts;
+		ts.tv_sec = static_cast<time_t>(wake / 1000000000ULL);
+		ts.tv_nsec = static_cast<long>(wake % 1000000000ULL);
+		while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, nullptr) == EINTR) {
+		}
+	}
+	while ((now = MonotonicNs()) < deadlineNs) {
+#if defined(__x86_64__)
+		_mm_pause();
+#endif
+	}
+	return now - deadlineNs;
+}
+
+/**
+ * Fixed-period ticks. Deadlines are start + k * period, so lateness of one wakeup never accumulates.
+ */
+class PeriodicScheduler
+{
+public:
+	/// @param startNs first deadline (MonotonicNs() clock), 0 for one period from now
+	explicit PeriodicScheduler(uint64_t periodNs, uint64_t startNs = 0) :
+		period(periodNs), next(startNs ? startNs : MonotonicNs() + periodNs), overruns(0), maxLateness(0)
+	{
+	}
+
+	/**
+	 * @brief Waits for the next deadline.
+	 *
+	 * @return number of periods elapsed since the previous call: 1, or more when the caller
+	 * overran and deadlines were skipped (counted in Overruns())
+	 */
+	uint64_t Wait()
+	{
+		uint64_t late = SleepUntil(next);
+		maxLateness = std::max(maxLateness, late);
+		uint64_t ticks = 1 + late / period;
+		overruns += ticks - 1;
+		next += ticks * period;
+		return ticks;
+	}
+
+	/// Moves the next deadline to the first tick at or after ns (skipped ticks are not overruns)
+	void SkipTo(uint64_t ns)
+	{
+		if (ns > next) {
+			next += (ns - next + period - 1) / period * period;
+		}
+	}
+
+	/// Restarts the ticks at startNs
+	void Reset(uint64_t startNs)
+	{
+		next = startNs;
+	}
+
+	uint64_t NextDeadline() const
+	{
+		return next;
+	}
+
+	uint64_t Period() const
+	{
+		return period;
+	}
+
+	uint64_t Overruns() const
+	{
+		return overruns;
+	}
+
+	/// Largest wakeup delay past a deadline, ns
+	uint64_t MaxLateness() const
+	{
+		return maxLateness;
+	}
+
+private:
+	uint64_t period;
+	uint64_t next;
+	uint64_t overruns;
+	uint64_t maxLateness;
+};
+
+/**
+ * One-shot timers ordered by deadline (MonotonicNs() clock).
+ *
+ * Cancel() only forgets the callback: its heap entry is skipped when it surfaces, and the heap is
+ * rebuilt once cancelled entries outnumber the live ones. Most request timeouts are cancelled by
+ * their reply, so this keeps both operations cheap. Not thread safe.
+ */
+class TimerQueue
+{
+public:
+	typedef uint64_t TimerId;
+	typedef std::function<void()> Callback;
+
+	TimerQueue() :
+		nextId(1)
+	{
+	}
+
+	TimerQueue(const TimerQueue&) = delete;
+	TimerQueue& operator=(const TimerQueue&) = delete;
+
+	/// Runs callback at deadlineNs (from RunExpired()); the id is never 0
+	TimerId Schedule(uint64_t deadlineNs, Callback callback)
+	{
+		TimerId id = nextId++;
+		callbacks.emplace(id, std::move(callback));
+		heap.push_back(Entry(deadlineNs, id));
+		std::push_heap(heap.begin(), heap.end(), Later());
+		return id;
+	}
+
+	/// @return false if the timer already ran or was cancelled
+	bool Cancel(TimerId id)
+	{
+		if (callbacks.erase(id) == 0) {
+			return false;
+		}
+		if (heap.size() > 64 && heap.size() > 2 * callbacks.size()) {
+			Compact();
+		}
+		return true;
+	}
+
+	/**
+	 * @brief Runs the callbacks due at nowNs, earliest first.
+	 *
+	 * Callbacks may schedule or cancel timers; new timers already due run in the same call.
+	 *
+	 * @return number of callbacks run
+	 */
+	size_t RunExpired(uint64_t nowNs)
+	{
+		size_t ran = 0;
+		while (!heap.empty() && heap.front().first <= nowNs) {
+			TimerId id = heap.front().second;
+			std::pop_heap(heap.begin(), heap.end(), Later());
+			heap.pop_back();
+			std::unordered_map<TimerId, Callback>::iterator it = callbacks.find(id);
+			if (it == callbacks.end()) {
+				continue;
+			}
+			Callback callback = std::move(it->second);
+			callbacks.erase(it);
+			callback();
+			++ran;
+		}
+		return ran;
+	}
+
+	/// Earliest pending deadline, UINT64_MAX if none
+	uint64_t NextDeadline()
+	{
+		while (!heap.empty() && callbacks.find(heap.front().second) == callbacks.end()) {
+			std::pop_heap(heap.begin(), heap.end(), Later());
+			heap.pop_back();
+		}
+		return heap.empty() ? UINT64_MAX : heap.front().first;
+	}
+
+	/// Wait until the next deadline in milliseconds (rounded up), for epoll_wait()/poll(); -1 if none
+	int TimeoutMs(uint64_t nowNs)
+	{
+		uint64_t next = NextDeadline();
+		if (next == UINT64_MAX) {
+			return -1;
+		}
+		if (next <= nowNs) {
+			return 0;
+		}
+		return static_cast<int>(std::min<uint64_t>((next - nowNs + 999999) / 1000000, INT32_MAX));
+	}
+
+	/// Pending timers
+	size_t Size() const
+	{
+		return callbacks.size();
+	}
+
+	bool Empty() const
+	{
+		return callbacks.empty();
+	}
+
+private:
+	typedef std::pair<uint64_t, TimerId> Entry;
+
+	/// Min-heap order; equal deadlines run in scheduling order
+	struct Later
+	{
+		bool operator()(const Entry &a, const Entry &b) const
+		{
+			return a.first != b.first ? a.first > b.first : a.second > b.second;
+		}
+	};
+
+	void Compact()
+	{
+		size_t out = 0;
+		for (size_t i = 0; i < heap.size(); ++i) {
+			if (callbacks.count(heap[i].second)) {
+				heap[out++] = heap[i];
+			}
+		}
+		heap.resize(out);
+		std::make_heap(heap.begin(), heap.end(), Later());
+	}
+
+	std::vector<Entry> heap;
+	std::unordered_map<TimerId, Callback> callbacks;
+	TimerId nextId;
+};
+
+} /* namespace FUTILS */
+
+#endif /* Linux functions*/
+
+#endif /* FUTILS_TIME_H_ */
@@ -0,0 +1,684 @@
+/**
+ * @brief Compact codecs for numeric time-series recordings.
+ *
+ * @details The utilities implemented include:
+ * 			- BitWriter/BitReader: MSB-first bit streams
+ * 			- TimestampEncoder/Decoder: delta-of-delta timestamps (Gorilla)
+ * 			- XorFloatEncoder/Decoder: XOR compression of doubles (Gorilla)
+ * 			- PackBlock/UnpackBlock: 128 integers bit-packed in a 4-lane vertical layout,
+ * 			  unpacked with SSE2 shifts and masks
+ * 			- EncodeIntegers/DecodeIntegers: zigzag delta + bit-packed integer columns
+ * 			- TimeSeriesEncoder/Decoder: rows of (timestamp, N doubles), e.g. the per-cycle
+ * 			  controller state otherwise dumped with CMATArrayToString()
+ *
+ * 			Reference: Pelkonen et al., "Gorilla: A Fast, Scalable, In-Memory Time Series Database"
+ */
+
+#ifndef FUTILS_TIMESERIES_H_
+#define FUTILS_TIMESERIES_H_
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#if defined(__SSE2__)
+#	include <emmintrin.h>
+#endif
+
+namespace FUTILS
+{
+
+/**
+ * Appends bits MSB-first to a byte vector. Bits are staged in a 64 bit accumulator and
+ * flushed a byte at a time.
+ */
+class BitWriter
+{
+public:
+	explicit BitWriter(std::vector<uint8_t> &out) :
+		out(out), acc(0), accBits(0)
+	{
+	}
+
+	/// Writes the count (0..64) least significant bits of value
+	void Write(uint64_t value, int count)
+	{
+		if (count == 0) {
+			return;
+		}
+		if (count < 64) {
+			value &= (1ULL << count) - 1;
+		}
+		if (accBits + count > 64) {
+			int first = 64 - accBits;
+			Write(value >> (count - first), first);
+			count -= first;
+			value &= (1ULL << count) - 1;
+		}
+		acc = (count == 64) ? value : (acc << count) | value;
+		accBits += count;
+		while (accBits >= 8) {
+			accBits -= 8;
+			out.push_back(static_cast<uint8_t>(acc >> accBits));
+		}
+	}
+
+	void WriteBit(bool bit)
+	{
+		Write(bit ? 1 : 0, 1);
+	}
+
+	/// Pads the last byte with zeros
+	void Flush()
+	{
+		if (accBits) {
+			out.push_back(static_cast<uint8_t>(acc << (8 - accBits)));
+			accBits = 0;
+		}
+		acc = 0;
+	}
+
+	/// Number of bits written so far
+	size_t BitCount() const
+	{
+		return out.size() * 8 + static_cast<size_t>(accBits);
+	}
+
+private:
+	std::vector<uint8_t> &out;
+	uint64_t acc;
+	int accBits;
+};
+
+/**
+ * Reads an MSB-first bit stream. Reading past the end returns zeros and sets Overrun().
+ */
+class BitReader
+{
+public:
+	BitReader(const uint8_t *data, size_t len) :
+		data(data), len(len), pos(0), acc(0), accBits(0), overrun(false)
+	{
+	}
+
+	uint64_t Read(int count)
+	{
+		if (count == 0) {
+			return 0;
+		}
+		if (count > 56) {
+			uint64_t high = Read(count - 32);
+			return (high << 32) | Read(32);
+		}
+		while (accBits < count) {
+			uint64_t byte = 0;
+			if (pos < len) {
+				byte = data[pos++];
+			} else {
+				overrun = true;
+			}
+			acc = (acc << 8) | byte;
+			accBits += 8;
+		}
+		accBits -= count;
+		return (acc >> accBits) & ((1ULL << count) - 1);
+	}
+
+	bool ReadBit()
+	{
+		return Read(1) != 0;
+	}
+
+	bool Overrun() const
+	{
+		return overrun;
+	}
+
+private:
+	const uint8_t *data;
+	size_t len;
+	size_t pos;
+	uint64_t acc;
+	int accBits;
+	bool overrun;
+};
+
+inline uint64_t ZigZagEncode(int64_t v)
+{
+	return (static_cast<uint64_t>(v) << 1) ^ static_cast<uint64_t>(v >> 63);
+}
+
+inline int64_t ZigZagDecode(uint64_t v)
+{
+	return static_cast<int64_t>(v >> 1) ^ -static_cast<int64_t>(v & 1);
+}
+
+/**
+ * Delta-of-delta timestamp encoder. A fixed-rate stream costs one bit per sample:
+ * 	'0' dod == 0, '10' + 7 bits, '110' + 9 bits, '1110' + 12 bits, '1111' + 64 bits (zigzag)
+ */
+class TimestampEncoder
+{
+public:
+	TimestampEncoder() :
+		count(0), prev(0), prevDelta(0)
+	{
+	}
+
+	void Append(BitWriter &w, int64_t ts)
+	{
+		if (count == 0) {
+			w.Write(static_cast<uint64_t>(ts), 64);
+		} else {
+			int64_t delta = static_cast<int64_t>(static_cast<uint64_t>(ts) - static_cast<uint64_t>(prev));
+			uint64_t zz = ZigZagEncode(static_cast<int64_t>(static_cast<uint64_t>(delta) - static_cast<uint64_t>(prevDelta)));
+			if (zz == 0) {
+				w.Write(0, 1);
+			} else if (zz < (1ULL << 7)) {
+				w.Write(0x2, 2);
+				w.Write(zz, 7);
+			} else if (zz < (1ULL << 9)) {
+				w.Write(0x6, 3);
+				w.Write(zz, 9);
+			} else if (zz < (1ULL << 12)) {
+				w.Write(0xe, 4);
+				w.Write(zz, 12);
+			} else {
+				w.Write(0xf, 4);
+				w.Write(zz, 64);
+			}
+			prevDelta = delta;
+		}
+		prev = ts;
+		count++;
+	}
+
+private:
+	uint64_t count;
+	int64_t prev, prevDelta;
+};
+
+class TimestampDecoder
+{
+public:
+	TimestampDecoder() :
+		count(0), prev(0), prevDelta(0)
+	{
+	}
+
+	int64_t Next(BitReader &r)
+	{
+		if (count++ == 0) {
+			prev = static_cast<int64_t>(r.Read(64));
+			return prev;
+		}
+		int prefix = 0;
+		while (prefix < 4 && r.ReadBit()) {
+			prefix++;
+		}
+		static const int kWidths[5] = { 0, 7, 9, 12, 64 };
+		int64_t dod = ZigZagDecode(r.Read(kWidths[prefix]));
+		prevDelta = static_cast<int64_t>(static_cast<uint64_t>(prevDelta) + static_cast<uint64_t>(dod));
+		prev = static_cast<int64_t>(static_cast<uint64_t>(prev) + static_cast<uint64_t>(prevDelta));
+		return prev;
+	}
+
+private:
+	uint64_t count;
+	int64_t prev, prevDelta;
+};
+
+/**
+ * XOR float encoder. Unchanged values cost one bit; small changes reuse the previous
+ * leading/trailing zero window.
+ */
+class XorFloatEncoder
+{
+public:
+	XorFloatEncoder() :
+		count(0), prev(0), prevLeading(-1), prevTrailing(0)
+	{
+	}
+
+	void Append(BitWriter &w, double value)
+	{
+		uint64_t bits;
+		memcpy(&bits, &value, sizeof(bits));
+		if (count++ == 0) {
+			w.Write(bits, 64);
+			prev = bits;
+			return;
+		}
+		uint64_t x = bits ^ prev;
+		prev = bits;
+		if (x == 0) {
+			w.Write(0, 1);
+			return;
+		}
+		int leading = __builtin_clzll(x);
+		int trailing = __builtin_ctzll(x);
+		if (leading > 31) {
+			leading = 31;
+		}
+		if (prevLeading >= 0 && leading >= prevLeading && trailing >= prevTrailing) {
+			w.Write(0x2, 2);
+			w.Write(x >> prevTrailing, 64 - prevLeading - prevTrailing);
+		} else {
+			int significant = 64 - leading - trailing;
+			w.Write(0x3, 2);
+			w.Write(static_cast<uint64_t>(leading), 5);
+			w.Write(static_cast<uint64_t>(significant & 63), 6);
+			w.Write(x >> trailing, significant);
+			prevLeading = leading;
+			prevTrailing = trailing;
+		}
+	}
+
+private:
+	uint64_t count;
+	uint64_t prev;
+	int prevLeading, prevTrailing;
+};
+
+class XorFloatDecoder
+{
+public:
+	XorFloatDecoder() :
+		count(0), prev(0), prevLeading(0), prevTrailing(0)
+	{
+	}
+
+	double Next(BitReader &r)
+	{
+		if (count++ == 0) {
+			prev = r.Read(64);
+		} else if (r.ReadBit()) {
+			if (r.ReadBit()) {
+				prevLeading = static_cast<int>(r.Read(5));
+				int significant = static_cast<int>(r.Read(6));
+				if (significant == 0) {
+					significant = 64;
+				}
+				prevTrailing = 64 - prevLeading - significant;
+			}
+			prev ^= r.Read(64 - prevLeading - prevTrailing) << prevTrailing;
+		}
+		double value;
+		memcpy(&value, &prev, sizeof(value));
+		return value;
+	}
+
+private:
+	uint64_t count;
+	uint64_t prev;
+	int prevLeading, prevTrailing;
+};
+
+/// Number of integers in a bit-packed block
+const size_t kPackBlockSize = 128;
+
+/// Bits needed to represent the largest of n values
+inline int MaxBits(const uint32_t *in, size_t n)
+{
+	uint32_t acc = 0;
+	for (size_t i = 0; i < n; ++i) {
+		acc |= in[i];
+	}
+	return acc ? 32 - __builtin_clz(acc) : 0;
+}
+
+/**
+ * @brief Packs 128 integers of at most bits bits into 4 * bits words.
+ *
+ * Layout is vertical: lane l of word w holds the bits of values l, l + 4, l + 8, ... so four
+ * values are unpacked at once with 128 bit shifts.
+ */
+inline void PackBlock(const uint32_t *in, int bits, uint32_t *out)
+{
+	if (bits == 0) {
+		return;
+	}
+	memset(out, 0, static_cast<size_t>(bits) * 4 * sizeof(uint32_t));
+	for (int lane = 0; lane < 4; ++lane) {
+		int word = 0, shift = 0;
+		for (int k = 0; k < 32; ++k) {
+			uint32_t v = in[4 * k + lane];
+			out[word * 4 + lane] |= v << shift;
+			if (shift + bits >= 32) {
+				if (shift + bits > 32) {
+					out[(word + 1) * 4 + lane] = v >> (32 - shift);
+				}
+				word++;
+				shift = shift + bits - 32;
+			} else {
+				shift += bits;
+			}
+		}
+	}
+}
+
+namespace detail
+{
+
+#if defined(__SSE2__)
+template<int B>
+inline void UnpackBlockSimd(const uint32_t *in, uint32_t *out)
+{
+	const __m128i *src = reinterpret_cast<const __m128i*>(in);
+	__m128i *dst = reinterpret_cast<__m128i*>(out);
+	const __m128i mask = _mm_set1_epi32(B == 32 ? -1 : static_cast<int>((1U << B) - 1));
+	__m128i cur = _mm_loadu_si128(src++);
+	int shift = 0;
+	for (int k = 0; k < 32; ++k) {
+		__m128i v;
+		if (shift + B <= 32) {
+			v = _mm_and_si128(_mm_srli_epi32(cur, shift), mask);
+			shift += B;
+			if (shift == 32 && k < 31) {
+				cur = _mm_loadu_si128(src++);
+				shift = 0;
+			}
+		} else {
+			v = _mm_srli_epi32(cur, shift);
+			cur = _mm_loadu_si128(src++);
+			v = _mm_and_si128(_mm_or_si128(v, _mm_slli_epi32(cur, 32 - shift)), mask);
+			shift = shift + B - 32;
+		}
+		_mm_storeu_si128(dst + k, v);
+	}
+}
+
+template<>
+inline void UnpackBlockSimd<0>(const uint32_t*, uint32_t *out)
+{
+	memset(out, 0, kPackBlockSize * sizeof(uint32_t));
+}
+
+typedef void (*UnpackKernel)(const uint32_t*, uint32_t*);
+
+template<int... B>
+struct UnpackTable
+{
+	static const UnpackKernel* Get()
+	{
+		static const UnpackKernel table[] = { &UnpackBlockSimd<B>... };
+		return table;
+	}
+};
+#endif
+
+inline void UnpackBlockScalar(const uint32_t *in, int bits, uint32_t *out)
+{
+	if (bits == 0) {
+		memset(out, 0, kPackBlockSize * sizeof(uint32_t));
+		return;
+	}
+	const uint32_t mask = bits == 32 ? ~0U : (1U << bits) - 1;
+	for (int lane = 0; lane < 4; ++lane) {
+		int word = 0, shift = 0;
+		for (int k = 0; k < 32; ++k) {
+			uint64_t v = in[word * 4 + lane] >> shift;
+			if (shift + bits > 32) {
+				v |= static_cast<uint64_t>(in[(word + 1) * 4 + lane]) << (32 - shift);
+			}
+			out[4 * k + lane] = static_cast<uint32_t>(v) & mask;
+			shift += bits;
+			if (shift >= 32) {
+				word++;
+				shift -= 32;
+			}
+		}
+	}
+}
+
+} /* namespace detail */
+
+/**
+ * @brief Unpacks a block written by PackBlock(). The bit width is dispatched to a kernel
+ * specialised at compile time, so every shift amount is an immediate.
+ */
+inline void UnpackBlock(const uint32_t *in, int bits, uint32_t *out)
+{
+#if defined(__SSE2__)
+	static const detail::UnpackKernel *table = detail::UnpackTable<0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10,
+			11, 12, 13, 14, 15, 16, 17, 18, 19, 20, 21, 22, 23, 24, 25, 26, 27, 28, 29, 30, 31, 32>::Get();
+	table[bits](in, out);
+#else
+	detail::UnpackBlockScalar(in, bits, out);
+#endif
+}
+
+/**
+ * @brief Encodes an integer column: zigzag deltas, bit-packed in blocks of 128.
+ *
+ * Format: uint32 count, then for every block one width byte followed by 16 * width bytes.
+ * The last block is zero padded.
+ */
+inline void EncodeIntegers(const int32_t *values, size_t n, std::vector<uint8_t> &out)
+{
+	uint32_t count = static_cast<uint32_t>(n);
+	const uint8_t *c = reinterpret_cast<const uint8_t*>(&count);
+	out.insert(out.end(), c, c + sizeof(count));
+
+	uint32_t block[kPackBlockSize];
+	uint32_t packed[kPackBlockSize];
+	int32_t prev = 0;
+	for (size_t start = 0; start < n; start += kPackBlockSize) {
+		size_t len = n - start < kPackBlockSize ? n - start : kPackBlockSize;
+		for (size_t i = 0; i < len; ++i) {
+			int32_t delta = static_cast<int32_t>(static_cast<uint32_t>(values[start + i]) - static_cast<uint32_t>(prev));
+			block[i] = (static_cast<uint32_t>(delta) << 1) ^ static_cast<uint32_t>(delta >> 31);
+			prev = values[start + i];
+		}
+		for (size_t i = len; i < kPackBlockSize; ++i) {
+			block[i] = 0;
+		}
+		int bits = MaxBits(block, kPackBlockSize);
+		PackBlock(block, bits, packed);
+		out.push_back(static_cast<uint8_t>(bits));
+		const uint8_t *p = reinterpret_cast<const uint8_t*>(packed);
+		out.insert(out.end(), p, p + static_cast<size_t>(bits) * 16);
+	}
+}
+
+/**
+ * @brief Decodes a column written by EncodeIntegers().
+ *
+ * @param consumed set to the number of input bytes used
+ * @return false if the input is truncated or malformed
+ */
+inline bool DecodeIntegers(const uint8_t *data, size_t len, std::vector<int32_t> &values, size_t *consumed = nullptr)
+{
+	if (len < sizeof(uint32_t)) {
+		return false;
+	}
+	uint32_t count;
+	memcpy(&count, data, sizeof(count));
+	size_t pos = sizeof(count);
+	// every block takes at least its width byte: reject counts the input cannot hold before allocating
+	size_t blocks = (static_cast<size_t>(count) + kPackBlockSize - 1) / kPackBlockSize;
+	if (blocks > len - pos) {
+		return false;
+	}
+	values.resize(count);
+
+	alignas(16) uint32_t packed[kPackBlockSize];
+	alignas(16) uint32_t block[kPackBlockSize];
+	uint32_t prev = 0;
+	for (size_t start = 0; start < count; start += kPackBlockSize) {
+		if (pos >= len) {
+			return false;
+		}
+		int bits = data[pos++];
+		size_t bytes = static_cast<size_t>(bits) * 16;
+		if (bits > 32 || len - pos < bytes) {
+			return false;
+		}
+		memcpy(packed, data + pos, bytes);
+		pos += bytes;
+		UnpackBlock(packed, bits, block);
+		size_t n = count - start < kPackBlockSize ? count - start : kPackBlockSize;
+		for (size_t i = 0; i < n; ++i) {
+			prev += (block[i] >> 1) ^ -(block[i] & 1);
+			values[start + i] = static_cast<int32_t>(prev);
+		}
+	}
+	if (consumed) {
+		*consumed = pos;
+	}
+	return true;
+}
+
+/**
+ * Encodes rows of (timestamp, N doubles) into self-contained segments. Each column has its
+ * own XOR state, so slowly changing controller variables cost a few bits per cycle.
+ *
+ * Segment format: uint32 magic, uint32 rows, uint32 columns, then the bit stream.
+ */
+class TimeSeriesEncoder
+{
+public:
+	static const uint32_t kMagic = 0x31535446; // "FTS1"
+	static const size_t kHeaderSize = 12;
+
+	explicit TimeSeriesEncoder(size_t columns) :
+		columns(columns), writer(buffer)
+	{
+		Reset();
+	}
+
+	TimeSeriesEncoder(const TimeSeriesEncoder&) = delete;
+	TimeSeriesEncoder& operator=(const TimeSeriesEncoder&) = delete;
+
+	void AppendRow(int64_t timestamp, const double *values)
+	{
+		tsEncoder.Append(writer, timestamp);
+		for (size_t i = 0; i < columns; ++i) {
+			valueEncoders[i].Append(writer, values[i]);
+		}
+		rows++;
+	}
+
+	/// Appends a row from an array indexed 1..size (same convention as CMATArrayToString())
+	template<typename T>
+	void AppendCMATRow(int64_t timestamp, T arr)
+	{
+		tsEncoder.Append(writer, timestamp);
+		for (size_t i = 0; i < columns; ++i) {
+			valueEncoders[i].Append(writer, static_cast<double>(arr(static_cast<int>(i) + 1)));
+		}
+		rows++;
+	}
+
+	size_t Rows() const
+	{
+		return rows;
+	}
+
+	/// Current encoded size in bytes, header included
+	size_t SizeBytes() const
+	{
+		return (writer.BitCount() + 7) / 8;
+	}
+
+	/// Completes the current segment, moves it into out and starts a new one
+	void TakeSegment(std::vector<uint8_t> &out)
+	{
+		writer.Flush();
+		uint32_t header[3] = { kMagic, static_cast<uint32_t>(rows), static_cast<uint32_t>(columns) };
+		memcpy(buffer.data(), header, kHeaderSize);
+		out.swap(buffer);
+		Reset();
+	}
+
+private:
+	void Reset()
+	{
+		buffer.assign(kHeaderSize, 0);
+		tsEncoder = TimestampEncoder();
+		valueEncoders.assign(columns, XorFloatEncoder());
+		rows = 0;
+	}
+
+	size_t columns;
+	size_t rows;
+	std::vector<uint8_t> buffer;
+	BitWriter writer;
+	TimestampEncoder tsEncoder;
+	std::vector<XorFloatEncoder> valueEncoders;
+};
+
+/**
+ * Streaming decoder of a segment produced by TimeSeriesEncoder::TakeSegment().
+ */
+class TimeSeriesDecoder
+{
+public:
+	TimeSeriesDecoder(const uint8_t *segment, size_t len) :
+		rows(0), columns(0), decoded(0),
+		reader(segment + (len >= TimeSeriesEncoder::kHeaderSize ? TimeSeriesEncoder::kHeaderSize : len),
+				len >= TimeSeriesEncoder::kHeaderSize ? len - TimeSeriesEncoder::kHeaderSize : 0)
+	{
+		uint32_t header[3] = { 0, 0, 0 };
+		if (len >= TimeSeriesEncoder::kHeaderSize) {
+			memcpy(header, segment, TimeSeriesEncoder::kHeaderSize);
+		}
+		if (header[0] == TimeSeriesEncoder::kMagic) {
+			// the first row takes 64 bits per field, the others at least one: a header claiming
+			// more than the payload can hold is corrupt (and must not size the decoders)
+			uint64_t payloadBits = static_cast<uint64_t>(len - TimeSeriesEncoder::kHeaderSize) * 8;
+			if (header[1] == 0 || static_cast<uint64_t>(header[2]) + 1 <= payloadBits / (63 + static_cast<uint64_t>(header[1]))) {
+				rows = header[1];
+				columns = header[2];
+			}
+		}
+		if (rows > 0) {
+			valueDecoders.resize(columns);
+		}
+	}
+
+	/// False if the segment header is not valid
+	bool Valid() const
+	{
+		return rows > 0 || columns > 0;
+	}
+
+	size_t Rows() const
+	{
+		return rows;
+	}
+
+	size_t Columns() const
+	{
+		return columns;
+	}
+
+	/**
+	 * @brief Decodes the next row.
+	 *
+	 * @param values array of Columns() doubles
+	 * @return false at the end of the segment or if the stream is truncated
+	 */
+	bool Next(int64_t &timestamp, double *values)
+	{
+		if (decoded >= rows) {
+			return false;
+		}
+		timestamp = tsDecoder.Next(reader);
+		for (size_t i = 0; i < columns; ++i) {
+			values[i] = valueDecoders[i].Next(reader);
+		}
+		decoded++;
+		return !reader.Overrun();
+	}
+
+private:
+	size_t rows, columns, decoded;
+	BitReader reader;
+	TimestampDecoder tsDecoder;
+	std::vector<XorFloatDecoder> valueDecoders;
+};
+
+} /* namespace FUTILS */
+
+#endif /* FUTILS_TIMESERIES_H_ */
@@ -0,0 +1,456 @@
+/**
+ * @brief Batched UDP I/O with recvmmsg()/sendmmsg().
+ *
+ * @details The utilities implemented include:
+ * 			- PacketBatch: preallocated datagram slots (payload, peer, length) plus the source
+ * 			  addresses and ports as flat arrays, ready for vectorized classification
+ * 			- UdpBatchReceiver: fills a batch with a single recvmmsg() call
+ * 			- UdpBatchSender: sends a batch with as few sendmmsg() calls as possible
+ *
+ * 			One system call moves up to Capacity() datagrams, which divides the per-packet syscall
+ * 			overhead of recvfrom()/sendto() loops by the batch size.
+ */
+
+#ifndef FUTILS_UDPBATCH_H_
+#define FUTILS_UDPBATCH_H_
+
+#include "futils.h"
+
+#if defined(__linux__) || defined(linux)
+
+#include <sys/uio.h>
+#include <cerrno>
+
+namespace FUTILS
+{
+
+/**
+ * Fixed set of datagram slots reused across receive/send calls (no allocation after construction).
+ */
+class PacketBatch
+{
+public:
+	explicit PacketBatch(size_t capacity = 64, size_t maxPayload = 2048) :
+		count(0), maxPayload(maxPayload),
+		storage(capacity * maxPayload), msgs(capacity), iov(capacity), peers(capacity),
+		lengths(capacity), srcAddrs(capacity + 8), srcPorts(capacity + 16), control(capacity),
+		timestamps(capacity), rxTimestamps(false)
+	{
+		for (size_t i = 0; i < capacity; ++i) {
+			iov[i].iov_base = &storage[i * maxPayload];
+			iov[i].iov_len = maxPayload;
+			memset(&msgs[i], 0, sizeof(msgs[i]));
+			msgs[i].msg_hdr.msg_iov = &iov[i];
+			msgs[i].msg_hdr.msg_iovlen = 1;
+			msgs[i].msg_hdr.msg_name = &peers[i];
+			msgs[i].msg_hdr.msg_namelen = sizeof(peers[i]);
+		}
+	}
+
+	PacketBatch(const PacketBatch&) = delete;
+	PacketBatch& operator=(const PacketBatch&) = delete;
+
+	size_t Capacity() const
+	{
+		return msgs.size();
+	}
+
+	size_t Size() const
+	{
+		return count;
+	}
+
+	size_t MaxPayload() const
+	{
+		return maxPayload;
+	}
+
+	void Clear()
+	{
+		count = 0;
+	}
+
+	uint8_t* Payload(size_t i)
+	{
+		return &storage[i * maxPayload];
+	}
+
+	const uint8_t* Payload(size_t i) const
+	{
+		return &storage[i * maxPayload];
+	}
+
+	size_t Length(size_t i) const
+	{
+		return lengths[i];
+	}
+
+	const struct sockaddr_in& Peer(size_t i) const
+	{
+		return peers[i];
+	}
+
+	/// Source address in host byte order
+	uint32_t SrcAddr(size_t i) const
+	{
+		return srcAddrs[i];
+	}
+
+	/// Source port in host byte order
+	uint16_t SrcPort(size_t i) const
+	{
+		return srcPorts[i];
+	}
+
+	/// Kernel receive time (CLOCK_REALTIME ns) of a datagram, 0 without UdpBatchReceiver::EnableTimestamps()
+	uint64_t Timestamp(size_t i) const
+	{
+		return timestamps[i];
+	}
+
+	/// Asks PrepareReceive() for the ancillary data carrying the receive timestamps
+	void SetReceiveTimestamps(bool enable)
+	{
+		rxTimestamps = enable;
+	}
+
+	/// Host order source addresses of the Size() datagrams (padded so vector loads may overrun)
+	const uint32_t* SrcAddrs() const
+	{
+		return srcAddrs.data();
+	}
+
+	const uint16_t* SrcPorts() const
+	{
+		return srcPorts.data();
+	}
+
+	/**
+	 * @brief Appends a datagram to send.
+	 *
+	 * @return false if the batch is full or the payload exceeds MaxPayload()
+	 */
+	bool Add(const struct sockaddr_in &peer, const void *data, size_t len)
+	{
+		if (count == msgs.size() || len > maxPayload) {
+			return false;
+		}
+		memcpy(Payload(count), data, len);
+		SetPacket(count, peer, len);
+		++count;
+		return true;
+	}
+
+	/**
+	 * @brief Reserves the next slot to be filled in place (e.g. serialized directly into Payload()).
+	 *
+	 * @return the slot index, -1 if the batch is full
+	 */
+	ssize_t AddInPlace(const struct sockaddr_in &peer, size_t len)
+	{
+		if (count == msgs.size() || len > maxPayload) {
+			return -1;
+		}
+		SetPacket(count, peer, len);
+		return static_cast<ssize_t>(count++);
+	}
+
+	/// Changes the length of datagram i after its payload was rewritten in place (len <= MaxPayload())
+	void SetLength(size_t i, size_t len)
+	{
+		lengths[i] = len;
+		iov[i].iov_len = len;
+	}
+
+#ifdef SCM_TXTIME
+	/**
+	 * @brief Sets the departure time of a datagram to send, for a socket with SO_TXTIME enabled.
+	 *
+	 * @param ns time in the clock given to SO_TXTIME (see EnableTxTime())
+	 */
+	void SetTxTime(size_t i, uint64_t ns)
+	{
+		struct msghdr &hdr = msgs[i].msg_hdr;
+		hdr.msg_control = control[i].buf;
+		hdr.msg_controllen = sizeof(control[i].buf);
+		struct cmsghdr *cmsg = CMSG_FIRSTHDR(&hdr);
+		cmsg->cmsg_level = SOL_SOCKET;
+		cmsg->cmsg_type = SCM_TXTIME;
+		cmsg->cmsg_len = CMSG_LEN(sizeof(ns));
+		memcpy(CMSG_DATA(cmsg), &ns, sizeof(ns));
+	}
+#endif
+
+	/// Headers for recvmmsg()/sendmmsg()
+	struct mmsghdr* Headers()
+	{
+		return msgs.data();
+	}
+
+	/// Resets the headers of every slot for a new receive
+	void PrepareReceive()
+	{
+		for (size_t i = 0; i < msgs.size(); ++i) {
+			iov[i].iov_len = maxPayload;
+			msgs[i].msg_hdr.msg_namelen = sizeof(peers[i]);
+			msgs[i].msg_hdr.msg_flags = 0;
+			msgs[i].msg_hdr.msg_control = rxTimestamps ? control[i].buf : nullptr;
+			msgs[i].msg_hdr.msg_controllen = rxTimestamps ? sizeof(control[i].buf) : 0;
+		}
+		count = 0;
+	}
+
+	/// Records the result of a receive of n datagrams
+	void CompleteReceive(size_t n)
+	{
+		count = n;
+		for (size_t i = 0; i < n; ++i) {
+			lengths[i] = msgs[i].msg_len;
+			srcAddrs[i] = ntohl(peers[i].sin_addr.s_addr);
+			srcPorts[i] = ntohs(peers[i].sin_port);
+			timestamps[i] = rxTimestamps ? ReceiveTime(msgs[i].msg_hdr) : 0;
+		}
+	}
+
+private:
+	static uint64_t ReceiveTime(struct msghdr &hdr)
+	{
+		for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&hdr); cmsg; cmsg = CMSG_NXTHDR(&hdr, cmsg)) {
+			if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_TIMESTAMPNS) {
+				struct timespec ts;
+				memcpy(&ts, CMSG_DATA(cmsg), sizeof(ts));
+				return static_cast<uint64_t>(ts.tv_sec) * 1000000000ULL + static_cast<uint64_t>(ts.tv_nsec);
+			}
+		}
+		return 0;
+	}
+
+	void SetPacket(size_t i, const struct sockaddr_in &peer, size_t len)
+	{
+		peers[i] = peer;
+		lengths[i] = len;
+		iov[i].iov_len = len;
+		msgs[i].msg_hdr.msg_namelen = sizeof(peers[i]);
+		msgs[i].msg_hdr.msg_control = nullptr;
+		msgs[i].msg_hdr.msg_controllen = 0;
+		srcAddrs[i] = ntohl(peer.sin_addr.s_addr);
+		srcPorts[i] = ntohs(peer.sin_port);
+	}
+
+	/// Ancillary data of a datagram: departure time when sending, timestamp when receiving
+	struct ControlSlot
+	{
+		alignas(struct cmsghdr) char buf[CMSG_SPACE(sizeof(struct timespec))];
+	};
+
+	size_t count;
+	size_t maxPayload;
+	std::vector<uint8_t> storage;
+	std::vector<struct mmsghdr> msgs;
+	std::vector<struct iovec> iov;
+	std::vector<struct sockaddr_in> peers;
+	std::vector<size_t> lengths;
+	std::vector<uint32_t> srcAddrs;
+	std::vector<uint16_t> srcPorts;
+	std::vector<ControlSlot> control;
+	std::vector<uint64_t> timestamps;
+	bool rxTimestamps;
+};
+
+/**
+ * Receives datagrams in batches on a bound UDP socket.
+ */
+class UdpBatchReceiver
+{
+public:
+	UdpBatchReceiver() :
+		sockfd(-1), owned(false)
+	{
+	}
+
+	~UdpBatchReceiver()
+	{
+		Close();
+	}
+
+	UdpBatchReceiver(const UdpBatchReceiver&) = delete;
+	UdpBatchReceiver& operator=(const UdpBatchReceiver&) = delete;
+
+	/// Creates and binds the socket (see ConfigureReceiverSocket())
+	bool Open(uint16_t port, bool nonBlocking)
+	{
+		Close();
+		struct sockaddr_in si_in;
+		owned = true;
+		return ConfigureReceiverSocket(sockfd, si_in, port, nonBlocking);
+	}
+
+	/// Uses an already configured socket (not closed by this object)
+	void Attach(int fd)
+	{
+		Close();
+		sockfd = fd;
+		owned = false;
+	}
+
+	/**
+	 * @brief Enables kernel receive timestamps (SO_TIMESTAMPNS), read back with PacketBatch::Timestamp().
+	 *
+	 * The batches passed to Receive() must have SetReceiveTimestamps(true).
+	 */
+	bool EnableTimestamps()
+	{
+		int on = 1;
+		if (setsockopt(sockfd, SOL_SOCKET, SO_TIMESTAMPNS, &on, sizeof(on)) < 0) {
+			perror("setsockopt(SO_TIMESTAMPNS)");
+			return false;
+		}
+		return true;
+	}
+
+	/// Sets SO_RCVBUF, to absorb bursts between two batches
+	bool SetReceiveBuffer(int bytes)
+	{
+		if (setsockopt(sockfd, SOL_SOCKET, SO_RCVBUF, &bytes, sizeof(bytes)) < 0) {
+			perror("setsockopt(SO_RCVBUF)");
+			return false;
+		}
+		return true;
+	}
+
+	/**
+	 * @brief Receives up to batch.Capacity() datagrams.
+	 *
+	 * On a blocking socket waits for the first datagram, then takes whatever else is queued
+	 * (MSG_WAITFORONE).
+	 *
+	 * @return number of datagrams (0 if none on a non-blocking socket), -1 on error
+	 */
+	int Receive(PacketBatch &batch)
+	{
+		batch.PrepareReceive();
+		int n;
+		do {
+			n = recvmmsg(sockfd, batch.Headers(), static_cast<unsigned int>(batch.Capacity()), MSG_WAITFORONE, nullptr);
+		} while (n < 0 && errno == EINTR);
+		if (n < 0) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK) {
+				return 0;
+			}
+			perror("recvmmsg");
+			return -1;
+		}
+		batch.CompleteReceive(static_cast<size_t>(n));
+		return n;
+	}
+
+	int Fd() const
+	{
+		return sockfd;
+	}
+
+	void Close()
+	{
+		if (sockfd >= 0 && owned) {
+			::close(sockfd);
+		}
+		sockfd = -1;
+	}
+
+private:
+	int sockfd;
+	bool owned;
+};
+
+/**
+ * Sends batches of datagrams from one UDP socket.
+ */
+class UdpBatchSender
+{
+public:
+	UdpBatchSender() :
+		sockfd(-1), owned(false)
+	{
+	}
+
+	~UdpBatchSender()
+	{
+		Close();
+	}
+
+	UdpBatchSender(const UdpBatchSender&) = delete;
+	UdpBatchSender& operator=(const UdpBatchSender&) = delete;
+
+	bool Open()
+	{
+		Close();
+		if ((sockfd = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP)) == -1) {
+			perror("socket");
+			return false;
+		}
+		owned = true;
+		return true;
+	}
+
+	/// Uses an already configured socket (not closed by this object)
+	void Attach(int fd)
+	{
+		Close();
+		sockfd = fd;
+		owned = false;
+	}
+
+	/**
+	 * @brief Sends every datagram of the batch, retrying partial sendmmsg() results.
+	 *
+	 * @return number of datagrams sent; less than batch.Size() on error (EAGAIN on a
+	 * non-blocking socket included), the rest is left to the caller
+	 */
+	size_t Send(PacketBatch &batch)
+	{
+		return Send(batch, 0, batch.Size());
+	}
+
+	/// Sends the count datagrams of the batch starting at first (same result as Send(batch))
+	size_t Send(PacketBatch &batch, size_t first, size_t count)
+	{
+		size_t sent = 0;
+		while (sent < count) {
+			int n = sendmmsg(sockfd, batch.Headers() + first + sent, static_cast<unsigned int>(count - sent), 0);
+			if (n < 0) {
+				if (errno == EINTR) {
+					continue;
+				}
+				if (errno != EAGAIN && errno != EWOULDBLOCK) {
+					perror("sendmmsg");
+				}
+				break;
+			}
+			sent += static_cast<size_t>(n);
+		}
+		return sent;
+	}
+
+	int Fd() const
+	{
+		return sockfd;
+	}
+
+	void Close()
+	{
+		if (sockfd >= 0 && owned) {
+			::close(sockfd);
+		}
+		sockfd = -1;
+	}
+
+private:
+	int sockfd;
+	bool owned;
+};
+
+} /* namespace FUTILS */
+
+#endif /* Linux functions*/
+
+#endif /* FUTILS_UDPBATCH_H_ */
@@ -0,0 +1,479 @@
+/**
+ * @brief AF_UNIX datagram/seqpacket sockets and descriptor passing of memfd buffers.
+ *
+ * @details The utilities implemented include:
+ * 			- ConfigureUnixReceiverSocket()/ConfigureUnixSenderSocket(): same-host counterparts of
+ * 			  the sockaddr_in helpers, for SOCK_DGRAM and SOCK_SEQPACKET (message boundaries kept,
+ * 			  seqpacket adds connections and ordering); paths starting with '@' are abstract
+ * 			- UnixSend()/UnixReceive(): one message plus SCM_RIGHTS descriptors
+ * 			- SharedBuffer: memfd backed shared mapping, sealed before handoff so the receiver can
+ * 			  trust its size (and optionally its contents)
+ * 			- SendSharedBuffer()/ReceiveSharedBuffer(): hand a buffer to another process by sending
+ * 			  its descriptor: the cost no longer depends on the payload size
+ *
+ * 			Example:
+ * 			@code
+ * 			FUTILS::SharedBuffer frame;
+ * 			frame.Create(64 << 20);
+ * 			Render(frame.Data(), frame.Size());
+ * 			frame.Seal(true);                         // size and contents frozen
+ * 			FUTILS::SendSharedBuffer(sockfd, frame);  // the peer maps the same pages
+ * 			@endcode
+ */
+
+#ifndef FUTILS_UNIX_H_
+#define FUTILS_UNIX_H_
+
+#include "futils.h"
+
+#if defined(__linux__) || defined(linux)
+
+#include <sys/un.h>
+#include <sys/mman.h>
+#include <cerrno>
+
+namespace FUTILS
+{
+
+/// Descriptors accepted per message by UnixReceive()
+static const size_t kUnixMaxFds = 16;
+
+/**
+ * @brief Fills a sockaddr_un; a leading '@' selects the abstract namespace (no file, gone with the socket).
+ *
+ * @return the address length to pass to bind()/connect()/sendto(), 0 if the path is too long
+ */
+inline socklen_t FillUnixAddress(struct sockaddr_un &addr, const std::string &path)
+{
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	if (path.empty() || path.size() >= sizeof(addr.sun_path)) {
+		std::cerr << tc::redL << "Invalid unix socket path \"" << path << "\"" << tc::none << std::endl;
+		return 0;
+	}
+	memcpy(addr.sun_path, path.data(), path.size());
+	if (path[0] == '@') {
+		addr.sun_path[0] = '\0';
+		return static_cast<socklen_t>(offsetof(struct sockaddr_un, sun_path) + path.size());
+	}
+	return static_cast<socklen_t>(sizeof(addr));
+}
+
+/// True when nothing listens on the socket file any more (connect() refused), so it may be unlinked
+inline bool UnixSocketStale(const struct sockaddr_un &addr, socklen_t len, int type)
+{
+	int probe = socket(AF_UNIX, type | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+	if (probe == -1) {
+		return false;
+	}
+	int rc;
+	do {
+		rc = connect(probe, (const struct sockaddr*)&addr, len);
+	} while (rc == -1 && errno == EINTR);
+	bool stale = rc == -1 && errno == ECONNREFUSED;
+	::close(probe);
+	return stale;
+}
+
+/**
+ * @brief Creates and binds a unix socket (listening for SOCK_SEQPACKET, see AcceptUnixConnection()).
+ *
+ * A stale socket file left at path by a previous run is removed first; the bind fails if a live
+ * receiver still answers on it.
+ *
+ * @param type SOCK_DGRAM or SOCK_SEQPACKET
+ */
+inline bool ConfigureUnixReceiverSocket(int &sockfd, struct sockaddr_un &un_in, const std::string &path, bool nonBlocking, int type = SOCK_DGRAM)
+{
+	socklen_t len = FillUnixAddress(un_in, path);
+	if (len == 0) {
+		return false;
+	}
+	if ((sockfd = socket(AF_UNIX, type | SOCK_CLOEXEC | (nonBlocking ? SOCK_NONBLOCK : 0), 0)) == -1) {
+		perror("socket");
+		return false;
+	}
+	if (path[0] != '@') {
+		struct stat st;
+		if (stat(path.c_str(), &st) == 0 && S_ISSOCK(st.st_mode) && UnixSocketStale(un_in, len, type)) {
+			unlink(path.c_str());
+		}
+	}
+	if (bind(sockfd, (struct sockaddr*)&un_in, len) == -1) {
+		perror(("bind " + path).c_str());
+		::close(sockfd);
+		sockfd = -1;
+		return false;
+	}
+	if (type == SOCK_SEQPACKET && listen(sockfd, SOMAXCONN) == -1) {
+		perror("listen");
+		::close(sockfd);
+		sockfd = -1;
+		return false;
+	}
+	return true;
+}
+
+/**
+ * @brief Creates a unix socket connected to the receiver at path.
+ *
+ * Connected, a datagram socket sends with plain send() and learns at once when the receiver is gone.
+ */
+inline bool ConfigureUnixSenderSocket(int &sockfd, struct sockaddr_un &un_out, const std::string &path, int type = SOCK_DGRAM)
+{
+	socklen_t len = FillUnixAddress(un_out, path);
+	if (len == 0) {
+		return false;
+	}
+	if ((sockfd = socket(AF_UNIX, type | SOCK_CLOEXEC, 0)) == -1) {
+		perror("socket");
+		return false;
+	}
+	if (connect(sockfd, (struct sockaddr*)&un_out, len) == -1) {
+		perror(("connect " + path).c_str());
+		::close(sockfd);
+		sockfd = -1;
+		return false;
+	}
+	return true;
+}
+
+/// Accepts a SOCK_SEQPACKET connection, -1 if none (EAGAIN on a non-blocking listener) or on error
+inline int AcceptUnixConnection(int listenFd, bool nonBlocking)
+{
+	int fd;
+	do {
+		fd = accept4(listenFd, nullptr, nullptr, SOCK_CLOEXEC | (nonBlocking ? SOCK_NONBLOCK : 0));
+	} while (fd < 0 && errno == EINTR);
+	if (fd < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+		perror("accept4");
+	}
+	return fd;
+}
+
+/**
+ * @brief Sends one message on a connected unix socket, with nfds descriptors attached (SCM_RIGHTS).
+ *
+ * The descriptors stay open in the sender; the receiver gets its own copies.
+ *
+ * @return bytes sent, -1 on error (errno set)
+ */
+inline ssize_t UnixSend(int sockfd, const void *data, size_t len, const int *fds = nullptr, size_t nfds = 0)
+{
+	if (nfds > kUnixMaxFds) {
+		errno = EINVAL;
+		return -1;
+	}
+	struct iovec iov;
+	iov.iov_base = const_cast<void*>(data);
+	iov.iov_len = len;
+	union {
+		char buf[CMSG_SPACE(sizeof(int) * kUnixMaxFds)];
+		struct cmsghdr align;
+	} control;
+	struct msghdr msg;
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	if (nfds > 0) {
+		msg.msg_control = control.buf;
+		msg.msg_controllen = CMSG_SPACE(sizeof(int) * nfds);
+		struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+		cmsg->cmsg_level = SOL_SOCKET;
+		cmsg->cmsg_type = SCM_RIGHTS;
+		cmsg->cmsg_len = CMSG_LEN(sizeof(int) * nfds);
+		memcpy(CMSG_DATA(cmsg), fds, sizeof(int) * nfds);
+	}
+	ssize_t n;
+	do {
+		n = sendmsg(sockfd, &msg, MSG_NOSIGNAL);
+	} while (n < 0 && errno == EINTR);
+	return n;
+}
+
+/**
+ * @brief Receives one message and the descriptors attached to it (opened with O_CLOEXEC).
+ *
+ * Received descriptors belong to the caller. A message longer than capacity is truncated;
+ * descriptors beyond kUnixMaxFds are closed by the kernel.
+ *
+ * @param fds receives the descriptors, may be nullptr (any descriptor received is then closed)
+ * @return message length (0 on a closed seqpacket connection), -1 on error (errno set)
+ */
+inline ssize_t UnixReceive(int sockfd, void *buf, size_t capacity, std::vector<int> *fds = nullptr, bool *truncated = nullptr)
+{
+	struct iovec iov;
+	iov.iov_base = buf;
+	iov.iov_len = capacity;
+	union {
+		char buf[CMSG_SPACE(sizeof(int) * kUnixMaxFds)];
+		struct cmsghdr align;
+	} control;
+	struct msghdr msg;
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control.buf;
+	msg.msg_controllen = sizeof(control.buf);
+	ssize_t n;
+	do {
+		n = recvmsg(sockfd, &msg, MSG_CMSG_CLOEXEC);
+	} while (n < 0 && errno == EINTR);
+	if (n < 0) {
+		return n;
+	}
+	if (truncated) {
+		*truncated = (msg.msg_flags & (MSG_TRUNC | MSG_CTRUNC)) != 0;
+	}
+	for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+		if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS) {
+			continue;
+		}
+		size_t count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+		for (size_t i = 0; i < count; ++i) {
+			int fd;
+			memcpy(&fd, CMSG_DATA(cmsg) + i * sizeof(int), sizeof(int));
+			if (fds) {
+				fds->push_back(fd);
+			} else {
+				::close(fd);
+			}
+		}
+	}
+	return n;
+}
+
+/**
+ * Shared memory buffer backed by a memfd, mapped in every process that holds its descriptor.
+ */
+class SharedBuffer
+{
+public:
+	SharedBuffer() :
+		fd(-1), data(nullptr), size(0), writable(false)
+	{
+	}
+
+	~SharedBuffer()
+	{
+		Reset();
+	}
+
+	SharedBuffer(const SharedBuffer&) = delete;
+	SharedBuffer& operator=(const SharedBuffer&) = delete;
+
+	SharedBuffer(SharedBuffer &&other) :
+		fd(other.fd), data(other.data), size(other.size), writable(other.writable)
+	{
+		other.fd = -1;
+		other.data = nullptr;
+		other.size = 0;
+	}
+
+	SharedBuffer& operator=(SharedBuffer &&other)
+	{
+		if (this != &other) {
+			Reset();
+			std::swap(fd, other.fd);
+			std::swap(data, other.data);
+			std::swap(size, other.size);
+			std::swap(writable, other.writable);
+		}
+		return *this;
+	}
+
+	/// Creates a writable buffer of len bytes (zero filled, pages allocated on first touch)
+	bool Create(size_t len, const char *name = "futils-buffer")
+	{
+		Reset();
+		if ((fd = memfd_create(name, MFD_CLOEXEC | MFD_ALLOW_SEALING)) < 0) {
+			perror("memfd_create");
+			return false;
+		}
+		if (ftruncate(fd, static_cast<off_t>(len)) != 0) {
+			perror("ftruncate");
+			Reset();
+			return false;
+		}
+		size = len;
+		return Map(true);
+	}
+
+	/**
+	 * @brief Freezes the size of the buffer, and its contents if readOnly (then remapped read-only here).
+	 *
+	 * The size seal is what makes mapping a received buffer safe: without it the sender could
+	 * shrink the file and make the receiver fault (SIGBUS) on the pages past the new end.
+	 */
+	bool Seal(bool readOnly = false)
+	{
+		if (fd < 0) {
+			return false;
+		}
+		if (readOnly && data) {
+			// F_SEAL_WRITE is refused while a writable shared mapping exists
+			munmap(data, size);
+			data = nullptr;
+		}
+		int seals = F_SEAL_SHRINK | F_SEAL_GROW | (readOnly ? F_SEAL_WRITE : 0);
+		if (fcntl(fd, F_ADD_SEALS, seals | F_SEAL_SEAL) != 0) {
+			perror("fcntl(F_ADD_SEALS)");
+			if (readOnly) {
+				Map(true);
+			}
+			return false;
+		}
+		return readOnly ? Map(false) : true;
+	}
+
+	/**
+	 * @brief Maps a received buffer descriptor (taking ownership of it).
+	 *
+	 * Refuses descriptors that are not size sealed memfds.
+	 *
+	 * @param wantWrite maps read-write (fails if the contents are sealed)
+	 */
+	bool Attach(int bufferFd, bool wantWrite = false)
+	{
+		Reset();
+		fd = bufferFd;
+		int seals = fcntl(fd, F_GET_SEALS);
+		if (seals < 0 || !(seals & F_SEAL_SHRINK)) {
+			std::cerr << tc::redL << "SharedBuffer: received descriptor is not a size-sealed memfd" << tc::none << std::endl;
+			Reset();
+			return false;
+		}
+		struct stat st;
+		if (fstat(fd, &st) != 0) {
+			perror("fstat");
+			Reset();
+			return false;
+		}
+		if (wantWrite && (seals & F_SEAL_WRITE)) {
+			std::cerr << tc::redL << "SharedBuffer: contents are sealed, cannot map for writing" << tc::none << std::endl;
+			Reset();
+			return false;
+		}
+		size = static_cast<size_t>(st.st_size);
+		if (!Map(wantWrite)) {
+			Reset();
+			return false;
+		}
+		return true;
+	}
+
+	uint8_t* Data()
+	{
+		return data;
+	}
+
+	const uint8_t* Data() const
+	{
+		return data;
+	}
+
+	size_t Size() const
+	{
+		return size;
+	}
+
+	int Fd() const
+	{
+		return fd;
+	}
+
+	bool Writable() const
+	{
+		return writable;
+	}
+
+	/// Unmaps and closes (the other holders keep their mapping)
+	void Reset()
+	{
+		if (data) {
+			munmap(data, size);
+			data = nullptr;
+		}
+		if (fd >= 0) {
+			::close(fd);
+			fd = -1;
+		}
+		size = 0;
+		writable = false;
+	}
+
+private:
+	bool Map(bool write)
+	{
+		writable = write;
+		if (size == 0) {
+			return true;
+		}
+		void *p = mmap(nullptr, size, write ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0);
+		if (p == MAP_FAILED) {
+			perror("mmap");
+			data = nullptr;
+			return false;
+		}
+		data = static_cast<uint8_t*>(p);
+		return true;
+	}
+
+	int fd;
+	uint8_t *data;
+	size_t size;
+	bool writable;
+};
+
+/**
+ * @brief Hands a (sealed) buffer to the peer of a unix socket, with an optional small header.
+ *
+ * @return false on error
+ */
+inline bool SendSharedBuffer(int sockfd, const SharedBuffer &buffer, const void *header = nullptr, size_t headerLen = 0)
+{
+	// an empty datagram would be indistinguishable from a closed seqpacket connection
+	const char placeholder = 0;
+	int fd = buffer.Fd();
+	if (UnixSend(sockfd, headerLen ? header : &placeholder, headerLen ? headerLen : 1, &fd, 1) < 0) {
+		perror("sendmsg");
+		return false;
+	}
+	return true;
+}
+
+/**
+ * @brief Receives a buffer sent by SendSharedBuffer() and maps it.
+ *
+ * @param header receives the header bytes, may be nullptr
+ * @return false on error or if the message carried no buffer
+ */
+inline bool ReceiveSharedBuffer(int sockfd, SharedBuffer &buffer, std::string *header = nullptr, bool wantWrite = false)
+{
+	char buf[4096];
+	std::vector<int> fds;
+	ssize_t n = UnixReceive(sockfd, buf, sizeof(buf), &fds);
+	if (n <= 0) {
+		if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+			perror("recvmsg");
+		}
+		return false;
+	}
+	for (size_t i = 1; i < fds.size(); ++i) {
+		::close(fds[i]);
+	}
+	if (fds.empty()) {
+		std::cerr << tc::redL << "ReceiveSharedBuffer: message without descriptor" << tc::none << std::endl;
+		return false;
+	}
+	if (header) {
+		header->assign(buf, static_cast<size_t>(n));
+	}
+	return buffer.Attach(fds[0], wantWrite);
+}
+
+} /* namespace FUTILS */
+
+#endif /* Linux functions*/
+
+#endif /* FUTILS_UNIX_H_ */
@@ -0,0 +1,786 @@
+/**
+ * @brief AF_XDP sockets: UDP receive and transmit beside the kernel network stack.
+ *
+ * @details The utilities implemented include:
+ * 			- XdpSocket: one AF_XDP socket bound to a queue of an interface, with its UMEM (packet
+ * 			  memory shared with the kernel or the NIC) and the fill, completion, RX and TX rings
+ * 			- Receive(PacketBatch&)/Send(PacketBatch&, ...): the batch interface of
+ * 			  UdpBatchReceiver/UdpBatchSender; Process() hands out the frames in place instead
+ * 			  (PacketView, parsed with ParseUdp())
+ * 			- the XDP program steering the IPv4 UDP datagrams of one port to the socket (everything
+ * 			  else goes on to the kernel), loaded and attached with bpf() directly: no libbpf needed
+ * 			- mode fallback: native driver XDP (zero-copy when the driver supports it, else copies),
+ * 			  then generic (SKB) mode, which works on any interface, veth pairs included
+ *
+ * 			Requires CAP_NET_ADMIN/CAP_BPF and Linux 5.9 (BPF links); the interface must have no
+ * 			other XDP program. On a NIC with several queues, flow steering (ethtool -N) or one
+ * 			socket per queue is needed to see all the traffic.
+ *
+ * 			Example:
+ * 			@code
+ * 			FUTILS::XdpOptions options;
+ * 			options.port = 5000;
+ * 			FUTILS::XdpSocket xsk;
+ * 			FUTILS::PacketBatch batch(64);
+ * 			if (xsk.Open("eth0", options)) {
+ * 				while (running) {
+ * 					int n = xsk.Receive(batch, 100);
+ * 					...
+ * 				}
+ * 			}
+ * 			@endcode
+ */
+
+#ifndef FUTILS_XDP_H_
+#define FUTILS_XDP_H_
+
+#include "futils.h"
+#include "futils_udpbatch.h"
+#include "futils_packetring.h"
+
+#if defined(__linux__) || defined(linux)
+
+#include <cerrno>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <net/if.h>
+#include <linux/if_xdp.h>
+#include <linux/if_link.h>
+#include <linux/bpf.h>
+
+#ifndef AF_XDP
+#	define AF_XDP 44
+#endif
+#ifndef SOL_XDP
+#	define SOL_XDP 283
+#endif
+
+namespace FUTILS
+{
+
+enum class XdpMode
+{
+	Auto,       ///< native, else generic
+	Native,     ///< in the driver, before any socket buffer is allocated
+	Generic,    ///< after the socket buffer allocation, on any interface
+};
+
+struct XdpOptions
+{
+	uint32_t queue = 0;
+	uint16_t port = 0;              ///< UDP destination port steered to the socket, 0 for all IPv4 UDP
+	uint32_t frameCount = 8192;     ///< UMEM frames, half for receiving and half for sending
+	uint32_t frameSize = 2048;      ///< power of two, 2048 or 4096
+	uint32_t ringSize = 2048;       ///< entries of each ring, power of two
+	XdpMode mode = XdpMode::Auto;
+};
+
+/// Link addresses for the frames built by XdpSocket::Send(), addresses in host byte order
+struct XdpUdpEndpoint
+{
+	uint8_t srcMac[6];
+	uint8_t dstMac[6];              ///< next hop
+	uint32_t srcAddr;
+	uint16_t srcPort;
+};
+
+/// Hardware address of an interface
+inline bool InterfaceMac(const std::string &ifname, uint8_t mac[6])
+{
+	int fd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+	if (fd < 0) {
+		perror("socket");
+		return false;
+	}
+	struct ifreq ifr;
+	memset(&ifr, 0, sizeof(ifr));
+	strncpy(ifr.ifr_name, ifname.c_str(), IFNAMSIZ - 1);
+	bool ok = ioctl(fd, SIOCGIFHWADDR, &ifr) == 0;
+	if (ok) {
+		memcpy(mac, ifr.ifr_hwaddr.sa_data, 6);
+	} else {
+		perror(("SIOCGIFHWADDR " + ifname).c_str());
+	}
+	::close(fd);
+	return ok;
+}
+
+namespace detail
+{
+
+inline long Bpf(int cmd, union bpf_attr &attr)
+{
+	return syscall(__NR_bpf, cmd, &attr, sizeof(attr));
+}
+
+inline struct bpf_insn BpfInsn(uint8_t code, uint8_t dst, uint8_t src, int16_t off, int32_t imm)
+{
+	struct bpf_insn insn;
+	insn.code = code;
+	insn.dst_reg = dst & 0xf;
+	insn.src_reg = src & 0xf;
+	insn.off = off;
+	insn.imm = imm;
+	return insn;
+}
+
+/**
+ * @brief XDP program redirecting IPv4 UDP datagrams (to port, unless 0) into the XSKMAP slot of their queue.
+ *
+ * Frames without a socket in their slot, IP fragments and all others are passed on to the kernel.
+ */
+inline std::vector<struct bpf_insn> XdpSteeringProgram(int mapFd, uint16_t port)
+{
+	std::vector<struct bpf_insn> p;
+	std::vector<size_t> toPass;
+	// r2 = data, r3 = data_end; Ethernet + 20 byte IPv4 + UDP headers must be present
+	p.push_back(BpfInsn(BPF_LDX | BPF_MEM | BPF_W, 2, 1, offsetof(struct xdp_md, data), 0));
+	p.push_back(BpfInsn(BPF_LDX | BPF_MEM | BPF_W, 3, 1, offsetof(struct xdp_md, data_end), 0));
+	p.push_back(BpfInsn(BPF_ALU64 | BPF_MOV | BPF_X, 4, 2, 0, 0));
+	p.push_back(BpfInsn(BPF_ALU64 | BPF_ADD | BPF_K, 4, 0, 0, 42));
+	toPass.push_back(p.size());
+	p.push_back(BpfInsn(BPF_JMP | BPF_JGT | BPF_X, 4, 3, 0, 0));
+	// loads return the network order bytes in host order: compare with htons() values
+	p.push_back(BpfInsn(BPF_LDX | BPF_MEM | BPF_H, 4, 2, 12, 0));
+	toPass.push_back(p.size());
+	p.push_back(BpfInsn(BPF_JMP | BPF_JNE | BPF_K, 4, 0, 0, htons(0x0800)));
+	p.push_back(BpfInsn(BPF_LDX | BPF_MEM | BPF_B, 4, 2, 14, 0));
+	toPass.push_back(p.size());
+	p.push_back(BpfInsn(BPF_JMP | BPF_JNE | BPF_K, 4, 0, 0, 0x45));
+	p.push_back(BpfInsn(BPF_LDX | BPF_MEM | BPF_B, 4, 2, 23, 0));
+	toPass.push_back(p.size());
+	p.push_back(BpfInsn(BPF_JMP | BPF_JNE | BPF_K, 4, 0, 0, IPPROTO_UDP));
+	// fragments (more fragments flag or non-zero offset) are reassembled by the kernel
+	p.push_back(BpfInsn(BPF_LDX | BPF_MEM | BPF_H, 4, 2, 20, 0));
+	toPass.push_back(p.size());
+	p.push_back(BpfInsn(BPF_JMP | BPF_JSET | BPF_K, 4, 0, 0, htons(0x3fff)));
+	if (port != 0) {
+		p.push_back(BpfInsn(BPF_LDX | BPF_MEM | BPF_H, 4, 2, 36, 0));
+		toPass.push_back(p.size());
+		p.push_back(BpfInsn(BPF_JMP | BPF_JNE | BPF_K, 4, 0, 0, htons(port)));
+	}
+	// return bpf_redirect_map(map, rx_queue_index, XDP_PASS)
+	p.push_back(BpfInsn(BPF_LDX | BPF_MEM | BPF_W, 2, 1, offsetof(struct xdp_md, rx_queue_index), 0));
+	p.push_back(BpfInsn(BPF_LD | BPF_DW | BPF_IMM, 1, BPF_PSEUDO_MAP_FD, 0, mapFd));
+	p.push_back(BpfInsn(0, 0, 0, 0, 0));
+	p.push_back(BpfInsn(BPF_ALU64 | BPF_MOV | BPF_K, 3, 0, 0, XDP_PASS));
+	p.push_back(BpfInsn(BPF_JMP | BPF_CALL, 0, 0, 0, BPF_FUNC_redirect_map));
+	p.push_back(BpfInsn(BPF_JMP | BPF_EXIT, 0, 0, 0, 0));
+	size_t pass = p.size();
+	p.push_back(BpfInsn(BPF_ALU64 | BPF_MOV | BPF_K, 0, 0, 0, XDP_PASS));
+	p.push_back(BpfInsn(BPF_JMP | BPF_EXIT, 0, 0, 0, 0));
+	for (size_t i = 0; i < toPass.size(); ++i) {
+		p[toPass[i]].off = static_cast<int16_t>(pass - toPass[i] - 1);
+	}
+	return p;
+}
+
+/**
+ * Producer/consumer ring shared with the kernel; cached copies of the other side's index avoid
+ * touching its cache line on every entry.
+ */
+template<typename T>
+struct XdpRing
+{
+	uint32_t *producer;
+	uint32_t *consumer;
+	uint32_t *flags;
+	T *entries;
+	uint32_t mask;
+	uint32_t size;
+	uint32_t cachedProducer;
+	uint32_t cachedConsumer;
+	void *map;
+	size_t mapSize;
+
+	/// Entries ready to consume (kernel produced)
+	uint32_t Ready(uint32_t wanted)
+	{
+		uint32_t n = cachedProducer - cachedConsumer;
+		if (n < wanted) {
+			cachedProducer = __atomic_load_n(producer, __ATOMIC_ACQUIRE);
+			n = cachedProducer - cachedConsumer;
+		}
+		return std::min(n, wanted);
+	}
+
+	void Release(uint32_t n)
+	{
+		cachedConsumer += n;
+		__atomic_store_n(consumer, cachedConsumer, __ATOMIC_RELEASE);
+	}
+
+	/// Free entries to produce into (kernel consumed)
+	uint32_t Free(uint32_t wanted)
+	{
+		uint32_t n = size - (cachedProducer - cachedConsumer);
+		if (n < wanted) {
+			cachedConsumer = __atomic_load_n(consumer, __ATOMIC_ACQUIRE);
+			n = size - (cachedProducer - cachedConsumer);
+		}
+		return std::min(n, wanted);
+	}
+
+	void Submit(uint32_t n)
+	{
+		cachedProducer += n;
+		__atomic_store_n(producer, cachedProducer, __ATOMIC_RELEASE);
+	}
+
+	T& operator[](uint32_t i)
+	{
+		return entries[i & mask];
+	}
+
+	bool NeedWakeup() const
+	{
+		return (__atomic_load_n(flags, __ATOMIC_RELAXED) & XDP_RING_NEED_WAKEUP) != 0;
+	}
+};
+
+inline uint16_t InternetChecksum(const uint8_t *p, size_t len)
+{
+	uint32_t sum = 0;
+	for (size_t i = 0; i + 1 < len; i += 2) {
+		sum += static_cast<uint32_t>(p[i] << 8 | p[i + 1]);
+	}
+	if (len & 1) {
+		sum += static_cast<uint32_t>(p[len - 1] << 8);
+	}
+	while (sum >> 16) {
+		sum = (sum & 0xffff) + (sum >> 16);
+	}
+	return static_cast<uint16_t>(~sum);
+}
+
+} /* namespace detail */
+
+/**
+ * AF_XDP socket with its own UMEM and steering program.
+ */
+class XdpSocket
+{
+public:
+	/// Frame headroom reserved by Send(): Ethernet + IPv4 + UDP headers
+	static const size_t kUdpHeaders = 42;
+
+	XdpSocket() :
+		fd(-1), umem(nullptr), umemSize(0), frameSize(0), rxFrames(0), txFrames(0), ifindex(0), queue(0),
+		mapFd(-1), progFd(-1), linkFd(-1), mode(XdpMode::Auto), zeroCopy(false)
+	{
+		memset(&rx, 0, sizeof(rx));
+		memset(&tx, 0, sizeof(tx));
+		memset(&fill, 0, sizeof(fill));
+		memset(&completion, 0, sizeof(completion));
+	}
+
+	~XdpSocket()
+	{
+		Close();
+	}
+
+	XdpSocket(const XdpSocket&) = delete;
+	XdpSocket& operator=(const XdpSocket&) = delete;
+
+	/**
+	 * @brief Sets up the UMEM and rings, binds to the queue and attaches the steering program.
+	 *
+	 * The program is detached by Close() (or when the process exits).
+	 */
+	bool Open(const std::string &ifname, const XdpOptions &options = XdpOptions())
+	{
+		Close();
+		if ((ifindex = static_cast<int>(if_nametoindex(ifname.c_str()))) == 0) {
+			perror(("if_nametoindex " + ifname).c_str());
+			return false;
+		}
+		queue = options.queue;
+		frameSize = options.frameSize;
+		if ((fd = socket(AF_XDP, SOCK_RAW | SOCK_CLOEXEC, 0)) == -1) {
+			perror("socket(AF_XDP)");
+			return false;
+		}
+		if (!SetupUmem(options) || !SetupRings(options.ringSize)) {
+			Close();
+			return false;
+		}
+		if (!Bind()) {
+			Close();
+			return false;
+		}
+		const XdpMode modes[2] = { XdpMode::Native, XdpMode::Generic };
+		for (int m = 0; m < 2; ++m) {
+			if (options.mode != XdpMode::Auto && options.mode != modes[m]) {
+				continue;
+			}
+			if (Attach(modes[m], options.port)) {
+				mode = modes[m];
+				FillRx();
+				return true;
+			}
+			Detach();
+		}
+		std::cerr << tc::redL << "XdpSocket: cannot attach to " << ifname << " queue " << queue << tc::none << std::endl;
+		Close();
+		return false;
+	}
+
+	/**
+	 * @brief Hands the received frames in place to handler, then gives their memory back to the kernel.
+	 *
+	 * @param handler callable as handler(const PacketView&); the view is valid during the call
+	 * @return number of frames
+	 */
+	template<typename Handler>
+	size_t Process(Handler &&handler, uint32_t maxFrames = UINT32_MAX)
+	{
+		uint32_t n = rx.Ready(std::min(maxFrames, rx.size));
+		if (n == 0) {
+			Kick(fill);
+			return 0;
+		}
+		uint32_t free = fill.Free(n);
+		for (uint32_t i = 0; i < n; ++i) {
+			const struct xdp_desc &d = rx[rx.cachedConsumer + i];
+			const uint8_t *frame = umem + d.addr;
+			PacketView view;
+			view.frame = frame;
+			view.network = frame + 14;
+			view.length = d.len;
+			view.wireLength = d.len;
+			view.timestampNs = 0;
+			view.protocol = d.len >= 14 ? static_cast<uint16_t>(frame[12] << 8 | frame[13]) : 0;
+			if (view.protocol == 0x8100 && d.len >= 18) {
+				view.vlan = static_cast<uint16_t>((frame[14] << 8 | frame[15]) & 0x0fff);
+				view.protocol = static_cast<uint16_t>(frame[16] << 8 | frame[17]);
+				view.network += 4;
+			} else {
+				view.vlan = 0;
+			}
+			view.packetType = PACKET_HOST;
+			view.ifindex = ifindex;
+			if (view.network <= frame + d.len) {
+				handler(static_cast<const PacketView&>(view));
+			}
+		}
+		// recycle the frames: the fill ring has room for all of them (it holds the rx frames only)
+		for (uint32_t i = 0; i < free; ++i) {
+			fill[fill.cachedProducer + i] = rx[rx.cachedConsumer + i].addr & ~static_cast<uint64_t>(frameSize - 1);
+		}
+		rx.Release(n);
+		fill.Submit(free);
+		Kick(fill);
+		return n;
+	}
+
+	/**
+	 * @brief Fills batch with the payloads of the UDP datagrams received (other frames are dropped).
+	 *
+	 * Waits up to timeoutMs when nothing is ready. Copies each payload once, out of the UMEM.
+	 *
+	 * @return number of datagrams, -1 on error
+	 */
+	int Receive(PacketBatch &batch, int timeoutMs = 0)
+	{
+		batch.PrepareReceive();
+		if (rx.Ready(1) == 0 && timeoutMs != 0 && !Wait(POLLIN, timeoutMs)) {
+			return -1;
+		}
+		Process([&batch](const PacketView &view) {
+			UdpView udp;
+			if (!ParseUdp(view, udp) || udp.captured != udp.length) {
+				return;
+			}
+			struct sockaddr_in peer;
+			memset(&peer, 0, sizeof(peer));
+			peer.sin_family = AF_INET;
+			peer.sin_addr.s_addr = htonl(udp.srcAddr);
+			peer.sin_port = htons(udp.srcPort);
+			ssize_t slot = batch.AddInPlace(peer, udp.length);
+			if (slot >= 0) {
+				memcpy(batch.Payload(static_cast<size_t>(slot)), udp.payload, udp.length);
+			}
+		}, static_cast<uint32_t>(batch.Capacity()));
+		return static_cast<int>(batch.Size());
+	}
+
+	/**
+	 * @brief Sends the datagrams of batch (Peer(i) as destination), building the frames in the UMEM.
+	 *
+	 * @return number of datagrams queued: fewer if the TX ring or the free frames run out, or if the
+	 * next datagram is longer than MaxPayload() (it is not truncated; Length(result) tells them apart)
+	 */
+	size_t Send(const PacketBatch &batch, const XdpUdpEndpoint &local)
+	{
+		ReclaimTx();
+		uint32_t n = tx.Free(static_cast<uint32_t>(std::min(batch.Size(), freeTx.size())));
+		for (uint32_t i = 0; i < n; ++i) {
+			size_t len = batch.Length(i);
+			if (len > MaxPayload()) {
+				n = i;
+				break;
+			}
+			uint64_t addr = freeTx.back();
+			freeTx.pop_back();
+			const struct sockaddr_in &peer = batch.Peer(i);
+			BuildUdp(umem + addr, local, ntohl(peer.sin_addr.s_addr), ntohs(peer.sin_port), len);
+			memcpy(umem + addr + kUdpHeaders, batch.Payload(i), len);
+			struct xdp_desc &d = tx[tx.cachedProducer + i];
+			d.addr = addr;
+			d.len = static_cast<uint32_t>(kUdpHeaders + len);
+			d.options = 0;
+		}
+		tx.Submit(n);
+		FlushTx();
+		return n;
+	}
+
+	/// Largest datagram payload Send() fits in one frame
+	size_t MaxPayload() const
+	{
+		return frameSize - kUdpHeaders;
+	}
+
+	/**
+	 * @brief Queues one complete frame (link header included).
+	 *
+	 * @return false if the frame is too large or no TX slot is free; call FlushTx() after a series
+	 */
+	bool Transmit(const void *frame, size_t len)
+	{
+		if (len > frameSize) {
+			return false;
+		}
+		if (freeTx.empty()) {
+			ReclaimTx();
+		}
+		if (freeTx.empty() || tx.Free(1) == 0) {
+			return false;
+		}
+		uint64_t addr = freeTx.back();
+		freeTx.pop_back();
+		memcpy(umem + addr, frame, len);
+		struct xdp_desc &d = tx[tx.cachedProducer];
+		d.addr = addr;
+		d.len = static_cast<uint32_t>(len);
+		d.options = 0;
+		tx.Submit(1);
+		return true;
+	}
+
+	/// Wakes the kernel up to send the queued frames (only when it asks for it, or in copy mode)
+	void FlushTx()
+	{
+		if (!zeroCopy || tx.NeedWakeup()) {
+			while (sendto(fd, nullptr, 0, MSG_DONTWAIT, nullptr, 0) < 0 && errno == EINTR) {
+			}
+		}
+	}
+
+	/// Takes back the frames the kernel has finished sending
+	void ReclaimTx()
+	{
+		uint32_t n = completion.Ready(completion.size);
+		for (uint32_t i = 0; i < n; ++i) {
+			freeTx.push_back(completion[completion.cachedConsumer + i]);
+		}
+		completion.Release(n);
+	}
+
+	/// Frames queued or in flight
+	size_t PendingTx() const
+	{
+		return txFrames - freeTx.size();
+	}
+
+	struct xdp_statistics Stats() const
+	{
+		struct xdp_statistics st;
+		memset(&st, 0, sizeof(st));
+		socklen_t len = sizeof(st);
+		if (fd >= 0) {
+			getsockopt(fd, SOL_XDP, XDP_STATISTICS, &st, &len);
+		}
+		return st;
+	}
+
+	XdpMode Mode() const
+	{
+		return mode;
+	}
+
+	bool ZeroCopy() const
+	{
+		return zeroCopy;
+	}
+
+	int Fd() const
+	{
+		return fd;
+	}
+
+	void Close()
+	{
+		Detach();
+		UnmapRing(rx);
+		UnmapRing(tx);
+		UnmapRing(fill);
+		UnmapRing(completion);
+		if (fd >= 0) {
+			::close(fd);
+			fd = -1;
+		}
+		if (umem) {
+			munmap(umem, umemSize);
+			umem = nullptr;
+		}
+		freeTx.clear();
+		umemSize = 0;
+	}
+
+private:
+	bool SetupUmem(const XdpOptions &options)
+	{
+		umemSize = static_cast<size_t>(options.frameCount) * options.frameSize;
+		void *p = mmap(nullptr, umemSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+		if (p == MAP_FAILED) {
+			perror("mmap(UMEM)");
+			umemSize = 0;
+			return false;
+		}
+		umem = static_cast<uint8_t*>(p);
+		struct xdp_umem_reg reg;
+		memset(&reg, 0, sizeof(reg));
+		reg.addr = reinterpret_cast<uintptr_t>(umem);
+		reg.len = umemSize;
+		reg.chunk_size = options.frameSize;
+		if (setsockopt(fd, SOL_XDP, XDP_UMEM_REG, &reg, sizeof(reg)) == -1) {
+			perror("setsockopt(XDP_UMEM_REG)");
+			return false;
+		}
+		// first half receives, second half sends
+		rxFrames = options.frameCount / 2;
+		txFrames = options.frameCount - rxFrames;
+		freeTx.clear();
+		for (uint32_t i = options.frameCount; i > rxFrames; --i) {
+			freeTx.push_back(static_cast<uint64_t>(i - 1) * frameSize);
+		}
+		return true;
+	}
+
+	bool SetupRings(uint32_t size)
+	{
+		// the fill ring must hold every rx frame so that recycling never has to wait
+		uint32_t fillSize = size;
+		while (fillSize < rxFrames) {
+			fillSize <<= 1;
+		}
+		if (setsockopt(fd, SOL_XDP, XDP_RX_RING, &size, sizeof(size)) == -1 ||
+				setsockopt(fd, SOL_XDP, XDP_TX_RING, &size, sizeof(size)) == -1 ||
+				setsockopt(fd, SOL_XDP, XDP_UMEM_FILL_RING, &fillSize, sizeof(fillSize)) == -1 ||
+				setsockopt(fd, SOL_XDP, XDP_UMEM_COMPLETION_RING, &size, sizeof(size)) == -1) {
+			perror("setsockopt(XDP rings)");
+			return false;
+		}
+		struct xdp_mmap_offsets off;
+		socklen_t len = sizeof(off);
+		if (getsockopt(fd, SOL_XDP, XDP_MMAP_OFFSETS, &off, &len) == -1) {
+			perror("getsockopt(XDP_MMAP_OFFSETS)");
+			return false;
+		}
+		return MapRing(rx, off.rx, size, sizeof(struct xdp_desc), XDP_PGOFF_RX_RING) &&
+				MapRing(tx, off.tx, size, sizeof(struct xdp_desc), XDP_PGOFF_TX_RING) &&
+				MapRing(fill, off.fr, fillSize, sizeof(uint64_t), XDP_UMEM_PGOFF_FILL_RING) &&
+				MapRing(completion, off.cr, size, sizeof(uint64_t), XDP_UMEM_PGOFF_COMPLETION_RING);
+	}
+
+	template<typename T>
+	bool MapRing(detail::XdpRing<T> &ring, const struct xdp_ring_offset &off, uint32_t size, size_t entrySize, off_t pgoff)
+	{
+		ring.mapSize = off.desc + size * entrySize;
+		ring.map = mmap(nullptr, ring.mapSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, pgoff);
+		if (ring.map == MAP_FAILED) {
+			perror("mmap(XDP ring)");
+			ring.map = nullptr;
+			return false;
+		}
+		uint8_t *base = static_cast<uint8_t*>(ring.map);
+		ring.producer = reinterpret_cast<uint32_t*>(base + off.producer);
+		ring.consumer = reinterpret_cast<uint32_t*>(base + off.consumer);
+		ring.flags = reinterpret_cast<uint32_t*>(base + off.flags);
+		ring.entries = reinterpret_cast<T*>(base + off.desc);
+		ring.size = size;
+		ring.mask = size - 1;
+		ring.cachedProducer = *ring.producer;
+		ring.cachedConsumer = *ring.consumer;
+		return true;
+	}
+
+	template<typename T>
+	void UnmapRing(detail::XdpRing<T> &ring)
+	{
+		if (ring.map) {
+			munmap(ring.map, ring.mapSize);
+		}
+		memset(&ring, 0, sizeof(ring));
+	}
+
+	/// Without XDP_COPY/XDP_ZEROCOPY the kernel tries zero-copy first and falls back to copying
+	bool Bind()
+	{
+		struct sockaddr_xdp sxdp;
+		memset(&sxdp, 0, sizeof(sxdp));
+		sxdp.sxdp_family = AF_XDP;
+		sxdp.sxdp_flags = XDP_USE_NEED_WAKEUP;
+		sxdp.sxdp_ifindex = static_cast<uint32_t>(ifindex);
+		sxdp.sxdp_queue_id = queue;
+		if (bind(fd, (struct sockaddr*)&sxdp, sizeof(sxdp)) == -1) {
+			perror("bind(AF_XDP)");
+			return false;
+		}
+		struct xdp_options opts;
+		socklen_t len = sizeof(opts);
+		zeroCopy = getsockopt(fd, SOL_XDP, XDP_OPTIONS, &opts, &len) == 0 && (opts.flags & XDP_OPTIONS_ZEROCOPY);
+		return true;
+	}
+
+	bool Attach(XdpMode m, uint16_t port)
+	{
+		union bpf_attr attr;
+		memset(&attr, 0, sizeof(attr));
+		attr.map_type = BPF_MAP_TYPE_XSKMAP;
+		attr.key_size = sizeof(uint32_t);
+		attr.value_size = sizeof(int);
+		attr.max_entries = queue + 1;
+		if ((mapFd = static_cast<int>(detail::Bpf(BPF_MAP_CREATE, attr))) < 0) {
+			perror("bpf(BPF_MAP_CREATE)");
+			return false;
+		}
+		uint32_t key = queue;
+		int value = fd;
+		memset(&attr, 0, sizeof(attr));
+		attr.map_fd = static_cast<uint32_t>(mapFd);
+		attr.key = reinterpret_cast<uintptr_t>(&key);
+		attr.value = reinterpret_cast<uintptr_t>(&value);
+		if (detail::Bpf(BPF_MAP_UPDATE_ELEM, attr) < 0) {
+			perror("bpf(BPF_MAP_UPDATE_ELEM)");
+			return false;
+		}
+		std::vector<struct bpf_insn> program = detail::XdpSteeringProgram(mapFd, port);
+		static const char license[] = "GPL";
+		std::vector<char> log(65536);
+		memset(&attr, 0, sizeof(attr));
+		attr.prog_type = BPF_PROG_TYPE_XDP;
+		attr.insns = reinterpret_cast<uintptr_t>(program.data());
+		attr.insn_cnt = static_cast<uint32_t>(program.size());
+		attr.license = reinterpret_cast<uintptr_t>(license);
+		attr.log_buf = reinterpret_cast<uintptr_t>(log.data());
+		attr.log_size = static_cast<uint32_t>(log.size());
+		attr.log_level = 1;
+		if ((progFd = static_cast<int>(detail::Bpf(BPF_PROG_LOAD, attr))) < 0) {
+			perror("bpf(BPF_PROG_LOAD)");
+			std::cerr << log.data() << std::endl;
+			return false;
+		}
+		memset(&attr, 0, sizeof(attr));
+		attr.link_create.prog_fd = static_cast<uint32_t>(progFd);
+		attr.link_create.target_ifindex = static_cast<uint32_t>(ifindex);
+		attr.link_create.attach_type = BPF_XDP;
+		attr.link_create.flags = m == XdpMode::Native ? XDP_FLAGS_DRV_MODE : XDP_FLAGS_SKB_MODE;
+		if ((linkFd = static_cast<int>(detail::Bpf(BPF_LINK_CREATE, attr))) < 0) {
+			return false;
+		}
+		return true;
+	}
+
+	void Detach()
+	{
+		int *fds[3] = { &linkFd, &progFd, &mapFd };
+		for (int i = 0; i < 3; ++i) {
+			if (*fds[i] >= 0) {
+				::close(*fds[i]);
+				*fds[i] = -1;
+			}
+		}
+	}
+
+	/// Gives the rx half of the UMEM to the kernel
+	void FillRx()
+	{
+		uint32_t n = fill.Free(rxFrames);
+		for (uint32_t i = 0; i < n; ++i) {
+			fill[fill.cachedProducer + i] = static_cast<uint64_t>(i) * frameSize;
+		}
+		fill.Submit(n);
+	}
+
+	template<typename T>
+	void Kick(detail::XdpRing<T> &ring)
+	{
+		if (ring.NeedWakeup()) {
+			recvfrom(fd, nullptr, 0, MSG_DONTWAIT, nullptr, nullptr);
+		}
+	}
+
+	bool Wait(short events, int timeoutMs)
+	{
+		struct pollfd pfd;
+		pfd.fd = fd;
+		pfd.events = events;
+		pfd.revents = 0;
+		if (poll(&pfd, 1, timeoutMs) < 0 && errno != EINTR) {
+			perror("poll");
+			return false;
+		}
+		return true;
+	}
+
+	static void BuildUdp(uint8_t *f, const XdpUdpEndpoint &local, uint32_t dstAddr, uint16_t dstPort, size_t len)
+	{
+		memcpy(f, local.dstMac, 6);
+		memcpy(f + 6, local.srcMac, 6);
+		f[12] = 0x08;
+		f[13] = 0x00;
+		uint8_t *ip = f + 14;
+		uint16_t total = static_cast<uint16_t>(len + 28);
+		const uint8_t header[12] = { 0x45, 0, static_cast<uint8_t>(total >> 8), static_cast<uint8_t>(total),
+				0, 0, 0x40, 0, 64, IPPROTO_UDP, 0, 0 };
+		memcpy(ip, header, sizeof(header));
+		uint32_t a = htonl(local.srcAddr);
+		memcpy(ip + 12, &a, 4);
+		a = htonl(dstAddr);
+		memcpy(ip + 16, &a, 4);
+		uint16_t checksum = htons(detail::InternetChecksum(ip, 20));
+		memcpy(ip + 10, &checksum, 2);
+		// no UDP checksum (optional over IPv4)
+		uint16_t udp[4] = { htons(local.srcPort), htons(dstPort), htons(static_cast<uint16_t>(len + 8)), 0 };
+		memcpy(ip + 20, udp, 8);
+	}
+
+	int fd;
+	uint8_t *umem;
+	size_t umemSize;
+	size_t frameSize;
+	uint32_t rxFrames;
+	uint32_t txFrames;
+	int ifindex;
+	uint32_t queue;
+	int mapFd;
+	int progFd;
+	int linkFd;
+	XdpMode mode;
+	bool zeroCopy;
+	detail::XdpRing<struct xdp_desc> rx;
+	detail::XdpRing<struct xdp_desc> tx;
+	detail::XdpRing<uint64_t> fill;
+	detail::XdpRing<uint64_t> completion;
+	std::vector<uint64_t> freeTx;
+};
+
+} /* namespace FUTILS */
+
+#endif /* Linux functions*/
+
+#endif /* FUTILS_XDP_H_ */